@@ -0,0 +1,39 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Shared helpers for the creeper-bench subcommands.
+
+typedef int (*BenchMain)(const std::vector<std::string>& args);
+
+int UnzipBench(const std::vector<std::string>& args);
+int CopyBench(const std::vector<std::string>& args);
+int HashBench(const std::vector<std::string>& args);
+int PipelineBench(const std::vector<std::string>& args);
+int ExtractBench(const std::vector<std::string>& args);
+int PathBench(const std::vector<std::string>& args);
+int LockBench(const std::vector<std::string>& args);
+
+class Stopwatch {
+public:
+	Stopwatch() : start_(std::chrono::steady_clock::now()) {}
+
+	double Seconds() const {
+		return std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start_).count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point start_;
+};
+
+// 1, 2, 4, ... up to and including |max|.
+inline std::vector<unsigned> ThreadSteps(unsigned max) {
+	std::vector<unsigned> steps;
+	for (unsigned n = 1; n < max; n *= 2)
+		steps.push_back(n);
+	steps.push_back(max);
+	return steps;
+}
@@ -0,0 +1,118 @@
+#include <filesystem>
+#include <fstream>
+#include "bench.hpp"
+#include "copyengine.hpp"
+
+// The loop SelfAttachedFiles::ExtractFile used before the copy engine.
+static bool LegacyCopy(const std::string& from, const std::string& to, uint64_t length) {
+	std::ifstream in(from, std::ios::in | std::ios::binary);
+	std::ofstream out(to, std::ios::out | std::ios::binary);
+
+	const size_t BUF_SIZE = 1024 * 4;
+	char buf[BUF_SIZE];
+	uint64_t rest = length;
+	while (rest) {
+		size_t block = (size_t)(rest < BUF_SIZE ? rest : BUF_SIZE);
+		rest -= block;
+		in.read(buf, block);
+		if (!in)
+			break;
+		out.write(buf, block);
+	}
+	return (bool)out;
+}
+
+static bool MakeSource(const std::string& path, uint64_t size) {
+	std::vector<uint8_t> block(1024 * 1024);
+	uint32_t x = 2463534242u;
+	for (uint8_t& b : block) {
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+		b = (uint8_t)x;
+	}
+
+	File out;
+	if (!out.Create(path.c_str()))
+		return false;
+	for (uint64_t done = 0; done < size; done += block.size()) {
+		size_t n = (size_t)std::min<uint64_t>(block.size(), size - done);
+		if (!out.Write(block.data(), n))
+			return false;
+	}
+	return true;
+}
+
+// Copies a payload-sized file with the legacy 4 KB stream loop and with
+// the copy engine in serial and pipelined mode. The source stays in the
+// page cache between runs, so the numbers mostly show per-call overhead
+// and write throughput.
+int CopyBench(const std::vector<std::string>& args) {
+	if (args.empty()) {
+		fprintf(stderr, "copy: <scratch dir> [size MB ...]\n");
+		return 1;
+	}
+
+	std::vector<uint64_t> sizes;
+	for (size_t i = 1; i < args.size(); ++i)
+		sizes.push_back(std::stoull(args[i]));
+	if (sizes.empty())
+		sizes = { 100, 1000 };
+
+	std::filesystem::path scratch = args[0];
+	std::filesystem::create_directories(scratch);
+	std::string src = (scratch / "copy-src.bin").string();
+	std::string dst = (scratch / "copy-dst.bin").string();
+
+	printf("%8s %-22s %10s %10s\n", "MB", "engine", "seconds", "MB/s");
+	for (uint64_t mb : sizes) {
+		uint64_t size = mb * 1024 * 1024;
+		if (!MakeSource(src, size)) {
+			fprintf(stderr, "failed to create %s\n", src.c_str());
+			return 1;
+		}
+
+		struct Variant {
+			const char* name;
+			bool legacy;
+			CopyOptions options;
+		};
+		CopyOptions serial;
+		serial.pipelined = false;
+		CopyOptions pipelined;
+		CopyOptions bigBlocks;
+		bigBlocks.blockSize = 8 * 1024 * 1024;
+
+		const Variant variants[] = {
+			{ "legacy 4K stream", true, CopyOptions() },
+			{ "engine serial 1M", false, serial },
+			{ "engine pipelined 1M", false, pipelined },
+			{ "engine pipelined 8M", false, bigBlocks },
+		};
+
+		for (const Variant& v : variants) {
+			std::filesystem::remove(dst);
+			Stopwatch watch;
+			bool ok;
+			std::string error;
+			if (v.legacy) {
+				ok = LegacyCopy(src, dst, size);
+			}
+			else {
+				CopyEngine engine(v.options);
+				ok = engine.CopyWholeFile(src.c_str(), dst.c_str());
+				error = engine.Error();
+			}
+			double secs = watch.Seconds();
+
+			if (!ok || std::filesystem::file_size(dst) != size) {
+				fprintf(stderr, "%s failed %s\n", v.name, error.c_str());
+				return 1;
+			}
+			printf("%8llu %-22s %10.3f %10.1f\n", (unsigned long long)mb,
+				v.name, secs, size / 1048576.0 / secs);
+		}
+	}
+
+	std::filesystem::remove(src);
+	std::filesystem::remove(dst);
+	return 0;
+}
@@ -0,0 +1,131 @@
+#include <filesystem>
+#include "asyncio.hpp"
+#include "bench.hpp"
+#include "solid.hpp"
+#include "stdlibpack.hpp"
+#include "synth.hpp"
+#include "treedelete.hpp"
+#include "zip.hpp"
+
+static void Report(const char* engine, uint64_t files, uint64_t bytes, double secs) {
+	printf("%-24s %8llu %9.1f %9.3f %10.0f %9.1f\n", engine,
+		(unsigned long long)files, bytes / 1e6, secs, files / secs, bytes / 1e6 / secs);
+}
+
+// The scheduling RunExtractJobs used before batching: one pool task per
+// file, for comparison.
+static bool ExtractPerFile(ZipArchive* zip, const std::string& root, TaskPool* pool) {
+	std::vector<ZipExtractJob> jobs;
+	if (!zip->PlanExtract(root, &jobs))
+		return false;
+
+	std::atomic<bool> failed(false);
+	for (const ZipExtractJob& job : jobs) {
+		const ZipExtractJob* p = &job;
+		pool->Submit([p, &failed] {
+			if (!failed && !(p->archive->ExtractEntry(*p) && p->archive->ApplyMode(*p)))
+				failed = true;
+		});
+	}
+	pool->Wait();
+	return !failed;
+}
+
+// Extracts a seeded tree of many small files (20000 by default) with
+// each write scheduling and I/O backend, reporting files per second, and
+// once more with the stdlib packed as the packer's --pack-stdlib does.
+int ExtractBench(const std::vector<std::string>& args) {
+	if (args.empty()) {
+		fprintf(stderr, "extract: <scratch dir> [files] [MB]\n");
+		return 1;
+	}
+
+	size_t fileCount = args.size() > 1 ? std::stoul(args[1]) : 20000;
+	uint64_t mb = args.size() > 2 ? std::stoull(args[2]) : 40;
+	if (fileCount > 0xffff) {
+		fprintf(stderr, "extract: at most 65535 files\n");
+		return 1;
+	}
+
+	std::string zipData = MakeSynthZip(SynthProfile{ fileCount, mb << 20, 0 }, 3);
+	ZipArchive zip;
+	if (!zip.Open((const uint8_t*)zipData.data(), zipData.size())) {
+		fprintf(stderr, "extract: %s\n", zip.Error().c_str());
+		return 1;
+	}
+	size_t files = 0;
+	uint64_t bytes = 0;
+	for (const ZipEntry& entry : zip.Entries()) {
+		files += entry.IsDir() ? 0 : 1;
+		bytes += entry.size;
+	}
+
+	TaskPool pool;
+	std::string solid, error;
+	if (!ZipToSolid((const uint8_t*)zipData.data(), zipData.size(), &pool, &solid, &error)) {
+		fprintf(stderr, "extract: %s\n", error.c_str());
+		return 1;
+	}
+	// the same tree with its "lib" packed into one zip imported in place
+	std::string runtime, packedSolid;
+	StdlibPackStats stats;
+	ZipArchive packedZip;
+	if (!PackStdlib((const uint8_t*)zipData.data(), zipData.size(), &pool, &runtime, &stats, &error)
+			|| !packedZip.Open((const uint8_t*)runtime.data(), runtime.size())
+			|| !ZipToSolid((const uint8_t*)runtime.data(), runtime.size(), &pool, &packedSolid, &error)) {
+		fprintf(stderr, "extract: %s\n", error.empty() ? packedZip.Error().c_str() : error.c_str());
+		return 1;
+	}
+	uint64_t packedBytes = 0;
+	for (const ZipEntry& entry : packedZip.Entries())
+		packedBytes += entry.size;
+	printf("%zu files, %.1f MB, %u threads; %llu files with the stdlib packed\n\n",
+		files, bytes / 1e6, TaskPool::DefaultThreads(), (unsigned long long)stats.extractedFiles);
+
+	std::filesystem::path dir = std::filesystem::path(args[0]) / "extract";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	std::string root = (dir / "tree").string();
+
+	printf("%-24s %8s %9s %9s %10s %9s\n", "engine", "files", "MB", "seconds", "files/s", "MB/s");
+	std::string async = std::string(", ") + IoBackendName(IO_ASYNC);
+	std::string names[] = {
+		"zip, 1 thread", "zip, task per file", "zip, batched", "zip, batched" + async,
+		"solid, batched", "solid, batched" + async, "solid, stdlib packed",
+	};
+	bool ok = true;
+	for (int variant = 0; variant < 7 && ok; ++variant) {
+		const char* name = names[variant].c_str();
+		IoBackend io = variant == 3 || variant == 5 ? IO_ASYNC : IO_SYNC;
+		Stopwatch watch;
+		if (variant == 0) {
+			ok = zip.ExtractTo(root, NULL);
+		}
+		else if (variant == 1) {
+			ok = ExtractPerFile(&zip, root, &pool);
+		}
+		else if (variant < 4) {
+			ok = zip.ExtractTo(root, &pool, io);
+		}
+		else {
+			const std::string& data = variant == 6 ? packedSolid : solid;
+			SolidArchive archive;
+			ok = archive.Open((const uint8_t*)data.data(), data.size())
+				&& archive.ExtractTo(root, &pool, io);
+			if (!ok)
+				error = archive.Error();
+		}
+
+		if (ok && variant == 6)
+			Report(name, stats.extractedFiles, packedBytes, watch.Seconds());
+		else if (ok)
+			Report(name, files, bytes, watch.Seconds());
+		else
+			fprintf(stderr, "extract %s failed: %s\n", name,
+				error.empty() ? zip.Error().c_str() : error.c_str());
+		TreeDeleter().Delete(root, &pool);
+	}
+
+	std::filesystem::remove_all(dir);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+#include <filesystem>
+#include "bench.hpp"
+#include "payload.hpp"
+#include "zip.hpp"
+
+static double HashSeconds(const MappedFile& file, bool hardware) {
+	Sha256::UseHardware() = hardware;
+	uint8_t digest[Sha256::DIGEST_SIZE];
+	Stopwatch watch;
+	Sha256::Hash(file.Data(), file.Size(), digest);
+	double secs = watch.Seconds();
+	Sha256::UseHardware() = true;
+	return secs;
+}
+
+// Measures SHA-256 throughput of both kernels on a payload, then the cost
+// of checking its entry digests during extraction the way the installer
+// does.
+int HashBench(const std::vector<std::string>& args) {
+	if (args.size() < 2) {
+		fprintf(stderr, "hash: <zip> <scratch dir> [threads]\n");
+		return 1;
+	}
+
+	MappedFile file;
+	ZipArchive zip;
+	if (!file.Open(args[0].c_str()) || !zip.Open(file.Data(), file.Size())) {
+		fprintf(stderr, "failed to open %s %s\n", args[0].c_str(), zip.Error().c_str());
+		return 1;
+	}
+
+	std::string digests;
+	if (!zip.HashEntries(&digests)) {
+		fprintf(stderr, "failed to hash %s %s\n", args[0].c_str(), zip.Error().c_str());
+		return 1;
+	}
+
+	double mb = file.Size() / 1e6;
+	printf("payload %.1f MB, SHA-NI %s\n", mb,
+		Sha256::HasHardwareSupport() ? "available" : "not available");
+	printf("sha256 portable  %8.1f MB/s\n", mb / HashSeconds(file, false));
+	if (Sha256::HasHardwareSupport())
+		printf("sha256 SHA-NI    %8.1f MB/s\n", mb / HashSeconds(file, true));
+
+	unsigned threads = args.size() > 2
+		? (unsigned)std::stoul(args[2]) : TaskPool::DefaultThreads();
+	std::filesystem::path dest = std::filesystem::path(args[1]) / "hash-extract";
+
+	double best[2] = { 1e9, 1e9 };
+	for (int round = 0; round < 3; ++round) {
+		for (int verify = 0; verify < 2; ++verify) {
+			std::filesystem::remove_all(dest);
+			TaskPool pool(threads);
+			Stopwatch watch;
+			ZipArchive checked;
+			bool ok = checked.Open(file.Data(), file.Size())
+				&& (!verify || checked.UseDigests(digests))
+				&& checked.ExtractTo(dest.string(), &pool);
+			double secs = watch.Seconds();
+			if (!ok) {
+				fprintf(stderr, "extract failed: %s\n", checked.Error().c_str());
+				return 1;
+			}
+			best[verify] = std::min(best[verify], secs);
+		}
+	}
+	std::filesystem::remove_all(dest);
+
+	printf("extract          %8.3f s\n", best[0]);
+	printf("extract+verify   %8.3f s (%+.1f%%)\n",
+		best[1], (best[1] / best[0] - 1) * 100);
+	return 0;
+}
@@ -0,0 +1,58 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "bench.hpp"
+#include "instancelock.hpp"
+
+// Hands the instance lock from one holder to a waiting instance and
+// reports how long the waiter still waits after the release. The wait
+// used to poll once a second.
+int LockBench(const std::vector<std::string>& args) {
+	if (args.empty()) {
+		fprintf(stderr, "lock: <scratch dir> [rounds]\n");
+		return 1;
+	}
+
+	int rounds = args.size() > 1 ? std::stoi(args[1]) : 20;
+	PathString path = Utf8ToPath(args[0].data(), args[0].size()) + PATH_SEP
+		+ Utf8ToPath("instance.lock", 13);
+	double total = 0, worst = 0;
+	for (int r = 0; r < rounds; ++r) {
+		InstanceLock holder(path);
+		if (!holder.TryAcquire()) {
+			fprintf(stderr, "lock: %s\n", holder.Error().c_str());
+			return 1;
+		}
+
+		InstanceLock waiter(path);
+		if (waiter.TryAcquire()) {
+			fprintf(stderr, "lock: acquired twice\n");
+			return 1;
+		}
+
+		std::atomic<int64_t> released(0);
+		std::thread thread([&holder, &released] {
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			released = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+			holder.Release();
+		});
+		bool acquired = waiter.Acquire(5000);
+		int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+		thread.join();
+		if (!acquired) {
+			fprintf(stderr, "lock: %s\n", waiter.Error().c_str());
+			return 1;
+		}
+
+		double ms = (now - released) / 1000.0;
+		total += ms;
+		worst = ms > worst ? ms : worst;
+	}
+
+	printf("%d handoffs, %.2f ms average, %.2f ms worst after release\n",
+		rounds, total / rounds, worst);
+	RemoveFile(path.c_str());
+	return 0;
+}
@@ -0,0 +1,33 @@
+#include <cstdio>
+#include <cstring>
+#include "bench.hpp"
+
+struct BenchCommand {
+	const char* name;
+	BenchMain main;
+	const char* usage;
+};
+
+static const BenchCommand g_commands[] = {
+	{ "unzip", &UnzipBench, "<zip> <scratch dir> [max threads]" },
+	{ "copy", &CopyBench, "<scratch dir> [size MB ...]" },
+	{ "hash", &HashBench, "<zip> <scratch dir> [threads]" },
+	{ "pipeline", &PipelineBench, "<scratch dir> [python files] [python MB] [app files] [app MB]" },
+	{ "extract", &ExtractBench, "<scratch dir> [files] [MB]" },
+	{ "path", &PathBench, "[paths] [rounds]" },
+	{ "lock", &LockBench, "<scratch dir> [rounds]" },
+};
+
+int main(int argc, char** argv) {
+	if (argc >= 2) {
+		for (const BenchCommand& cmd : g_commands) {
+			if (strcmp(argv[1], cmd.name) == 0)
+				return cmd.main(std::vector<std::string>(argv + 2, argv + argc));
+		}
+	}
+
+	fprintf(stderr, "usage:\n");
+	for (const BenchCommand& cmd : g_commands)
+		fprintf(stderr, "  %s %s %s\n", argv[0], cmd.name, cmd.usage);
+	return 1;
+}
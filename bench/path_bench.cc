@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "bench.hpp"
+#include "path.hpp"
+#include "patharena.hpp"
+
+struct RelPath {
+	std::string dir;
+	std::string name;
+};
+
+// Entry names shaped like a Python runtime: a few hundred packages
+// nested two or three deep, listed directory by directory as in a zip.
+static std::vector<RelPath> MakeNames(size_t count) {
+	std::vector<RelPath> names(count);
+	uint32_t x = 2463534242u;
+	for (size_t i = 0; i < count; ++i) {
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+		RelPath& p = names[i];
+		p.dir = "Lib/site-packages/package" + std::to_string(x % 97)
+			+ "/module" + std::to_string((x >> 8) % 13);
+		if (x & 0x10000)
+			p.dir += "/tests";
+		p.name = "file_" + std::to_string(i) + ".py";
+	}
+	std::stable_sort(names.begin(), names.end(), [](const RelPath& a, const RelPath& b) {
+		return a.dir < b.dir;
+	});
+	return names;
+}
+
+static void Report(const char* engine, size_t count, uint64_t checksum, double secs) {
+	printf("%-24s %8zu %9.3f %10.1f %12llu\n", engine, count, secs,
+		secs * 1e9 / count, (unsigned long long)checksum);
+}
+
+// Builds the full path of every entry below a root and keeps it, as the
+// extractors do until their writes finish. Path is how extraction joined
+// paths before; PathTree starts from the whole relative name, as for zip
+// entries, or from a known directory, as for solid archives. Also times
+// taking a Path apart with Parent() and Name().
+int PathBench(const std::vector<std::string>& args) {
+	size_t count = args.size() > 0 ? std::stoul(args[0]) : 50000;
+	int rounds = args.size() > 1 ? std::stoi(args[1]) : 5;
+	std::vector<RelPath> names = MakeNames(count);
+	std::vector<std::string> full;
+	for (const RelPath& p : names)
+		full.push_back(p.dir + "/" + p.name);
+	PathString root = Utf8ToPath("C:/Users/someone/AppData/Local/Programs/app/python", 50);
+
+	printf("%-24s %8s %9s %10s %12s\n", "engine", "paths", "seconds", "ns/path", "checksum");
+	{
+		uint64_t checksum = 0;
+		Stopwatch watch;
+		for (int r = 0; r < rounds; ++r) {
+			std::vector<PathString> paths;
+			paths.reserve(full.size());
+			for (const std::string& name : full) {
+				paths.push_back(Path(root) / Utf8ToPath(name.data(), name.size()));
+				checksum += paths.back().size();
+			}
+		}
+		Report("Path, full name", count * rounds, checksum, watch.Seconds());
+	}
+
+	{
+		uint64_t checksum = 0;
+		Stopwatch watch;
+		for (int r = 0; r < rounds; ++r) {
+			PathTree tree(root);
+			std::vector<ArenaPath> paths;
+			paths.reserve(names.size());
+			for (const RelPath& p : names) {
+				PathTree::Dir dir = tree.InternPathUtf8(p.dir.data(), p.dir.size());
+				paths.push_back(tree.JoinUtf8(dir, p.name.data(), p.name.size()));
+				checksum += paths.back().len;
+			}
+		}
+		Report("PathTree, full name", count * rounds, checksum, watch.Seconds());
+	}
+
+	{
+		std::vector<Path> dirs;
+		std::vector<size_t> dirOf;
+		for (const RelPath& p : names) {
+			if (dirOf.empty() || p.dir != names[&p - &names[0] - 1].dir)
+				dirs.push_back(Path(root) / Utf8ToPath(p.dir.data(), p.dir.size()));
+			dirOf.push_back(dirs.size() - 1);
+		}
+
+		uint64_t checksum = 0;
+		Stopwatch watch;
+		for (int r = 0; r < rounds; ++r) {
+			std::vector<PathString> paths;
+			paths.reserve(names.size());
+			for (size_t i = 0; i < names.size(); ++i) {
+				paths.push_back(dirs[dirOf[i]] + PATH_SEP
+					+ Utf8ToPath(names[i].name.data(), names[i].name.size()));
+				checksum += paths.back().size();
+			}
+		}
+		Report("Path, dir + name", count * rounds, checksum, watch.Seconds());
+
+		checksum = 0;
+		watch = Stopwatch();
+		for (int r = 0; r < rounds; ++r) {
+			PathTree tree(root);
+			std::vector<PathTree::Dir> ids;
+			for (const Path& dir : dirs) {
+				std::string rel = PathToUtf8(dir.substr(root.size() + 1));
+				ids.push_back(tree.InternPathUtf8(rel.data(), rel.size()));
+			}
+			std::vector<ArenaPath> paths;
+			paths.reserve(names.size());
+			for (size_t i = 0; i < names.size(); ++i) {
+				paths.push_back(tree.JoinUtf8(ids[dirOf[i]], names[i].name.data(), names[i].name.size()));
+				checksum += paths.back().len;
+			}
+		}
+		Report("PathTree, dir + name", count * rounds, checksum, watch.Seconds());
+	}
+
+	{
+		std::vector<Path> paths;
+		for (const std::string& name : full)
+			paths.push_back(Path(root) / Utf8ToPath(name.data(), name.size()));
+
+		uint64_t checksum = 0;
+		Stopwatch watch;
+		for (int r = 0; r < rounds; ++r) {
+			for (const Path& path : paths)
+				checksum += path.Parent().size() + path.Name().size();
+		}
+		Report("Path, Parent + Name", count * rounds, checksum, watch.Seconds());
+	}
+	return 0;
+}
@@ -0,0 +1,319 @@
+#include <filesystem>
+#include "bench.hpp"
+#include "copyengine.hpp"
+#include "delta.hpp"
+#include "packer.hpp"
+#include "payload.hpp"
+#include "runtimecache.hpp"
+#include "selfimage.hpp"
+#include "solid.hpp"
+#include "synth.hpp"
+#include "treecopy.hpp"
+#include "treedelete.hpp"
+#include "zip.hpp"
+
+struct Payload {
+	const char* name;
+	const char* dir;
+	std::string zip;
+	size_t files = 0;
+	uint64_t bytes = 0;
+};
+
+static void Report(const char* phase, const char* engine, uint64_t files, uint64_t bytes, double secs) {
+	printf("%-8s %-18s %8llu %9.1f %9.3f %10.0f %9.1f\n", phase, engine,
+		(unsigned long long)files, bytes / 1e6, secs, files / secs, bytes / 1e6 / secs);
+}
+
+static double FileSizeMb(const std::string& path) {
+	uint64_t size = 0;
+	QueryFileSize(path.c_str(), &size);
+	return size / 1e6;
+}
+
+static bool Failed(const char* what, const std::string& error) {
+	fprintf(stderr, "%s failed: %s\n", what, error.c_str());
+	return false;
+}
+
+static void Count(Payload* payload) {
+	ZipArchive zip;
+	zip.Open((const uint8_t*)payload->zip.data(), payload->zip.size());
+	for (const ZipEntry& entry : zip.Entries()) {
+		payload->files += entry.IsDir() ? 0 : 1;
+		payload->bytes += entry.size;
+	}
+}
+
+static bool RunPipeline(const std::filesystem::path& dir, Payload* payloads, size_t count) {
+	size_t files = 0;
+	uint64_t bytes = 0, packed = 0;
+	for (size_t i = 0; i < count; ++i) {
+		files += payloads[i].files;
+		bytes += payloads[i].bytes;
+		packed += payloads[i].zip.size();
+	}
+	TaskPool pool;
+
+	// attach: host plus payloads in the installer image format
+	std::string image = (dir / "installer.bin").string();
+	{
+		std::vector<uint8_t> host(512 * 1024, 0xcc);
+		Stopwatch watch;
+		PayloadWriter writer;
+		bool ok = writer.Create(image.c_str()) && writer.WriteHost(host.data(), host.size());
+		for (size_t i = 0; i < count && ok; ++i) {
+			const Payload& p = payloads[i];
+			ok = AddPlainPayload(&writer, p.name, (const uint8_t*)p.zip.data(), p.zip.size());
+		}
+		if (!ok || !writer.Finish())
+			return Failed("attach", image);
+		Report("attach", "payload writer", count, packed, watch.Seconds());
+	}
+
+	SelfImage self;
+	if (!self.Open(image))
+		return Failed("open", self.Error());
+	const PayloadTable& table = self.Table();
+
+	// extract: map the payloads as the installer does
+	{
+		Stopwatch watch;
+		for (size_t i = 0; i < count; ++i) {
+			MappedPayload payload;
+			if (!self.MapPayload(payloads[i].name, i, &payload))
+				return Failed("extract", self.Error());
+		}
+		Report("extract", "map", count, packed, watch.Seconds());
+	}
+
+	// extract: the payload written out as a file, as for the host image
+	{
+		const PayloadEntry* entry = table.Find(payloads[0].name);
+		std::string out = (dir / payloads[0].name).string();
+		File in, file;
+		Stopwatch watch;
+		CopyEngine engine;
+		if (!in.OpenRead(image.c_str(), true) || !file.Create(out.c_str())
+				|| !engine.Copy(in, entry->offset, entry->storedSize, file))
+			return Failed("extract", out + ": " + engine.Error());
+		Report("extract", "copy engine", 1, entry->storedSize, watch.Seconds());
+	}
+
+	// unzip: every payload below one root, per engine
+	std::string serial = (dir / "unzip-serial").string();
+	std::string pooled = (dir / "unzip-pool").string();
+	{
+		struct Variant {
+			const char* name;
+			const std::string* root;
+			TaskPool* pool;
+		};
+		Variant variants[] = {
+			{ "zip, 1 thread", &serial, NULL },
+			{ "zip, pool", &pooled, &pool },
+		};
+		for (const Variant& v : variants) {
+			Stopwatch watch;
+			for (size_t i = 0; i < count; ++i) {
+				const PayloadEntry* entry = table.Find(payloads[i].name);
+				ZipArchive zip;
+				if (!zip.Open(table.Data(*entry), (size_t)entry->storedSize)
+						|| !zip.ExtractTo(*v.root + PATH_SEP + payloads[i].dir, v.pool))
+					return Failed("unzip", zip.Error());
+			}
+			Report("unzip", v.name, files, bytes, watch.Seconds());
+		}
+	}
+
+	// the same payloads block-compressed, zips rewritten with stored entries
+	{
+		std::string compressed = (dir / "installer-compressed.bin").string();
+		std::vector<uint8_t> host(512 * 1024, 0xcc);
+		Stopwatch watch;
+		PayloadWriter writer;
+		std::string error = compressed;
+		bool ok = writer.Create(compressed.c_str()) && writer.WriteHost(host.data(), host.size());
+		for (size_t i = 0; i < count && ok; ++i) {
+			const Payload& p = payloads[i];
+			ok = AddCompressedPayload(&writer, p.name, (const uint8_t*)p.zip.data(),
+				p.zip.size(), &pool, &error);
+		}
+		if (!ok || !writer.Finish())
+			return Failed("attach", error);
+		Report("attach", "block stream", count, packed, watch.Seconds());
+
+		SelfImage compressedSelf;
+		if (!compressedSelf.Open(compressed))
+			return Failed("open", compressedSelf.Error());
+
+		std::vector<MappedPayload> zips(count);
+		uint64_t decoded = 0;
+		watch = Stopwatch();
+		for (size_t i = 0; i < count; ++i) {
+			if (!compressedSelf.MapPayload(payloads[i].name, i, &zips[i]))
+				return Failed("extract", compressedSelf.Error());
+			decoded += zips[i].size;
+		}
+		Report("extract", "block decode", count, decoded, watch.Seconds());
+
+		std::string root = (dir / "unzip-stored").string();
+		watch = Stopwatch();
+		for (size_t i = 0; i < count; ++i) {
+			ZipArchive zip;
+			if (!zip.Open(zips[i].data, zips[i].size)
+					|| !zip.ExtractTo(root + PATH_SEP + payloads[i].dir, &pool))
+				return Failed("unzip", zip.Error());
+		}
+		Report("unzip", "stored zip, pool", files, bytes, watch.Seconds());
+		TreeDeleter().Delete(root, &pool);
+
+		printf("%-8s %-18s %8s %9.1f  (%.1f MB with deflated zips)\n",
+			"size", "compressed image", "", FileSizeMb(compressed), FileSizeMb(image));
+	}
+
+	// the python payload as a solid archive, as the packer converts it
+	{
+		const Payload& python = payloads[0];
+		std::string solid, error;
+		Stopwatch watch;
+		if (!ZipToSolid((const uint8_t*)python.zip.data(), python.zip.size(), &pool, &solid, &error))
+			return Failed("attach", error);
+		Report("attach", "zip to solid", python.files, python.zip.size(), watch.Seconds());
+
+		std::string root = (dir / "solid").string();
+		SolidArchive archive;
+		watch = Stopwatch();
+		if (!archive.Open((const uint8_t*)solid.data(), solid.size())
+				|| !archive.ExtractTo(root, &pool))
+			return Failed("unzip", archive.Error());
+		Report("unzip", "solid, pool", python.files, python.bytes, watch.Seconds());
+		TreeDeleter().Delete(root, &pool);
+
+		printf("%-8s %-18s %8s %9.1f  (%.1f MB as %s)\n", "size", "solid python", "",
+			solid.size() / 1e6, python.zip.size() / 1e6, python.name);
+	}
+
+	// unzip: the installer's engines, a fresh install and an unchanged
+	// upgrade next to it, which links every file over
+	{
+		std::string roots[] = { (dir / "install").string(), (dir / "upgrade").string() };
+		const char* names[] = { "delta, full", "delta, unchanged" };
+		for (int round = 0; round < 2; ++round) {
+			const char* name = names[round];
+			Stopwatch watch;
+			DeltaInstaller installer(roots[round], round ? roots[0] : (dir / "none").string());
+			for (size_t i = 0; i < count; ++i) {
+				const PayloadEntry* entry = table.Find(payloads[i].name);
+				if (!installer.Add(payloads[i].name, table.Data(*entry),
+						(size_t)entry->storedSize, payloads[i].dir, entry->entryDigests))
+					return Failed("unzip", installer.Error());
+			}
+			if (!installer.Run(&pool))
+				return Failed("unzip", installer.Error());
+			Report("unzip", name, files, installer.WrittenBytes(), watch.Seconds());
+		}
+
+		const PayloadEntry* entry = table.Find(payloads[0].name);
+		RuntimeCache cache((dir / "runtimes").string());
+		Stopwatch watch;
+		if (!cache.Prepare("bench", table.Data(*entry), (size_t)entry->storedSize, &pool,
+				IO_SYNC, entry->entryDigests)
+				|| !cache.Publish("bench"))
+			return Failed("unzip", cache.Error());
+		Report("unzip", "runtime cache", payloads[0].files, payloads[0].bytes, watch.Seconds());
+	}
+
+	// copy: the extracted tree, per TreeCopier mode
+	{
+		struct Variant {
+			const char* name;
+			bool clone;
+			bool hardLink;
+		};
+		const Variant variants[] = {
+			{ "copy engine", false, false },
+			{ "clone", true, false },
+			{ "hard link", false, true },
+		};
+		for (const Variant& v : variants) {
+			TreeCopyOptions options;
+			options.clone = v.clone;
+			options.hardLink = v.hardLink;
+			TreeCopier copier(options);
+			std::string to = (dir / (std::string("copy-") + v.name)).string();
+			Stopwatch watch;
+			if (!copier.Copy(pooled, to, &pool))
+				return Failed("copy", copier.Error());
+			Report("copy", v.name, copier.Stats().files, copier.Stats().bytes, watch.Seconds());
+		}
+	}
+
+	// delete: two trees of the same shape, serial and on the pool
+	{
+		struct Variant {
+			const char* name;
+			const std::string* root;
+			TaskPool* pool;
+		};
+		Variant variants[] = {
+			{ "tree, 1 thread", &serial, NULL },
+			{ "tree, pool", &pooled, &pool },
+		};
+		for (const Variant& v : variants) {
+			TreeDeleter deleter;
+			Stopwatch watch;
+			if (!deleter.Delete(*v.root, v.pool))
+				return Failed("delete", deleter.Error());
+			Report("delete", v.name, deleter.Stats().files, deleter.Stats().bytes, watch.Seconds());
+		}
+	}
+	return true;
+}
+
+// Runs the install pipeline on synthetic payloads: generates python.zip
+// and app.zip, attaches them to a dummy host and times each stage with
+// every engine the installer has. The payloads are seeded, so the same
+// arguments give the same bytes on every machine.
+int PipelineBench(const std::vector<std::string>& args) {
+	if (args.empty()) {
+		fprintf(stderr, "pipeline: <scratch dir> [python files] [python MB] [app files] [app MB]\n");
+		return 1;
+	}
+
+	size_t pythonFiles = args.size() > 1 ? std::stoul(args[1]) : 3000;
+	uint64_t pythonMb = args.size() > 2 ? std::stoull(args[2]) : 40;
+	size_t appFiles = args.size() > 3 ? std::stoul(args[3]) : 500;
+	uint64_t appMb = args.size() > 4 ? std::stoull(args[4]) : 10;
+	if (pythonFiles > 0xffff || appFiles > 0xffff) {
+		fprintf(stderr, "pipeline: at most 65535 files per payload\n");
+		return 1;
+	}
+
+	Payload payloads[2];
+	payloads[0].name = "python.zip";
+	payloads[0].dir = "python";
+	payloads[1].name = "app.zip";
+	payloads[1].dir = "app";
+	{
+		Stopwatch watch;
+		payloads[0].zip = MakeSynthZip(SynthProfile{ pythonFiles, pythonMb << 20, 0.3 }, 1);
+		payloads[1].zip = MakeSynthZip(SynthProfile{ appFiles, appMb << 20, 0.1 }, 2);
+		for (Payload& p : payloads) {
+			Count(&p);
+			printf("%s: %zu files, %.1f MB, %.1f MB packed\n",
+				p.name, p.files, p.bytes / 1e6, p.zip.size() / 1e6);
+		}
+		printf("generated in %.3f s, %u threads\n\n", watch.Seconds(), TaskPool::DefaultThreads());
+	}
+
+	std::filesystem::path dir = std::filesystem::path(args[0]) / "pipeline";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+
+	printf("%-8s %-18s %8s %9s %9s %10s %9s\n",
+		"phase", "engine", "files", "MB", "seconds", "files/s", "MB/s");
+	bool ok = RunPipeline(dir, payloads, 2);
+	std::filesystem::remove_all(dir);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,191 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "inflate.hpp"
+#include "zipwriter.hpp"
+
+// Synthetic payloads for the benchmarks: a small DEFLATE encoder (fixed
+// Huffman codes, greedy LZ77) and a generator for archives shaped like
+// the python and app payloads. Everything is seeded, so runs with the
+// same parameters produce byte-identical archives.
+
+class DeflateEncoder {
+public:
+	// Compresses |data| into one final fixed-Huffman block.
+	static std::string Encode(const uint8_t* data, size_t size) {
+		DeflateEncoder enc;
+		enc.PutBits(1, 1);  // BFINAL
+		enc.PutBits(1, 2);  // BTYPE = fixed Huffman
+
+		const size_t HASH_SIZE = 1 << 15;
+		const size_t WINDOW = 32768;
+		std::vector<int64_t> head(HASH_SIZE, -1);
+
+		size_t pos = 0;
+		while (pos < size) {
+			size_t bestLen = 0, bestDist = 0;
+			if (pos + 3 <= size) {
+				uint32_t h = ((data[pos] << 16) | (data[pos + 1] << 8) | data[pos + 2]) * 2654435761u;
+				h >>= 17;
+				int64_t cand = head[h];
+				head[h] = (int64_t)pos;
+				if (cand >= 0 && pos - (size_t)cand <= WINDOW) {
+					size_t max = size - pos < 258 ? size - pos : 258;
+					size_t len = 0;
+					while (len < max && data[cand + len] == data[pos + len])
+						++len;
+					if (len >= 3) {
+						bestLen = len;
+						bestDist = pos - (size_t)cand;
+					}
+				}
+			}
+
+			if (bestLen) {
+				enc.PutLength(bestLen);
+				enc.PutDistance(bestDist);
+				pos += bestLen;
+			}
+			else {
+				enc.PutLiteral(data[pos]);
+				++pos;
+			}
+		}
+
+		enc.PutLiteral(256);
+		enc.Flush();
+		return enc.out_;
+	}
+
+private:
+	void PutBits(uint32_t value, int count) {
+		bits_ |= (uint64_t)value << count_;
+		count_ += count;
+		while (count_ >= 8) {
+			out_.push_back((char)(bits_ & 0xff));
+			bits_ >>= 8;
+			count_ -= 8;
+		}
+	}
+
+	// Huffman codes go out most significant bit first.
+	void PutCode(uint32_t code, int length) {
+		uint32_t reversed = 0;
+		for (int i = 0; i < length; ++i)
+			reversed |= ((code >> i) & 1) << (length - 1 - i);
+		PutBits(reversed, length);
+	}
+
+	void PutLiteral(unsigned sym) {
+		if (sym < 144)
+			PutCode(0x30 + sym, 8);
+		else if (sym < 256)
+			PutCode(0x190 + sym - 144, 9);
+		else if (sym < 280)
+			PutCode(sym - 256, 7);
+		else
+			PutCode(0xc0 + sym - 280, 8);
+	}
+
+	void PutLength(size_t len) {
+		static const uint16_t base[] = {
+			3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+			35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const uint8_t extra[] = {
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+			3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		int i = 28;
+		while (base[i] > len)
+			--i;
+		PutLiteral(257 + i);
+		PutBits((uint32_t)(len - base[i]), extra[i]);
+	}
+
+	void PutDistance(size_t dist) {
+		static const uint16_t base[] = {
+			1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+			257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+			8193, 12289, 16385, 24577 };
+		static const uint8_t extra[] = {
+			0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+			7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+		int i = 29;
+		while (base[i] > dist)
+			--i;
+		PutCode(i, 5);
+		PutBits((uint32_t)(dist - base[i]), extra[i]);
+	}
+
+	void Flush() {
+		if (count_)
+			out_.push_back((char)(bits_ & 0xff));
+		bits_ = 0;
+		count_ = 0;
+	}
+
+	std::string out_;
+	uint64_t bits_ = 0;
+	int count_ = 0;
+};
+
+struct SynthProfile {
+	size_t files;
+	uint64_t bytes;
+	// share of |bytes| in a few large binaries (python3x.dll, *.pyd)
+	double binaryShare;
+};
+
+// Builds a seeded archive of |profile.files| files spread over nested
+// packages: mostly source-like text, which compresses, plus a handful of
+// large incompressible binaries stored as they are.
+inline std::string MakeSynthZip(const SynthProfile& profile, uint32_t seed) {
+	static const char* const words[] = {
+		"def", "return", "self", "import", "class", "if", "else", "for",
+		"in", "not", "None", "True", "False", "value", "name", "data",
+		"result", "args", "kwargs", "path", "len", "range", "try", "except" };
+
+	uint32_t x = seed ? seed : 1;
+	auto next = [&x] {
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+		return x;
+	};
+
+	ZipWriter zip;
+	size_t binaries = profile.files < 8 ? 0 : profile.files / 500 + 1;
+	uint64_t binaryBytes = binaries ? (uint64_t)(profile.bytes * profile.binaryShare) : 0;
+	uint64_t textBytes = profile.bytes - binaryBytes;
+	size_t textFiles = profile.files - binaries;
+
+	for (size_t i = 0; i < binaries; ++i) {
+		std::string content((size_t)(binaryBytes / binaries), '\0');
+		for (char& c : content)
+			c = (char)next();
+		zip.AddStored("bin/module" + std::to_string(i) + ".pyd",
+			(const uint8_t*)content.data(), content.size());
+	}
+
+	for (size_t i = 0; i < textFiles; ++i) {
+		// sizes vary between a quarter and 1.75 times the average
+		uint64_t avg = textFiles ? textBytes / textFiles : 0;
+		size_t size = (size_t)(avg / 4 + next() % (avg * 3 / 2 + 1));
+		std::string content;
+		content.reserve(size + 16);
+		while (content.size() < size) {
+			content += words[next() % (sizeof(words) / sizeof(words[0]))];
+			content += (next() % 8) ? ' ' : '\n';
+		}
+		content.resize(size);
+
+		std::string name = "lib/pkg" + std::to_string(i % 37) + "/sub"
+			+ std::to_string(i % 5) + "/file" + std::to_string(i) + ".py";
+		const uint8_t* data = (const uint8_t*)content.data();
+		std::string packed = DeflateEncoder::Encode(data, content.size());
+		zip.Add(name, 8, Crc32::Update(0, data, content.size()),
+			(const uint8_t*)packed.data(), packed.size(), content.size());
+	}
+
+	std::string archive;
+	zip.Finish(&archive);
+	return archive;
+}
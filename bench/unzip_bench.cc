@@ -0,0 +1,61 @@
+#include <filesystem>
+#include "bench.hpp"
+#include "zip.hpp"
+
+// Extracts one archive repeatedly with 1..N worker threads and reports
+// entries/s and MB/s (uncompressed) for each thread count.
+int UnzipBench(const std::vector<std::string>& args) {
+	if (args.size() < 2) {
+		fprintf(stderr, "unzip: <zip> <scratch dir> [max threads]\n");
+		return 1;
+	}
+
+	std::vector<uint8_t> data;
+	if (!ReadWholeFile(args[0].c_str(), &data)) {
+		fprintf(stderr, "failed to read %s\n", args[0].c_str());
+		return 1;
+	}
+
+	ZipArchive zip;
+	if (!zip.Open(data.data(), data.size())) {
+		fprintf(stderr, "%s: %s\n", args[0].c_str(), zip.Error().c_str());
+		return 1;
+	}
+
+	uint64_t bytes = 0;
+	size_t files = 0;
+	for (const ZipEntry& entry : zip.Entries()) {
+		bytes += entry.size;
+		files += entry.IsDir() ? 0 : 1;
+	}
+
+	unsigned maxThreads = args.size() > 2
+		? (unsigned)std::stoul(args[2]) : TaskPool::DefaultThreads();
+	std::filesystem::path scratch = args[1];
+
+	printf("%zu files, %.1f MB uncompressed\n", files, bytes / 1e6);
+	printf("%8s %10s %12s %10s %8s\n", "threads", "seconds", "entries/s", "MB/s", "speedup");
+
+	double base = 0;
+	for (unsigned threads : ThreadSteps(maxThreads)) {
+		std::filesystem::path dest = scratch / ("unzip-" + std::to_string(threads));
+		std::filesystem::remove_all(dest);
+
+		TaskPool pool(threads);
+		Stopwatch watch;
+		bool ok = zip.ExtractTo(dest.string(), &pool);
+		double secs = watch.Seconds();
+		std::filesystem::remove_all(dest);
+
+		if (!ok) {
+			fprintf(stderr, "extract failed: %s\n", zip.Error().c_str());
+			return 1;
+		}
+
+		if (base == 0)
+			base = secs;
+		printf("%8u %10.3f %12.0f %10.1f %8.2f\n",
+			threads, secs, files / secs, bytes / 1e6 / secs, base / secs);
+	}
+	return 0;
+}
@@ -0,0 +1,512 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "fileio.hpp"
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+// Asynchronous file writes for extraction: a queue keeps up to DEPTH
+// requests in flight instead of one blocking write at a time. io_uring
+// backs it on Linux, driven by raw syscalls, and an I/O completion port
+// on Windows. The backend is picked at run time; where it is missing
+// (old kernel, seccomp filter) extraction falls back to plain writes.
+
+enum IoBackend {
+	IO_SYNC,
+	IO_ASYNC,
+};
+
+// "sync" or "async".
+inline bool ParseIoBackend(const std::string& name, IoBackend* backend) {
+	if (name == "sync")
+		*backend = IO_SYNC;
+	else if (name == "async")
+		*backend = IO_ASYNC;
+	else
+		return false;
+	return true;
+}
+
+class IoQueue {
+public:
+	static const unsigned DEPTH = 64;
+	// writes are split so one big file still keeps the queue busy
+	static const size_t CHUNK_SIZE = 1024 * 1024;
+
+	virtual ~IoQueue() {}
+
+	virtual const char* Name() const = 0;
+
+	// Creates |path| for writing through this queue.
+	virtual bool Create(File* file, const PathChar* path) = 0;
+
+	// Queues a write of |size| bytes at |offset|; |data| must stay valid
+	// and |file| open until Wait() returns. |failed| is set if the write
+	// fails. Blocks while the queue is full.
+	bool Write(File& file, const void* data, size_t size, uint64_t offset, bool* failed) {
+		const uint8_t* p = (const uint8_t*)data;
+		do {
+			size_t len = size < CHUNK_SIZE ? size : CHUNK_SIZE;
+			Request* req = Acquire();
+			if (!req)
+				return false;
+			req->file = &file;
+			req->data = p;
+			req->size = len;
+			req->offset = offset;
+			req->failed = failed;
+			if (!Submit(req))
+				return false;
+			p += len;
+			offset += len;
+			size -= len;
+		} while (size);
+		return true;
+	}
+
+	// Waits for every queued request; false if any of them failed.
+	bool Wait() {
+		while (inflight_) {
+			if (!Reap(true))
+				break;
+		}
+		bool ok = !failed_ && !inflight_;
+		failed_ = false;
+		return ok;
+	}
+
+	int ErrorCode() const {
+		return errorCode_;
+	}
+
+protected:
+	struct Request {
+#ifdef _WIN32
+		// first, completions hand back the OVERLAPPED pointer
+		OVERLAPPED overlapped;
+#endif
+		File* file;
+		const uint8_t* data;
+		size_t size;
+		uint64_t offset;
+		bool* failed;
+		Request* next;
+	};
+
+	IoQueue() : requests_(DEPTH) {
+		for (size_t i = 0; i + 1 < requests_.size(); ++i)
+			requests_[i].next = &requests_[i + 1];
+		requests_.back().next = NULL;
+		free_ = &requests_[0];
+	}
+
+	// Hands |req| to the backend; false only for a broken queue.
+	virtual bool Submit(Request* req) = 0;
+
+	// Collects completions, waiting for one if |wait|; false only for a
+	// broken queue.
+	virtual bool Reap(bool wait) = 0;
+
+	// Called by the backends for every completion. A short write is
+	// queued again for the rest.
+	bool Complete(Request* req, bool ok, size_t done, int code) {
+		if (ok && done > 0 && done < req->size) {
+			req->data += done;
+			req->offset += done;
+			req->size -= done;
+			return Submit(req);
+		}
+
+		if (!ok || done != req->size) {
+			*req->failed = true;
+			failed_ = true;
+			errorCode_ = code;
+		}
+		Release(req);
+		return true;
+	}
+
+	void Release(Request* req) {
+		req->next = free_;
+		free_ = req;
+		--inflight_;
+	}
+
+	bool Broken(int code) {
+		errorCode_ = code;
+		failed_ = true;
+		return false;
+	}
+
+	size_t inflight_ = 0;
+
+private:
+	Request* Acquire() {
+		while (!free_) {
+			if (!Reap(true))
+				return NULL;
+		}
+		Request* req = free_;
+		free_ = req->next;
+		++inflight_;
+		return req;
+	}
+
+	std::vector<Request> requests_;
+	Request* free_;
+	bool failed_ = false;
+	int errorCode_ = 0;
+};
+
+#ifdef __linux__
+
+// The io_uring ABI, declared here so the build does not depend on the
+// kernel headers being new enough.
+struct UringSqOffsets {
+	uint32_t head, tail, ringMask, ringEntries, flags, dropped, array, resv1;
+	uint64_t userAddr;
+};
+
+struct UringCqOffsets {
+	uint32_t head, tail, ringMask, ringEntries, overflow, cqes, flags, resv1;
+	uint64_t userAddr;
+};
+
+struct UringParams {
+	uint32_t sqEntries, cqEntries, flags, sqThreadCpu, sqThreadIdle, features, wqFd;
+	uint32_t resv[3];
+	UringSqOffsets sqOff;
+	UringCqOffsets cqOff;
+};
+
+struct UringSqe {
+	uint8_t opcode, flags;
+	uint16_t ioprio;
+	int32_t fd;
+	uint64_t off, addr;
+	uint32_t len, rwFlags;
+	uint64_t userData;
+	uint64_t pad[3];
+};
+
+struct UringCqe {
+	uint64_t userData;
+	int32_t res;
+	uint32_t flags;
+};
+
+struct UringProbe {
+	uint8_t lastOp, opsLen;
+	uint16_t resv;
+	uint32_t resv2[3];
+	struct {
+		uint8_t op, resv;
+		uint16_t flags;
+		uint32_t resv2;
+	} ops[64];
+};
+
+class UringQueue : public IoQueue {
+public:
+	~UringQueue() {
+		if (sqes_ != MAP_FAILED)
+			munmap(sqes_, sqesSize_);
+		if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_)
+			munmap(cqRing_, cqRingSize_);
+		if (sqRing_ != MAP_FAILED)
+			munmap(sqRing_, sqRingSize_);
+		if (fd_ >= 0)
+			close(fd_);
+	}
+
+	// False when the kernel has no usable io_uring.
+	bool Init() {
+		UringParams params;
+		memset(&params, 0, sizeof(params));
+		fd_ = (int)syscall(SYS_SETUP, DEPTH, &params);
+		if (fd_ < 0)
+			return false;
+
+		UringProbe probe;
+		memset(&probe, 0, sizeof(probe));
+		if (syscall(SYS_REGISTER, fd_, REGISTER_PROBE, &probe, 64) < 0
+				|| probe.lastOp < OP_WRITE || !(probe.ops[OP_WRITE].flags & OP_SUPPORTED))
+			return false;
+
+		sqRingSize_ = params.sqOff.array + params.sqEntries * sizeof(uint32_t);
+		cqRingSize_ = params.cqOff.cqes + params.cqEntries * sizeof(UringCqe);
+		bool single = (params.features & FEAT_SINGLE_MMAP) != 0;
+		if (single && cqRingSize_ > sqRingSize_)
+			sqRingSize_ = cqRingSize_;
+
+		sqRing_ = Map(sqRingSize_, OFF_SQ_RING);
+		if (sqRing_ == MAP_FAILED)
+			return false;
+		cqRing_ = single ? sqRing_ : Map(cqRingSize_, OFF_CQ_RING);
+		sqesSize_ = params.sqEntries * sizeof(UringSqe);
+		sqes_ = Map(sqesSize_, OFF_SQES);
+		if (cqRing_ == MAP_FAILED || sqes_ == MAP_FAILED)
+			return false;
+
+		uint8_t* sq = (uint8_t*)sqRing_;
+		sqTail_ = (uint32_t*)(sq + params.sqOff.tail);
+		sqMask_ = *(uint32_t*)(sq + params.sqOff.ringMask);
+		sqArray_ = (uint32_t*)(sq + params.sqOff.array);
+		uint8_t* cq = (uint8_t*)cqRing_;
+		cqHead_ = (uint32_t*)(cq + params.cqOff.head);
+		cqTail_ = (uint32_t*)(cq + params.cqOff.tail);
+		cqMask_ = *(uint32_t*)(cq + params.cqOff.ringMask);
+		cqes_ = (UringCqe*)(cq + params.cqOff.cqes);
+		return true;
+	}
+
+	const char* Name() const override {
+		return "io_uring";
+	}
+
+	bool Create(File* file, const PathChar* path) override {
+		return file->Create(path, true);
+	}
+
+protected:
+	// Only fills the submission ring, Reap() hands the batch to the
+	// kernel in one call.
+	bool Submit(Request* req) override {
+		uint32_t tail = *sqTail_;
+		uint32_t index = tail & sqMask_;
+		UringSqe* sqe = (UringSqe*)sqes_ + index;
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = OP_WRITE;
+		sqe->fd = req->file->Handle();
+		sqe->off = req->offset;
+		sqe->addr = (uint64_t)(uintptr_t)req->data;
+		sqe->len = (uint32_t)req->size;
+		sqe->userData = (uint64_t)(uintptr_t)req;
+		sqArray_[index] = index;
+		__atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+		++unsubmitted_;
+		return true;
+	}
+
+	bool Reap(bool wait) override {
+		uint32_t head = *cqHead_;
+		bool ready = head != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+		if (unsubmitted_ || (wait && !ready)) {
+			unsigned flags = wait && !ready ? ENTER_GETEVENTS : 0;
+			long n = syscall(SYS_ENTER, fd_, unsubmitted_, flags ? 1 : 0, flags, NULL, 0);
+			if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+				return Broken(errno);
+			if (n > 0)
+				unsubmitted_ -= (unsigned)n;
+		}
+
+		uint32_t tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			// the kernel may reuse the slot once the head passes it
+			const UringCqe& cqe = cqes_[head & cqMask_];
+			Request* req = (Request*)(uintptr_t)cqe.userData;
+			int32_t res = cqe.res;
+			__atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+			if (!Complete(req, res >= 0, res >= 0 ? (size_t)res : 0, -res))
+				return false;
+		}
+		return true;
+	}
+
+private:
+	static const long SYS_SETUP = 425;
+	static const long SYS_ENTER = 426;
+	static const long SYS_REGISTER = 427;
+	static const uint8_t OP_WRITE = 23;
+	static const unsigned REGISTER_PROBE = 8;
+	static const uint16_t OP_SUPPORTED = 1;
+	static const unsigned ENTER_GETEVENTS = 1;
+	static const uint32_t FEAT_SINGLE_MMAP = 1;
+	static const off_t OFF_SQ_RING = 0;
+	static const off_t OFF_CQ_RING = 0x8000000;
+	static const off_t OFF_SQES = 0x10000000;
+
+	void* Map(size_t size, off_t offset) {
+		return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+	}
+
+	int fd_ = -1;
+	void* sqRing_ = MAP_FAILED;
+	void* cqRing_ = MAP_FAILED;
+	void* sqes_ = MAP_FAILED;
+	size_t sqRingSize_ = 0;
+	size_t cqRingSize_ = 0;
+	size_t sqesSize_ = 0;
+	uint32_t* sqTail_ = NULL;
+	uint32_t* sqArray_ = NULL;
+	uint32_t sqMask_ = 0;
+	uint32_t* cqHead_ = NULL;
+	uint32_t* cqTail_ = NULL;
+	uint32_t cqMask_ = 0;
+	UringCqe* cqes_ = NULL;
+	unsigned unsubmitted_ = 0;
+};
+
+typedef UringQueue NativeIoQueue;
+
+#endif
+
+#ifdef _WIN32
+
+// NTFS runs writes that extend a file synchronously inside WriteFile, so
+// fresh files mostly gain from having many of them open at once.
+class IocpQueue : public IoQueue {
+public:
+	~IocpQueue() {
+		if (port_)
+			CloseHandle(port_);
+	}
+
+	bool Init() {
+		port_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+		return port_ != NULL;
+	}
+
+	const char* Name() const override {
+		return "iocp";
+	}
+
+	bool Create(File* file, const PathChar* path) override {
+		return file->Create(path, true, true)
+			&& CreateIoCompletionPort(file->Handle(), port_, 0, 0) == port_;
+	}
+
+protected:
+	bool Submit(Request* req) override {
+		memset(&req->overlapped, 0, sizeof(req->overlapped));
+		req->overlapped.Offset = (DWORD)req->offset;
+		req->overlapped.OffsetHigh = (DWORD)(req->offset >> 32);
+		if (WriteFile(req->file->Handle(), req->data, (DWORD)req->size, NULL, &req->overlapped)
+				|| GetLastError() == ERROR_IO_PENDING)
+			return true;
+		// no completion packet is posted for a call that failed outright
+		return Complete(req, false, 0, (int)GetLastError());
+	}
+
+	bool Reap(bool wait) override {
+		for (;;) {
+			DWORD done = 0;
+			ULONG_PTR key = 0;
+			OVERLAPPED* overlapped = NULL;
+			BOOL ok = GetQueuedCompletionStatus(port_, &done, &key, &overlapped, wait ? INFINITE : 0);
+			if (!overlapped)
+				return wait ? Broken((int)GetLastError()) : true;
+			Request* req = CONTAINING_RECORD(overlapped, Request, overlapped);
+			if (!Complete(req, ok != FALSE, done, ok ? 0 : (int)GetLastError()))
+				return false;
+			wait = false;
+		}
+	}
+
+private:
+	HANDLE port_ = NULL;
+};
+
+typedef IocpQueue NativeIoQueue;
+
+#endif
+
+// A queue for |backend|, NULL for IO_SYNC or when the platform cannot
+// do asynchronous writes.
+inline std::unique_ptr<IoQueue> CreateIoQueue(IoBackend backend) {
+	if (backend == IO_SYNC)
+		return NULL;
+#if defined(__linux__) || defined(_WIN32)
+	std::unique_ptr<NativeIoQueue> queue(new NativeIoQueue);
+	if (queue->Init())
+		return std::unique_ptr<IoQueue>(queue.release());
+#endif
+	return NULL;
+}
+
+// The calling thread's queue, created on first use, so every pool worker
+// keeps its own ring. NULL means write synchronously.
+inline IoQueue* ThreadIoQueue(IoBackend backend) {
+	static thread_local std::unique_ptr<IoQueue> queue;
+	static thread_local bool created = false;
+	if (backend == IO_SYNC)
+		return NULL;
+	if (!created) {
+		created = true;
+		queue = CreateIoQueue(backend);
+	}
+	return queue.get();
+}
+
+// Name of the writer actually used for |backend| on this thread.
+inline const char* IoBackendName(IoBackend backend) {
+	IoQueue* queue = ThreadIoQueue(backend);
+	return queue ? queue->Name() : "sync";
+}
+
+// Writes a batch of extracted files through a queue: each file is
+// created, preallocated and queued at once, then Finish() waits for the
+// data and stamps and closes the files. Contents must stay valid until
+// then; Buffer() hands out storage that does.
+class ExtractWriter {
+public:
+	explicit ExtractWriter(IoQueue* queue) : queue_(queue) {}
+
+	~ExtractWriter() {
+		queue_->Wait();
+	}
+
+	ExtractWriter(const ExtractWriter&) = delete;
+	ExtractWriter& operator=(const ExtractWriter&) = delete;
+
+	std::vector<uint8_t>* Buffer() {
+		buffers_.emplace_back(new std::vector<uint8_t>);
+		return buffers_.back().get();
+	}
+
+	bool Add(const PathChar* path, const uint8_t* data, size_t size,
+			uint16_t dosDate, uint16_t dosTime) {
+		std::unique_ptr<Pending> file(new Pending);
+		if (!queue_->Create(&file->file, path))
+			return false;
+		if (size >= PREALLOCATE_MIN_SIZE)
+			file->file.Preallocate(size);
+		file->dosDate = dosDate;
+		file->dosTime = dosTime;
+		files_.push_back(std::move(file));
+
+		Pending& added = *files_.back();
+		return size == 0 || queue_->Write(added.file, data, size, 0, &added.failed);
+	}
+
+	// |failed| receives the index, in Add() order, of the first file that
+	// could not be written.
+	bool Finish(size_t* failed) {
+		bool ok = queue_->Wait();
+		*failed = 0;
+		for (size_t i = files_.size(); i-- > 0;) {
+			if (files_[i]->failed)
+				*failed = i;
+			files_[i]->file.SetDosTime(files_[i]->dosDate, files_[i]->dosTime);
+		}
+		files_.clear();
+		buffers_.clear();
+		return ok;
+	}
+
+private:
+	struct Pending {
+		File file;
+		uint16_t dosDate = 0;
+		uint16_t dosTime = 0;
+		bool failed = false;
+	};
+
+	IoQueue* queue_;
+	std::vector<std::unique_ptr<Pending>> files_;
+	std::vector<std::unique_ptr<std::vector<uint8_t>>> buffers_;
+};
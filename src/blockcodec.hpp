@@ -0,0 +1,431 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "endian.hpp"
+#include "entropy.hpp"
+#include "sha256.hpp"
+#include "taskpool.hpp"
+
+// Block-framed compressed stream for payloads. The input is cut into
+// fixed-size blocks that are compressed independently with an LZ4-style
+// byte codec (literal runs and matches of up to 64 KB back), so every
+// block can be decoded on its own worker:
+//
+//   header:  magic[4] block_size[4] raw_size[8] count[4]
+//   table:   count * stored_size[4], the top bit marks a block kept raw,
+//            the next one a block with an entropy stage
+//   digests: count * sha256[32] of the stored blocks
+//   blocks:  back to back
+//
+// A block with an entropy stage keeps the sequences (tokens, lengths and
+// offsets) and the literals apart, each Huffman coded (entropy.hpp); the
+// encoder picks it when it saves at least ENTROPY_MIN_SAVING of the
+// plain block, which decodes with memcpy-like loops only.
+//
+// Integers are little-endian. The table doubles as the seek index: the
+// offset of a block is the sum of the stored sizes before it. Each block
+// is checked against its digest by the worker that decodes it, right
+// before decoding.
+
+const char BLOCK_STREAM_MAGIC[4] = { 'C', 'R', 'B', 'S' };
+const uint32_t BLOCK_STREAM_RAW = 0x80000000u;
+const uint32_t BLOCK_STREAM_ENTROPY = 0x40000000u;
+const size_t BLOCK_STREAM_HEADER_SIZE = 20;
+
+class BlockStream {
+public:
+	static const uint32_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+	// percent of a plain block an entropy stage must save
+	static const size_t ENTROPY_MIN_SAVING = 10;
+
+	// Compresses |data| with the blocks spread over |pool|, if any.
+	static std::string Encode(const uint8_t* data, size_t size, TaskPool* pool,
+			uint32_t blockSize = DEFAULT_BLOCK_SIZE) {
+		size_t count = (size + blockSize - 1) / blockSize;
+		std::vector<std::string> blocks(count);
+		std::vector<uint32_t> flags(count);
+		std::string digests(count * Sha256::DIGEST_SIZE, '\0');
+		TaskPool::Group group;
+		for (size_t i = 0; i < count; ++i) {
+			const uint8_t* src = data + i * blockSize;
+			size_t len = size - i * blockSize < blockSize ? size - i * blockSize : blockSize;
+			std::string* out = &blocks[i];
+			uint32_t* flag = &flags[i];
+			uint8_t* digest = (uint8_t*)&digests[i * Sha256::DIGEST_SIZE];
+			auto task = [src, len, out, flag, digest] {
+				*flag = EncodeBlock(src, len, out);
+				Sha256::Hash(out->data(), out->size(), digest);
+			};
+
+			if (pool)
+				pool->Submit(task, &group);
+			else
+				task();
+		}
+		if (pool)
+			pool->Wait(&group);
+
+		std::string stream(BLOCK_STREAM_MAGIC, sizeof(BLOCK_STREAM_MAGIC));
+		PutLe32(&stream, blockSize);
+		PutLe64(&stream, size);
+		PutLe32(&stream, (uint32_t)count);
+		for (size_t i = 0; i < count; ++i)
+			PutLe32(&stream, (uint32_t)blocks[i].size() | flags[i]);
+		stream += digests;
+		for (const std::string& block : blocks)
+			stream += block;
+		return stream;
+	}
+
+	static bool IsBlockStream(const uint8_t* data, size_t size) {
+		return size >= BLOCK_STREAM_HEADER_SIZE
+			&& memcmp(data, BLOCK_STREAM_MAGIC, sizeof(BLOCK_STREAM_MAGIC)) == 0;
+	}
+
+	// Reads the header, the seek table and the digests; the blocks are
+	// checked while decoding.
+	bool Open(const uint8_t* data, size_t size) {
+		data_ = data;
+		blocks_.clear();
+		error_.clear();
+		if (!IsBlockStream(data, size))
+			return Fail("not a block stream");
+
+		blockSize_ = GetLe32(data + 4);
+		rawSize_ = GetLe64(data + 8);
+		uint32_t count = GetLe32(data + 16);
+		if (blockSize_ == 0 || blockSize_ >= BLOCK_STREAM_ENTROPY
+				|| (rawSize_ + blockSize_ - 1) / blockSize_ != count
+				|| count > (size - BLOCK_STREAM_HEADER_SIZE) / (4 + Sha256::DIGEST_SIZE))
+			return Fail("bad block stream header");
+
+		const uint8_t* digests = data + BLOCK_STREAM_HEADER_SIZE + (size_t)count * 4;
+		uint64_t offset = BLOCK_STREAM_HEADER_SIZE + (uint64_t)count * (4 + Sha256::DIGEST_SIZE);
+		for (uint32_t i = 0; i < count; ++i) {
+			uint32_t field = GetLe32(data + BLOCK_STREAM_HEADER_SIZE + i * 4);
+			Block block;
+			block.src = data + offset;
+			block.digest = digests + (size_t)i * Sha256::DIGEST_SIZE;
+			block.storedSize = field & ~(BLOCK_STREAM_RAW | BLOCK_STREAM_ENTROPY);
+			block.raw = (field & BLOCK_STREAM_RAW) != 0;
+			block.entropy = (field & BLOCK_STREAM_ENTROPY) != 0;
+			block.rawOffset = (uint64_t)i * blockSize_;
+			block.rawSize = (size_t)(rawSize_ - block.rawOffset < blockSize_
+				? rawSize_ - block.rawOffset : blockSize_);
+			if (block.storedSize > size - offset
+					|| (block.raw && (block.entropy || block.storedSize != block.rawSize)))
+				return Fail("truncated block stream");
+			offset += block.storedSize;
+			blocks_.push_back(block);
+		}
+		return true;
+	}
+
+	uint64_t RawSize() const {
+		return rawSize_;
+	}
+
+	uint32_t BlockSize() const {
+		return blockSize_;
+	}
+
+	size_t BlockCount() const {
+		return blocks_.size();
+	}
+
+	// Looks up the block holding the decoded byte at |rawOffset| in the
+	// seek table: its index, and where its stored bytes start in the
+	// stream.
+	bool Seek(uint64_t rawOffset, size_t* index, uint64_t* storedOffset) const {
+		if (rawOffset >= rawSize_)
+			return false;
+		*index = (size_t)(rawOffset / blockSize_);
+		*storedOffset = (uint64_t)(blocks_[*index].src - data_);
+		return true;
+	}
+
+	// Decodes block |index| alone into |out|, which must hold BlockSize()
+	// bytes; |size| receives its decoded size.
+	bool DecodeBlock(size_t index, uint8_t* out, size_t* size) {
+		if (index >= blocks_.size())
+			return Fail("no such block");
+
+		const Block& block = blocks_[index];
+		bool damaged = false;
+		if (!CheckAndDecode(block, out, &damaged))
+			return Fail(damaged ? "damaged block stream" : "corrupt block stream");
+		*size = block.rawSize;
+		return true;
+	}
+
+	// Decodes the whole stream into |out|, which must hold RawSize() bytes.
+	bool Decode(uint8_t* out, TaskPool* pool) {
+		std::atomic<bool> ok(true);
+		std::atomic<bool> damaged(false);
+		TaskPool::Group group;
+		for (const Block& block : blocks_) {
+			const Block* b = &block;
+			auto task = [b, out, &ok, &damaged] {
+				bool blockDamaged = false;
+				if (!CheckAndDecode(*b, out + b->rawOffset, &blockDamaged)) {
+					if (blockDamaged)
+						damaged = true;
+					ok = false;
+				}
+			};
+
+			if (pool)
+				pool->Submit(task, &group);
+			else
+				task();
+		}
+		if (pool)
+			pool->Wait(&group);
+
+		if (damaged)
+			return Fail("damaged block stream");
+		if (!ok)
+			return Fail("corrupt block stream");
+		return true;
+	}
+
+	const std::string& Error() const {
+		return error_;
+	}
+
+private:
+	static const size_t MIN_MATCH = 4;
+	// the format keeps the tail of a block as literals
+	static const size_t LAST_LITERALS = 5;
+	static const size_t MATCH_FIND_LIMIT = 12;
+	static const size_t MAX_OFFSET = 65535;
+	static const int HASH_BITS = 16;
+
+	struct Block {
+		const uint8_t* src;
+		const uint8_t* digest;
+		size_t storedSize;
+		uint64_t rawOffset;
+		size_t rawSize;
+		bool raw;
+		bool entropy;
+	};
+
+	// Checks the stored bytes against their digest, then decodes them.
+	static bool CheckAndDecode(const Block& block, uint8_t* dst, bool* damaged) {
+		uint8_t digest[Sha256::DIGEST_SIZE];
+		Sha256::Hash(block.src, block.storedSize, digest);
+		if (memcmp(digest, block.digest, sizeof(digest)) != 0) {
+			*damaged = true;
+			return false;
+		}
+
+		if (block.raw) {
+			memcpy(dst, block.src, block.rawSize);
+			return true;
+		}
+		if (block.entropy)
+			return DecodeEntropyBlock(block.src, block.storedSize, dst, block.rawSize);
+		return DecompressBlock(block.src, block.storedSize, false, NULL, 0, dst, block.rawSize);
+	}
+
+	static uint32_t Read32(const uint8_t* p) {
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	static void PutLength(size_t len, std::string* out) {
+		for (; len >= 255; len -= 255)
+			out->push_back((char)255);
+		out->push_back((char)len);
+	}
+
+	// The literals go to |lit|, which is |out| itself in a plain block.
+	static void PutSequence(const uint8_t* literals, size_t literalLen,
+			size_t offset, size_t matchLen, std::string* out, std::string* lit) {
+		size_t matchCode = matchLen ? matchLen - MIN_MATCH : 0;
+		uint8_t token = (uint8_t)(((literalLen < 15 ? literalLen : 15) << 4)
+			| (matchCode < 15 ? matchCode : 15));
+		out->push_back((char)token);
+		if (literalLen >= 15)
+			PutLength(literalLen - 15, out);
+		lit->append((const char*)literals, literalLen);
+		if (!matchLen)
+			return;
+
+		out->push_back((char)(offset & 0xff));
+		out->push_back((char)(offset >> 8));
+		if (matchCode >= 15)
+			PutLength(matchCode - 15, out);
+	}
+
+	// Greedy single-probe hash matcher; speed matters more than ratio
+	// here, the payloads are packed once per release.
+	static bool CompressBlock(const uint8_t* src, size_t size, std::string* out,
+			std::string* lit) {
+		out->clear();
+		lit->clear();
+		out->reserve(size / 2);
+		std::vector<uint32_t> table((size_t)1 << HASH_BITS, 0);
+
+		size_t anchor = 0;
+		size_t pos = 0;
+		size_t limit = size > MATCH_FIND_LIMIT ? size - MATCH_FIND_LIMIT : 0;
+		while (pos < limit) {
+			uint32_t seq = Read32(src + pos);
+			uint32_t hash = (seq * 2654435761u) >> (32 - HASH_BITS);
+			size_t candidate = table[hash];
+			table[hash] = (uint32_t)pos + 1;
+
+			if (candidate == 0 || pos - (candidate - 1) > MAX_OFFSET
+					|| Read32(src + candidate - 1) != seq) {
+				++pos;
+				continue;
+			}
+
+			size_t match = candidate - 1;
+			size_t len = MIN_MATCH;
+			while (pos + len < size - LAST_LITERALS && src[match + len] == src[pos + len])
+				++len;
+
+			PutSequence(src + anchor, pos - anchor, pos - match, len, out, lit);
+			pos += len;
+			anchor = pos;
+			if (out->size() + (lit != out ? lit->size() : 0) >= size)
+				return false;
+		}
+
+		PutSequence(src + anchor, size - anchor, 0, 0, out, lit);
+		return true;
+	}
+
+	// Fills |out| with the smallest form of the block and returns its
+	// flags in the table.
+	static uint32_t EncodeBlock(const uint8_t* src, size_t size, std::string* out) {
+		std::string seq, lit;
+		if (!CompressBlock(src, size, &seq, &lit)) {
+			out->assign((const char*)src, size);
+			return BLOCK_STREAM_RAW;
+		}
+
+		size_t plain = seq.size() + lit.size();
+		out->clear();
+		ByteHuffman::Encode((const uint8_t*)seq.data(), seq.size(), out);
+		ByteHuffman::Encode((const uint8_t*)lit.data(), lit.size(), out);
+		if (out->size() < size && out->size() * 100 <= plain * (100 - ENTROPY_MIN_SAVING))
+			return BLOCK_STREAM_ENTROPY;
+
+		if (plain < size) {
+			CompressBlock(src, size, out, out);
+			return 0;
+		}
+		out->assign((const char*)src, size);
+		return BLOCK_STREAM_RAW;
+	}
+
+	static bool DecodeEntropyBlock(const uint8_t* src, size_t srcSize,
+			uint8_t* dst, size_t dstSize) {
+		const uint8_t* ip = src;
+		const uint8_t* end = src + srcSize;
+		size_t seqSize;
+		if (!ByteHuffman::PeekCount(ip, end, &seqSize) || seqSize > dstSize + dstSize / 8 + 16)
+			return false;
+		std::vector<uint8_t> seq(seqSize);
+		if (!ByteHuffman::Decode(&ip, end, seq.data()))
+			return false;
+
+		// the literals never outnumber the output bytes
+		size_t litSize;
+		if (!ByteHuffman::PeekCount(ip, end, &litSize) || litSize > dstSize)
+			return false;
+		std::vector<uint8_t> lit(litSize);
+		if (!ByteHuffman::Decode(&ip, end, lit.data()) || ip != end)
+			return false;
+		return DecompressBlock(seq.data(), seq.size(), true, lit.data(), lit.size(), dst, dstSize);
+	}
+
+	// Bounds-checked on both sides, damaged input fails instead of
+	// reading or writing outside the buffers. In a |split| block the
+	// literals are read from |lit|, else from |src| between the sequences.
+	static bool DecompressBlock(const uint8_t* src, size_t srcSize, bool split,
+			const uint8_t* lit, size_t litSize, uint8_t* dst, size_t dstSize) {
+		const uint8_t* ip = src;
+		const uint8_t* end = src + srcSize;
+		const uint8_t* lp = lit;
+		const uint8_t* litEnd = lit + litSize;
+		size_t op = 0;
+
+		while (ip < end) {
+			uint8_t token = *ip++;
+			size_t literalLen = token >> 4;
+			if (literalLen == 15 && !ReadLength(&ip, end, &literalLen))
+				return false;
+			if (literalLen > dstSize - op)
+				return false;
+			if (!split) {
+				if (literalLen > (size_t)(end - ip))
+					return false;
+				memcpy(dst + op, ip, literalLen);
+				ip += literalLen;
+			}
+			else {
+				if (literalLen > (size_t)(litEnd - lp))
+					return false;
+				memcpy(dst + op, lp, literalLen);
+				lp += literalLen;
+			}
+			op += literalLen;
+			if (ip == end)
+				break;
+
+			if (end - ip < 2)
+				return false;
+			size_t offset = ip[0] | (ip[1] << 8);
+			ip += 2;
+			size_t matchLen = (token & 15);
+			if (matchLen == 15 && !ReadLength(&ip, end, &matchLen))
+				return false;
+			matchLen += MIN_MATCH;
+			if (offset == 0 || offset > op || matchLen > dstSize - op)
+				return false;
+
+			uint8_t* out = dst + op;
+			const uint8_t* from = out - offset;
+			if (offset >= matchLen) {
+				memcpy(out, from, matchLen);
+			}
+			else {
+				for (size_t i = 0; i < matchLen; ++i)
+					out[i] = from[i];
+			}
+			op += matchLen;
+		}
+		return op == dstSize && lp == litEnd;
+	}
+
+	static bool ReadLength(const uint8_t** ip, const uint8_t* end, size_t* len) {
+		uint8_t b;
+		do {
+			if (*ip == end)
+				return false;
+			b = *(*ip)++;
+			*len += b;
+		} while (b == 255);
+		return true;
+	}
+
+	bool Fail(const std::string& message) {
+		error_ = message;
+		return false;
+	}
+
+	const uint8_t* data_ = NULL;
+	std::vector<Block> blocks_;
+	uint32_t blockSize_ = 0;
+	uint64_t rawSize_ = 0;
+	std::string error_;
+};
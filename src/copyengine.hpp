@@ -0,0 +1,213 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fileio.hpp"
+
+// Block copy between two open files. By default a reader thread fills
+// the next block while the caller writes the previous one; buffers are
+// page-aligned and the destination is preallocated to its final size.
+// Any failed or short read/write stops the copy and is reported.
+
+struct CopyOptions {
+	size_t blockSize = 1024 * 1024;
+	size_t depth = 2;
+	bool pipelined = true;
+	bool preallocate = true;
+};
+
+class AlignedBuffer {
+public:
+	static const size_t ALIGNMENT = 4096;
+
+	explicit AlignedBuffer(size_t size) : size_(size) {
+#ifdef _WIN32
+		data_ = (uint8_t*)_aligned_malloc(size, ALIGNMENT);
+#else
+		void* p = NULL;
+		data_ = posix_memalign(&p, ALIGNMENT, size) == 0 ? (uint8_t*)p : NULL;
+#endif
+	}
+
+	~AlignedBuffer() {
+#ifdef _WIN32
+		_aligned_free(data_);
+#else
+		free(data_);
+#endif
+	}
+
+	AlignedBuffer(const AlignedBuffer&) = delete;
+	AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+	uint8_t* Data() const {
+		return data_;
+	}
+
+	size_t Size() const {
+		return size_;
+	}
+
+private:
+	uint8_t* data_;
+	size_t size_;
+};
+
+class CopyEngine {
+public:
+	explicit CopyEngine(const CopyOptions& options = CopyOptions())
+		: options_(options) {
+		if (options_.depth < 2)
+			options_.depth = 2;
+	}
+
+	// Copies |length| bytes starting at |offset| of |in| to the current
+	// position of |out|.
+	bool Copy(File& in, uint64_t offset, uint64_t length, File& out) {
+		error_.clear();
+		if (!in.Seek(offset))
+			return Fail("seek failed");
+
+		if (options_.preallocate)
+			out.Preallocate(length);
+
+		return options_.pipelined
+			? CopyPipelined(in, length, out)
+			: CopySerial(in, length, out);
+	}
+
+	bool CopyWholeFile(const PathChar* from, const PathChar* to) {
+		File in, out;
+		if (!in.OpenRead(from, true))
+			return Fail("open failed");
+		if (!out.Create(to))
+			return Fail("create failed");
+		return Copy(in, 0, in.Size(), out);
+	}
+
+	const std::string& Error() const {
+		return error_;
+	}
+
+private:
+	bool Fail(const char* what) {
+		error_ = std::string(what) + " (error " + std::to_string(LastErrorCode()) + ")";
+		return false;
+	}
+
+	size_t BlockLength(uint64_t rest) const {
+		return (size_t)(rest < options_.blockSize ? rest : options_.blockSize);
+	}
+
+	bool CopySerial(File& in, uint64_t length, File& out) {
+		AlignedBuffer buf(options_.blockSize);
+		if (!buf.Data())
+			return Fail("out of memory");
+
+		while (length) {
+			size_t block = BlockLength(length);
+			if (!in.Read(buf.Data(), block))
+				return Fail("read failed");
+			if (!out.Write(buf.Data(), block))
+				return Fail("write failed");
+			length -= block;
+		}
+		return true;
+	}
+
+	bool CopyPipelined(File& in, uint64_t length, File& out) {
+		struct Slot {
+			std::unique_ptr<AlignedBuffer> buf;
+			size_t len = 0;
+			bool full = false;
+		};
+
+		std::vector<Slot> slots(options_.depth);
+		for (Slot& slot : slots) {
+			slot.buf.reset(new AlignedBuffer(options_.blockSize));
+			if (!slot.buf->Data())
+				return Fail("out of memory");
+		}
+
+		std::mutex mutex;
+		std::condition_variable changed;
+		bool readFailed = false;
+		bool writeFailed = false;
+		int readError = 0;
+
+		std::thread reader([&] {
+			uint64_t rest = length;
+			for (size_t i = 0; rest; ++i) {
+				Slot& slot = slots[i % slots.size()];
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					changed.wait(lock, [&] { return !slot.full || writeFailed; });
+					if (writeFailed)
+						return;
+				}
+
+				size_t block = BlockLength(rest);
+				bool ok = in.Read(slot.buf->Data(), block);
+				int code = ok ? 0 : LastErrorCode();
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (!ok) {
+						readFailed = true;
+						readError = code;
+					}
+					slot.len = block;
+					slot.full = ok;
+				}
+				changed.notify_all();
+				if (!ok)
+					return;
+				rest -= block;
+			}
+		});
+
+		bool result = true;
+		uint64_t rest = length;
+		for (size_t i = 0; rest; ++i) {
+			Slot& slot = slots[i % slots.size()];
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&] { return slot.full || readFailed; });
+				if (!slot.full) {
+					result = false;
+					break;
+				}
+			}
+
+			if (!out.Write(slot.buf->Data(), slot.len)) {
+				result = Fail("write failed");
+				std::lock_guard<std::mutex> lock(mutex);
+				writeFailed = true;
+				break;
+			}
+
+			rest -= slot.len;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				slot.full = false;
+			}
+			changed.notify_all();
+		}
+
+		changed.notify_all();
+		reader.join();
+
+		if (readFailed) {
+			error_ = "read failed (error " + std::to_string(readError) + ")";
+			return false;
+		}
+		return result;
+	}
+
+	CopyOptions options_;
+	std::string error_;
+};
@@ -0,0 +1,319 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "asyncio.hpp"
+#include "copyengine.hpp"
+#include "fileio.hpp"
+#include "progress.hpp"
+#include "taskpool.hpp"
+#include "zip.hpp"
+
+// Incremental install of payload archives into a fresh application root.
+//
+// Every install leaves a manifest of the files it wrote: path, size and
+// CRC-32 exactly as found in the archives' central directories, and the
+// modification time the file got. The next upgrade compares the new
+// archives with the manifest of the installed tree in |base|: unchanged
+// files are hard-linked (or copied) from there, new and changed ones are
+// written. Without a manifest all files are written.
+//
+// A file counts as unchanged only while its size and modification time
+// on disk still match the manifest, so one edited in place is written
+// again. Manifests from before the times were recorded match nothing.
+//
+// Manifest file: a "creeper-manifest 2" line, then one line per file:
+//   <crc32 hex> <size> <modified> <path relative to the root, '/' separated>
+// with the time in File::DosTimeToTicks() units.
+
+const char INSTALL_MANIFEST_HEADER[] = "creeper-manifest 2";
+const char INSTALL_MANIFEST_HEADER_V1[] = "creeper-manifest 1";
+
+struct InstalledFile {
+	uint64_t size = 0;
+	uint32_t crc = 0;
+	// 0 when unknown
+	uint64_t modified = 0;
+};
+
+class InstallManifest {
+public:
+	bool Load(const PathChar* path) {
+		files_.clear();
+		std::vector<uint8_t> data;
+		if (!ReadWholeFile(path, &data))
+			return false;
+
+		std::string text(data.begin(), data.end());
+		size_t pos = text.find('\n');
+		if (pos == std::string::npos)
+			return false;
+		bool hasTimes = text.compare(0, pos, INSTALL_MANIFEST_HEADER) == 0;
+		if (!hasTimes && text.compare(0, pos, INSTALL_MANIFEST_HEADER_V1) != 0)
+			return false;
+
+		while (++pos < text.size()) {
+			size_t eol = text.find('\n', pos);
+			if (eol == std::string::npos)
+				return false;
+
+			std::string line = text.substr(pos, eol - pos);
+			char* end = NULL;
+			InstalledFile file;
+			file.crc = (uint32_t)strtoul(line.c_str(), &end, 16);
+			if (*end != ' ')
+				return false;
+			file.size = strtoull(end + 1, &end, 10);
+			if (*end != ' ')
+				return false;
+			if (hasTimes) {
+				file.modified = strtoull(end + 1, &end, 10);
+				if (*end != ' ')
+					return false;
+			}
+			if (!end[1])
+				return false;
+
+			files_[end + 1] = file;
+			pos = eol;
+		}
+		return true;
+	}
+
+	bool Save(const PathChar* path) const {
+		std::string text(INSTALL_MANIFEST_HEADER);
+		text.push_back('\n');
+		for (const auto& item : files_) {
+			char fields[64];
+			snprintf(fields, sizeof(fields), "%08x %llu %llu ",
+				item.second.crc, (unsigned long long)item.second.size,
+				(unsigned long long)item.second.modified);
+			text.append(fields);
+			text.append(item.first);
+			text.push_back('\n');
+		}
+
+		File file;
+		return file.Create(path) && file.Write(text.data(), text.size());
+	}
+
+	void Add(const std::string& path, const InstalledFile& file) {
+		files_[path] = file;
+	}
+
+	const InstalledFile* Find(const std::string& path) const {
+		auto it = files_.find(path);
+		return it == files_.end() ? NULL : &it->second;
+	}
+
+	const std::map<std::string, InstalledFile>& Files() const {
+		return files_;
+	}
+
+private:
+	std::map<std::string, InstalledFile> files_;
+};
+
+class DeltaInstaller {
+public:
+	// |root| is filled from scratch, |base| holds the installed version.
+	DeltaInstaller(const PathString& root, const PathString& base)
+		: root_(root), base_(base) {}
+
+	static PathString ManifestPath(const PathString& root) {
+		PathString path = root;
+		path.push_back(PATH_SEP);
+		const char name[] = ".install-manifest";
+		path.append(name, name + sizeof(name) - 1);
+		return path;
+	}
+
+	// Plans the extraction of the archive at |data| below root/|subdir|,
+	// checking its entries against |entryDigests| if given. |data| and
+	// |entryDigests| must stay valid until Run() returns.
+	bool Add(const std::string& name, const uint8_t* data, size_t size,
+			const std::string& subdir, const std::string& entryDigests = std::string()) {
+		if (!loaded_) {
+			hasInstalled_ = installed_.Load(ManifestPath(base_).c_str());
+			loaded_ = true;
+		}
+
+		std::unique_ptr<ZipArchive> zip(new ZipArchive);
+		PathString dir = root_;
+		PathString baseDir = base_;
+		std::string keyPrefix;
+		if (!subdir.empty()) {
+			PathString native = Utf8ToPath(subdir.data(), subdir.size());
+			dir += PATH_SEP + native;
+			baseDir += PATH_SEP + native;
+			keyPrefix = subdir + "/";
+		}
+
+		std::vector<ZipExtractJob> jobs;
+		if (!zip->Open(data, size)
+				|| (!entryDigests.empty() && !zip->UseDigests(entryDigests))
+				|| !zip->PlanExtract(dir, &jobs))
+			return Fail(name + ": " + zip->Error());
+
+		// the job paths stay in the archive's tree, reused files keep a
+		// slice of them and get their base path only when linked
+		baseDirs_.push_back(baseDir);
+		PathString installed;
+		for (ZipExtractJob& job : jobs) {
+			const ZipEntry& entry = zip->Entries()[job.index];
+			const PathChar* rel = job.path.str + job.relative;
+			size_t relLen = job.path.len - job.relative;
+			std::string key = keyPrefix + PathToUtf8(rel, relLen);
+			for (char& c : key) {
+				if (c == '\\')
+					c = '/';
+			}
+
+			installed.assign(baseDir);
+			installed.push_back(PATH_SEP);
+			installed.append(rel, relLen);
+			const InstalledFile* file = FindInstalled(key, entry, installed);
+			if (file) {
+				// a link shares the time; a copy gets a new one and is
+				// written again by the next upgrade
+				manifest_.Add(key, *file);
+				++unchanged_;
+				Progress::Get().Drop(1, entry.size);
+				Reuse reuse = { job.path, job.relative, baseDirs_.size() - 1 };
+				reuses_.push_back(reuse);
+				continue;
+			}
+
+			// the extractors give the file the entry's time
+			InstalledFile written;
+			written.size = entry.size;
+			written.crc = entry.crc;
+			File::DosTimeToTicks(entry.dosDate, entry.dosTime, &written.modified);
+			manifest_.Add(key, written);
+			writtenBytes_ += entry.size;
+			jobs_.push_back(job);
+		}
+
+		archives_.push_back(std::move(zip));
+		return true;
+	}
+
+	// Links unchanged files, writes new and changed ones, then records the
+	// new manifest.
+	bool Run(TaskPool* pool, IoBackend io = IO_SYNC) {
+		std::atomic<bool> reuseFailed(false);
+		TaskPool::Group group;
+		for (const Reuse& reuse : reuses_) {
+			const Reuse* p = &reuse;
+			pool->Submit([this, p, &reuseFailed] {
+				const PathString& base = baseDirs_[p->baseDir];
+				size_t relLen = p->to.len - p->relative;
+				PathString from;
+				from.reserve(base.size() + 1 + relLen);
+				from.append(base);
+				from.push_back(PATH_SEP);
+				from.append(p->to.str + p->relative, relLen);
+				if (!LinkFile(from.c_str(), p->to.c_str())
+						&& !CopyEngine().CopyWholeFile(from.c_str(), p->to.c_str()))
+					reuseFailed = true;
+			}, &group);
+		}
+
+		written_ = jobs_.size();
+		bool extracted = RunExtractJobs(jobs_, pool, io);
+		pool->Wait(&group);
+		if (reuseFailed)
+			return Fail("failed to take over unchanged files from "
+				+ PathToUtf8(base_));
+
+		if (!extracted) {
+			for (const std::unique_ptr<ZipArchive>& zip : archives_) {
+				if (!zip->Error().empty())
+					return Fail(zip->Error());
+			}
+			return Fail("extraction failed");
+		}
+
+		if (!manifest_.Save(ManifestPath(root_).c_str()))
+			return Fail("failed to write " + PathToUtf8(ManifestPath(root_)));
+		return true;
+	}
+
+	// True when the base held a manifest, i.e. only changes are written.
+	bool IsIncremental() const {
+		return hasInstalled_;
+	}
+
+	// What the previous install recorded, empty without a manifest.
+	const InstallManifest& Installed() const {
+		return installed_;
+	}
+
+	size_t Unchanged() const {
+		return unchanged_;
+	}
+
+	size_t Written() const {
+		return written_;
+	}
+
+	uint64_t WrittenBytes() const {
+		return writtenBytes_;
+	}
+
+	const std::string& Error() const {
+		return error_;
+	}
+
+private:
+	// An unchanged file: |to| in the new root, the same relative path
+	// below baseDirs_[baseDir] in the installed one.
+	struct Reuse {
+		ArenaPath to;
+		size_t relative;
+		size_t baseDir;
+	};
+
+	bool Fail(const std::string& message) {
+		if (error_.empty())
+			error_ = message;
+		return false;
+	}
+
+	// The manifest record of a file that can be taken over: the manifest
+	// has it with the same size and CRC, and the copy at |path| still has
+	// that size and modification time, so it was not touched since.
+	const InstalledFile* FindInstalled(const std::string& key, const ZipEntry& entry,
+			const PathString& path) const {
+		const InstalledFile* file = installed_.Find(key);
+		if (!file || file->size != entry.size || file->crc != entry.crc
+				|| file->modified == 0)
+			return NULL;
+
+		uint64_t size = 0, modified = 0;
+		if (!QueryFileInfo(path.c_str(), &size, &modified)
+				|| size != file->size || modified != file->modified)
+			return NULL;
+		return file;
+	}
+
+	PathString root_;
+	PathString base_;
+	InstallManifest installed_;
+	InstallManifest manifest_;
+	bool loaded_ = false;
+	bool hasInstalled_ = false;
+	std::vector<std::unique_ptr<ZipArchive>> archives_;
+	std::vector<ZipExtractJob> jobs_;
+	std::vector<PathString> baseDirs_;
+	std::vector<Reuse> reuses_;
+	size_t unchanged_ = 0;
+	size_t written_ = 0;
+	uint64_t writtenBytes_ = 0;
+	std::string error_;
+};
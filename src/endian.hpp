@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+
+// Unaligned fixed-width integer access for the on-disk formats.
+
+inline uint16_t GetLe16(const uint8_t* p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+inline uint32_t GetLe32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline uint64_t GetLe64(const uint8_t* p) {
+	return GetLe32(p) | ((uint64_t)GetLe32(p + 4) << 32);
+}
+
+inline uint32_t GetBe32(const uint8_t* p) {
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+inline void PutLe16(std::string* out, uint16_t v) {
+	out->push_back((char)(v & 0xff));
+	out->push_back((char)(v >> 8));
+}
+
+inline void PutLe32(std::string* out, uint32_t v) {
+	PutLe16(out, (uint16_t)(v & 0xffff));
+	PutLe16(out, (uint16_t)(v >> 16));
+}
+
+inline void PutLe64(std::string* out, uint64_t v) {
+	PutLe32(out, (uint32_t)(v & 0xffffffff));
+	PutLe32(out, (uint32_t)(v >> 32));
+}
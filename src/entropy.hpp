@@ -0,0 +1,249 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+#include "endian.hpp"
+
+// Order-0 Huffman coding of a byte string, the entropy stage of the block
+// codec. Codes are canonical and at most MAX_BITS long, so one table
+// lookup decodes a symbol:
+//
+//   count[4]                 symbols in the string
+//   lengths[128]             code length of each byte value, 4 bits each,
+//                            low nibble first; absent when count is 0
+//   bits_size[4] bits        the codes, least significant bit first
+//
+// Integers are little-endian.
+
+class ByteHuffman {
+public:
+	static const int MAX_BITS = 12;
+
+	static void Encode(const uint8_t* data, size_t size, std::string* out) {
+		PutLe32(out, (uint32_t)size);
+		if (size == 0)
+			return;
+
+		uint64_t freq[256] = {};
+		for (size_t i = 0; i < size; ++i)
+			++freq[data[i]];
+		uint8_t lengths[256];
+		BuildLengths(freq, lengths);
+		for (int i = 0; i < 256; i += 2)
+			out->push_back((char)(lengths[i] | (lengths[i + 1] << 4)));
+
+		uint16_t codes[256];
+		AssignCodes(lengths, codes);
+
+		size_t sizeAt = out->size();
+		PutLe32(out, 0);
+		size_t begin = out->size();
+		uint64_t bits = 0;
+		int count = 0;
+		for (size_t i = 0; i < size; ++i) {
+			bits |= (uint64_t)codes[data[i]] << count;
+			count += lengths[data[i]];
+			if (count >= 32) {
+				PutLe32(out, (uint32_t)bits);
+				bits >>= 32;
+				count -= 32;
+			}
+		}
+		for (; count > 0; count -= 8, bits >>= 8)
+			out->push_back((char)(bits & 0xff));
+
+		uint32_t bitsSize = (uint32_t)(out->size() - begin);
+		for (int i = 0; i < 4; ++i)
+			(*out)[sizeAt + i] = (char)(bitsSize >> (i * 8));
+	}
+
+	// Reads the symbol count at |*ip| without decoding.
+	static bool PeekCount(const uint8_t* ip, const uint8_t* end, size_t* count) {
+		if (end - ip < 4)
+			return false;
+		*count = GetLe32(ip);
+		return true;
+	}
+
+	// Decodes the string at |*ip| into |out|, which holds PeekCount()
+	// bytes, and moves |*ip| past it. Damaged input fails instead of
+	// reading outside |end|.
+	static bool Decode(const uint8_t** ip, const uint8_t* end, uint8_t* out) {
+		const uint8_t* p = *ip;
+		size_t count;
+		if (!PeekCount(p, end, &count))
+			return false;
+		p += 4;
+		if (count == 0) {
+			*ip = p;
+			return true;
+		}
+		if (end - p < 128 + 4)
+			return false;
+
+		uint8_t lengths[256];
+		for (int i = 0; i < 256; i += 2) {
+			lengths[i] = p[i / 2] & 15;
+			lengths[i + 1] = p[i / 2] >> 4;
+		}
+		p += 128;
+		size_t size = GetLe32(p);
+		p += 4;
+		if (size > (size_t)(end - p))
+			return false;
+
+		std::vector<uint16_t> table;
+		if (!BuildTable(lengths, &table))
+			return false;
+
+		// bytes past the end read as zeros; the final check catches codes
+		// that needed them
+		const uint8_t* src = p;
+		size_t pos = 0;
+		uint64_t bits = 0;
+		int avail = 0;
+		const uint64_t mask = ((uint64_t)1 << MAX_BITS) - 1;
+		for (size_t i = 0; i < count; ++i) {
+			if (avail < MAX_BITS) {
+				if (pos + 8 <= size) {
+					uint64_t word;
+					memcpy(&word, src + pos, sizeof(word));
+					bits |= LittleEndian(word) << avail;
+					pos += (63 - avail) >> 3;
+					avail |= 56;
+				}
+				else {
+					for (; avail <= 56; avail += 8, ++pos)
+						bits |= (uint64_t)(pos < size ? src[pos] : 0) << avail;
+				}
+			}
+			uint16_t entry = table[bits & mask];
+			if (!entry)
+				return false;
+			int len = entry & 15;
+			out[i] = (uint8_t)(entry >> 4);
+			bits >>= len;
+			avail -= len;
+		}
+		if (pos * 8 - avail > size * 8)
+			return false;
+
+		*ip = p + size;
+		return true;
+	}
+
+private:
+	static uint64_t LittleEndian(uint64_t word) {
+		const uint8_t* b = (const uint8_t*)&word;
+		return GetLe64(b);
+	}
+
+	// Huffman code lengths; while the tree is deeper than MAX_BITS, the
+	// counts are halved, which flattens it.
+	static void BuildLengths(const uint64_t* freq, uint8_t* lengths) {
+		std::vector<uint64_t> counts(freq, freq + 256);
+		memset(lengths, 0, 256);
+		for (;;) {
+			typedef std::pair<uint64_t, int> Node;
+			std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+			std::vector<int> parent(512, -1);
+			for (int i = 0; i < 256; ++i) {
+				if (counts[i])
+					queue.push(Node(counts[i], i));
+			}
+			if (queue.size() == 1) {
+				lengths[queue.top().second] = 1;
+				return;
+			}
+
+			int next = 256;
+			while (queue.size() > 1) {
+				Node a = queue.top();
+				queue.pop();
+				Node b = queue.top();
+				queue.pop();
+				parent[a.second] = next;
+				parent[b.second] = next;
+				queue.push(Node(a.first + b.first, next++));
+			}
+
+			int deepest = 0;
+			for (int i = 0; i < 256; ++i) {
+				int depth = 0;
+				for (int n = i; parent[n] >= 0; n = parent[n])
+					++depth;
+				lengths[i] = (uint8_t)depth;
+				deepest = std::max(deepest, depth);
+			}
+			if (deepest <= MAX_BITS)
+				return;
+			for (uint64_t& c : counts)
+				c = c ? (c >> 1) | 1 : 0;
+		}
+	}
+
+	// Canonical codes, bit-reversed so they go out least significant bit
+	// first.
+	static void AssignCodes(const uint8_t* lengths, uint16_t* codes) {
+		int sizes[MAX_BITS + 1] = {};
+		for (int i = 0; i < 256; ++i)
+			++sizes[lengths[i]];
+		sizes[0] = 0;
+
+		int nextCode[MAX_BITS + 1];
+		int code = 0;
+		for (int len = 1; len <= MAX_BITS; ++len) {
+			code = (code + sizes[len - 1]) << 1;
+			nextCode[len] = code;
+		}
+		for (int i = 0; i < 256; ++i) {
+			int len = lengths[i];
+			codes[i] = len ? Reverse(nextCode[len]++, len) : 0;
+		}
+	}
+
+	// Entries are symbol << 4 | length, 0 where no code matches.
+	static bool BuildTable(const uint8_t* lengths, std::vector<uint16_t>* table) {
+		int sizes[MAX_BITS + 1] = {};
+		for (int i = 0; i < 256; ++i) {
+			if (lengths[i] > MAX_BITS)
+				return false;
+			++sizes[lengths[i]];
+		}
+		sizes[0] = 0;
+		// an oversubscribed set of lengths is no prefix code
+		int64_t left = 1;
+		for (int len = 1; len <= MAX_BITS; ++len) {
+			left = (left << 1) - sizes[len];
+			if (left < 0)
+				return false;
+		}
+
+		uint16_t codes[256];
+		AssignCodes(lengths, codes);
+		table->assign((size_t)1 << MAX_BITS, 0);
+		for (int i = 0; i < 256; ++i) {
+			int len = lengths[i];
+			if (!len)
+				continue;
+			uint16_t entry = (uint16_t)((i << 4) | len);
+			for (size_t j = codes[i]; j < table->size(); j += (size_t)1 << len)
+				(*table)[j] = entry;
+		}
+		return true;
+	}
+
+	static uint16_t Reverse(int code, int len) {
+		int r = 0;
+		for (int i = 0; i < len; ++i) {
+			r = (r << 1) | (code & 1);
+			code >>= 1;
+		}
+		return (uint16_t)r;
+	}
+};
@@ -0,0 +1,800 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <winioctl.h>
+// from the Windows 10 SDK, for older headers
+#ifndef FSCTL_DUPLICATE_EXTENTS_TO_FILE
+#define FSCTL_DUPLICATE_EXTENTS_TO_FILE \
+	CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 209, METHOD_BUFFERED, FILE_WRITE_DATA)
+#endif
+#ifndef FSCTL_GET_INTEGRITY_INFORMATION
+#define FSCTL_GET_INTEGRITY_INFORMATION \
+	CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 159, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#endif
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <linux/falloc.h>
+#include <sys/ioctl.h>
+// from <linux/fs.h>, which also defines macros like BLOCK_SIZE
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Minimal file primitives shared by the portable extraction code.
+// Paths are wide on Windows and UTF-8 elsewhere.
+
+#ifdef _WIN32
+typedef wchar_t PathChar;
+#define PATH_SEP L'\\'
+#else
+typedef char PathChar;
+#define PATH_SEP '/'
+#endif
+
+typedef std::basic_string<PathChar> PathString;
+
+inline bool IsPathSep(PathChar c) {
+	return c == '/' || c == '\\';
+}
+
+inline PathString Utf8ToPath(const char* str, size_t len, bool utf8 = true) {
+#ifdef _WIN32
+	UINT codePage = utf8 ? CP_UTF8 : CP_OEMCP;
+	int wlen = MultiByteToWideChar(codePage, 0, str, (int)len, NULL, 0);
+	PathString result(wlen, L'\0');
+	if (wlen > 0)
+		MultiByteToWideChar(codePage, 0, str, (int)len, &result[0], wlen);
+	return result;
+#else
+	(void)utf8;
+	return PathString(str, len);
+#endif
+}
+
+// Windows paths of MAX_PATH characters and more only work with the "\\?\"
+// prefix, which also turns off '/' parsing. Elsewhere this is a no-op.
+inline PathString LongPath(const PathString& path) {
+#ifdef _WIN32
+	if (path.compare(0, 4, L"\\\\?\\") == 0)
+		return path;
+
+	PathString result;
+	if (path.size() > 2 && IsPathSep(path[0]) && IsPathSep(path[1]))
+		result = L"\\\\?\\UNC" + path.substr(1);
+	else if (path.size() > 2 && path[1] == L':' && IsPathSep(path[2]))
+		result = L"\\\\?\\" + path;
+	else
+		return path;
+
+	for (wchar_t& c : result) {
+		if (c == L'/')
+			c = L'\\';
+	}
+	return result;
+#else
+	return path;
+#endif
+}
+
+inline std::string PathToUtf8(const PathChar* path, size_t size) {
+#ifdef _WIN32
+	int len = WideCharToMultiByte(CP_UTF8, 0, path, (int)size, NULL, 0, NULL, NULL);
+	std::string result(len, '\0');
+	if (len > 0)
+		WideCharToMultiByte(CP_UTF8, 0, path, (int)size, &result[0], len, NULL, NULL);
+	return result;
+#else
+	return std::string(path, size);
+#endif
+}
+
+inline std::string PathToUtf8(const PathString& path) {
+	return PathToUtf8(path.data(), path.size());
+}
+
+class File {
+public:
+	File() {}
+	~File() { Close(); }
+
+	File(const File&) = delete;
+	File& operator=(const File&) = delete;
+
+	// |sequential| hints the cache manager to read ahead aggressively.
+	bool OpenRead(const PathChar* path, bool sequential = false) {
+		Close();
+#ifdef _WIN32
+		DWORD flags = FILE_ATTRIBUTE_NORMAL
+			| (sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0);
+		handle_ = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, flags, NULL);
+#else
+		fd_ = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd_ >= 0 && sequential)
+			posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		return IsOpen();
+	}
+
+	// |sequential| tells the cache manager the file is written front to
+	// back and not read again soon. An |overlapped| file is written only
+	// through an IoQueue (Windows, no effect elsewhere).
+	bool Create(const PathChar* path, bool sequential = false, bool overlapped = false) {
+		Close();
+#ifdef _WIN32
+		DWORD flags = FILE_ATTRIBUTE_NORMAL
+			| (sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0)
+			| (overlapped ? FILE_FLAG_OVERLAPPED : 0);
+		handle_ = CreateFileW(path, GENERIC_WRITE, 0, NULL,
+			CREATE_ALWAYS, flags, NULL);
+#else
+		(void)overlapped;
+		fd_ = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd_ >= 0 && sequential)
+			posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		return IsOpen();
+	}
+
+	bool IsOpen() const {
+#ifdef _WIN32
+		return handle_ != INVALID_HANDLE_VALUE;
+#else
+		return fd_ >= 0;
+#endif
+	}
+
+	// Reads exactly |len| bytes, a short read is an error.
+	bool Read(void* buf, size_t len) {
+		char* p = (char*)buf;
+		while (len) {
+#ifdef _WIN32
+			DWORD chunk = (DWORD)(len < (1u << 30) ? len : (1u << 30));
+			DWORD done = 0;
+			if (!ReadFile(handle_, p, chunk, &done, NULL) || done == 0)
+				return false;
+#else
+			ssize_t done = read(fd_, p, len);
+			if (done < 0 && errno == EINTR)
+				continue;
+			if (done <= 0)
+				return false;
+#endif
+			p += done;
+			len -= done;
+		}
+		return true;
+	}
+
+	bool Write(const void* buf, size_t len) {
+		const char* p = (const char*)buf;
+		while (len) {
+#ifdef _WIN32
+			DWORD chunk = (DWORD)(len < (1u << 30) ? len : (1u << 30));
+			DWORD done = 0;
+			if (!WriteFile(handle_, p, chunk, &done, NULL) || done == 0)
+				return false;
+#else
+			ssize_t done = write(fd_, p, len);
+			if (done < 0 && errno == EINTR)
+				continue;
+			if (done <= 0)
+				return false;
+#endif
+			p += done;
+			len -= done;
+		}
+		return true;
+	}
+
+	bool Seek(uint64_t pos) {
+#ifdef _WIN32
+		LARGE_INTEGER li;
+		li.QuadPart = (LONGLONG)pos;
+		return SetFilePointerEx(handle_, li, NULL, FILE_BEGIN) != FALSE;
+#else
+		return lseek(fd_, (off_t)pos, SEEK_SET) == (off_t)pos;
+#endif
+	}
+
+	uint64_t Size() const {
+#ifdef _WIN32
+		LARGE_INTEGER li = {};
+		if (!GetFileSizeEx(handle_, &li))
+			return 0;
+		return (uint64_t)li.QuadPart;
+#else
+		struct stat st;
+		if (fstat(fd_, &st) != 0)
+			return 0;
+		return (uint64_t)st.st_size;
+#endif
+	}
+
+	// Reserves disk space for |size| bytes without changing the file size,
+	// so a following sequential write does not grow the file piecemeal.
+	bool Preallocate(uint64_t size) {
+#ifdef _WIN32
+		FILE_ALLOCATION_INFO info;
+		info.AllocationSize.QuadPart = (LONGLONG)size;
+		return SetFileInformationByHandle(
+			handle_, FileAllocationInfo, &info, sizeof(info)) != FALSE;
+#elif defined(__linux__)
+		return size == 0
+			|| fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, (off_t)size) == 0;
+#else
+		(void)size;
+		return true;
+#endif
+	}
+
+	// Sets the modification time from a ZIP-style MS-DOS date/time pair,
+	// interpreted as local time.
+	bool SetDosTime(uint16_t dosDate, uint16_t dosTime) {
+		uint64_t ticks = 0;
+		return DosTimeToTicks(dosDate, dosTime, &ticks) && SetModifiedTicks(ticks);
+	}
+
+	// The modification time in FileTicks().
+	bool SetModifiedTicks(uint64_t ticks) {
+#ifdef _WIN32
+		FILETIME utc;
+		utc.dwLowDateTime = (DWORD)ticks;
+		utc.dwHighDateTime = (DWORD)(ticks >> 32);
+		return SetFileTime(handle_, NULL, NULL, &utc) != FALSE;
+#else
+		struct timespec times[2];
+		times[0].tv_sec = 0;
+		times[0].tv_nsec = UTIME_OMIT;
+		times[1].tv_sec = (time_t)(ticks / 10000000);
+		times[1].tv_nsec = (long)(ticks % 10000000) * 100;
+		return futimens(fd_, times) == 0;
+#endif
+	}
+
+	// File times as 100 ns ticks since the platform's epoch, the unit of
+	// a Windows FILETIME. Only comparable on the same machine.
+	static bool DosTimeToTicks(uint16_t dosDate, uint16_t dosTime, uint64_t* ticks) {
+#ifdef _WIN32
+		FILETIME local, utc;
+		if (!DosDateTimeToFileTime(dosDate, dosTime, &local)
+				|| !LocalFileTimeToFileTime(&local, &utc))
+			return false;
+		*ticks = ((uint64_t)utc.dwHighDateTime << 32) | utc.dwLowDateTime;
+		return true;
+#else
+		struct tm tm = {};
+		tm.tm_year = ((dosDate >> 9) & 0x7f) + 80;
+		tm.tm_mon = ((dosDate >> 5) & 0x0f) - 1;
+		tm.tm_mday = dosDate & 0x1f;
+		tm.tm_hour = (dosTime >> 11) & 0x1f;
+		tm.tm_min = (dosTime >> 5) & 0x3f;
+		tm.tm_sec = (dosTime & 0x1f) * 2;
+		tm.tm_isdst = -1;
+		time_t t = mktime(&tm);
+		if (t < 0)
+			return false;
+		*ticks = (uint64_t)t * 10000000;
+		return true;
+#endif
+	}
+
+	// Gives this file the access and modification times of |other|.
+	bool CopyTimesFrom(const File& other) {
+#ifdef _WIN32
+		FILETIME created, accessed, written;
+		return GetFileTime(other.handle_, &created, &accessed, &written)
+			&& SetFileTime(handle_, &created, &accessed, &written);
+#else
+		struct stat st;
+		if (fstat(other.fd_, &st) != 0)
+			return false;
+		struct timespec times[2] = { st.st_atim, st.st_mtim };
+		return futimens(fd_, times) == 0;
+#endif
+	}
+
+	// Makes this file a copy-on-write clone of |other| where the file
+	// system supports it (btrfs, XFS, ReFS); false means copy the data
+	// instead.
+	bool CloneFrom(const File& other) {
+#ifdef _WIN32
+		// DUPLICATE_EXTENTS_DATA and FSCTL_GET_INTEGRITY_INFORMATION_BUFFER
+		struct DuplicateExtents {
+			HANDLE file;
+			LARGE_INTEGER sourceOffset;
+			LARGE_INTEGER targetOffset;
+			LARGE_INTEGER byteCount;
+		};
+		struct IntegrityInfo {
+			WORD checksumAlgorithm;
+			WORD reserved;
+			DWORD flags;
+			DWORD checksumChunkSize;
+			DWORD clusterSize;
+		};
+
+		// only ReFS answers this, and block cloning needs its cluster size
+		IntegrityInfo info = {};
+		DWORD bytes = 0;
+		if (!DeviceIoControl(other.handle_, FSCTL_GET_INTEGRITY_INFORMATION,
+				NULL, 0, &info, sizeof(info), &bytes, NULL) || info.clusterSize == 0)
+			return false;
+
+		BY_HANDLE_FILE_INFORMATION source;
+		if (!GetFileInformationByHandle(other.handle_, &source))
+			return false;
+		if ((source.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE)
+				&& !DeviceIoControl(handle_, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes, NULL))
+			return false;
+
+		// Ranges are whole clusters. With the end of file set first, the
+		// range may run past it, so the last partial cluster is cloned too.
+		uint64_t size = other.Size();
+		FILE_END_OF_FILE_INFO eof;
+		eof.EndOfFile.QuadPart = (LONGLONG)size;
+		if (!SetFileInformationByHandle(handle_, FileEndOfFileInfo, &eof, sizeof(eof)))
+			return false;
+
+		uint64_t cluster = info.clusterSize;
+		uint64_t end = (size + cluster - 1) / cluster * cluster;
+		// one call clones less than 4 GB
+		const uint64_t CHUNK = 1024 * 1024 * 1024;
+		for (uint64_t offset = 0; offset < end; offset += CHUNK) {
+			DuplicateExtents extents;
+			extents.file = other.handle_;
+			extents.sourceOffset.QuadPart = (LONGLONG)offset;
+			extents.targetOffset.QuadPart = (LONGLONG)offset;
+			extents.byteCount.QuadPart = (LONGLONG)(end - offset < CHUNK ? end - offset : CHUNK);
+			if (!DeviceIoControl(handle_, FSCTL_DUPLICATE_EXTENTS_TO_FILE,
+					&extents, sizeof(extents), NULL, 0, &bytes, NULL)) {
+				eof.EndOfFile.QuadPart = 0;
+				SetFileInformationByHandle(handle_, FileEndOfFileInfo, &eof, sizeof(eof));
+				return false;
+			}
+		}
+		return true;
+#elif defined(__linux__) && defined(FICLONE)
+		return ioctl(fd_, FICLONE, other.fd_) == 0;
+#else
+		(void)other;
+		return false;
+#endif
+	}
+
+#ifdef _WIN32
+	HANDLE Handle() const {
+		return handle_;
+	}
+#else
+	int Handle() const {
+		return fd_;
+	}
+#endif
+
+	void Close() {
+#ifdef _WIN32
+		if (handle_ != INVALID_HANDLE_VALUE) {
+			CloseHandle(handle_);
+			handle_ = INVALID_HANDLE_VALUE;
+		}
+#else
+		if (fd_ >= 0) {
+			close(fd_);
+			fd_ = -1;
+		}
+#endif
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE handle_ = INVALID_HANDLE_VALUE;
+#else
+	int fd_ = -1;
+#endif
+};
+
+// Read-only view of a whole file.
+class MappedFile {
+public:
+	MappedFile() {}
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const PathChar* path) {
+		Close();
+		File file;
+		if (!file.OpenRead(path))
+			return false;
+
+		uint64_t size = file.Size();
+		if (size == 0 || size != (size_t)size)
+			return false;
+		size_ = (size_t)size;
+
+#ifdef _WIN32
+		HANDLE mapping = CreateFileMappingW(
+			file.Handle(), NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mapping)
+			return false;
+		data_ = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+#else
+		void* p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, file.Handle(), 0);
+		data_ = (p == MAP_FAILED) ? NULL : (const uint8_t*)p;
+#endif
+		if (!data_)
+			size_ = 0;
+		return IsOpen();
+	}
+
+	bool IsOpen() const {
+		return data_ != NULL;
+	}
+
+	const uint8_t* Data() const {
+		return data_;
+	}
+
+	size_t Size() const {
+		return size_;
+	}
+
+	void Close() {
+		if (!data_)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(data_);
+#else
+		munmap((void*)data_, size_);
+#endif
+		data_ = NULL;
+		size_ = 0;
+	}
+
+private:
+	const uint8_t* data_ = NULL;
+	size_t size_ = 0;
+};
+
+inline int LastErrorCode() {
+#ifdef _WIN32
+	return (int)GetLastError();
+#else
+	return errno;
+#endif
+}
+
+inline bool IsDirExists(const PathChar* path) {
+#ifdef _WIN32
+	DWORD attr = GetFileAttributesW(path);
+	return attr != INVALID_FILE_ATTRIBUTES
+		&& (attr & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+inline bool QueryFileSize(const PathChar* path, uint64_t* size) {
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExW(path, GetFileExInfoStandard, &data)
+			|| (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return false;
+	*size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	return true;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+	*size = (uint64_t)st.st_size;
+	return true;
+#endif
+}
+
+// Size and modification time (see File::DosTimeToTicks) of a regular file.
+inline bool QueryFileInfo(const PathChar* path, uint64_t* size, uint64_t* modified) {
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExW(path, GetFileExInfoStandard, &data)
+			|| (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return false;
+	*size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	*modified = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32)
+		| data.ftLastWriteTime.dwLowDateTime;
+	return true;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+	*size = (uint64_t)st.st_size;
+	*modified = (uint64_t)st.st_mtim.tv_sec * 10000000 + st.st_mtim.tv_nsec / 100;
+	return true;
+#endif
+}
+
+inline bool RemoveFile(const PathChar* path) {
+#ifdef _WIN32
+	return DeleteFileW(path) != FALSE;
+#else
+	return unlink(path) == 0;
+#endif
+}
+
+// Fails, harmlessly, when the directory is not empty.
+inline bool RemoveEmptyDir(const PathChar* path) {
+#ifdef _WIN32
+	return RemoveDirectoryW(path) != FALSE;
+#else
+	return rmdir(path) == 0;
+#endif
+}
+
+inline bool RenamePath(const PathChar* from, const PathChar* to) {
+#ifdef _WIN32
+	return MoveFileExW(from, to, MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+
+// Makes |to| another name for the file |from|; both must be on one volume.
+inline bool LinkFile(const PathChar* from, const PathChar* to) {
+#ifdef _WIN32
+	return CreateHardLinkW(to, from, NULL) != FALSE;
+#else
+	return link(from, to) == 0;
+#endif
+}
+
+struct DirEntry {
+	PathString name;
+	bool isDir = false;
+	// symlink or junction, never followed by the tree helpers
+	bool isLink = false;
+	uint64_t size = 0;
+};
+
+// Lists |dir| without "." and "..".
+inline bool ListDir(const PathString& dir, std::vector<DirEntry>* entries) {
+#ifdef _WIN32
+	WIN32_FIND_DATAW data;
+	HANDLE find = FindFirstFileExW((dir + L"\\*").c_str(), FindExInfoBasic,
+		&data, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (find == INVALID_HANDLE_VALUE)
+		return false;
+
+	do {
+		if (wcscmp(data.cFileName, L".") == 0 || wcscmp(data.cFileName, L"..") == 0)
+			continue;
+		DirEntry entry;
+		entry.name = data.cFileName;
+		entry.isDir = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+		entry.isLink = (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+		entry.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		entries->push_back(entry);
+	} while (FindNextFileW(find, &data));
+
+	FindClose(find);
+	return true;
+#else
+	DIR* d = opendir(dir.c_str());
+	if (!d)
+		return false;
+
+	while (struct dirent* ent = readdir(d)) {
+		if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+			continue;
+		struct stat st;
+		if (fstatat(dirfd(d), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+			continue;
+		DirEntry entry;
+		entry.name = ent->d_name;
+		entry.isDir = S_ISDIR(st.st_mode);
+		entry.isLink = S_ISLNK(st.st_mode);
+		entry.size = (uint64_t)st.st_size;
+		entries->push_back(entry);
+	}
+
+	closedir(d);
+	return true;
+#endif
+}
+
+// Removes a symlink or junction itself, never what it points to.
+inline bool RemoveLink(const PathChar* path) {
+#ifdef _WIN32
+	DWORD attr = GetFileAttributesW(path);
+	if (attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY))
+		return RemoveDirectoryW(path) != FALSE;
+	return DeleteFileW(path) != FALSE;
+#else
+	return unlink(path) == 0;
+#endif
+}
+
+inline bool IsLink(const PathChar* path) {
+#ifdef _WIN32
+	DWORD attr = GetFileAttributesW(path);
+	return attr != INVALID_FILE_ATTRIBUTES
+		&& (attr & FILE_ATTRIBUTE_REPARSE_POINT);
+#else
+	struct stat st;
+	return lstat(path, &st) == 0 && S_ISLNK(st.st_mode);
+#endif
+}
+
+// Deletes |path| and everything below it, links are removed but not
+// followed. Missing paths count as removed.
+inline bool RemoveTree(const PathString& path) {
+	if (IsLink(path.c_str()))
+		return RemoveLink(path.c_str());
+	if (!IsDirExists(path.c_str())) {
+		uint64_t size = 0;
+		return !QueryFileSize(path.c_str(), &size) || RemoveFile(path.c_str());
+	}
+
+	std::vector<DirEntry> entries;
+	bool result = ListDir(path, &entries);
+	for (const DirEntry& entry : entries) {
+		PathString child = path + PATH_SEP + entry.name;
+		if (entry.isLink)
+			result = RemoveLink(child.c_str()) && result;
+		else if (entry.isDir)
+			result = RemoveTree(child) && result;
+		else
+			result = RemoveFile(child.c_str()) && result;
+	}
+	return RemoveEmptyDir(path.c_str()) && result;
+}
+
+// Makes |link| a directory link to the absolute path |target|: a junction
+// on Windows, which unlike a symlink needs no privilege, a symlink elsewhere.
+inline bool CreateDirLink(const PathString& link, const PathString& target) {
+#ifdef _WIN32
+	// REPARSE_DATA_BUFFER for IO_REPARSE_TAG_MOUNT_POINT, which only the
+	// DDK headers declare
+	struct MountPointBuffer {
+		DWORD tag;
+		WORD dataLength;
+		WORD reserved;
+		WORD substituteOffset;
+		WORD substituteLength;
+		WORD printOffset;
+		WORD printLength;
+	};
+
+	std::wstring substitute = L"\\??\\" + target;
+	size_t substituteBytes = substitute.size() * sizeof(WCHAR);
+	size_t printBytes = target.size() * sizeof(WCHAR);
+	size_t pathBytes = substituteBytes + printBytes + 2 * sizeof(WCHAR);
+	std::vector<uint8_t> buf(sizeof(MountPointBuffer) + pathBytes);
+	if (buf.size() > MAXIMUM_REPARSE_DATA_BUFFER_SIZE)
+		return false;
+
+	MountPointBuffer* header = (MountPointBuffer*)&buf[0];
+	header->tag = IO_REPARSE_TAG_MOUNT_POINT;
+	header->dataLength = (WORD)(buf.size() - 8);
+	header->substituteOffset = 0;
+	header->substituteLength = (WORD)substituteBytes;
+	header->printOffset = (WORD)(substituteBytes + sizeof(WCHAR));
+	header->printLength = (WORD)printBytes;
+	uint8_t* names = &buf[sizeof(MountPointBuffer)];
+	memcpy(names, substitute.c_str(), substituteBytes);
+	memcpy(names + header->printOffset, target.c_str(), printBytes);
+
+	if (!CreateDirectoryW(link.c_str(), NULL))
+		return false;
+
+	HANDLE handle = CreateFileW(link.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT, NULL);
+	DWORD bytes = 0;
+	bool result = handle != INVALID_HANDLE_VALUE
+		&& DeviceIoControl(handle, FSCTL_SET_REPARSE_POINT, &buf[0],
+			(DWORD)buf.size(), NULL, 0, &bytes, NULL);
+	if (handle != INVALID_HANDLE_VALUE)
+		CloseHandle(handle);
+	if (!result)
+		RemoveDirectoryW(link.c_str());
+	return result;
+#else
+	return symlink(target.c_str(), link.c_str()) == 0;
+#endif
+}
+
+// Creates |path| and all missing parents.
+inline bool MakeDirs(const PathString& path) {
+	if (path.empty())
+		return false;
+	if (IsDirExists(path.c_str()))
+		return true;
+
+	PathString prefix;
+	prefix.reserve(path.size());
+	for (size_t i = 0; i <= path.size(); ++i) {
+		if (i == path.size() || IsPathSep(path[i])) {
+			// skips drives and the "\\?\" long path prefix
+			bool isRoot = prefix.empty()
+				|| prefix.back() == ':' || prefix.back() == '?'
+				|| IsDirExists(prefix.c_str());
+			if (!isRoot) {
+#ifdef _WIN32
+				CreateDirectoryW(prefix.c_str(), NULL);
+#else
+				mkdir(prefix.c_str(), 0755);
+#endif
+			}
+		}
+		if (i < path.size())
+			prefix.push_back(IsPathSep(path[i]) ? PATH_SEP : path[i]);
+	}
+
+	return IsDirExists(path.c_str());
+}
+
+// Files below this size are written in one call, reserving space first
+// would only add a syscall.
+const uint64_t PREALLOCATE_MIN_SIZE = 64 * 1024;
+
+// Writes a file produced by extraction: created with the sequential hint,
+// preallocated when big enough, stamped with its archive time.
+inline bool WriteExtractedFile(const PathChar* path, const uint8_t* data, size_t size,
+		uint16_t dosDate, uint16_t dosTime) {
+	File file;
+	if (!file.Create(path, true))
+		return false;
+	if (size >= PREALLOCATE_MIN_SIZE)
+		file.Preallocate(size);
+	if (!file.Write(data, size))
+		return false;
+	file.SetDosTime(dosDate, dosTime);
+	return true;
+}
+
+// Applies the mode recorded in an archive to an extracted file. Windows
+// has no executable bit, there only the read-only attribute is set.
+inline bool SetFileMode(const PathChar* path, bool readOnly, bool executable) {
+#ifdef _WIN32
+	(void)executable;
+	DWORD attr = GetFileAttributesW(path);
+	if (attr == INVALID_FILE_ATTRIBUTES)
+		return false;
+	return !readOnly || SetFileAttributesW(path, attr | FILE_ATTRIBUTE_READONLY);
+#else
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return false;
+	mode_t mode = st.st_mode & 07777;
+	if (executable)
+		mode |= (mode & 0444) >> 2;
+	if (readOnly)
+		mode &= ~(mode_t)0222;
+	return chmod(path, mode) == 0;
+#endif
+}
+
+inline bool ReadWholeFile(const PathChar* path, std::vector<uint8_t>* data) {
+	File file;
+	if (!file.OpenRead(path))
+		return false;
+
+	data->resize((size_t)file.Size());
+	return data->empty() || file.Read(&(*data)[0], data->size());
+}
@@ -0,0 +1,373 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+// Raw DEFLATE (RFC 1951) decoder and CRC-32, enough for ZIP entries whose
+// uncompressed size is known up front.
+
+class Crc32 {
+public:
+	static uint32_t Update(uint32_t crc, const void* data, size_t len) {
+		const uint32_t (*t)[256] = Tables();
+		const uint8_t* p = (const uint8_t*)data;
+		crc = ~crc;
+
+		// slice-by-8
+		while (len >= 8) {
+			uint32_t lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+			uint32_t hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+			crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff]
+				^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+				^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff]
+				^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+			p += 8;
+			len -= 8;
+		}
+
+		while (len--)
+			crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+		return ~crc;
+	}
+
+private:
+	static const uint32_t (*Tables())[256] {
+		static const struct Init {
+			uint32_t t[8][256];
+			Init() {
+				for (uint32_t i = 0; i < 256; ++i) {
+					uint32_t c = i;
+					for (int k = 0; k < 8; ++k)
+						c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+					t[0][i] = c;
+				}
+				for (uint32_t i = 0; i < 256; ++i)
+					for (int s = 1; s < 8; ++s)
+						t[s][i] = t[0][t[s - 1][i] & 0xff] ^ (t[s - 1][i] >> 8);
+			}
+		} init;
+		return init.t;
+	}
+};
+
+class Inflater {
+	static const int FAST_BITS = 9;
+
+	struct Huffman {
+		uint16_t fast[1 << FAST_BITS];
+		uint16_t firstCode[16];
+		int maxCode[17];
+		uint16_t firstSymbol[16];
+		uint8_t size[288];
+		uint16_t value[288];
+	};
+
+public:
+	// Decodes |src| into |dst|, which must be exactly the uncompressed size.
+	bool Inflate(const uint8_t* src, size_t srcLen, uint8_t* dst, size_t dstLen) {
+		src_ = src;
+		srcLen_ = srcLen;
+		srcPos_ = 0;
+		padding_ = 0;
+		bits_ = 0;
+		bitCount_ = 0;
+		dst_ = dst;
+		dstLen_ = dstLen;
+		dstPos_ = 0;
+
+		bool last = false;
+		while (!last) {
+			last = GetBits(1) != 0;
+			int type = (int)GetBits(2);
+			bool ok = false;
+			if (type == 0)
+				ok = StoredBlock();
+			else if (type == 1)
+				ok = FixedTables() && CodesBlock();
+			else if (type == 2)
+				ok = DynamicTables() && CodesBlock();
+
+			if (!ok || padding_ > sizeof(bits_))
+				return false;
+		}
+
+		return dstPos_ == dstLen_;
+	}
+
+private:
+	void Refill() {
+		while (bitCount_ <= 56) {
+			uint64_t byte = 0;
+			if (srcPos_ < srcLen_)
+				byte = src_[srcPos_++];
+			else
+				++padding_;
+			bits_ |= byte << bitCount_;
+			bitCount_ += 8;
+		}
+	}
+
+	uint32_t GetBits(int n) {
+		if (bitCount_ < n)
+			Refill();
+		uint32_t v = (uint32_t)(bits_ & ((1ull << n) - 1));
+		bits_ >>= n;
+		bitCount_ -= n;
+		return v;
+	}
+
+	static int BitReverse(int v, int bits) {
+		int r = 0;
+		for (int i = 0; i < bits; ++i) {
+			r = (r << 1) | (v & 1);
+			v >>= 1;
+		}
+		return r;
+	}
+
+	static bool BuildHuffman(Huffman* h, const uint8_t* lengths, int num) {
+		int sizes[17] = {};
+		int nextCode[16];
+		memset(h->fast, 0, sizeof(h->fast));
+		memset(h->size, 0, sizeof(h->size));
+
+		for (int i = 0; i < num; ++i)
+			++sizes[lengths[i]];
+		sizes[0] = 0;
+		for (int i = 1; i < 16; ++i) {
+			if (sizes[i] > (1 << i))
+				return false;
+		}
+
+		int code = 0, k = 0;
+		for (int i = 1; i < 16; ++i) {
+			nextCode[i] = code;
+			h->firstCode[i] = (uint16_t)code;
+			h->firstSymbol[i] = (uint16_t)k;
+			code += sizes[i];
+			if (sizes[i] && code - 1 >= (1 << i))
+				return false;
+			h->maxCode[i] = code << (16 - i);
+			code <<= 1;
+			k += sizes[i];
+		}
+		h->maxCode[16] = 0x10000;
+
+		for (int i = 0; i < num; ++i) {
+			int s = lengths[i];
+			if (!s)
+				continue;
+			int c = nextCode[s] - h->firstCode[s] + h->firstSymbol[s];
+			h->size[c] = (uint8_t)s;
+			h->value[c] = (uint16_t)i;
+			if (s <= FAST_BITS) {
+				uint16_t entry = (uint16_t)((s << 9) | i);
+				for (int j = BitReverse(nextCode[s], s); j < (1 << FAST_BITS); j += (1 << s))
+					h->fast[j] = entry;
+			}
+			++nextCode[s];
+		}
+		return true;
+	}
+
+	int Decode(const Huffman& h) {
+		if (bitCount_ < 16)
+			Refill();
+
+		uint16_t entry = h.fast[bits_ & ((1 << FAST_BITS) - 1)];
+		if (entry) {
+			int s = entry >> 9;
+			bits_ >>= s;
+			bitCount_ -= s;
+			return entry & 511;
+		}
+
+		int k = BitReverse((int)(bits_ & 0xffff), 16);
+		int s = FAST_BITS + 1;
+		while (k >= h.maxCode[s])
+			++s;
+		if (s >= 16)
+			return -1;
+
+		int b = (k >> (16 - s)) - h.firstCode[s] + h.firstSymbol[s];
+		if (b >= 288 || h.size[b] != s)
+			return -1;
+
+		bits_ >>= s;
+		bitCount_ -= s;
+		return h.value[b];
+	}
+
+	bool StoredBlock() {
+		// Drop to a byte boundary and hand back the whole bytes still
+		// buffered so the block can be copied straight from the input.
+		GetBits(bitCount_ & 7);
+		size_t unread = bitCount_ / 8;
+		size_t fromPadding = unread < padding_ ? unread : padding_;
+		padding_ -= fromPadding;
+		srcPos_ -= unread - fromPadding;
+		bits_ = 0;
+		bitCount_ = 0;
+
+		if (srcLen_ - srcPos_ < 4)
+			return false;
+		const uint8_t* p = src_ + srcPos_;
+		size_t len = p[0] | (p[1] << 8);
+		size_t nlen = p[2] | (p[3] << 8);
+		srcPos_ += 4;
+		if (len != (~nlen & 0xffff))
+			return false;
+		if (srcLen_ - srcPos_ < len || dstLen_ - dstPos_ < len)
+			return false;
+
+		memcpy(dst_ + dstPos_, src_ + srcPos_, len);
+		srcPos_ += len;
+		dstPos_ += len;
+		return true;
+	}
+
+	bool FixedTables() {
+		uint8_t lengths[288 + 30];
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 256 - 144);
+		memset(lengths + 256, 7, 280 - 256);
+		memset(lengths + 280, 8, 288 - 280);
+		memset(lengths + 288, 5, 30);
+		return BuildHuffman(&lit_, lengths, 288)
+			&& BuildHuffman(&dist_, lengths + 288, 30);
+	}
+
+	bool DynamicTables() {
+		static const uint8_t order[19] = {
+			16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+		};
+
+		int hlit = (int)GetBits(5) + 257;
+		int hdist = (int)GetBits(5) + 1;
+		int hclen = (int)GetBits(4) + 4;
+		if (hlit > 286 || hdist > 30)
+			return false;
+
+		uint8_t codeLengths[19] = {};
+		for (int i = 0; i < hclen; ++i)
+			codeLengths[order[i]] = (uint8_t)GetBits(3);
+
+		Huffman lenCodes;
+		if (!BuildHuffman(&lenCodes, codeLengths, 19))
+			return false;
+
+		uint8_t lengths[286 + 30];
+		int n = 0;
+		while (n < hlit + hdist) {
+			int sym = Decode(lenCodes);
+			if (sym < 0 || sym > 18)
+				return false;
+
+			if (sym < 16) {
+				lengths[n++] = (uint8_t)sym;
+				continue;
+			}
+
+			uint8_t fill = 0;
+			int repeat;
+			if (sym == 16) {
+				if (n == 0)
+					return false;
+				fill = lengths[n - 1];
+				repeat = 3 + (int)GetBits(2);
+			}
+			else if (sym == 17)
+				repeat = 3 + (int)GetBits(3);
+			else
+				repeat = 11 + (int)GetBits(7);
+
+			if (n + repeat > hlit + hdist)
+				return false;
+			memset(lengths + n, fill, repeat);
+			n += repeat;
+		}
+
+		if (lengths[256] == 0)
+			return false;
+
+		return BuildHuffman(&lit_, lengths, hlit)
+			&& BuildHuffman(&dist_, lengths + hlit, hdist);
+	}
+
+	bool CodesBlock() {
+		static const uint16_t lenBase[29] = {
+			3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+			35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+		};
+		static const uint8_t lenExtra[29] = {
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+			3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+		};
+		static const uint16_t distBase[30] = {
+			1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+			257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+			8193, 12289, 16385, 24577
+		};
+		static const uint8_t distExtra[30] = {
+			0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+			7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+		};
+
+		for (;;) {
+			int sym = Decode(lit_);
+			if (sym < 0)
+				return false;
+
+			if (sym < 256) {
+				if (dstPos_ >= dstLen_)
+					return false;
+				dst_[dstPos_++] = (uint8_t)sym;
+				continue;
+			}
+
+			if (sym == 256)
+				return true;
+
+			sym -= 257;
+			if (sym >= 29)
+				return false;
+			size_t len = lenBase[sym] + GetBits(lenExtra[sym]);
+
+			int dsym = Decode(dist_);
+			if (dsym < 0 || dsym >= 30)
+				return false;
+			size_t dist = distBase[dsym] + GetBits(distExtra[dsym]);
+
+			if (dist > dstPos_ || len > dstLen_ - dstPos_)
+				return false;
+
+			uint8_t* out = dst_ + dstPos_;
+			const uint8_t* from = out - dist;
+			dstPos_ += len;
+			if (dist == 1) {
+				memset(out, *from, len);
+			}
+			else if (dist >= len) {
+				memcpy(out, from, len);
+			}
+			else {
+				while (len--)
+					*out++ = *from++;
+			}
+		}
+	}
+
+	const uint8_t* src_ = NULL;
+	size_t srcLen_ = 0;
+	size_t srcPos_ = 0;
+	size_t padding_ = 0;
+	uint64_t bits_ = 0;
+	int bitCount_ = 0;
+
+	uint8_t* dst_ = NULL;
+	size_t dstLen_ = 0;
+	size_t dstPos_ = 0;
+
+	Huffman lit_;
+	Huffman dist_;
+};
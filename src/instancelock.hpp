@@ -0,0 +1,174 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include "fileio.hpp"
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/file.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#endif
+
+// Lets one instance of the installer run at a time. On Windows it is a
+// named mutex: a waiter wakes the moment the holder releases it or exits,
+// an abandoned mutex counts as acquired. Elsewhere it is an flock() on a
+// lock file with the same semantics. On Linux a waiter sleeps on inotify
+// until the holder touches the file as it releases it, or closes it as
+// it exits; other systems retry every few milliseconds.
+//
+// The handle is kept for the lifetime of the lock, so the process holds
+// the lock until Release() or destruction.
+class InstanceLock {
+public:
+	// Polling period where the lock file cannot be watched.
+	static const uint32_t RETRY_MS = 5;
+
+	// |name| is the mutex name on Windows and the lock file path elsewhere.
+	explicit InstanceLock(const PathString& name) : name_(name) {}
+
+	InstanceLock(const InstanceLock&) = delete;
+	InstanceLock& operator=(const InstanceLock&) = delete;
+
+	~InstanceLock() {
+		Release();
+#ifdef _WIN32
+		if (handle_)
+			CloseHandle(handle_);
+#else
+		if (fd_ >= 0)
+			close(fd_);
+		// closing an inotify descriptor waits for a grace period of the
+		// kernel, milliseconds, so it is kept until here
+		if (watch_ >= 0)
+			close(watch_);
+#endif
+	}
+
+	bool TryAcquire() {
+		return Acquire(0);
+	}
+
+	// False when another instance still holds the lock after |timeoutMs|,
+	// or when the lock cannot be opened; Error() tells which.
+	bool Acquire(uint32_t timeoutMs) {
+		if (held_)
+			return true;
+		if (!Open())
+			return false;
+
+#ifdef _WIN32
+		DWORD result = WaitForSingleObject(handle_, timeoutMs);
+		held_ = result == WAIT_OBJECT_0 || result == WAIT_ABANDONED;
+		if (!held_ && result != WAIT_TIMEOUT)
+			return Fail("failed to wait for the instance lock");
+#else
+		// watched before the first try, so a release in between still wakes
+		bool watched = timeoutMs && WatchLockFile();
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (;;) {
+			if (flock(fd_, LOCK_EX | LOCK_NB) == 0) {
+				held_ = true;
+				break;
+			}
+			if (errno != EWOULDBLOCK && errno != EINTR)
+				return Fail("failed to lock " + PathToUtf8(name_));
+
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			int64_t elapsed = (now.tv_sec - start.tv_sec) * 1000
+				+ (now.tv_nsec - start.tv_nsec) / 1000000;
+			if (elapsed >= timeoutMs)
+				break;
+			if (!watched) {
+				usleep(RETRY_MS * 1000);
+				continue;
+			}
+
+			struct pollfd event = { watch_, POLLIN, 0 };
+			if (poll(&event, 1, (int)(timeoutMs - elapsed)) > 0)
+				DrainWatch();
+		}
+#endif
+		if (!held_)
+			error_ = "another instance is running";
+		return held_;
+	}
+
+	void Release() {
+		if (!held_)
+			return;
+#ifdef _WIN32
+		ReleaseMutex(handle_);
+#else
+		flock(fd_, LOCK_UN);
+		// wakes the waiters watching the file
+		futimens(fd_, NULL);
+#endif
+		held_ = false;
+	}
+
+	bool IsHeld() const {
+		return held_;
+	}
+
+	const std::string& Error() const {
+		return error_;
+	}
+
+private:
+	bool Open() {
+#ifdef _WIN32
+		if (!handle_)
+			handle_ = CreateMutexW(NULL, FALSE, name_.c_str());
+		return handle_ ? true : Fail("failed to create the instance mutex");
+#else
+		if (fd_ < 0)
+			fd_ = open(name_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		return fd_ >= 0 ? true : Fail("failed to open " + PathToUtf8(name_));
+#endif
+	}
+
+#ifndef _WIN32
+	// Sets up |watch_|, an inotify descriptor that becomes readable when
+	// the lock file is touched or closed, with no events pending. False
+	// where that is not available.
+	bool WatchLockFile() {
+#ifdef __linux__
+		if (watch_ < 0) {
+			int watch = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+			if (watch >= 0 && inotify_add_watch(watch, name_.c_str(), IN_ATTRIB | IN_CLOSE) < 0) {
+				close(watch);
+				watch = -1;
+			}
+			watch_ = watch;
+		}
+		DrainWatch();
+		return watch_ >= 0;
+#else
+		return false;
+#endif
+	}
+
+	void DrainWatch() {
+		char buf[4096];
+		while (watch_ >= 0 && read(watch_, buf, sizeof(buf)) > 0) {}
+	}
+#endif
+
+	bool Fail(const std::string& message) {
+		error_ = message + " (error " + std::to_string(LastErrorCode()) + ")";
+		return false;
+	}
+
+	PathString name_;
+#ifdef _WIN32
+	HANDLE handle_ = NULL;
+#else
+	int fd_ = -1;
+	int watch_ = -1;
+#endif
+	bool held_ = false;
+	std::string error_;
+};
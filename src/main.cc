@@ -1,11 +1,20 @@
 ﻿#include <shlwapi.h>
 #include <shlobj.h>
-#include <tlhelp32.h>
-#include <psapi.h>
 
 #include <string>
-#include <fstream>
-#include "unzip.hpp"
+#include "delta.hpp"
+#include "instancelock.hpp"
+#include "msgbox.hpp"
+#include "path.hpp"
+#include "progress.hpp"
+#include "runtimecache.hpp"
+#include "selfimage.hpp"
+#include "shutdown.hpp"
+#include "staging.hpp"
+#include "taskgraph.hpp"
+#include "trace.hpp"
+#include "treecopy.hpp"
+#include "treedelete.hpp"
 #include "wait.hpp"
 #include "linker.hpp"
 #include "debug.hpp"
@@ -13,89 +22,17 @@
 #define APP_NAME L"Creeper"
 #define APP_VER g_appVersion
 #define APP_UID L"creeper.pyapp.win32"
+#define APP_JOB L"Local\\" APP_UID L".job"
 
 WCHAR g_appVersion[MAX_PATH] = L"{{app_version}}";
 
-typedef void (*ProcessEnumHandler)(const PROCESSENTRY32& entry);
-
-class Path : public std::wstring {
-public:
-	Path(PCWSTR path) : std::wstring(path) {}
-
-	Path operator /(PCWSTR part) {
-		size_t partLen = wcslen(part);
-		if (partLen == 0
-				|| (partLen == 1 && part[0] == L'.'))
-			return *this;
-
-		Path newPath(*this);
-		if (!newPath.IsDir())
-			newPath.push_back(L'\\');
-
-		newPath.append(part);
-		return newPath;
-	}
-
-	Path operator /(const std::wstring& part) {
-		return *this / part.c_str();
-	}
-
-	BOOL MakeDir() {
-		int result = SHCreateDirectoryEx(NULL, c_str(), NULL);
-		return (result == ERROR_SUCCESS
-			|| result == ERROR_FILE_EXISTS
-			|| result == ERROR_ALREADY_EXISTS);
-	}
-
-	operator PCWSTR() const {
-		return c_str();
-	}
-
-	bool IsDir() const {
-		if (empty())
-			return false;
-		return (*rbegin() == L'\\' || *rbegin() == L'/');
-	}
-
-	std::wstring Name() const {
-		PCWSTR path = c_str();
-		for (int i = ((int)size() - 2); i >= 0; --i) {
-			if (path[i] == L'/' || path[i] == L'\\') {
-				std::wstring result = &path[i + 1];
-				if (IsDir())
-					result.pop_back();
-				return result;
-			}
-		}
-
-		return *this;
-	}
-
-	Path Parent() const {
-		WCHAR path[MAX_PATH + 1] = {};
-		wcsncpy_s(path, c_str(), MAX_PATH);
-		size_t pathLen = wcslen(path);
-
-		for (int i = ((int)pathLen - 1); i >= 0; --i) {
-			if (path[i] == L'/' || path[i] == L'\\')
-				path[i] = L'\0';
-			else
-				break;
-		}
-
-		for (size_t i = 0; i < pathLen; ++i) {
-			if (path[i] == L'/')
-				path[i] = L'\\';
-		}
-
-		PathRemoveFileSpec(path);
-		return path;
-	}
-
-	BOOL IsExists() const {
-		return PathFileExists(c_str());
-	}
-};
+// The worker threads of the whole process. Install steps and the work
+// they spread out share it; it is never destroyed, the idle workers end
+// with the process.
+TaskPool* WorkerPool() {
+	static TaskPool* pool = new TaskPool;
+	return pool;
+}
 
 class FileCopier {
 public:
@@ -104,12 +41,7 @@ public:
 	}
 
 	BOOL Copy(Path subPath) {
-		Path to = (m_toDir / subPath).Parent();
-		if (!to.MakeDir())
-			return FALSE;
-
-		Path from = m_fromDir / subPath;
-		return CopyFileOrFolder(from, to);
+		return CopyFileOrFolder(m_fromDir / subPath, m_toDir / subPath);
 	}
 
 	BOOL Copy(Path subPath, PCWSTR newName) {
@@ -127,22 +59,15 @@ private:
 		if (!from.IsExists())
 			return FALSE;
 
-		from.push_back(NULL);
-		to.push_back(NULL);
-		SHFILEOPSTRUCT shfo = {
-			NULL,
-			FO_COPY,
-			from.c_str(),
-			to.c_str(),
-			FOF_SILENT | FOF_NOERRORUI | FOF_NOCONFIRMATION,
-			FALSE,
-			NULL,
-			NULL
-		};
-
-		BOOL result = (SHFileOperation(&shfo) == 0);
+		TraceScope trace("copy " + PathToUtf8(from.Name()));
+		TreeCopier copier;
+		BOOL result = copier.Copy(from, to, WorkerPool());
+		Trace::Get().Counter("copied", {
+			{ "files", copier.Stats().files },
+			{ "bytes", copier.Stats().bytes } });
 		if (!result && errorUI) {
-			ErrorMsg(L"Failed to copy: %s => %s", from.c_str(), to.c_str());
+			ErrorMsg(L"Failed to copy: %s => %s: %s", from.c_str(), to.c_str(),
+				Utf8ToPath(copier.Error().data(), copier.Error().size()).c_str());
 		}
 
 		return result;
@@ -161,145 +86,78 @@ Path GetSelfExePath() {
 	return path;
 }
 
+// Shows the errors of SelfImage; the image itself is platform neutral.
 class SelfAttachedFiles {
-	typedef std::fstream S;
-
-	// offset[4] + length[4] + checksum[4]
-	static const size_t META_DATA_NUM = 3;
-
 public:
 	bool Init() {
-		Path path = GetSelfExePath();
-		self_file_.open(path, S::in | S::binary);
-		if (!self_file_)
-			ErrorMsg(L"Failed to open: %s", path);
-
-		return (bool)self_file_;
+		image_.UsePool(WorkerPool());
+		return Check(image_.Open(GetSelfExePath()));
 	}
 
-	bool ExtractBackTo(const Path& path) {
-		DWORD32 offset = 0, length = 0;
-		if (!ReadBackItemInfo(&offset, &length)) {
-			ErrorMsg(L"Invalid checksum for: %s", (PCWSTR)path);
-			return false;
-		}
-		ExtractFile(offset, length, path);
-		return true;
+	bool HasPayload(const char* name) const {
+		return image_.HasPayload(name);
 	}
 
-	bool PushBackTo(PCWSTR newAttach, PCWSTR output) {
-		std::ifstream attach(newAttach, S::in | S::binary);
-		if (!attach) {
-			ErrorMsg(L"Failed to open: %s", newAttach);
-			return false;
-		}
-
-		std::ofstream out(output, S::out | S::binary);
-		if (!out) {
-			ErrorMsg(L"Failed to create: %s", output);
-			return false;
-		}
+	bool MapPayload(const char* name, size_t legacyIndex, MappedPayload* payload) {
+		return Check(image_.MapPayload(name, legacyIndex, payload));
+	}
 
-		out << self_file_.rdbuf();
-		out << attach.rdbuf();
-		out << GetMetaData(&attach);
-		return true;
+	bool PushBackTo(PCWSTR newAttach, PCWSTR output, const PackOptions& options) {
+		return Check(image_.PushBackTo(newAttach, output, options));
 	}
 
-	bool ExtractHostTo(int payload_num, const Path& path) {
-		int host_size = GetHostSize(payload_num);
-		if (host_size <= 0)
-			return false;
+	bool PackTo(PCWSTR manifest, PCWSTR output, const PackOptions& options) {
+		return Check(image_.PackTo(manifest, output, options));
+	}
 
-		ExtractFile(0, host_size, path);
-		return true;
+	bool ExtractHostTo(const Path& path) {
+		return Check(image_.ExtractHostTo(path));
 	}
 
 private:
-	int GetHostSize(int payload_num) {
-		extracted_len = 0;
-
-		for (int i = 0; i < payload_num; ++i) {
-			DWORD32 offset = 0, length = 0;
-			bool result = ReadBackItemInfo(&offset, &length);
-			if (!result)
-				return 0;
-		}
-
-		self_file_.seekg(0, S::end);
-		return (int)self_file_.tellg() - extracted_len;
-	}
-
-	std::string GetMetaData(std::ifstream* attach) {
-		self_file_.seekg(0, S::end);
-		attach->seekg(0, S::end);
-		DWORD32 self_size = (DWORD32)self_file_.tellg();
-		DWORD32 attach_size = (DWORD32)attach->tellg();
-
-		DWORD32 data[META_DATA_NUM] = { 0 };
-		data[0] = (DWORD32)htonl(self_size);
-		data[1] = (DWORD32)htonl(attach_size);
-		data[2] = (DWORD32)htonl(self_size ^ attach_size);
-		return std::string((char*)data, sizeof(data));
-	}
-
-	bool ReadBackItemInfo(DWORD32* offset, DWORD32* length) {
-		DWORD32 data[META_DATA_NUM] = { 0 };
-		size_t data_offset = extracted_len + sizeof(data);
-		self_file_.seekg((std::streamoff)-1 * data_offset, S::end);
-		self_file_.read((char*)data, sizeof(data));
-
-		*offset = ntohl(data[0]);
-		*length = ntohl(data[1]);
-		DWORD32 checksum = ntohl(data[2]);
-		extracted_len += (*length + sizeof(data));
-		return length && (*offset ^ *length) == checksum;
-	}
-
-	void ExtractFile(DWORD32 offset, DWORD32 length, const Path& path) {
-		std::ofstream out(path, S::out | S::binary);
-		self_file_.seekg(offset);
-
-		const int BUF_SIZE = 1024 * 4;
-		char buf[BUF_SIZE];
-		size_t rest_len = length;
-		while (rest_len) {
-			size_t block_size = min(rest_len, BUF_SIZE);
-			rest_len -= block_size;
-			self_file_.read(buf, block_size);
-			if (!self_file_)
-				break;
-			out.write(buf, block_size);
-		}
+	bool Check(bool result) {
+		if (!result)
+			ErrorMsg(L"%s", Utf8ToPath(image_.Error().data(), image_.Error().size()).c_str());
+		return result;
 	}
 
-	std::ifstream self_file_;
-	size_t extracted_len = 0;
+	SelfImage image_;
 };
 
+// The job object the app's processes run in, which AppShutdown looks up
+// by name. Created on first use and never closed: the processes in it
+// keep it alive after the installer exits, and so does the app it starts.
+HANDLE AppJob() {
+	static HANDLE job = CreateJobObject(NULL, APP_JOB);
+	return job;
+}
+
+// Runs |exeFile| inside the app's job, so that whatever the scripts start,
+// the app included, is found and stopped by the next upgrade.
 BOOL ExecAndWait(PCWSTR exeFile, PCWSTR args) {
-	SHELLEXECUTEINFO ShExecInfo = { 0 };
-	ShExecInfo.cbSize = sizeof(SHELLEXECUTEINFO);
-	ShExecInfo.fMask = SEE_MASK_NOCLOSEPROCESS;
-	ShExecInfo.hwnd = NULL;
-	ShExecInfo.lpVerb = NULL;
-	ShExecInfo.lpFile = exeFile;
-	ShExecInfo.lpParameters = args;
-	ShExecInfo.lpDirectory = NULL;
-	ShExecInfo.nShow = SW_SHOW;
-	ShExecInfo.hInstApp = NULL;
-	ShellExecuteEx(&ShExecInfo);
-
-	if (!ShExecInfo.hProcess) {
+	std::wstring cmdLine = L"\"" + std::wstring(exeFile) + L"\" " + args;
+	STARTUPINFO startup = { 0 };
+	startup.cb = sizeof(startup);
+	PROCESS_INFORMATION process = { 0 };
+	if (!CreateProcess(exeFile, &cmdLine[0], NULL, NULL, FALSE,
+			CREATE_SUSPENDED, NULL, NULL, &startup, &process)) {
 		ErrorMsg(L"Failed to run: %s %s", exeFile, args);
 		return FALSE;
 	}
 
-	WaitForSingleObject(ShExecInfo.hProcess, INFINITE);
+	// a job the installer itself runs in may forbid nesting (before
+	// Windows 8); the process then runs outside, found by name instead
+	HANDLE job = AppJob();
+	if (job)
+		AssignProcessToJobObject(job, process.hProcess);
+	ResumeThread(process.hThread);
+	CloseHandle(process.hThread);
+
+	WaitForSingleObject(process.hProcess, INFINITE);
 
 	DWORD exitCode = 0;
-	BOOL result = GetExitCodeProcess(ShExecInfo.hProcess, &exitCode);
-	CloseHandle(ShExecInfo.hProcess);
+	BOOL result = GetExitCodeProcess(process.hProcess, &exitCode);
+	CloseHandle(process.hProcess);
 	return (BOOL)(result && !exitCode);
 }
 
@@ -307,81 +165,21 @@ BOOL RemoveDir(Path path, BOOL errorUI = TRUE) {
 	if (!path.IsExists())
 		return TRUE;
 
-	path.push_back(NULL);
-	SHFILEOPSTRUCT shfo = {
-		NULL,
-		FO_DELETE,
-		path.c_str(),
-		NULL,
-		FOF_SILENT | FOF_NOERRORUI | FOF_NOCONFIRMATION,
-		FALSE,
-		NULL,
-		NULL
-	};
-
-	BOOL result = (SHFileOperation(&shfo) == 0);
+	TraceScope trace("delete " + PathToUtf8(path.Name()));
+	TreeDeleter deleter;
+	BOOL result = deleter.Delete(path, WorkerPool());
+	Trace::Get().Counter("deleted", {
+		{ "files", deleter.Stats().files },
+		{ "bytes", deleter.Stats().bytes } });
 	if (!result && errorUI) {
-		ErrorMsg(L"Failed to remove: %s", path.c_str());
+		ErrorMsg(L"Failed to remove %s: %s (%u items left)",
+			path.c_str(), Utf8ToPath(deleter.Error().data(), deleter.Error().size()).c_str(),
+			(unsigned)deleter.Stats().failed);
 	}
 
 	return result;
 }
 
-BOOL CALLBACK DeleteTrayIcon(HWND window, LPARAM param) {
-	WCHAR title[MAX_PATH] = {};
-	GetWindowTextW(window, title, MAX_PATH);
-
-	if (wcsstr(title, APP_UID) && wcsstr(title, L"trayicon")) {
-		NOTIFYICONDATA nid;
-		ZeroMemory(&nid, sizeof(NOTIFYICONDATA));
-		nid.hWnd = window;
-		nid.uID = 0;
-		Shell_NotifyIcon(NIM_DELETE, &nid);
-		return FALSE;
-	}
-
-	return TRUE;
-}
-
-void EnumProcess(ProcessEnumHandler handler) {
-	HANDLE hProcessSnap;
-	PROCESSENTRY32 pe32;
-	hProcessSnap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-	if (hProcessSnap == INVALID_HANDLE_VALUE)
-		return;
-
-	pe32.dwSize = sizeof(PROCESSENTRY32);
-	if (Process32First(hProcessSnap, &pe32)) {
-		handler(pe32);
-		while (Process32Next(hProcessSnap, &pe32)) {
-			handler(pe32);
-		}
-		CloseHandle(hProcessSnap);
-	}
-}
-
-void KillOldProcesses(const PROCESSENTRY32& entry) {
-	DWORD pid = entry.th32ProcessID;
-	if (!pid || pid == GetCurrentProcessId())
-		return;
-
-	HANDLE hProcess = OpenProcess(
-		PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_TERMINATE,
-		FALSE, pid);
-
-	if (!hProcess)
-		return;
-
-	WCHAR filePath[MAX_PATH] = { 0 };
-	GetProcessImageFileName(hProcess, filePath, MAX_PATH);
-
-	if (wcsstr(filePath, APP_UID)) {
-		TerminateProcess(hProcess, 0);
-	}
-
-	CloseHandle(hProcess);
-}
-
 BOOL RemoveAndCreateFolder(PCWSTR path) {
 	if (!RemoveDir(path))
 		return FALSE;
@@ -418,45 +216,11 @@ Path GetAppDirPath() {
 	return path;
 }
 
-void SelfExtractAndExec(Path tempPath, Path appPath, BOOL isUpgrade) {
-	Path python_zip = tempPath / L"python.zip";
-	Path app_zip = tempPath / L"app.zip";
-
-	SelfAttachedFiles saf;
-	if (!saf.Init())
-		return;
-
-	if (!saf.ExtractBackTo(app_zip))
-		return;
-
-	if (!saf.ExtractBackTo(python_zip))
-		return;
-
-	Path python_dir = appPath / L"python";
-	python_dir.MakeDir();
-
-	if (!Unzip(python_zip, python_dir))
-		return;
-
-	if (!Unzip(app_zip, appPath))
-		return;
-
-	if (isUpgrade)
-		FileCopier(tempPath, appPath).Copy(L"data.old");
-
-	CopyFile(GetSelfExePath(), appPath / L"installer.exe", TRUE);
-	BOOL result = ExecAndWait(
-		python_dir / L"pythonw.exe", appPath / L"install.py");
-
-	if (result)
-		MsgBox(APP_NAME L" has been installed successfully!",
-			MB_ICONINFORMATION);
-}
-
-VOID BackupUserConf(Path appPath, Path tempPath) {
-	FileCopier fc(appPath / L"data", tempPath / L"data.old");
-	fc.Copy(L"conf/user");
-	fc.Copy(L"html/version.json");
+// Next to the app dir, so swapping app versions never touches it.
+Path GetRuntimeCachePath() {
+	std::wstring path = GetAppDirPath();
+	path += L".runtimes";
+	return path.c_str();
 }
 
 VOID RunUnistallScript(Path appPath) {
@@ -468,45 +232,283 @@ VOID RunUnistallScript(Path appPath) {
 	if (!ver.IsExists())
 		return;
 
+	TraceScope trace("uninstall script");
 	std::wstring installScript = appPath / L"install.py";
 	std::wstring param = installScript + L" " + L"--undo";
 	ExecAndWait(pyw, param.c_str());
 }
 
+VOID StopApp(Path appPath) {
+	RunUnistallScript(appPath);
+
+	TraceScope trace("stop processes");
+	AppShutdown shutdown(appPath, GetRuntimeCachePath(), APP_JOB);
+	shutdown.Stop();
+	Trace::Get().Counter("app processes", {
+		{ "found", shutdown.Stats().found },
+		{ "closed", shutdown.Stats().closed },
+		{ "killed", shutdown.Stats().killed },
+		{ "left", shutdown.Stats().left } });
+}
+
+// CREEPER_IO=async writes the extracted files through the asynchronous
+// I/O queue, to compare it against the synchronous default.
+IoBackend GetIoBackend() {
+	WCHAR value[16] = { 0 };
+	IoBackend backend = IO_SYNC;
+	if (GetEnvironmentVariable(L"CREEPER_IO", value, 16))
+		ParseIoBackend(PathToUtf8(value), &backend);
+	return backend;
+}
+
+// The app still runs and the uninstall script is yet to come, so the
+// backup must not share the live files: it is a copy-on-write clone where
+// the volume allows, else a copy.
+VOID BackupUserConf(Path appPath, Path tempPath) {
+	FileCopier fc(appPath / L"data", tempPath / L"data.old");
+	fc.Copy(L"conf/user");
+	fc.Copy(L"html/version.json");
+}
+
 BOOL StopAndUninstall(Path appPath) {
 	if (!appPath.IsExists())
 		return TRUE;
 
-	RunUnistallScript(appPath);
-	EnumWindows(&DeleteTrayIcon, NULL);
-	EnumProcess(&KillOldProcesses);
-	return RemoveDir(appPath);
+	StopApp(appPath);
+	return RemoveDir(appPath) && RemoveDir(GetRuntimeCachePath());
 }
 
-BOOL InstallOrUpgrade() {
-	Path tempPath = GetTempDirPath();
-	if (!RemoveAndCreateFolder(tempPath))
+// One install or upgrade, split into steps that Run() hands to a task
+// graph. The payloads are mapped and extracted into staging while the
+// temp dir is reset and the user configuration is backed up; the old
+// version is stopped only once the new one is complete, and every step
+// shows up in the install trace. The payloads are checked piece by piece
+// as they are decoded and extracted, not in a pass of their own.
+class InstallSteps {
+public:
+	InstallSteps(Path tempPath, Path appPath)
+		: tempPath_(tempPath), appPath_(appPath),
+		isUpgrade_(appPath.IsExists()),
+		staged_(appPath),
+		stagePath_(staged_.StagePath().c_str()),
+		runtimes_(GetRuntimeCachePath()),
+		installer_(stagePath_, appPath),
+		io_(GetIoBackend()) {
+		// written anew after the swap; the old copies would shadow them
+		staged_.ExcludeFromCarryOver("installer.exe");
+		staged_.ExcludeFromCarryOver("data.old");
+		staged_.ExcludeFromCarryOver("install-trace.json");
+	}
+
+	BOOL Run() {
+		typedef TaskGraph::Node Node;
+		TaskGraph graph;
+		Node resetTemp = AddStep(&graph, "reset temp", &InstallSteps::ResetTemp);
+		Node backup = AddStep(&graph, "backup user conf", &InstallSteps::BackupConf, { resetTemp });
+		Node map = AddStep(&graph, "map payloads", &InstallSteps::MapPayloads);
+		Node staging = AddStep(&graph, "prepare staging", &InstallSteps::PrepareStaging);
+		Node runtime = AddStep(&graph, "extract runtime", &InstallSteps::ExtractRuntime, { map });
+		Node app = AddStep(&graph, "extract app.zip", &InstallSteps::ExtractApp, { map, staging });
+		Node check = AddStep(&graph, "check extraction", &InstallSteps::CheckExtraction, { runtime, app });
+		Node link = AddStep(&graph, "link runtime", &InstallSteps::LinkRuntime, { check });
+		Node stop = AddStep(&graph, "stop app", &InstallSteps::Stop, { link, backup });
+		Node swap = AddStep(&graph, "swap", &InstallSteps::Swap, { stop });
+		AddStep(&graph, "clean up", &InstallSteps::CleanUp, { swap });
+		Node restore = AddStep(&graph, "restore user conf", &InstallSteps::RestoreConf, { swap });
+		Node copy = AddStep(&graph, "copy installer", &InstallSteps::CopyInstaller, { swap });
+		AddStep(&graph, "install script", &InstallSteps::RunInstallScript, { restore, copy });
+
+		// the steps and the work they spread out share the worker pool
+		int64_t start = Trace::Get().Now();
+		BOOL result = graph.Run(WorkerPool());
+		Trace::Get().Counter("install steps", {
+			{ "wall us", (uint64_t)(Trace::Get().Now() - start) },
+			{ "critical path us", (uint64_t)graph.CriticalPath() },
+			{ "serial us", (uint64_t)graph.SerialTime() } });
+
+		if (result)
+			MsgBox(APP_NAME L" has been installed successfully!",
+				MB_ICONINFORMATION);
+		return result;
+	}
+
+private:
+	typedef BOOL (InstallSteps::*Method)();
+
+	TaskGraph::Node AddStep(TaskGraph* graph, const char* name, Method method,
+			const std::vector<TaskGraph::Node>& deps = {}) {
+		return graph->Add(name, [this, name, method] {
+			Progress::Get().BeginPhase(name);
+			BOOL result = (this->*method)();
+			Progress::Get().EndPhase(name);
+			return result != FALSE;
+		}, deps);
+	}
+
+	// the errors of the core are UTF-8, paths included
+	static std::wstring Wide(const std::string& text) {
+		return Utf8ToPath(text.data(), text.size());
+	}
+
+	BOOL ResetTemp() {
+		return RemoveAndCreateFolder(tempPath_);
+	}
+
+	BOOL BackupConf() {
+		if (isUpgrade_)
+			BackupUserConf(appPath_, tempPath_);
+		return TRUE;
+	}
+
+	BOOL MapPayloads() {
+		if (!saf_.Init())
+			return FALSE;
+
+		// the runtime comes as a solid archive or, from older packers, a zip
+		pythonName_ = saf_.HasPayload("python.solid") ? "python.solid" : "python.zip";
+		if (!saf_.MapPayload(pythonName_, 0, &python_)
+				|| !saf_.MapPayload("app.zip", 1, &app_))
+			return FALSE;
+
+		// the bar covers all extraction from the start; a cached runtime
+		// is not extracted, unchanged app files are dropped as found
+		if (!runtimes_.Has(python_.key))
+			PlanExtractProgress(python_.data, python_.size);
+		PlanExtractProgress(app_.data, app_.size);
+		return TRUE;
+	}
+
+	// the new version is built next to the old one, which keeps running
+	BOOL PrepareStaging() {
+		if (staged_.Begin())
+			return TRUE;
+
+		ErrorMsg(L"Failed to prepare the installation: %s", Wide(staged_.Error()).c_str());
 		return FALSE;
+	}
 
-	Path appPath = GetAppDirPath();
-	BOOL isReplacingOldApp = appPath.IsExists();
+	// The runtime is extracted once per distinct payload and shared. A
+	// failure is reported once the app is extracted as well.
+	BOOL ExtractRuntime() {
+		BOOL cached = runtimes_.Has(python_.key);
+		runtimeReady_ = runtimes_.Prepare(python_.key, python_.data, python_.size,
+			WorkerPool(), io_, python_.entryDigests);
+		Trace::Get().Counter(pythonName_, {
+			{ "bytes", python_.size }, { "cached", (uint64_t)cached } });
+		return TRUE;
+	}
+
+	// unchanged app files are linked over from the installed version
+	BOOL ExtractApp() {
+		unzipped_ = installer_.Add("app.zip", app_.data, app_.size, "", app_.entryDigests)
+			&& installer_.Run(WorkerPool(), io_);
+		Trace::Get().Counter("app.zip", {
+			{ "bytes", app_.size },
+			{ "written files", installer_.Written() },
+			{ "written bytes", installer_.WrittenBytes() },
+			{ "unchanged files", installer_.Unchanged() } });
+		return TRUE;
+	}
+
+	BOOL CheckExtraction() {
+		if (!runtimeReady_) {
+			ErrorMsg(L"Failed to extract the Python runtime: %s",
+				Wide(runtimes_.Error()).c_str());
+			return FALSE;
+		}
 
-	if (isReplacingOldApp) {
-		BackupUserConf(appPath, tempPath);
-		if (!StopAndUninstall(appPath))
+		if (!unzipped_) {
+			ErrorMsg(L"Failed to install files to \"%s\": %s",
+				(PCWSTR)stagePath_, Wide(installer_.Error()).c_str());
 			return FALSE;
+		}
+		return TRUE;
 	}
 
-	if (!RemoveAndCreateFolder(appPath))
+	BOOL LinkRuntime() {
+		if (runtimes_.Publish(python_.key)
+				&& runtimes_.Link(stagePath_ / L"python", python_.key))
+			return TRUE;
+
+		ErrorMsg(L"Failed to activate the Python runtime: %s",
+			Wide(runtimes_.Error()).c_str());
 		return FALSE;
+	}
 
-	SelfExtractAndExec(tempPath, appPath, isReplacingOldApp);
-	return TRUE;
-}
+	// downtime starts here and lasts for the swap only
+	BOOL Stop() {
+		if (isUpgrade_)
+			StopApp(appPath_);
+		return TRUE;
+	}
+
+	// an install that kept no manifest gets replaced as a whole, as before
+	BOOL Swap() {
+		if ((!installer_.IsIncremental() || staged_.CarryOver(installer_.Installed()))
+				&& staged_.Commit())
+			return TRUE;
+
+		ErrorMsg(L"Failed to replace the installed version: %s",
+			Wide(staged_.Error()).c_str());
+		return FALSE;
+	}
+
+	BOOL CleanUp() {
+		staged_.DeleteOldInBackground();
+		runtimes_.Prune(python_.key);
+		return TRUE;
+	}
+
+	// the backup replaces any data.old of an earlier upgrade, so files
+	// deleted since then stay deleted
+	BOOL RestoreConf() {
+		if (isUpgrade_ && RemoveDir(appPath_ / L"data.old"))
+			FileCopier(tempPath_, appPath_).Copy(L"data.old");
+		return TRUE;
+	}
+
+	// uninstall runs this copy, so it must be the new version's
+	BOOL CopyInstaller() {
+		CopyFile(GetSelfExePath(), appPath_ / L"installer.exe", FALSE);
+		return TRUE;
+	}
+
+	BOOL RunInstallScript() {
+		return ExecAndWait(
+			appPath_ / L"python/pythonw.exe", appPath_ / L"install.py");
+	}
+
+	Path tempPath_;
+	Path appPath_;
+	BOOL isUpgrade_;
+	SelfAttachedFiles saf_;
+	StagedInstall staged_;
+	Path stagePath_;
+	RuntimeCache runtimes_;
+	DeltaInstaller installer_;
+	IoBackend io_;
 
-BOOL IsAnotherInstanceRunning() {
-	HANDLE mutex = CreateMutex(NULL, TRUE, APP_UID);
-	return mutex && GetLastError() == ERROR_ALREADY_EXISTS;
+	const char* pythonName_ = "python.zip";
+	MappedPayload python_;
+	MappedPayload app_;
+	BOOL runtimeReady_ = FALSE;
+	BOOL unzipped_ = FALSE;
+};
+
+BOOL InstallOrUpgrade() {
+	Path tempPath = GetTempDirPath();
+	Path appPath = GetAppDirPath();
+	BOOL result;
+	{
+		TraceScope trace("install");
+		InstallSteps steps(tempPath, appPath);
+		result = steps.Run();
+	}
+
+	// kept with the install, or in the temp dir when there is none
+	Path tracePath = (appPath.IsExists() ? appPath : tempPath) / L"install-trace.json";
+	Trace::Get().Save(tracePath);
+	return result;
 }
 
 void InstallOrUpgradeRoutine() {
@@ -524,34 +526,37 @@ int InstallOrUpgradeUI(HINSTANCE hInstance) {
 	return StartWaiting(hInstance, &InstallOrUpgradeRoutine);
 }
 
-int PackFileUI(PCWSTR newAttach, PCWSTR output) {
+int PackFileUI(PCWSTR newAttach, PCWSTR output, const PackOptions& options) {
 	SelfAttachedFiles saf;
 	if (!saf.Init())
 		return ERROR_OPEN_FAILED;
 
-	if (!saf.PushBackTo(newAttach, output))
+	if (!saf.PushBackTo(newAttach, output, options))
 		return ERROR_INVALID_PARAMETER;
 
 	return ERROR_SUCCESS;
 }
 
-BOOL WaitAnotherQuit(int times) {
-	for (int i = 0; i < times; ++i) {
-		if (!IsAnotherInstanceRunning())
-			return TRUE;
+int PackManifestUI(PCWSTR manifest, PCWSTR output, const PackOptions& options) {
+	SelfAttachedFiles saf;
+	if (!saf.Init())
+		return ERROR_OPEN_FAILED;
 
-		Sleep(1000);
-	}
+	if (!saf.PackTo(manifest, output, options))
+		return ERROR_INVALID_PARAMETER;
 
-	return FALSE;
+	return ERROR_SUCCESS;
 }
 
-int UninstallUI() {
+// The installer that started the uninstall may still be exiting.
+const DWORD UNINSTALL_WAIT_MS = 5000;
+
+int UninstallUI(InstanceLock* instance) {
 	PCWSTR question = L"Do you want to remove " APP_NAME L"?";
 	if (IDYES != MsgBox(question, MB_YESNO))
 		return ERROR_HANDLE_EOF;
 
-	if (!WaitAnotherQuit(5))
+	if (!instance->Acquire(UNINSTALL_WAIT_MS))
 		return ERROR_NOT_OWNER;
 
 	Path appPath = GetAppDirPath();
@@ -571,9 +576,8 @@ int CopyUninstall() {
 	if (!saf.Init())
 		return ERROR_OPEN_FAILED;
 
-	int payloadNum = IS_DEBUG ? 0 : 2;
 	Path copyPath = tempPath / L"installer.exe";
-	saf.ExtractHostTo(payloadNum, copyPath);
+	saf.ExtractHostTo(copyPath);
 
 	ShellExecute(NULL, NULL, copyPath, L"uninstall", NULL, 0);
 	return ERROR_SUCCESS;
@@ -634,6 +638,16 @@ public:
 		return *this;
 	}
 
+	// Consumes the next argument if it is |str|, setting |found|.
+	Args& PopOption(LPWSTR str, bool* found) {
+		if (m_result && m_curArg + 1 < m_argNum
+				&& 0 == wcscmp(m_argList[m_curArg + 1], str)) {
+			++m_curArg;
+			*found = true;
+		}
+		return *this;
+	}
+
 	Args& Left(int num) {
 		if (m_result) {
 			int realLeft = (m_argNum - m_curArg - 1);
@@ -652,6 +666,7 @@ private:
 enum class SubCommand {
 	Unknown,
 	PackFile,
+	PackManifest,
 	Upgrade,
 	Uninstall,
 	CopyUninstall,
@@ -666,8 +681,17 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
 	Args args;
 	SubCommand sc = SubCommand::Unknown;
+	PackOptions packOptions;
 	if (args->PopEquals(L"push").Left(2))
 		sc = SubCommand::PackFile;
+	else if (args->PopEquals(L"push").PopEquals(L"--compress").Left(2)) {
+		sc = SubCommand::PackFile;
+		packOptions.compress = true;
+	}
+	else if (args->PopEquals(L"pack")
+			.PopOption(L"--compress", &packOptions.compress)
+			.PopOption(L"--pack-stdlib", &packOptions.packStdlib).Left(2))
+		sc = SubCommand::PackManifest;
 	else if (args->Left(0))
 		sc = SubCommand::Upgrade;
 	else if (args->PopEquals(L"uninstall"))
@@ -675,19 +699,26 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 	else if (args->PopEquals(L"copy-uninstall"))
 		sc = SubCommand::CopyUninstall;
 
+	// held until the process exits
+	InstanceLock instance(APP_UID);
 	if (sc != SubCommand::Uninstall)
-		if (IsAnotherInstanceRunning())
+		if (!instance.TryAcquire())
 			return ERROR_NOT_OWNER;
 
 	if (sc == SubCommand::PackFile) {
 		PCWSTR newAttach = args.Pop();
 		PCWSTR output = args.Pop();
-		return PackFileUI(newAttach, output);
+		return PackFileUI(newAttach, output, packOptions);
+	}
+	else if (sc == SubCommand::PackManifest) {
+		PCWSTR manifest = args.Pop();
+		PCWSTR output = args.Pop();
+		return PackManifestUI(manifest, output, packOptions);
 	}
 	else if (sc == SubCommand::Upgrade)
 		return InstallOrUpgradeUI(hInstance);
 	else if (sc == SubCommand::Uninstall)
-		return UninstallUI();
+		return UninstallUI(&instance);
 	else if (sc == SubCommand::CopyUninstall)
 		return CopyUninstall();
 	else {
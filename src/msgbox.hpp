@@ -0,0 +1,21 @@
+#pragma once
+#include <windows.h>
+#include <stdarg.h>
+
+// Message boxes of the installer, owned by the waiting window once it is up.
+
+HWND g_topWindow = NULL;
+LPCWSTR g_msgBoxTitle = L"";
+
+inline int MsgBox(LPCWSTR text, _In_ UINT flags) {
+	return MessageBox(g_topWindow, text, g_msgBoxTitle, flags);
+}
+
+inline void ErrorMsg(PCWSTR format, ...) {
+	WCHAR text[1024] = { 0 };
+	va_list args;
+	va_start(args, format);
+	wvsprintf(text, format, args);
+	MessageBox(g_topWindow, text, L"Error", MB_ICONERROR);
+	va_end(args);
+}
@@ -0,0 +1,309 @@
+#pragma once
+#include <ctype.h>
+#include <string.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "payload.hpp"
+#include "solid.hpp"
+#include "stdlibpack.hpp"
+#include "taskpool.hpp"
+#include "zipwriter.hpp"
+
+// Builds a complete installer image in one streaming pass: host, every
+// payload listed in a manifest, then a single index. Payload hashes are
+// computed on a pool ahead of the writer, so hashing of later payloads
+// overlaps with writing the earlier ones. A zip stored as it is gets the
+// digests of its entries along (PAYLOAD_ENTRY_DIGESTS), which the
+// installer checks as it extracts them.
+//
+// With PackOptions::compress every payload is stored as a BlockStream;
+// zip payloads are first rewritten with stored entries, so the client
+// decodes blocks in parallel and unzips with plain copies.
+//
+// A payload named "*.solid" whose file is a zip is converted into a solid
+// archive (solid.hpp), e.g. "python.solid = python.zip".
+//
+// With PackOptions::packStdlib the runtime payload ("python.zip" or
+// "python.solid") keeps its standard library in one zip imported in
+// place (stdlibpack.hpp), before any other conversion.
+//
+// Manifest: one payload per line, "name = path" or just "path" (named
+// after the file). Blank lines and lines starting with '#' are ignored,
+// relative paths are taken from the manifest's directory.
+
+struct PackOptions {
+	bool compress = false;
+	bool packStdlib = false;
+};
+
+struct PackItem {
+	std::string name;
+	PathString path;
+};
+
+inline std::string TrimSpaces(const std::string& str) {
+	size_t begin = str.find_first_not_of(" \t\r\n");
+	if (begin == std::string::npos)
+		return std::string();
+	size_t end = str.find_last_not_of(" \t\r\n");
+	return str.substr(begin, end - begin + 1);
+}
+
+inline bool IsAbsolutePath(const std::string& path) {
+	return (!path.empty() && (path[0] == '/' || path[0] == '\\'))
+		|| (path.size() > 1 && path[1] == ':');
+}
+
+inline bool ParsePackManifest(const std::string& text, const PathString& baseDir,
+		std::vector<PackItem>* items, std::string* error) {
+	size_t lineNo = 0;
+	size_t pos = 0;
+	// skip a UTF-8 BOM
+	if (text.compare(0, 3, "\xef\xbb\xbf") == 0)
+		pos = 3;
+
+	while (pos < text.size()) {
+		size_t eol = text.find('\n', pos);
+		if (eol == std::string::npos)
+			eol = text.size();
+		std::string line = TrimSpaces(text.substr(pos, eol - pos));
+		pos = eol + 1;
+		++lineNo;
+
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		PackItem item;
+		std::string path = line;
+		size_t eq = line.find('=');
+		if (eq != std::string::npos) {
+			item.name = TrimSpaces(line.substr(0, eq));
+			path = TrimSpaces(line.substr(eq + 1));
+		}
+		else {
+			size_t sep = path.find_last_of("/\\");
+			item.name = (sep == std::string::npos) ? path : path.substr(sep + 1);
+		}
+
+		if (item.name.empty() || path.empty()) {
+			*error = "manifest line " + std::to_string(lineNo) + ": missing name or path";
+			return false;
+		}
+
+		item.path = Utf8ToPath(path.data(), path.size());
+		if (!IsAbsolutePath(path) && !baseDir.empty())
+			item.path = baseDir + PATH_SEP + item.path;
+		items->push_back(item);
+	}
+
+	if (items->empty()) {
+		*error = "manifest lists no payloads";
+		return false;
+	}
+	return true;
+}
+
+inline bool HasSuffix(const std::string& name, const char* suffix) {
+	size_t len = strlen(suffix);
+	if (name.size() <= len)
+		return false;
+	for (size_t i = 0; i < len; ++i) {
+		if (tolower((unsigned char)name[name.size() - len + i]) != suffix[i])
+			return false;
+	}
+	return true;
+}
+
+inline bool IsZipName(const std::string& name) {
+	return HasSuffix(name, ".zip");
+}
+
+inline bool IsSolidName(const std::string& name) {
+	return HasSuffix(name, ".solid");
+}
+
+// The payload the installer extracts into its runtime cache.
+inline bool IsRuntimeName(const std::string& name) {
+	std::string norm = NormalizeEntryName(name);
+	return norm == "python.zip" || norm == "python.solid";
+}
+
+// The entry digests of |data| if it is a zip payload, else empty.
+inline std::string HashZipPayload(const std::string& name, const uint8_t* data, size_t size) {
+	std::string digests;
+	ZipArchive zip;
+	if (IsZipName(name) && zip.Open(data, size) && !zip.HashEntries(&digests))
+		digests.clear();
+	return digests;
+}
+
+// Adds |data| as it is, a zip with its entry digests. |digests| are
+// those of HashZipPayload(), computed here unless given.
+inline bool AddPlainPayload(PayloadWriter* writer, const std::string& name,
+		const uint8_t* data, size_t size, const uint8_t* digest = NULL,
+		const std::string* digests = NULL) {
+	std::string computed;
+	if (!digests) {
+		computed = HashZipPayload(name, data, size);
+		digests = &computed;
+	}
+	if (!writer->AddPayload(name, data, size, digest))
+		return false;
+	if (!digests->empty())
+		writer->AddEntryDigests(*digests);
+	return true;
+}
+
+// Adds |data| as a BlockStream payload; a zip is rewritten with stored
+// entries first. Solid archives are compressed already and stored as is.
+inline bool AddCompressedPayload(PayloadWriter* writer, const std::string& name,
+		const uint8_t* data, size_t size, TaskPool* pool, std::string* error) {
+	if (SolidArchive::IsSolid(data, size)) {
+		if (!writer->AddPayload(name, data, size)) {
+			*error = "failed to write " + name;
+			return false;
+		}
+		return true;
+	}
+
+	std::string stored;
+	if (IsZipName(name)) {
+		if (!StoreZipEntries(data, size, pool, &stored, error)) {
+			*error = name + ": " + *error;
+			return false;
+		}
+		data = (const uint8_t*)stored.data();
+		size = stored.size();
+	}
+
+	if (!writer->AddCompressedPayload(name, data, size, pool)) {
+		*error = "failed to write " + name;
+		return false;
+	}
+	return true;
+}
+
+class Packer {
+public:
+	bool Pack(const uint8_t* host, size_t hostSize,
+			const std::vector<PackItem>& items, const PathChar* output,
+			TaskPool* pool, const PackOptions& options = PackOptions()) {
+		std::vector<std::unique_ptr<Input>> inputs;
+		for (const PackItem& item : items) {
+			std::unique_ptr<Input> input(new Input);
+			if (!input->file.Open(item.path.c_str()))
+				return Fail("failed to open " + PathToUtf8(item.path));
+			input->item = &item;
+			bool isSolid = SolidArchive::IsSolid(input->file.Data(), input->file.Size());
+			input->converted = options.compress || (IsSolidName(item.name) && !isSolid)
+				|| (options.packStdlib && IsRuntimeName(item.name) && !isSolid);
+			inputs.push_back(std::move(input));
+		}
+
+		// converted payloads are hashed by the writer, after encoding
+		TaskPool::Group group;
+		for (std::unique_ptr<Input>& input : inputs) {
+			Input* p = input.get();
+			if (p->converted)
+				continue;
+			pool->Submit([this, p] {
+				Sha256::Hash(p->file.Data(), p->file.Size(), p->digest);
+				p->entryDigests = HashZipPayload(p->item->name, p->file.Data(), p->file.Size());
+				std::lock_guard<std::mutex> lock(mutex_);
+				p->hashed = true;
+				hashed_.notify_all();
+			}, &group);
+		}
+
+		PayloadWriter writer;
+		bool result = writer.Create(output);
+		if (!result)
+			Fail("failed to create " + PathToUtf8(output));
+		else if (!(result = writer.WriteHost(host, hostSize)))
+			Fail("failed to write host");
+
+		for (std::unique_ptr<Input>& input : inputs) {
+			if (!result)
+				break;
+			if (input->converted) {
+				result = AddConverted(&writer, *input, pool, options);
+				continue;
+			}
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				hashed_.wait(lock, [&input] { return input->hashed; });
+			}
+			result = AddPlainPayload(&writer, input->item->name, input->file.Data(),
+				input->file.Size(), input->digest, &input->entryDigests);
+			if (!result)
+				Fail("failed to write " + input->item->name);
+		}
+
+		if (result && !(result = writer.Finish()))
+			Fail("failed to write index");
+
+		pool->Wait(&group);
+		return result;
+	}
+
+	const std::string& Error() const {
+		return error_;
+	}
+
+private:
+	struct Input {
+		const PackItem* item = NULL;
+		MappedFile file;
+		uint8_t digest[Sha256::DIGEST_SIZE] = {};
+		std::string entryDigests;
+		bool hashed = false;
+		bool converted = false;
+	};
+
+	bool AddConverted(PayloadWriter* writer, const Input& input, TaskPool* pool,
+			const PackOptions& options) {
+		const std::string& name = input.item->name;
+		const uint8_t* data = input.file.Data();
+		size_t size = input.file.Size();
+		std::string error;
+
+		std::string runtime;
+		if (options.packStdlib && IsRuntimeName(name) && !SolidArchive::IsSolid(data, size)) {
+			StdlibPackStats stats;
+			if (!PackStdlib(data, size, pool, &runtime, &stats, &error))
+				return Fail(name + ": " + error);
+			data = (const uint8_t*)runtime.data();
+			size = runtime.size();
+		}
+
+		std::string solid;
+		if (IsSolidName(name) && !SolidArchive::IsSolid(data, size)) {
+			if (!ZipToSolid(data, size, pool, &solid, &error))
+				return Fail(name + ": " + error);
+			data = (const uint8_t*)solid.data();
+			size = solid.size();
+		}
+
+		if (options.compress) {
+			if (!AddCompressedPayload(writer, name, data, size, pool, &error))
+				return Fail(error);
+		}
+		else if (!AddPlainPayload(writer, name, data, size)) {
+			return Fail("failed to write " + name);
+		}
+		return true;
+	}
+
+	bool Fail(const std::string& message) {
+		if (error_.empty())
+			error_ = message;
+		return false;
+	}
+
+	std::mutex mutex_;
+	std::condition_variable hashed_;
+	std::string error_;
+};
@@ -0,0 +1,97 @@
+#pragma once
+#include <string>
+#include "fileio.hpp"
+
+// A file system path in the native encoding, with the few helpers the
+// installer needs. Both separators are accepted, PATH_SEP is written.
+class Path : public PathString {
+public:
+	Path(const PathChar* path) : PathString(path) {}
+	Path(const PathString& path) : PathString(path) {}
+
+	Path operator /(const PathChar* part) const {
+		return Join(part, std::char_traits<PathChar>::length(part));
+	}
+
+	Path operator /(const PathString& part) const {
+		return Join(part.data(), part.size());
+	}
+
+	bool MakeDir() const {
+		return MakeDirs(*this);
+	}
+
+	operator const PathChar*() const {
+		return c_str();
+	}
+
+	// Ends with a separator.
+	bool IsDir() const {
+		return !empty() && IsPathSep(back());
+	}
+
+	PathString Name() const {
+		for (size_t i = size() < 2 ? 0 : size() - 1; i-- > 0;) {
+			if (IsPathSep((*this)[i])) {
+				PathString result = substr(i + 1);
+				if (IsDir())
+					result.pop_back();
+				return result;
+			}
+		}
+
+		return *this;
+	}
+
+	// The path without its last part; roots such as "C:\" and "/" are
+	// kept, a bare name has no parent.
+	Path Parent() const {
+		size_t end = size();
+		while (end > 1 && IsPathSep((*this)[end - 1]))
+			--end;
+		size_t sep = end;
+		while (sep > 0 && !IsPathSep((*this)[sep - 1]))
+			--sep;
+
+		// |sep| is one past the last separator, 0 without one
+		size_t len = 0;
+		if (sep == 0)
+			len = IsDrive(end) ? end : 0;
+		else if (sep == 1 || (sep == 3 && IsDrive(2)))
+			len = sep;
+		else
+			len = sep - 1;
+
+		PathString path(*this, 0, len);
+		for (PathChar& c : path) {
+			if (IsPathSep(c))
+				c = PATH_SEP;
+		}
+		return path;
+	}
+
+	bool IsExists() const {
+		uint64_t size = 0;
+		return IsDirExists(c_str()) || QueryFileSize(c_str(), &size);
+	}
+
+private:
+	// One allocation for the joined path.
+	Path Join(const PathChar* part, size_t len) const {
+		if (len == 0 || (len == 1 && part[0] == '.'))
+			return *this;
+
+		Path path{ PathString() };
+		path.reserve(size() + 1 + len);
+		path.append(*this);
+		if (!IsDir())
+			path.push_back(PATH_SEP);
+		path.append(part, len);
+		return path;
+	}
+
+	// Whether the first |len| characters are a drive such as "C:".
+	bool IsDrive(size_t len) const {
+		return len == 2 && size() >= 2 && (*this)[1] == ':';
+	}
+};
@@ -0,0 +1,255 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <wctype.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "fileio.hpp"
+
+// Path building for extraction without a heap allocation per path.
+// PathArena hands out null-terminated strings from large chunks that are
+// freed together. PathTree interns the directories below a root: each
+// directory's full path is stored once, and a file path is its parent's
+// string plus one name, built with a single copy into the arena. Names
+// are matched the way the file system does, on Windows regardless of
+// case.
+
+// A null-terminated path owned by an arena.
+struct ArenaPath {
+	const PathChar* str = NULL;
+	size_t len = 0;
+
+	const PathChar* c_str() const {
+		return str;
+	}
+};
+
+class PathArena {
+public:
+	static const size_t CHUNK_CHARS = 64 * 1024;
+
+	PathArena() {}
+	PathArena(const PathArena&) = delete;
+	PathArena& operator=(const PathArena&) = delete;
+
+	// Room for |len| characters and the terminator, valid until Clear().
+	PathChar* Allocate(size_t len) {
+		if (len + 1 > left_) {
+			size_t size = len + 1 > CHUNK_CHARS ? len + 1 : CHUNK_CHARS;
+			chunks_.emplace_back(new PathChar[size]);
+			next_ = chunks_.back().get();
+			left_ = size;
+		}
+		PathChar* p = next_;
+		next_ += len + 1;
+		left_ -= len + 1;
+		p[len] = 0;
+		return p;
+	}
+
+	void Clear() {
+		chunks_.clear();
+		next_ = NULL;
+		left_ = 0;
+	}
+
+private:
+	std::vector<std::unique_ptr<PathChar[]>> chunks_;
+	PathChar* next_ = NULL;
+	size_t left_ = 0;
+};
+
+class PathTree {
+public:
+	typedef uint32_t Dir;
+	static const Dir ROOT = 0;
+	static const Dir NOT_FOUND = 0xffffffffu;
+
+	// The root gets the "\\?\" prefix, so every path built here also
+	// works beyond MAX_PATH.
+	explicit PathTree(const PathString& root) {
+		PathString path = LongPath(root);
+		while (path.size() > 1 && IsPathSep(path.back()))
+			path.pop_back();
+
+		Node node;
+		node.path.len = path.size();
+		PathChar* str = arena_.Allocate(path.size());
+		memcpy(str, path.data(), path.size() * sizeof(PathChar));
+		node.path.str = str;
+		nodes_.push_back(node);
+	}
+
+	PathTree(const PathTree&) = delete;
+	PathTree& operator=(const PathTree&) = delete;
+
+	// The directory |name| below |parent|, added on first use. |name| is
+	// a single component. NOT_FOUND if a file took the name.
+	Dir Intern(Dir parent, const PathChar* name, size_t len) {
+		Key key = { parent, name, len };
+		auto it = index_.find(key);
+		if (it != index_.end())
+			return it->second;
+		if (files_.count(key))
+			return NOT_FOUND;
+
+		Node node;
+		node.path = Join(parent, name, len);
+		nodes_.push_back(node);
+		Dir dir = (Dir)(nodes_.size() - 1);
+		key.name = node.path.str + node.path.len - len;
+		index_.emplace(key, dir);
+		return dir;
+	}
+
+	// |utf8| false takes |name| in the OEM code page, as zip entries
+	// without the UTF-8 flag.
+	Dir InternUtf8(Dir parent, const char* name, size_t len, bool utf8 = true) {
+		ToNative(name, len, utf8);
+		return Intern(parent, scratch_.data(), scratch_.size());
+	}
+
+	// The directory at the '/' or '\\' separated |path| below the root,
+	// with its parents; NOT_FOUND if a component is unsafe. Archives list
+	// files directory by directory, so the last lookup is remembered.
+	Dir InternPathUtf8(const char* path, size_t len) {
+		if (lastValid_ && lastPath_.size() == len && memcmp(lastPath_.data(), path, len) == 0)
+			return lastDir_;
+
+		Dir dir = ROOT;
+		size_t begin = 0;
+		while (begin < len) {
+			size_t sep = begin;
+			while (sep < len && path[sep] != '/' && path[sep] != '\\')
+				++sep;
+			if (!IsSafeName(path + begin, sep - begin))
+				return NOT_FOUND;
+			dir = InternUtf8(dir, path + begin, sep - begin);
+			if (dir == NOT_FOUND)
+				return NOT_FOUND;
+			begin = sep + 1;
+		}
+
+		lastPath_.assign(path, len);
+		lastDir_ = dir;
+		lastValid_ = true;
+		return dir;
+	}
+
+	// The path of |name| in |dir|.
+	ArenaPath Join(Dir dir, const PathChar* name, size_t len) {
+		const ArenaPath& base = nodes_[dir].path;
+		ArenaPath path;
+		path.len = base.len + 1 + len;
+		PathChar* str = arena_.Allocate(path.len);
+		memcpy(str, base.str, base.len * sizeof(PathChar));
+		str[base.len] = PATH_SEP;
+		memcpy(str + base.len + 1, name, len * sizeof(PathChar));
+		path.str = str;
+		return path;
+	}
+
+	ArenaPath JoinUtf8(Dir dir, const char* name, size_t len, bool utf8 = true) {
+		ToNative(name, len, utf8);
+		return Join(dir, scratch_.data(), scratch_.size());
+	}
+
+	// Joins the file |name| to |dir| like JoinUtf8(), but false when a
+	// file or directory of that name was added to |dir| before.
+	bool AddFileUtf8(Dir dir, const char* name, size_t len, bool utf8, ArenaPath* path) {
+		ToNative(name, len, utf8);
+		Key key = { dir, scratch_.data(), scratch_.size() };
+		if (files_.count(key) || index_.count(key))
+			return false;
+
+		*path = Join(dir, scratch_.data(), scratch_.size());
+		key.name = path->str + path->len - key.len;
+		files_.insert(key);
+		return true;
+	}
+
+	const ArenaPath& DirPath(Dir dir) const {
+		return nodes_[dir].path;
+	}
+
+	size_t DirCount() const {
+		return nodes_.size();
+	}
+
+	// A name that stays in its directory: not empty, "." or "..", and
+	// without separators or drive colons.
+	static bool IsSafeName(const char* name, size_t len) {
+		if (len == 0 || (len <= 2 && name[0] == '.' && name[len - 1] == '.'))
+			return false;
+		for (size_t i = 0; i < len; ++i) {
+			if (name[i] == '/' || name[i] == '\\' || name[i] == ':')
+				return false;
+		}
+		return true;
+	}
+
+private:
+	struct Node {
+		ArenaPath path;
+	};
+
+	struct Key {
+		Dir parent;
+		const PathChar* name;
+		size_t len;
+
+		bool operator==(const Key& other) const {
+			if (parent != other.parent || len != other.len)
+				return false;
+			for (size_t i = 0; i < len; ++i) {
+				if (Fold(name[i]) != Fold(other.name[i]))
+					return false;
+			}
+			return true;
+		}
+	};
+
+	// FNV-1a over the name, seeded with the parent.
+	struct KeyHash {
+		size_t operator()(const Key& key) const {
+			uint64_t hash = 14695981039346656037ull ^ key.parent;
+			for (size_t i = 0; i < key.len; ++i)
+				hash = (hash ^ (uint64_t)Fold(key.name[i])) * 1099511628211ull;
+			return (size_t)hash;
+		}
+	};
+
+	static PathChar Fold(PathChar c) {
+#ifdef _WIN32
+		return (PathChar)towlower(c);
+#else
+		return c;
+#endif
+	}
+
+	// Converts into a reused buffer, no allocation once it is big enough.
+	void ToNative(const char* name, size_t len, bool utf8 = true) {
+#ifdef _WIN32
+		UINT codePage = utf8 ? CP_UTF8 : CP_OEMCP;
+		int wlen = MultiByteToWideChar(codePage, 0, name, (int)len, NULL, 0);
+		scratch_.resize(wlen > 0 ? wlen : 0);
+		if (wlen > 0)
+			MultiByteToWideChar(codePage, 0, name, (int)len, &scratch_[0], wlen);
+#else
+		(void)utf8;
+		scratch_.assign(name, len);
+#endif
+	}
+
+	PathArena arena_;
+	std::vector<Node> nodes_;
+	std::unordered_map<Key, Dir, KeyHash> index_;
+	std::unordered_set<Key, KeyHash> files_;
+	PathString scratch_;
+	std::string lastPath_;
+	Dir lastDir_ = ROOT;
+	bool lastValid_ = false;
+};
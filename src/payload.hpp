@@ -0,0 +1,348 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "blockcodec.hpp"
+#include "endian.hpp"
+#include "fileio.hpp"
+#include "inflate.hpp"
+#include "sha256.hpp"
+#include "taskpool.hpp"
+
+// Payload container appended to the installer image:
+//
+//   [host image][payload 0]...[payload N-1][index][footer]
+//
+// The footer sits at EOF and locates the index, so every payload can be
+// found by name with one read (or one look into a mapping). Integers are
+// little-endian. Index entries use 32-bit offsets and sizes unless the
+// footer carries PAYLOAD_INDEX_OFFSET64.
+//
+//   footer (40 bytes): magic[8] version[2] flags[2] count[4]
+//                      host_size[8] index_offset[8] index_size[4] index_crc[4]
+//   entry:             name_len[2] flags[2] hash_type[1] reserved[3]
+//                      offset[4|8] stored_size[4|8] size[4|8] hash[32] name
+//                      [digest_count[4] digests[32 * digest_count]]
+//
+// Entries flagged PAYLOAD_BLOCK_STREAM are stored as a BlockStream
+// (blockcodec.hpp); their size is the decoded size, their hash covers the
+// stored bytes. Entries flagged PAYLOAD_ENTRY_DIGESTS are zips that carry
+// the digests of ZipArchive::HashEntries().
+//
+// The hash names a payload, it is not checked on install: that would be a
+// pass of its own over every payload. The extractors check each piece
+// where they read it instead, a BlockStream its blocks, a zip with entry
+// digests its entries.
+//
+// Images built before the index existed end in a chain of big-endian
+// offset|length|offset^length triples, one per payload, walked backwards
+// from EOF. Open() still reads those; their payloads have no names.
+
+enum PayloadHashType : uint8_t {
+	PAYLOAD_HASH_NONE = 0,
+	PAYLOAD_HASH_CRC32 = 1,
+	PAYLOAD_HASH_SHA256 = 2,
+};
+
+struct PayloadEntry {
+	std::string name;
+	uint64_t offset = 0;
+	uint64_t storedSize = 0;
+	uint64_t size = 0;
+	uint16_t flags = 0;
+	uint8_t hashType = PAYLOAD_HASH_NONE;
+	uint8_t hash[32] = {};
+	// PAYLOAD_ENTRY_DIGESTS
+	std::string entryDigests;
+};
+
+const char PAYLOAD_MAGIC[8] = { 'C', 'R', 'E', 'E', 'P', 'E', 'R', '\x1a' };
+const uint16_t PAYLOAD_VERSION = 1;
+const uint16_t PAYLOAD_INDEX_OFFSET64 = 0x0001;
+const size_t PAYLOAD_FOOTER_SIZE = 40;
+const uint16_t PAYLOAD_BLOCK_STREAM = 0x0001;
+const uint16_t PAYLOAD_ENTRY_DIGESTS = 0x0002;
+
+class PayloadTable {
+	static const size_t LEGACY_TRAILER_SIZE = 12;
+
+public:
+	bool Open(const uint8_t* image, size_t size) {
+		image_ = image;
+		size_ = size;
+		entries_.clear();
+		error_.clear();
+		legacy_ = false;
+		hostSize_ = size;
+
+		if (size_ >= PAYLOAD_FOOTER_SIZE && memcmp(image_ + size_
+				- PAYLOAD_FOOTER_SIZE, PAYLOAD_MAGIC, sizeof(PAYLOAD_MAGIC)) == 0)
+			return ReadIndex();
+
+		ReadLegacyChain();
+		return true;
+	}
+
+	bool IsLegacy() const {
+		return legacy_;
+	}
+
+	uint64_t HostSize() const {
+		return hostSize_;
+	}
+
+	const std::vector<PayloadEntry>& Entries() const {
+		return entries_;
+	}
+
+	const std::string& Error() const {
+		return error_;
+	}
+
+	const PayloadEntry* Find(const std::string& name) const {
+		for (const PayloadEntry& entry : entries_) {
+			if (entry.name == name)
+				return &entry;
+		}
+		return NULL;
+	}
+
+	const uint8_t* Data(const PayloadEntry& entry) const {
+		return image_ + entry.offset;
+	}
+
+private:
+	bool Fail(const std::string& message) {
+		error_ = message;
+		entries_.clear();
+		return false;
+	}
+
+	bool ReadIndex() {
+		const uint8_t* footer = image_ + size_ - PAYLOAD_FOOTER_SIZE;
+		uint16_t version = GetLe16(footer + 8);
+		uint16_t flags = GetLe16(footer + 10);
+		uint32_t count = GetLe32(footer + 12);
+		uint64_t hostSize = GetLe64(footer + 16);
+		uint64_t indexOffset = GetLe64(footer + 24);
+		uint32_t indexSize = GetLe32(footer + 32);
+		uint32_t indexCrc = GetLe32(footer + 36);
+
+		if (version != PAYLOAD_VERSION)
+			return Fail("unsupported payload index version");
+
+		uint64_t footerPos = size_ - PAYLOAD_FOOTER_SIZE;
+		if (indexOffset > footerPos || indexSize != footerPos - indexOffset
+				|| hostSize > indexOffset)
+			return Fail("payload index out of range");
+
+		const uint8_t* p = image_ + indexOffset;
+		const uint8_t* end = p + indexSize;
+		if (Crc32::Update(0, p, indexSize) != indexCrc)
+			return Fail("payload index checksum mismatch");
+
+		bool wide = (flags & PAYLOAD_INDEX_OFFSET64) != 0;
+		size_t fieldSize = wide ? 8 : 4;
+		size_t fixedSize = 8 + 3 * fieldSize + 32;
+		for (uint32_t i = 0; i < count; ++i) {
+			if ((size_t)(end - p) < fixedSize)
+				return Fail("truncated payload index");
+
+			PayloadEntry entry;
+			size_t nameLen = GetLe16(p);
+			entry.flags = GetLe16(p + 2);
+			entry.hashType = p[4];
+			p += 8;
+			entry.offset = wide ? GetLe64(p) : GetLe32(p);
+			entry.storedSize = wide ? GetLe64(p + fieldSize) : GetLe32(p + fieldSize);
+			entry.size = wide ? GetLe64(p + 2 * fieldSize) : GetLe32(p + 2 * fieldSize);
+			p += 3 * fieldSize;
+			memcpy(entry.hash, p, sizeof(entry.hash));
+			p += sizeof(entry.hash);
+
+			if ((size_t)(end - p) < nameLen)
+				return Fail("truncated payload index");
+			entry.name.assign((const char*)p, nameLen);
+			p += nameLen;
+
+			if (entry.flags & PAYLOAD_ENTRY_DIGESTS) {
+				if (end - p < 4 || GetLe32(p) > (size_t)(end - p - 4) / Sha256::DIGEST_SIZE)
+					return Fail("truncated payload index");
+				size_t digestsSize = GetLe32(p) * Sha256::DIGEST_SIZE;
+				entry.entryDigests.assign((const char*)p + 4, digestsSize);
+				p += 4 + digestsSize;
+			}
+
+			if (entry.offset < hostSize || entry.offset > indexOffset
+					|| entry.storedSize > indexOffset - entry.offset)
+				return Fail("payload out of range: " + entry.name);
+
+			entries_.push_back(entry);
+		}
+
+		hostSize_ = hostSize;
+		return true;
+	}
+
+	void ReadLegacyChain() {
+		std::vector<PayloadEntry> chain;
+		uint64_t end = size_;
+
+		while (end >= LEGACY_TRAILER_SIZE) {
+			const uint8_t* t = image_ + end - LEGACY_TRAILER_SIZE;
+			uint32_t offset = GetBe32(t);
+			uint32_t length = GetBe32(t + 4);
+			uint32_t checksum = GetBe32(t + 8);
+
+			// every payload directly precedes its own trailer
+			uint64_t payloadEnd = end - LEGACY_TRAILER_SIZE;
+			if (!length || (offset ^ length) != checksum
+					|| (uint64_t)offset + length != payloadEnd)
+				break;
+
+			PayloadEntry entry;
+			entry.offset = offset;
+			entry.storedSize = length;
+			entry.size = length;
+			chain.push_back(entry);
+			end = offset;
+		}
+
+		if (chain.empty())
+			return;
+
+		legacy_ = true;
+		hostSize_ = end;
+		entries_.assign(chain.rbegin(), chain.rend());
+	}
+
+	const uint8_t* image_ = NULL;
+	size_t size_ = 0;
+	uint64_t hostSize_ = 0;
+	bool legacy_ = false;
+	std::vector<PayloadEntry> entries_;
+	std::string error_;
+};
+
+// Streams host + payloads to a new image and closes it with the index.
+class PayloadWriter {
+public:
+	bool Create(const PathChar* path) {
+		pos_ = 0;
+		entries_.clear();
+		return file_.Create(path);
+	}
+
+	bool WriteHost(const uint8_t* data, size_t size) {
+		hostSize_ = size;
+		return Write(data, size);
+	}
+
+	// Hashes the payload with SHA-256 block by block as it is written,
+	// unless the caller already has its |digest|.
+	bool AddPayload(const std::string& name, const uint8_t* data, size_t size,
+			const uint8_t* digest = NULL) {
+		const size_t BLOCK_SIZE = 1024 * 1024;
+
+		PayloadEntry entry;
+		entry.name = name;
+		entry.offset = pos_;
+		entry.storedSize = size;
+		entry.size = size;
+		entry.hashType = PAYLOAD_HASH_SHA256;
+
+		Sha256 sha;
+		for (size_t done = 0; done < size; done += BLOCK_SIZE) {
+			size_t block = size - done < BLOCK_SIZE ? size - done : BLOCK_SIZE;
+			if (!digest)
+				sha.Update(data + done, block);
+			if (!Write(data + done, block))
+				return false;
+		}
+		if (digest)
+			memcpy(entry.hash, digest, sizeof(entry.hash));
+		else
+			sha.Final(entry.hash);
+
+		entries_.push_back(entry);
+		return true;
+	}
+
+	// Attaches the entry digests of the zip added last.
+	void AddEntryDigests(const std::string& digests) {
+		entries_.back().entryDigests = digests;
+		entries_.back().flags |= PAYLOAD_ENTRY_DIGESTS;
+	}
+
+	// Stores the payload block-compressed, encoding the blocks on |pool|.
+	bool AddCompressedPayload(const std::string& name, const uint8_t* data, size_t size,
+			TaskPool* pool) {
+		std::string stream = BlockStream::Encode(data, size, pool);
+		if (!AddPayload(name, (const uint8_t*)stream.data(), stream.size()))
+			return false;
+		entries_.back().size = size;
+		entries_.back().flags |= PAYLOAD_BLOCK_STREAM;
+		return true;
+	}
+
+	// Appends a payload taken from another image, keeping its metadata.
+	bool CopyPayload(const PayloadEntry& source, const uint8_t* data) {
+		PayloadEntry entry = source;
+		entry.offset = pos_;
+		entries_.push_back(entry);
+		return Write(data, (size_t)entry.storedSize);
+	}
+
+	bool Finish() {
+		bool wide = pos_ > 0xffffffffu;
+		for (const PayloadEntry& entry : entries_)
+			wide = wide || entry.size > 0xffffffffu;
+
+		std::string index;
+		for (const PayloadEntry& entry : entries_) {
+			PutLe16(&index, (uint16_t)entry.name.size());
+			PutLe16(&index, entry.flags);
+			index.push_back((char)entry.hashType);
+			index.append(3, '\0');
+			uint64_t fields[] = { entry.offset, entry.storedSize, entry.size };
+			for (uint64_t field : fields) {
+				if (wide)
+					PutLe64(&index, field);
+				else
+					PutLe32(&index, (uint32_t)field);
+			}
+			index.append((const char*)entry.hash, sizeof(entry.hash));
+			index.append(entry.name);
+			if (entry.flags & PAYLOAD_ENTRY_DIGESTS) {
+				PutLe32(&index, (uint32_t)(entry.entryDigests.size() / Sha256::DIGEST_SIZE));
+				index.append(entry.entryDigests);
+			}
+		}
+
+		std::string footer(PAYLOAD_MAGIC, sizeof(PAYLOAD_MAGIC));
+		PutLe16(&footer, PAYLOAD_VERSION);
+		PutLe16(&footer, wide ? PAYLOAD_INDEX_OFFSET64 : 0);
+		PutLe32(&footer, (uint32_t)entries_.size());
+		PutLe64(&footer, hostSize_);
+		PutLe64(&footer, pos_);
+		PutLe32(&footer, (uint32_t)index.size());
+		PutLe32(&footer, Crc32::Update(0, index.data(), index.size()));
+
+		bool result = Write(index.data(), index.size())
+			&& Write(footer.data(), footer.size());
+		file_.Close();
+		return result;
+	}
+
+private:
+	bool Write(const void* data, size_t size) {
+		pos_ += size;
+		return file_.Write(data, size);
+	}
+
+	File file_;
+	uint64_t pos_ = 0;
+	uint64_t hostSize_ = 0;
+	std::vector<PayloadEntry> entries_;
+};
@@ -0,0 +1,149 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Install progress shared between the workers and the wait window.
+// The installer plans all the work it knows of up front, before any of
+// it starts, so the totals do not move under a running bar. Workers then
+// add finished work with relaxed atomic adds, the extractors once per
+// batch. The window samples the counters on a timer, so a worker never
+// waits for the UI and nothing is sent per file.
+class Progress {
+public:
+	struct Sample {
+		std::string phase;
+		uint64_t files = 0;
+		uint64_t bytes = 0;
+		uint64_t totalFiles = 0;
+		uint64_t totalBytes = 0;
+	};
+
+	static Progress& Get() {
+		static Progress progress;
+		return progress;
+	}
+
+	// Steps running side by side each begin and end their phase. The one
+	// shown is the oldest still running, so the label only moves on when
+	// that step ends, not whenever another one starts.
+	void BeginPhase(const std::string& name) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		phases_.push_back(name);
+	}
+
+	void EndPhase(const std::string& name) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (size_t i = 0; i < phases_.size(); ++i) {
+			if (phases_[i] == name) {
+				phases_.erase(phases_.begin() + i);
+				break;
+			}
+		}
+	}
+
+	void Plan(uint64_t files, uint64_t bytes) {
+		totalFiles_.fetch_add(files, std::memory_order_relaxed);
+		totalBytes_.fetch_add(bytes, std::memory_order_relaxed);
+	}
+
+	// Planned work that turned out not to be needed, unchanged files say.
+	// The bar only moves forward from it.
+	void Drop(uint64_t files, uint64_t bytes) {
+		totalFiles_.fetch_sub(files, std::memory_order_relaxed);
+		totalBytes_.fetch_sub(bytes, std::memory_order_relaxed);
+	}
+
+	void Done(uint64_t files, uint64_t bytes) {
+		files_.fetch_add(files, std::memory_order_relaxed);
+		bytes_.fetch_add(bytes, std::memory_order_relaxed);
+	}
+
+	// The counters are read one by one, a sample may be off by a batch.
+	Sample Take() const {
+		Sample sample;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!phases_.empty())
+				sample.phase = phases_.front();
+		}
+		sample.files = files_.load(std::memory_order_relaxed);
+		sample.bytes = bytes_.load(std::memory_order_relaxed);
+		sample.totalFiles = totalFiles_.load(std::memory_order_relaxed);
+		sample.totalBytes = totalBytes_.load(std::memory_order_relaxed);
+		return sample;
+	}
+
+	void Reset() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			phases_.clear();
+		}
+		files_ = 0;
+		bytes_ = 0;
+		totalFiles_ = 0;
+		totalBytes_ = 0;
+	}
+
+private:
+	Progress() {}
+
+	// finished work is bumped by every worker, planned work rarely, so
+	// they live on separate cache lines
+	alignas(64) std::atomic<uint64_t> files_{ 0 };
+	std::atomic<uint64_t> bytes_{ 0 };
+	alignas(64) std::atomic<uint64_t> totalFiles_{ 0 };
+	std::atomic<uint64_t> totalBytes_{ 0 };
+	mutable std::mutex mutex_;
+	std::vector<std::string> phases_;
+};
+
+// Turns samples taken at intervals into a fraction, a throughput and a
+// time left. The fraction never goes back, even if a sample reads the
+// counters halfway through an update.
+class ProgressRate {
+public:
+	// |nowMs| is any monotonic clock.
+	void Update(const Progress::Sample& sample, uint64_t nowMs) {
+		if (sample.totalBytes > 0) {
+			double fraction = (double)sample.bytes / sample.totalBytes;
+			fraction = fraction > 1 ? 1 : fraction;
+			fraction_ = fraction > fraction_ ? fraction : fraction_;
+		}
+
+		if (started_ && nowMs > lastMs_) {
+			uint64_t bytes = sample.bytes > lastBytes_ ? sample.bytes - lastBytes_ : 0;
+			double rate = bytes * 1000.0 / (nowMs - lastMs_);
+			// smoothed over about a second at the usual sampling rate
+			rate_ = rate_ > 0 ? rate_ * 0.8 + rate * 0.2 : rate;
+		}
+		started_ = true;
+		lastMs_ = nowMs;
+		lastBytes_ = sample.bytes;
+		left_ = sample.totalBytes > sample.bytes ? sample.totalBytes - sample.bytes : 0;
+	}
+
+	// 0 to 1 of the planned bytes.
+	double Fraction() const {
+		return fraction_;
+	}
+
+	double BytesPerSecond() const {
+		return rate_;
+	}
+
+	// Seconds until the planned work is done, negative while unknown.
+	double SecondsLeft() const {
+		return rate_ > 0 ? left_ / rate_ : -1;
+	}
+
+private:
+	bool started_ = false;
+	uint64_t lastMs_ = 0;
+	uint64_t lastBytes_ = 0;
+	uint64_t left_ = 0;
+	double rate_ = 0;
+	double fraction_ = 0;
+};
@@ -0,0 +1,127 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "asyncio.hpp"
+#include "fileio.hpp"
+#include "solid.hpp"
+#include "taskpool.hpp"
+#include "treedelete.hpp"
+#include "zip.hpp"
+
+// Content-addressed store for extracted runtimes, one directory per
+// payload hash below |root|. A runtime is extracted to "<key>.tmp" and
+// published as "<key>" only once the extraction, which checks the payload,
+// succeeded and the install is complete, so an existing "<key>" is always
+// usable and an identical runtime is never extracted twice. Installs reach
+// the current runtime through a directory link.
+class RuntimeCache {
+public:
+	explicit RuntimeCache(const PathString& root) : root_(root) {}
+
+	PathString PathFor(const std::string& key) const {
+		return root_ + PATH_SEP + Utf8ToPath(key.data(), key.size());
+	}
+
+	bool Has(const std::string& key) const {
+		return IsDirExists(PathFor(key).c_str());
+	}
+
+	// Makes sure the runtime |key| can be published, extracting the
+	// archive at |data|, a zip or a solid archive, to "<key>.tmp" unless
+	// "<key>" is cached already. A zip is checked against |entryDigests|
+	// if given. Nothing is left behind on failure.
+	bool Prepare(const std::string& key, const uint8_t* data, size_t size,
+			TaskPool* pool, IoBackend io = IO_SYNC,
+			const std::string& entryDigests = std::string()) {
+		if (Has(key))
+			return true;
+
+		PathString tmp = TempPathFor(key);
+		DeleteTree(tmp);
+		if (!MakeDirs(tmp))
+			return Fail("failed to create " + PathToUtf8(tmp));
+
+		if (SolidArchive::IsSolid(data, size)) {
+			SolidArchive solid;
+			if (!solid.Open(data, size) || !solid.ExtractTo(tmp, pool, io)) {
+				DeleteTree(tmp);
+				return Fail(solid.Error());
+			}
+		}
+		else {
+			ZipArchive zip;
+			if (!zip.Open(data, size)
+					|| (!entryDigests.empty() && !zip.UseDigests(entryDigests))
+					|| !zip.ExtractTo(tmp, pool, io)) {
+				DeleteTree(tmp);
+				return Fail(zip.Error());
+			}
+		}
+
+		return true;
+	}
+
+	// Moves the runtime extracted by Prepare() into place, once the rest of
+	// the install succeeded as well. A cached runtime stays as it is.
+	bool Publish(const std::string& key) {
+		PathString tmp = TempPathFor(key);
+		if (Has(key)) {
+			DeleteTree(tmp);
+			return true;
+		}
+		if (!RenamePath(tmp.c_str(), PathFor(key).c_str())) {
+			DeleteTree(tmp);
+			return Fail("failed to move " + PathToUtf8(tmp) + " into place");
+		}
+		return true;
+	}
+
+	// Points |link| at the runtime |key|. Whatever |link| was before, an
+	// older link or a directory from an install without the cache, is
+	// replaced.
+	bool Link(const PathString& link, const std::string& key) {
+		PathString next = link + Utf8ToPath(".new", 4);
+		RemoveTree(next);
+		if (!CreateDirLink(next, PathFor(key)))
+			return Fail("failed to link " + PathToUtf8(link));
+
+#ifndef _WIN32
+		// a symlink can be swapped in one step
+		if (RenamePath(next.c_str(), link.c_str()))
+			return true;
+#endif
+		if (!RemoveTree(link) || !RenamePath(next.c_str(), link.c_str())) {
+			RemoveTree(next);
+			return Fail("failed to replace " + PathToUtf8(link));
+		}
+		return true;
+	}
+
+	// Deletes every runtime but |keep|, including unfinished extractions.
+	void Prune(const std::string& keep) {
+		std::vector<DirEntry> entries;
+		ListDir(root_, &entries);
+		PathString kept = Utf8ToPath(keep.data(), keep.size());
+		for (const DirEntry& entry : entries) {
+			if (entry.name != kept)
+				DeleteTree(root_ + PATH_SEP + entry.name);
+		}
+	}
+
+	const std::string& Error() const {
+		return error_;
+	}
+
+private:
+	PathString TempPathFor(const std::string& key) const {
+		return PathFor(key) + Utf8ToPath(".tmp", 4);
+	}
+
+	bool Fail(const std::string& message) {
+		error_ = message;
+		return false;
+	}
+
+	PathString root_;
+	std::string error_;
+};
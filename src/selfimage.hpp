@@ -0,0 +1,203 @@
+#pragma once
+#include <string.h>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include "blockcodec.hpp"
+#include "copyengine.hpp"
+#include "fileio.hpp"
+#include "packer.hpp"
+#include "path.hpp"
+#include "payload.hpp"
+#include "sha256.hpp"
+#include "taskpool.hpp"
+#include "zip.hpp"
+
+struct MappedPayload {
+	const uint8_t* data = NULL;
+	size_t size = 0;
+	// hex SHA-256 naming the payload
+	std::string key;
+	// for ZipArchive::UseDigests(), empty if the payload has none
+	std::string entryDigests;
+};
+
+// The installer image: the host executable followed by its payloads and
+// the payload index. Payloads are read straight from the mapped image;
+// new images are written with the same PayloadWriter format. Compressed
+// payloads are decoded into memory owned by the image.
+class SelfImage {
+public:
+	bool Open(const PathString& path) {
+		path_ = path;
+		if (!image_.Open(path.c_str()))
+			return Fail("Failed to open: " + PathToUtf8(path));
+
+		if (!table_.Open(image_.Data(), image_.Size()))
+			return Fail("Invalid payload index: " + table_.Error());
+
+		return true;
+	}
+
+	// Compressed payloads are decoded on |pool| from then on, instead of
+	// on a pool of their own. |pool| must outlive the image.
+	void UsePool(TaskPool* pool) {
+		pool_ = pool;
+	}
+
+	bool HasPayload(const char* name) const {
+		return table_.Find(name) != NULL;
+	}
+
+	// Finds a payload by name, else by |legacyIndex|, its position in push
+	// order. Images from before the payload index carry no names, neither
+	// do their payloads once pushed onto, and "push" names a payload after
+	// its file, so the position is what finds those.
+	// The payload points into the mapped image, or into a buffer for a
+	// compressed payload, whose blocks are decoded and checked against
+	// their digests in parallel here. Its key is the stored SHA-256; images
+	// from before the payload index have none, a zip there is named by the
+	// SHA-256 of its central directory, which lists the CRC-32 of every
+	// entry.
+	bool MapPayload(const char* name, size_t legacyIndex, MappedPayload* payload) {
+		const PayloadEntry* entry = table_.Find(name);
+		if (!entry && legacyIndex < table_.Entries().size())
+			entry = &table_.Entries()[legacyIndex];
+
+		if (!entry)
+			return Fail(std::string("Missing payload: ") + name);
+
+		const uint8_t* stored = table_.Data(*entry);
+		size_t storedSize = (size_t)entry->storedSize;
+		if (!(entry->flags & PAYLOAD_BLOCK_STREAM)) {
+			payload->data = stored;
+			payload->size = storedSize;
+			payload->entryDigests = entry->entryDigests;
+		}
+		else {
+			BlockStream stream;
+			if (!stream.Open(stored, storedSize) || stream.RawSize() != entry->size)
+				return Fail(std::string("Damaged payload ") + name + ": " + stream.Error());
+
+			decoded_.emplace_back((size_t)entry->size);
+			std::vector<uint8_t>& raw = decoded_.back();
+			std::unique_ptr<TaskPool> local(pool_ ? NULL : new TaskPool);
+			if (!stream.Decode(raw.data(), pool_ ? pool_ : local.get())) {
+				decoded_.pop_back();
+				return Fail(std::string("Damaged payload ") + name + ": " + stream.Error());
+			}
+			payload->data = raw.data();
+			payload->size = raw.size();
+			payload->entryDigests.clear();
+		}
+
+		uint8_t digest[Sha256::DIGEST_SIZE];
+		if (entry->hashType == PAYLOAD_HASH_SHA256) {
+			memcpy(digest, entry->hash, sizeof(digest));
+		}
+		else {
+			ZipArchive zip;
+			if (!zip.Open(payload->data, payload->size))
+				return Fail(std::string("Damaged payload ") + name + ": " + zip.Error());
+			zip.HashCentralDirectory(digest);
+		}
+		payload->key = Sha256::ToHex(digest);
+		return true;
+	}
+
+	// Writes this image plus |newAttach| as one more payload to |output|.
+	bool PushBackTo(const PathString& newAttach, const PathString& output,
+			const PackOptions& options = PackOptions()) {
+		MappedFile attach;
+		if (!attach.Open(newAttach.c_str()))
+			return Fail("Failed to open: " + PathToUtf8(newAttach));
+
+		PayloadWriter writer;
+		if (!writer.Create(output.c_str()))
+			return Fail("Failed to create: " + PathToUtf8(output));
+
+		bool result = writer.WriteHost(image_.Data(), (size_t)table_.HostSize());
+		for (const PayloadEntry& entry : table_.Entries())
+			result = result && writer.CopyPayload(entry, table_.Data(entry));
+
+		if (!result)
+			return Fail("Failed to write: " + PathToUtf8(output));
+
+		std::string name = PathToUtf8(Path(newAttach).Name());
+		if (options.compress) {
+			TaskPool pool;
+			std::string error;
+			if (!AddCompressedPayload(&writer, name, attach.Data(), attach.Size(), &pool, &error))
+				return Fail("Failed to compress " + PathToUtf8(newAttach) + ": " + error);
+		}
+		else if (!AddPlainPayload(&writer, name, attach.Data(), attach.Size())) {
+			return Fail("Failed to write: " + PathToUtf8(output));
+		}
+
+		if (!writer.Finish())
+			return Fail("Failed to write: " + PathToUtf8(output));
+		return true;
+	}
+
+	// Writes this host plus every payload listed in |manifest| to |output|,
+	// dropping the payloads currently attached to this image.
+	bool PackTo(const PathString& manifest, const PathString& output,
+			const PackOptions& options = PackOptions()) {
+		std::vector<uint8_t> text;
+		if (!ReadWholeFile(manifest.c_str(), &text))
+			return Fail("Failed to open: " + PathToUtf8(manifest));
+
+		std::vector<PackItem> items;
+		std::string error;
+		if (!ParsePackManifest(std::string(text.begin(), text.end()),
+				Path(manifest).Parent(), &items, &error))
+			return Fail("Invalid manifest " + PathToUtf8(manifest) + ": " + error);
+
+		TaskPool pool;
+		Packer packer;
+		if (!packer.Pack(image_.Data(), (size_t)table_.HostSize(),
+				items, output.c_str(), &pool, options))
+			return Fail("Failed to pack " + PathToUtf8(output) + ": " + packer.Error());
+		return true;
+	}
+
+	bool ExtractHostTo(const PathString& path) {
+		return ExtractFile(0, table_.HostSize(), path);
+	}
+
+	const PayloadTable& Table() const {
+		return table_;
+	}
+
+	const std::string& Error() const {
+		return error_;
+	}
+
+private:
+	bool Fail(const std::string& message) {
+		error_ = message;
+		return false;
+	}
+
+	bool ExtractFile(uint64_t offset, uint64_t length, const PathString& path) {
+		File in, out;
+		if (!in.OpenRead(path_.c_str(), true))
+			return Fail("Failed to open: " + PathToUtf8(path_));
+
+		if (!out.Create(path.c_str()))
+			return Fail("Failed to create: " + PathToUtf8(path));
+
+		CopyEngine engine;
+		if (!engine.Copy(in, offset, length, out))
+			return Fail("Failed to extract " + PathToUtf8(path) + ": " + engine.Error());
+		return true;
+	}
+
+	PathString path_;
+	MappedFile image_;
+	PayloadTable table_;
+	TaskPool* pool_ = NULL;
+	std::list<std::vector<uint8_t>> decoded_;
+	std::string error_;
+};
@@ -0,0 +1,246 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SHA256_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SHA256_TARGET
+#else
+#include <cpuid.h>
+#define SHA256_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+#endif
+
+// Streaming SHA-256. Blocks go through the SHA-NI instructions when the
+// CPU has them and through the portable rounds otherwise.
+class Sha256 {
+public:
+	static const size_t DIGEST_SIZE = 32;
+
+	Sha256() {
+		static const uint32_t init[8] = {
+			0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+			0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+		};
+		memcpy(state_, init, sizeof(state_));
+	}
+
+	void Update(const void* data, size_t len) {
+		const uint8_t* p = (const uint8_t*)data;
+		total_ += len;
+
+		if (bufLen_) {
+			size_t take = 64 - bufLen_ < len ? 64 - bufLen_ : len;
+			memcpy(buf_ + bufLen_, p, take);
+			bufLen_ += take;
+			p += take;
+			len -= take;
+			if (bufLen_ < 64)
+				return;
+			Compress(state_, buf_, 1);
+			bufLen_ = 0;
+		}
+
+		if (len >= 64) {
+			Compress(state_, p, len / 64);
+			p += len & ~(size_t)63;
+			len &= 63;
+		}
+
+		memcpy(buf_, p, len);
+		bufLen_ = len;
+	}
+
+	void Final(uint8_t digest[DIGEST_SIZE]) {
+		uint64_t bits = total_ * 8;
+		uint8_t pad[72] = { 0x80 };
+		size_t padLen = (bufLen_ < 56 ? 56 : 120) - bufLen_;
+		for (int i = 0; i < 8; ++i)
+			pad[padLen + i] = (uint8_t)(bits >> (56 - 8 * i));
+		Update(pad, padLen + 8);
+
+		for (int i = 0; i < 8; ++i) {
+			digest[4 * i] = (uint8_t)(state_[i] >> 24);
+			digest[4 * i + 1] = (uint8_t)(state_[i] >> 16);
+			digest[4 * i + 2] = (uint8_t)(state_[i] >> 8);
+			digest[4 * i + 3] = (uint8_t)state_[i];
+		}
+	}
+
+	static void Hash(const void* data, size_t len, uint8_t digest[DIGEST_SIZE]) {
+		Sha256 sha;
+		sha.Update(data, len);
+		sha.Final(digest);
+	}
+
+	static std::string ToHex(const uint8_t digest[DIGEST_SIZE]) {
+		static const char hex[] = "0123456789abcdef";
+		std::string result;
+		for (size_t i = 0; i < DIGEST_SIZE; ++i) {
+			result.push_back(hex[digest[i] >> 4]);
+			result.push_back(hex[digest[i] & 15]);
+		}
+		return result;
+	}
+
+	static bool HasHardwareSupport() {
+#ifdef SHA256_X86
+		static const bool supported = DetectShaNi();
+		return supported;
+#else
+		return false;
+#endif
+	}
+
+	// Lets benchmarks compare the kernels, on by default.
+	static bool& UseHardware() {
+		static bool enabled = true;
+		return enabled;
+	}
+
+private:
+	static const uint32_t* K() {
+		static const uint32_t k[64] = {
+			0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+			0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+			0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+			0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+			0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+			0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+			0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+			0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+		};
+		return k;
+	}
+
+	static void Compress(uint32_t state[8], const uint8_t* blocks, size_t count) {
+#ifdef SHA256_X86
+		if (UseHardware() && HasHardwareSupport()) {
+			CompressShaNi(state, blocks, count);
+			return;
+		}
+#endif
+		CompressPortable(state, blocks, count);
+	}
+
+	static uint32_t Rotr(uint32_t x, int n) {
+		return (x >> n) | (x << (32 - n));
+	}
+
+	static void CompressPortable(uint32_t state[8], const uint8_t* p, size_t count) {
+		const uint32_t* k = K();
+		for (; count--; p += 64) {
+			uint32_t w[64];
+			for (int i = 0; i < 16; ++i) {
+				w[i] = ((uint32_t)p[4 * i] << 24) | (p[4 * i + 1] << 16)
+					| (p[4 * i + 2] << 8) | p[4 * i + 3];
+			}
+			for (int i = 16; i < 64; ++i) {
+				uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+
+			uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+			uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+			for (int i = 0; i < 64; ++i) {
+				uint32_t s1 = Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25);
+				uint32_t ch = (e & f) ^ (~e & g);
+				uint32_t t1 = h + s1 + ch + k[i] + w[i];
+				uint32_t s0 = Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22);
+				uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+				uint32_t t2 = s0 + maj;
+				h = g; g = f; f = e; e = d + t1;
+				d = c; c = b; b = a; a = t1 + t2;
+			}
+
+			state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+			state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+		}
+	}
+
+#ifdef SHA256_X86
+	static bool DetectShaNi() {
+		int leaf1[4] = {}, leaf7[4] = {};
+#ifdef _MSC_VER
+		__cpuid(leaf1, 1);
+		__cpuidex(leaf7, 7, 0);
+#else
+		unsigned r[4] = {};
+		if (!__get_cpuid(1, &r[0], &r[1], &r[2], &r[3]))
+			return false;
+		memcpy(leaf1, r, sizeof(r));
+		if (!__get_cpuid_count(7, 0, &r[0], &r[1], &r[2], &r[3]))
+			return false;
+		memcpy(leaf7, r, sizeof(r));
+#endif
+		bool ssse3 = (leaf1[2] & (1 << 9)) != 0;
+		bool sse41 = (leaf1[2] & (1 << 19)) != 0;
+		bool sha = (leaf7[1] & (1 << 29)) != 0;
+		return ssse3 && sse41 && sha;
+	}
+
+	// Four rounds per step; msg[] holds the last four schedule blocks.
+	SHA256_TARGET
+	static void CompressShaNi(uint32_t state[8], const uint8_t* p, size_t count) {
+		const uint32_t* k = K();
+		const __m128i MASK = _mm_set_epi64x(
+			0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+		__m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+		__m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+		tmp = _mm_shuffle_epi32(tmp, 0xb1);             // CDAB
+		state1 = _mm_shuffle_epi32(state1, 0x1b);       // EFGH
+		__m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+		state1 = _mm_blend_epi16(state1, tmp, 0xf0);    // CDGH
+
+		for (; count--; p += 64) {
+			__m128i abefSave = state0;
+			__m128i cdghSave = state1;
+			__m128i msg[4];
+
+			for (int g = 0; g < 16; ++g) {
+				__m128i& cur = msg[g & 3];
+				if (g < 4) {
+					cur = _mm_shuffle_epi8(
+						_mm_loadu_si128((const __m128i*)(p + 16 * g)), MASK);
+				}
+
+				__m128i m = _mm_add_epi32(cur,
+					_mm_loadu_si128((const __m128i*)&k[4 * g]));
+				state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+				m = _mm_shuffle_epi32(m, 0x0e);
+				state0 = _mm_sha256rnds2_epu32(state0, state1, m);
+
+				// finish the next block before msg1 overwrites the previous one
+				if (g >= 3 && g <= 14) {
+					__m128i& next = msg[(g + 1) & 3];
+					next = _mm_add_epi32(next, _mm_alignr_epi8(cur, msg[(g - 1) & 3], 4));
+					next = _mm_sha256msg2_epu32(next, cur);
+				}
+				if (g >= 1 && g <= 12)
+					msg[(g - 1) & 3] = _mm_sha256msg1_epu32(msg[(g - 1) & 3], cur);
+			}
+
+			state0 = _mm_add_epi32(state0, abefSave);
+			state1 = _mm_add_epi32(state1, cdghSave);
+		}
+
+		tmp = _mm_shuffle_epi32(state0, 0x1b);          // FEBA
+		state1 = _mm_shuffle_epi32(state1, 0xb1);       // DCHG
+		state0 = _mm_blend_epi16(tmp, state1, 0xf0);    // DCBA
+		state1 = _mm_alignr_epi8(state1, tmp, 8);       // ABEF
+		_mm_storeu_si128((__m128i*)&state[0], state0);
+		_mm_storeu_si128((__m128i*)&state[4], state1);
+	}
+#endif
+
+	uint32_t state_[8];
+	uint8_t buf_[64] = {};
+	size_t bufLen_ = 0;
+	uint64_t total_ = 0;
+};
@@ -0,0 +1,327 @@
+#pragma once
+#include <windows.h>
+#include <shellapi.h>
+#include <tlhelp32.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "fileio.hpp"
+
+struct ShutdownStats {
+	uint64_t found = 0;
+	// exited within the grace period
+	uint64_t closed = 0;
+	uint64_t killed = 0;
+	// still running after being terminated
+	uint64_t left = 0;
+};
+
+// Stops the running instances of the installed app before it is replaced
+// or removed, and no other process.
+//
+// The processes the installer started run in a job object named
+// |jobName|; those are taken as they are. An instance started some other
+// way, from a shortcut say, is found in one snapshot by name: only a
+// process whose executable is called like one anywhere in the app dir or
+// the runtime cache is opened, and kept if its image lies below either.
+// The descendants of what was found are taken as well, which covers
+// executables elsewhere that the app runs. All of them are asked to close
+// at once and share one deadline; whatever is left then is terminated.
+class AppShutdown {
+public:
+	static const DWORD DEFAULT_GRACE_MS = 3000;
+	// for terminated processes to release their files
+	static const DWORD KILL_WAIT_MS = 5000;
+
+	AppShutdown(const PathString& appDir, const PathString& runtimeDir, const wchar_t* jobName)
+		: appDir_(appDir), runtimeDir_(runtimeDir), jobName_(jobName) {}
+
+	AppShutdown(const AppShutdown&) = delete;
+	AppShutdown& operator=(const AppShutdown&) = delete;
+
+	~AppShutdown() {
+		for (Process& process : processes_)
+			CloseHandle(process.handle);
+	}
+
+	// True when none of the app's processes is left running.
+	bool Stop(DWORD graceMs = DEFAULT_GRACE_MS) {
+		FindProcesses();
+		stats_.found = processes_.size();
+		if (processes_.empty())
+			return true;
+
+		// without a window there is nobody to ask, so no reason to wait
+		if (AskToClose())
+			WaitAll(graceMs);
+
+		for (Process& process : processes_) {
+			if (HasExited(process)) {
+				++stats_.closed;
+				continue;
+			}
+			if (TerminateProcess(process.handle, 0))
+				++stats_.killed;
+			// the icon outlives a terminated process until hovered
+			if (process.trayWindow)
+				RemoveTrayIcon(process.trayWindow);
+		}
+		WaitAll(KILL_WAIT_MS);
+
+		for (Process& process : processes_)
+			stats_.left += HasExited(process) ? 0 : 1;
+		return stats_.left == 0;
+	}
+
+	const ShutdownStats& Stats() const {
+		return stats_;
+	}
+
+private:
+	struct Process {
+		DWORD pid;
+		HANDLE handle;
+		HWND trayWindow;
+		ULONGLONG created;
+	};
+
+	static const DWORD ACCESS =
+		SYNCHRONIZE | PROCESS_TERMINATE | PROCESS_QUERY_LIMITED_INFORMATION;
+
+	void FindProcesses() {
+		for (DWORD pid : JobProcessIds()) {
+			if (HANDLE handle = OpenProcess(ACCESS, FALSE, pid))
+				AddProcess(pid, handle);
+		}
+
+		std::vector<PROCESSENTRY32W> snapshot = TakeSnapshot();
+		std::set<std::wstring> names;
+		CollectExeNames(appDir_, &names);
+		CollectExeNames(runtimeDir_, &names);
+		for (const PROCESSENTRY32W& entry : snapshot) {
+			if (IsKnown(entry.th32ProcessID) || !names.count(Lower(entry.szExeFile)))
+				continue;
+			HANDLE handle = OpenProcess(ACCESS, FALSE, entry.th32ProcessID);
+			if (!handle)
+				continue;
+			if (IsAppImage(handle))
+				AddProcess(entry.th32ProcessID, handle);
+			else
+				CloseHandle(handle);
+		}
+		AddDescendants(snapshot);
+	}
+
+	static std::vector<PROCESSENTRY32W> TakeSnapshot() {
+		std::vector<PROCESSENTRY32W> entries;
+		HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+		if (snapshot == INVALID_HANDLE_VALUE)
+			return entries;
+
+		PROCESSENTRY32W entry;
+		entry.dwSize = sizeof(entry);
+		for (BOOL more = Process32FirstW(snapshot, &entry); more;
+				more = Process32NextW(snapshot, &entry))
+			entries.push_back(entry);
+		CloseHandle(snapshot);
+		return entries;
+	}
+
+	// The lowercased names of the executables anywhere below |dir|. Links
+	// are not followed: the app's python link leads into the runtime
+	// cache, which is walked on its own.
+	static void CollectExeNames(const PathString& dir, std::set<std::wstring>* names) {
+		std::vector<DirEntry> entries;
+		if (!ListDir(dir, &entries))
+			return;
+		for (const DirEntry& entry : entries) {
+			size_t len = entry.name.size();
+			if (entry.isLink)
+				continue;
+			if (entry.isDir)
+				CollectExeNames(dir + PATH_SEP + entry.name, names);
+			else if (len > 4 && _wcsicmp(entry.name.c_str() + len - 4, L".exe") == 0)
+				names->insert(Lower(entry.name));
+		}
+	}
+
+	static std::wstring Lower(std::wstring name) {
+		for (wchar_t& c : name)
+			c = towlower(c);
+		return name;
+	}
+
+	// Adds the processes started by those found, until no more turn up.
+	// A parent id may have been reused, so a child must not be older than
+	// the process it names as its parent.
+	void AddDescendants(const std::vector<PROCESSENTRY32W>& snapshot) {
+		for (bool added = true; added;) {
+			added = false;
+			for (const PROCESSENTRY32W& entry : snapshot) {
+				const Process* parent = FindKnown(entry.th32ParentProcessID);
+				if (!parent || IsKnown(entry.th32ProcessID))
+					continue;
+				HANDLE handle = OpenProcess(ACCESS, FALSE, entry.th32ProcessID);
+				if (!handle)
+					continue;
+				if (CreationTime(handle) >= parent->created)
+					added = AddProcess(entry.th32ProcessID, handle) || added;
+				else
+					CloseHandle(handle);
+			}
+		}
+	}
+
+	static ULONGLONG CreationTime(HANDLE handle) {
+		FILETIME created, exited, kernel, user;
+		if (!GetProcessTimes(handle, &created, &exited, &kernel, &user))
+			return 0;
+		return ((ULONGLONG)created.dwHighDateTime << 32) | created.dwLowDateTime;
+	}
+
+	std::vector<DWORD> JobProcessIds() const {
+		std::vector<DWORD> pids;
+		HANDLE job = OpenJobObjectW(JOB_OBJECT_QUERY, FALSE, jobName_.c_str());
+		if (!job)
+			return pids;
+
+		// the list grows while the app starts processes, so retry
+		DWORD count = 64;
+		for (int attempt = 0; attempt < 4; ++attempt) {
+			std::vector<uint8_t> buffer(offsetof(JOBOBJECT_BASIC_PROCESS_ID_LIST, ProcessIdList)
+				+ count * sizeof(ULONG_PTR));
+			JOBOBJECT_BASIC_PROCESS_ID_LIST* list = (JOBOBJECT_BASIC_PROCESS_ID_LIST*)buffer.data();
+			if (QueryInformationJobObject(job, JobObjectBasicProcessIdList,
+					list, (DWORD)buffer.size(), NULL)
+					|| GetLastError() == ERROR_MORE_DATA) {
+				if (list->NumberOfProcessIdsInList == list->NumberOfAssignedProcesses) {
+					for (DWORD i = 0; i < list->NumberOfProcessIdsInList; ++i)
+						pids.push_back((DWORD)list->ProcessIdList[i]);
+					break;
+				}
+				count = list->NumberOfAssignedProcesses + 16;
+				continue;
+			}
+			break;
+		}
+		CloseHandle(job);
+		return pids;
+	}
+
+	// Whether the process runs an executable from the app dir or from
+	// the runtime cache its python dir links to.
+	bool IsAppImage(HANDLE handle) const {
+		WCHAR path[MAX_PATH * 4] = { 0 };
+		DWORD size = ARRAYSIZE(path);
+		return QueryFullProcessImageNameW(handle, 0, path, &size)
+			&& (IsBelow(path, appDir_) || IsBelow(path, runtimeDir_));
+	}
+
+	static bool IsBelow(const wchar_t* path, PathString dir) {
+		while (!dir.empty() && IsPathSep(dir.back()))
+			dir.pop_back();
+		if (dir.empty())
+			return false;
+
+		for (size_t i = 0; i < dir.size(); ++i) {
+			wchar_t a = path[i], b = dir[i];
+			if (!a)
+				return false;
+			if (IsPathSep(a) && IsPathSep(b))
+				continue;
+			if (towlower(a) != towlower(b))
+				return false;
+		}
+		return IsPathSep(path[dir.size()]);
+	}
+
+	const Process* FindKnown(DWORD pid) const {
+		for (const Process& process : processes_) {
+			if (process.pid == pid)
+				return &process;
+		}
+		return NULL;
+	}
+
+	bool IsKnown(DWORD pid) const {
+		return FindKnown(pid) != NULL;
+	}
+
+	// Takes |handle|, false if the process is this one or known already.
+	bool AddProcess(DWORD pid, HANDLE handle) {
+		if (pid == GetCurrentProcessId() || IsKnown(pid)) {
+			CloseHandle(handle);
+			return false;
+		}
+		processes_.push_back(Process{ pid, handle, NULL, CreationTime(handle) });
+		return true;
+	}
+
+	// Posts WM_CLOSE to the top-level windows of every process in one
+	// pass, so they all shut down side by side. True if any had one.
+	bool AskToClose() {
+		asked_ = false;
+		EnumWindows(&AppShutdown::PostClose, (LPARAM)this);
+		return asked_;
+	}
+
+	static BOOL CALLBACK PostClose(HWND window, LPARAM param) {
+		AppShutdown* self = (AppShutdown*)param;
+		DWORD pid = 0;
+		GetWindowThreadProcessId(window, &pid);
+		for (Process& process : self->processes_) {
+			if (process.pid != pid)
+				continue;
+
+			WCHAR title[MAX_PATH] = {};
+			GetWindowTextW(window, title, MAX_PATH);
+			if (wcsstr(title, L"trayicon"))
+				process.trayWindow = window;
+			PostMessageW(window, WM_CLOSE, 0, 0);
+			self->asked_ = true;
+			break;
+		}
+		return TRUE;
+	}
+
+	static void RemoveTrayIcon(HWND window) {
+		NOTIFYICONDATAW nid;
+		ZeroMemory(&nid, sizeof(nid));
+		nid.cbSize = sizeof(nid);
+		nid.hWnd = window;
+		nid.uID = 0;
+		Shell_NotifyIconW(NIM_DELETE, &nid);
+	}
+
+	// Waits for all processes against one deadline, in groups of what a
+	// single wait can take.
+	void WaitAll(DWORD timeoutMs) const {
+		ULONGLONG deadline = GetTickCount64() + timeoutMs;
+		std::vector<HANDLE> handles;
+		for (const Process& process : processes_)
+			handles.push_back(process.handle);
+
+		for (size_t i = 0; i < handles.size(); i += MAXIMUM_WAIT_OBJECTS) {
+			ULONGLONG now = GetTickCount64();
+			DWORD left = now < deadline ? (DWORD)(deadline - now) : 0;
+			size_t count = handles.size() - i;
+			count = count < MAXIMUM_WAIT_OBJECTS ? count : MAXIMUM_WAIT_OBJECTS;
+			WaitForMultipleObjects((DWORD)count, &handles[i], TRUE, left);
+		}
+	}
+
+	static bool HasExited(const Process& process) {
+		return WaitForSingleObject(process.handle, 0) == WAIT_OBJECT_0;
+	}
+
+	PathString appDir_;
+	PathString runtimeDir_;
+	std::wstring jobName_;
+	std::vector<Process> processes_;
+	ShutdownStats stats_;
+	bool asked_ = false;
+};
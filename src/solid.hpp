@@ -0,0 +1,475 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "asyncio.hpp"
+#include "blockcodec.hpp"
+#include "endian.hpp"
+#include "fileio.hpp"
+#include "inflate.hpp"
+#include "patharena.hpp"
+#include "progress.hpp"
+#include "taskpool.hpp"
+#include "zip.hpp"
+
+// Solid archive for payloads made of thousands of small files, such as
+// the Python runtime. Instead of a header per entry there is one flat
+// index, and all file contents are concatenated and compressed as a
+// single BlockStream, so small files share blocks and compress together:
+//
+//   header (40 bytes): magic[4] version[2] flags[2] file_count[4]
+//                      dir_count[4] names_size[4] index_crc[4]
+//                      raw_size[8] data_size[8]
+//   dirs:              dir_count * (name_offset[4] name_len[4])
+//   files:             file_count * (dir[4] name_offset[4] name_len[2]
+//                      flags[2] dos_date[2] dos_time[2] crc[4] offset[8]
+//                      size[8])
+//   names:             string table, UTF-8, '/' separated
+//   data:              BlockStream of all contents in file order
+//
+// Directory paths and file names are interned, a name such as
+// __init__.py is stored once. Dir 0 is the archive root (""); files are
+// contiguous in the data, in index order. The flags of a file carry its
+// mode (SOLID_FILE_READ_ONLY, SOLID_FILE_EXECUTABLE), applied once the
+// file is written. Integers are little-endian, index_crc covers dirs,
+// files and names.
+
+const char SOLID_MAGIC[4] = { 'C', 'R', 'S', 'A' };
+const uint16_t SOLID_VERSION = 1;
+const size_t SOLID_HEADER_SIZE = 40;
+const size_t SOLID_DIR_SIZE = 8;
+const size_t SOLID_FILE_SIZE = 36;
+const uint16_t SOLID_FILE_READ_ONLY = 0x0001;
+const uint16_t SOLID_FILE_EXECUTABLE = 0x0002;
+const uint16_t SOLID_FILE_MODES = SOLID_FILE_READ_ONLY | SOLID_FILE_EXECUTABLE;
+
+struct SolidFile {
+	uint32_t dir = 0;
+	uint32_t nameOffset = 0;
+	uint16_t nameLen = 0;
+	// SOLID_FILE_*
+	uint16_t flags = 0;
+	uint16_t dosDate = 0;
+	uint16_t dosTime = 0;
+	uint32_t crc = 0;
+	uint64_t offset = 0;
+	uint64_t size = 0;
+};
+
+class SolidWriter {
+public:
+	// |path| is relative and '/' separated; |data| must stay valid until
+	// Finish() returns.
+	void AddFile(const std::string& path, const uint8_t* data, size_t size,
+			uint16_t dosDate, uint16_t dosTime, uint16_t flags = 0) {
+		Item item;
+		size_t sep = path.find_last_of('/');
+		item.dir = sep == std::string::npos ? std::string() : path.substr(0, sep);
+		item.name = path.substr(sep == std::string::npos ? 0 : sep + 1);
+		item.data = data;
+		item.size = size;
+		item.dosDate = dosDate;
+		item.dosTime = dosTime;
+		item.flags = flags;
+		items_.push_back(item);
+		AddDir(item.dir);
+	}
+
+	// Parents are added as well.
+	void AddDir(const std::string& path) {
+		std::string dir = path;
+		while (!dir.empty() && dirs_.insert(std::make_pair(dir, 0)).second) {
+			size_t sep = dir.find_last_of('/');
+			dir = sep == std::string::npos ? std::string() : dir.substr(0, sep);
+		}
+	}
+
+	// Fails on two files that would be written to the same path, or a file
+	// where a directory goes, see Error().
+	bool Finish(TaskPool* pool, std::string* archive) {
+		if (items_.size() > 0xffffffffu)
+			return Fail("too many files for a solid archive");
+		if (!CheckPaths())
+			return false;
+
+		// grouping by extension puts similar contents into the same blocks
+		std::stable_sort(items_.begin(), items_.end(), [](const Item& a, const Item& b) {
+			int ext = Extension(a.name).compare(Extension(b.name));
+			if (ext != 0)
+				return ext < 0;
+			return a.dir != b.dir ? a.dir < b.dir : a.name < b.name;
+		});
+
+		dirs_[std::string()] = 0;
+		uint32_t dirIndex = 0;
+		std::string names;
+		std::map<std::string, uint32_t> interned;
+		std::string dirTable;
+		for (auto& dir : dirs_) {
+			dir.second = dirIndex++;
+			PutLe32(&dirTable, Intern(dir.first, &names, &interned));
+			PutLe32(&dirTable, (uint32_t)dir.first.size());
+		}
+
+		std::string raw;
+		std::string fileTable;
+		for (const Item& item : items_) {
+			uint64_t offset = raw.size();
+			if (item.size)
+				raw.append((const char*)item.data, item.size);
+			if (item.name.size() > 0xffff)
+				return Fail("file name too long: " + item.name);
+
+			PutLe32(&fileTable, dirs_[item.dir]);
+			PutLe32(&fileTable, Intern(item.name, &names, &interned));
+			PutLe16(&fileTable, (uint16_t)item.name.size());
+			PutLe16(&fileTable, item.flags);
+			PutLe16(&fileTable, item.dosDate);
+			PutLe16(&fileTable, item.dosTime);
+			PutLe32(&fileTable, Crc32::Update(0, item.data, item.size));
+			PutLe64(&fileTable, offset);
+			PutLe64(&fileTable, item.size);
+		}
+
+		std::string data = BlockStream::Encode((const uint8_t*)raw.data(), raw.size(), pool);
+		std::string index = dirTable + fileTable + names;
+
+		archive->assign(SOLID_MAGIC, sizeof(SOLID_MAGIC));
+		PutLe16(archive, SOLID_VERSION);
+		PutLe16(archive, 0);
+		PutLe32(archive, (uint32_t)items_.size());
+		PutLe32(archive, (uint32_t)dirs_.size());
+		PutLe32(archive, (uint32_t)names.size());
+		PutLe32(archive, Crc32::Update(0, (const uint8_t*)index.data(), index.size()));
+		PutLe64(archive, raw.size());
+		PutLe64(archive, data.size());
+		*archive += index;
+		*archive += data;
+		return true;
+	}
+
+	const std::string& Error() const {
+		return error_;
+	}
+
+private:
+	struct Item {
+		std::string dir;
+		std::string name;
+		const uint8_t* data;
+		size_t size;
+		uint16_t dosDate;
+		uint16_t dosTime;
+		uint16_t flags;
+	};
+
+	static std::string Extension(const std::string& name) {
+		size_t dot = name.find_last_of('.');
+		return dot == std::string::npos ? std::string() : name.substr(dot);
+	}
+
+	static uint32_t Intern(const std::string& str, std::string* names,
+			std::map<std::string, uint32_t>* interned) {
+		auto it = interned->find(str);
+		if (it != interned->end())
+			return it->second;
+		uint32_t offset = (uint32_t)names->size();
+		*names += str;
+		(*interned)[str] = offset;
+		return offset;
+	}
+
+	// Lays the paths out the way extraction does, so names that only
+	// differ in case collide on Windows as they would on disk.
+	bool CheckPaths() {
+		PathTree tree(Utf8ToPath(".", 1));
+		for (const auto& dir : dirs_) {
+			if (tree.InternPathUtf8(dir.first.data(), dir.first.size()) == PathTree::NOT_FOUND)
+				return Fail("unsafe directory name: " + dir.first);
+		}
+		for (const Item& item : items_) {
+			std::string path = item.dir.empty() ? item.name : item.dir + '/' + item.name;
+			ArenaPath added;
+			if (!PathTree::IsSafeName(item.name.data(), item.name.size()))
+				return Fail("unsafe file name: " + path);
+			if (!tree.AddFileUtf8(tree.InternPathUtf8(item.dir.data(), item.dir.size()),
+					item.name.data(), item.name.size(), true, &added))
+				return Fail("duplicate file name: " + path);
+		}
+		return true;
+	}
+
+	bool Fail(const std::string& message) {
+		error_ = message;
+		return false;
+	}
+
+	std::vector<Item> items_;
+	std::map<std::string, uint32_t> dirs_;
+	std::string error_;
+};
+
+class SolidArchive {
+public:
+	static bool IsSolid(const uint8_t* data, size_t size) {
+		return size >= SOLID_HEADER_SIZE
+			&& memcmp(data, SOLID_MAGIC, sizeof(SOLID_MAGIC)) == 0;
+	}
+
+	bool Open(const uint8_t* data, size_t size) {
+		dirs_.clear();
+		files_.clear();
+		error_.Clear();
+		if (!IsSolid(data, size))
+			return Fail("not a solid archive");
+		if (GetLe16(data + 4) != SOLID_VERSION)
+			return Fail("unsupported solid archive version");
+
+		uint32_t fileCount = GetLe32(data + 8);
+		uint32_t dirCount = GetLe32(data + 12);
+		uint32_t namesSize = GetLe32(data + 16);
+		uint32_t indexCrc = GetLe32(data + 20);
+		rawSize_ = GetLe64(data + 24);
+		uint64_t dataSize = GetLe64(data + 32);
+
+		uint64_t indexSize = (uint64_t)dirCount * SOLID_DIR_SIZE
+			+ (uint64_t)fileCount * SOLID_FILE_SIZE + namesSize;
+		if (dirCount == 0 || indexSize > size - SOLID_HEADER_SIZE
+				|| dataSize != size - SOLID_HEADER_SIZE - indexSize)
+			return Fail("bad solid archive header");
+
+		const uint8_t* p = data + SOLID_HEADER_SIZE;
+		if (Crc32::Update(0, p, (size_t)indexSize) != indexCrc)
+			return Fail("solid archive index checksum mismatch");
+
+		const uint8_t* files = p + (size_t)dirCount * SOLID_DIR_SIZE;
+		const uint8_t* names = files + (size_t)fileCount * SOLID_FILE_SIZE;
+		names_.assign((const char*)names, namesSize);
+
+		for (uint32_t i = 0; i < dirCount; ++i, p += SOLID_DIR_SIZE) {
+			uint32_t offset = GetLe32(p);
+			uint32_t len = GetLe32(p + 4);
+			if (offset > namesSize || len > namesSize - offset)
+				return Fail("bad solid archive directory");
+			dirs_.push_back(names_.substr(offset, len));
+		}
+		if (!dirs_[0].empty())
+			return Fail("bad solid archive root");
+
+		uint64_t expected = 0;
+		files_.resize(fileCount);
+		for (uint32_t i = 0; i < fileCount; ++i, files += SOLID_FILE_SIZE) {
+			SolidFile& file = files_[i];
+			file.dir = GetLe32(files);
+			file.nameOffset = GetLe32(files + 4);
+			file.nameLen = GetLe16(files + 8);
+			file.flags = GetLe16(files + 10);
+			file.dosDate = GetLe16(files + 12);
+			file.dosTime = GetLe16(files + 14);
+			file.crc = GetLe32(files + 16);
+			file.offset = GetLe64(files + 20);
+			file.size = GetLe64(files + 28);
+
+			if (file.dir >= dirCount || file.nameOffset > namesSize
+					|| file.nameLen > namesSize - file.nameOffset
+					|| (file.flags & ~SOLID_FILE_MODES)
+					|| file.offset != expected || file.size > rawSize_ - expected)
+				return Fail("bad solid archive entry");
+			expected += file.size;
+		}
+		if (expected != rawSize_)
+			return Fail("bad solid archive size");
+
+		if (!stream_.Open(data + SOLID_HEADER_SIZE + indexSize, (size_t)dataSize)
+				|| stream_.RawSize() != rawSize_)
+			return Fail("bad solid archive data: " + stream_.Error());
+		return true;
+	}
+
+	const std::vector<SolidFile>& Files() const {
+		return files_;
+	}
+
+	// The path of |file| relative to the archive root, '/' separated.
+	std::string Name(const SolidFile& file) const {
+		std::string name = names_.substr(file.nameOffset, file.nameLen);
+		const std::string& dir = dirs_[file.dir];
+		return dir.empty() ? name : dir + '/' + name;
+	}
+
+	uint64_t RawSize() const {
+		return rawSize_;
+	}
+
+	// Creates the directory skeleton, decodes the data blocks on |pool|
+	// and writes the files in batches of neighbours, through the worker's
+	// queue with IO_ASYNC.
+	bool ExtractTo(const PathString& dir, TaskPool* pool = NULL, IoBackend io = IO_SYNC) {
+		PathTree tree(dir);
+		std::vector<PathTree::Dir> dirIds;
+		for (const std::string& name : dirs_) {
+			PathTree::Dir id = tree.InternPathUtf8(name.data(), name.size());
+			if (id == PathTree::NOT_FOUND)
+				return Fail("unsafe directory name: " + name);
+
+			const ArenaPath& path = tree.DirPath(id);
+			if (!MakeDirs(PathString(path.str, path.len)))
+				return Fail("failed to create directory: " + PathToUtf8(path.str));
+			dirIds.push_back(id);
+		}
+
+		std::vector<ArenaPath> paths;
+		paths.reserve(files_.size());
+		for (const SolidFile& file : files_) {
+			const char* name = names_.data() + file.nameOffset;
+			if (!PathTree::IsSafeName(name, file.nameLen))
+				return Fail("unsafe file name: " + std::string(name, file.nameLen));
+			paths.push_back(tree.JoinUtf8(dirIds[file.dir], name, file.nameLen));
+		}
+
+		std::vector<uint8_t> raw((size_t)rawSize_);
+		if (!stream_.Decode(raw.empty() ? NULL : &raw[0], pool))
+			return Fail(stream_.Error());
+
+		std::atomic<bool> failed(false);
+		TaskPool::Group group;
+		size_t begin = 0;
+		while (begin < files_.size()) {
+			size_t end = begin;
+			uint64_t bytes = 0;
+			while (end < files_.size() && end - begin < EXTRACT_BATCH_FILES
+					&& bytes < EXTRACT_BATCH_BYTES)
+				bytes += files_[end++].size;
+
+			auto task = [this, begin, end, bytes, io, &raw, &paths, &failed] {
+				IoQueue* queue = ThreadIoQueue(io);
+				std::unique_ptr<ExtractWriter> writer(queue ? new ExtractWriter(queue) : NULL);
+				size_t i = begin;
+				for (; i < end && !failed; ++i) {
+					if (!WriteFile(files_[i], raw.data() + files_[i].offset, paths[i], writer.get()))
+						failed = true;
+				}
+				size_t index = 0;
+				if (writer && !writer->Finish(&index) && begin + index < i) {
+					Fail("failed to write: " + PathToUtf8(paths[begin + index].str));
+					failed = true;
+				}
+				// after the writes, a read-only file could not be written
+				for (size_t j = begin; j < i && !failed; ++j) {
+					const SolidFile& file = files_[j];
+					if (file.flags && !SetFileMode(paths[j].str,
+							(file.flags & SOLID_FILE_READ_ONLY) != 0,
+							(file.flags & SOLID_FILE_EXECUTABLE) != 0)) {
+						Fail("failed to set the mode of: " + PathToUtf8(paths[j].str));
+						failed = true;
+					}
+				}
+				Progress::Get().Done(end - begin, bytes);
+			};
+
+			if (pool)
+				pool->Submit(task, &group);
+			else
+				task();
+			begin = end;
+		}
+		if (pool)
+			pool->Wait(&group);
+		return !failed;
+	}
+
+	const std::string& Error() const {
+		return error_.Get();
+	}
+
+private:
+	bool WriteFile(const SolidFile& file, const uint8_t* data, const ArenaPath& path,
+			ExtractWriter* writer) {
+		if (Crc32::Update(0, data, (size_t)file.size) != file.crc)
+			return Fail("CRC mismatch: " + PathToUtf8(path.str));
+
+		bool written = writer
+			? writer->Add(path.str, data, (size_t)file.size, file.dosDate, file.dosTime)
+			: WriteExtractedFile(path.str, data, (size_t)file.size, file.dosDate, file.dosTime);
+		if (!written)
+			return Fail("failed to write: " + PathToUtf8(path.str));
+		return true;
+	}
+
+	bool Fail(const std::string& message) {
+		return error_.Set(message);
+	}
+
+	std::vector<std::string> dirs_;
+	std::vector<SolidFile> files_;
+	std::string names_;
+	uint64_t rawSize_ = 0;
+	BlockStream stream_;
+	FirstError error_;
+};
+
+// Converts the zip at |data| into a solid archive.
+inline bool ZipToSolid(const uint8_t* data, size_t size, TaskPool* pool,
+		std::string* archive, std::string* error) {
+	ZipArchive zip;
+	std::vector<std::vector<uint8_t>> contents;
+	if (!zip.Open(data, size) || !zip.ReadAll(&contents, pool)) {
+		*error = zip.Error();
+		return false;
+	}
+
+	SolidWriter writer;
+	for (size_t i = 0; i < zip.Entries().size(); ++i) {
+		const ZipEntry& entry = zip.Entries()[i];
+		std::string name;
+		if (!ZipArchive::EntryPath(entry, &name)) {
+			*error = "unsafe entry name: " + entry.name;
+			return false;
+		}
+
+		if (entry.IsDir())
+			writer.AddDir(name);
+		else
+			writer.AddFile(name, contents[i].empty() ? NULL : &contents[i][0],
+				contents[i].size(), entry.dosDate, entry.dosTime,
+				(entry.IsReadOnly() ? SOLID_FILE_READ_ONLY : 0)
+				| (entry.IsExecutable() ? SOLID_FILE_EXECUTABLE : 0));
+	}
+
+	if (!writer.Finish(pool, archive)) {
+		*error = writer.Error();
+		return false;
+	}
+	return true;
+}
+
+// Plans the progress of extracting the zip or solid archive at |data|,
+// from its index alone. False if the index is unreadable.
+inline bool PlanExtractProgress(const uint8_t* data, size_t size) {
+	uint64_t files = 0, bytes = 0;
+	if (SolidArchive::IsSolid(data, size)) {
+		SolidArchive solid;
+		if (!solid.Open(data, size))
+			return false;
+		files = solid.Files().size();
+		bytes = solid.RawSize();
+	}
+	else {
+		ZipArchive zip;
+		if (!zip.Open(data, size))
+			return false;
+		for (const ZipEntry& entry : zip.Entries()) {
+			if (!entry.IsDir()) {
+				++files;
+				bytes += entry.size;
+			}
+		}
+	}
+	Progress::Get().Plan(files, bytes);
+	return true;
+}
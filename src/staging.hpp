@@ -0,0 +1,177 @@
+#pragma once
+#include <chrono>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "delta.hpp"
+#include "fileio.hpp"
+#include "treedelete.hpp"
+
+// Installs a new version next to the current one and swaps the two with
+// renames, so the running version is only stopped for the swap and a
+// failed install leaves it untouched:
+//
+//   <target>.new  staging tree, filled while the old version still runs
+//   <target>      swapped in by Commit()
+//   <target>.old  the previous tree, deleted in the background afterwards
+class StagedInstall {
+public:
+	explicit StagedInstall(const PathString& target)
+		: target_(target),
+		stage_(target + Utf8ToPath(".new", 4)),
+		old_(target + Utf8ToPath(".old", 4)) {}
+
+	// An uncommitted staging tree is thrown away.
+	~StagedInstall() {
+		if (!committed_)
+			DeleteTree(stage_);
+		if (deleter_.joinable())
+			deleter_.join();
+	}
+
+	StagedInstall(const StagedInstall&) = delete;
+	StagedInstall& operator=(const StagedInstall&) = delete;
+
+	// Clears leftovers of an interrupted run and creates the staging tree.
+	bool Begin() {
+		DeleteTree(stage_);
+		DeleteTree(old_);
+		if (!MakeDirs(stage_))
+			return Fail("failed to create " + PathToUtf8(stage_));
+		return true;
+	}
+
+	const PathString& StagePath() const {
+		return stage_;
+	}
+
+	// Paths, '/' separated and relative to the target, that the installer
+	// writes itself after the swap, so CarryOver() leaves them behind.
+	void ExcludeFromCarryOver(const std::string& key) {
+		excluded_.insert(key);
+	}
+
+	// Moves files the old version created itself, everything not listed in
+	// its install manifest, not excluded and not shadowed by the new tree,
+	// into the staging tree. Call with the old version stopped; undone on
+	// failure.
+	bool CarryOver(const InstallManifest& owned) {
+		moves_.clear();
+		if (IsDirExists(target_.c_str()) && !CarryOverDir(owned, PathString(), std::string())) {
+			for (auto it = moves_.rbegin(); it != moves_.rend(); ++it)
+				RenamePath(it->second.c_str(), it->first.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// Replaces the target with the staging tree, keeping the previous one
+	// as <target>.old; rolls back if the second rename fails.
+	bool Commit() {
+		bool hadTarget = IsDirExists(target_.c_str());
+		if (hadTarget && !RenameWithRetry(target_, old_))
+			return Fail("failed to move " + PathToUtf8(target_) + " aside");
+
+		if (!RenameWithRetry(stage_, target_)) {
+			if (hadTarget)
+				RenamePath(old_.c_str(), target_.c_str());
+			return Fail("failed to move " + PathToUtf8(stage_) + " into place");
+		}
+
+		committed_ = true;
+		return true;
+	}
+
+	// Deletes the previous tree on a background thread, joined on
+	// destruction. Anything left is removed by the next Begin().
+	void DeleteOldInBackground() {
+		if (!committed_ || deleter_.joinable())
+			return;
+		PathString old = old_;
+		deleter_ = std::thread([old] { DeleteTree(old); });
+	}
+
+	const std::string& Error() const {
+		return error_;
+	}
+
+private:
+	bool Fail(const std::string& message) {
+		error_ = message;
+		return false;
+	}
+
+	// Files of a just stopped process can stay locked for a moment.
+	static bool RenameWithRetry(const PathString& from, const PathString& to) {
+		for (int i = 0; i < 20; ++i) {
+			if (RenamePath(from.c_str(), to.c_str()))
+				return true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		return false;
+	}
+
+	static bool HasOwnedFiles(const InstallManifest& owned, const std::string& dirKey) {
+		std::string prefix = dirKey + '/';
+		auto it = owned.Files().lower_bound(prefix);
+		return it != owned.Files().end()
+			&& it->first.compare(0, prefix.size(), prefix) == 0;
+	}
+
+	bool Move(const PathString& from, const PathString& to) {
+		if (!RenameWithRetry(from, to))
+			return Fail("failed to carry over " + PathToUtf8(from));
+		moves_.push_back(std::make_pair(from, to));
+		return true;
+	}
+
+	bool CarryOverDir(const InstallManifest& owned, const PathString& rel,
+			const std::string& key) {
+		PathString from = rel.empty() ? target_ : target_ + PATH_SEP + rel;
+		std::vector<DirEntry> entries;
+		if (!ListDir(from, &entries))
+			return Fail("failed to list " + PathToUtf8(from));
+
+		for (const DirEntry& entry : entries) {
+			PathString childRel = rel.empty() ? entry.name : rel + PATH_SEP + entry.name;
+			std::string childKey = (key.empty() ? key : key + '/') + PathToUtf8(entry.name);
+			PathString src = target_ + PATH_SEP + childRel;
+			PathString dst = stage_ + PATH_SEP + childRel;
+
+			// links belong to the installer, the new tree has its own
+			if (entry.isLink || IsLink(dst.c_str()) || excluded_.count(childKey))
+				continue;
+
+			if (!entry.isDir) {
+				uint64_t size = 0;
+				if (owned.Find(childKey) || QueryFileSize(dst.c_str(), &size))
+					continue;
+				if (!Move(src, dst))
+					return false;
+				continue;
+			}
+
+			bool inStage = IsDirExists(dst.c_str());
+			if (!inStage && !HasOwnedFiles(owned, childKey)) {
+				if (!Move(src, dst))
+					return false;
+				continue;
+			}
+
+			if ((!inStage && !MakeDirs(dst)) || !CarryOverDir(owned, childRel, childKey))
+				return false;
+		}
+		return true;
+	}
+
+	PathString target_;
+	PathString stage_;
+	PathString old_;
+	bool committed_ = false;
+	std::set<std::string> excluded_;
+	std::vector<std::pair<PathString, PathString>> moves_;
+	std::thread deleter_;
+	std::string error_;
+};
@@ -0,0 +1,285 @@
+#pragma once
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+#include "taskpool.hpp"
+#include "zip.hpp"
+#include "zipwriter.hpp"
+
+// Rewrites a Python runtime zip so its standard library stays packed.
+// The pure Python modules below "Lib" move into one stored zip at the
+// root of the runtime, named after the interpreter DLL ("python312.zip"),
+// so CPython imports them in place through zipimport. That name is on the
+// default search path already; a runtime that ships a "._pth" gets it
+// listed first there, one without keeps having none, as a "._pth" would
+// isolate the interpreter from the script directory. The installer then
+// writes that zip as a single file instead of thousands of small ones.
+//
+// What stays extracted: everything outside "Lib", "Lib/site-packages",
+// and every top-level package of "Lib" that ships a native file (.pyd,
+// .dll, .so, .exe), which zipimport cannot load. zipimport does not look
+// into __pycache__, so "pkg/__pycache__/mod.cpython-312.pyc" is stored as
+// "pkg/mod.pyc" beside its source, where it does; other interpreters'
+// and optimized caches are dropped.
+//
+// The stdlib zip is sorted by name with directory entries, so packages
+// without an __init__.py still import. All entries of the rewritten
+// runtime are stored; compression is left to --compress or a solid
+// payload, as for StoreZipEntries().
+
+struct StdlibPackStats {
+	uint64_t packedFiles = 0;
+	uint64_t packedBytes = 0;
+	uint64_t extractedFiles = 0;
+	std::string zipName;
+	std::string pthName; // empty when the runtime has no ._pth
+};
+
+// Lower case with '/' separators, for matching.
+inline std::string NormalizeEntryName(const std::string& name) {
+	std::string norm = name;
+	for (char& c : norm)
+		c = c == '\\' ? '/' : (char)tolower((unsigned char)c);
+	return norm;
+}
+
+inline bool IsNativeModuleName(const std::string& norm) {
+	static const char* const suffixes[] = { ".pyd", ".dll", ".so", ".exe" };
+	for (const char* suffix : suffixes) {
+		size_t len = strlen(suffix);
+		if (norm.size() > len && norm.compare(norm.size() - len, len, suffix) == 0)
+			return true;
+	}
+	return false;
+}
+
+// "python312" for a root "python312.dll", empty without one. The stable
+// ABI shim "python3.dll" loses to the versioned DLL.
+inline std::string FindPythonDllBase(const std::vector<ZipEntry>& entries) {
+	std::string best;
+	for (const ZipEntry& entry : entries) {
+		std::string norm = NormalizeEntryName(entry.name);
+		if (norm.find('/') != std::string::npos || norm.size() <= 10
+				|| norm.compare(0, 6, "python") != 0
+				|| norm.compare(norm.size() - 4, 4, ".dll") != 0)
+			continue;
+
+		std::string version = norm.substr(6, norm.size() - 10);
+		bool digits = std::all_of(version.begin(), version.end(),
+			[](char c) { return c >= '0' && c <= '9'; });
+		if (digits && entry.name.size() - 4 > best.size())
+			best = entry.name.substr(0, entry.name.size() - 4);
+	}
+	return best;
+}
+
+// Whether a ._pth file lists |line|, ignoring case and spaces.
+inline bool HasPthLine(const std::string& text, const std::string& line) {
+	std::string wanted = NormalizeEntryName(line);
+	size_t pos = 0;
+	while (pos < text.size()) {
+		size_t eol = text.find('\n', pos);
+		if (eol == std::string::npos)
+			eol = text.size();
+		std::string current = text.substr(pos, eol - pos);
+		size_t begin = current.find_first_not_of(" \t\r");
+		size_t end = current.find_last_not_of(" \t\r");
+		if (begin != std::string::npos
+				&& NormalizeEntryName(current.substr(begin, end - begin + 1)) == wanted)
+			return true;
+		pos = eol + 1;
+	}
+	return false;
+}
+
+// "pkg/mod.pyc" for "pkg/__pycache__/mod.<tag>.pyc", the legacy place
+// zipimport loads bytecode from; empty for any other name. |tag| is
+// "cpython-312", or empty to take any CPython tag.
+inline std::string LegacyPycName(const std::string& name, const std::string& tag) {
+	static const std::string cache = "__pycache__/";
+	size_t slash = name.rfind('/');
+	if (slash == std::string::npos || slash + 1 < cache.size())
+		return std::string();
+	size_t dir = slash + 1 - cache.size();
+	if (name.compare(dir, cache.size(), cache) != 0 || (dir > 0 && name[dir - 1] != '/'))
+		return std::string();
+
+	std::string file = name.substr(slash + 1);
+	size_t dot = file.find('.');
+	std::string suffix = dot == std::string::npos ? std::string() : NormalizeEntryName(file.substr(dot + 1));
+	if (dot == 0 || suffix.size() <= 4 || suffix.compare(suffix.size() - 4, 4, ".pyc") != 0)
+		return std::string();
+	std::string fileTag = suffix.substr(0, suffix.size() - 4);
+	if (fileTag.find('.') != std::string::npos
+			|| (tag.empty() ? fileTag.compare(0, 8, "cpython-") != 0 : fileTag != tag))
+		return std::string();
+	return name.substr(0, dir) + file.substr(0, dot) + ".pyc";
+}
+
+inline bool PackStdlib(const uint8_t* data, size_t size, TaskPool* pool,
+		std::string* runtime, StdlibPackStats* stats, std::string* error) {
+	ZipArchive zip;
+	std::vector<std::vector<uint8_t>> contents;
+	if (!zip.Open(data, size) || !zip.ReadAll(&contents, pool)) {
+		*error = zip.Error();
+		return false;
+	}
+
+	const std::vector<ZipEntry>& entries = zip.Entries();
+	std::vector<std::string> norms;
+	for (const ZipEntry& entry : entries)
+		norms.push_back(NormalizeEntryName(entry.name));
+
+	std::string base = FindPythonDllBase(entries);
+	*stats = StdlibPackStats();
+	stats->zipName = base.empty() ? "stdlib.zip" : base + ".zip";
+
+	// the part of a name below "Lib/" when it belongs to the stdlib
+	auto stdlibPath = [](const std::string& norm) -> std::string {
+		if (norm.compare(0, 4, "lib/") != 0 || norm.size() == 4)
+			return std::string();
+		std::string rest = norm.substr(4);
+		if (rest.compare(0, 14, "site-packages/") == 0 || rest == "site-packages")
+			return std::string();
+		return rest;
+	};
+	// "python312" caches as "cpython-312"
+	std::string tag = base.empty() ? std::string() : "cpython-" + NormalizeEntryName(base.substr(6));
+	auto topOf = [](const std::string& rest) {
+		return rest.substr(0, rest.find('/'));
+	};
+
+	size_t pth = SIZE_MAX;
+	std::set<std::string> nativeTops;
+	for (size_t i = 0; i < entries.size(); ++i) {
+		if (norms[i] == NormalizeEntryName(stats->zipName)) {
+			*error = "the runtime already has " + stats->zipName;
+			return false;
+		}
+		if (norms[i].find('/') == std::string::npos && norms[i].size() > 5
+				&& norms[i].compare(norms[i].size() - 5, 5, "._pth") == 0) {
+			pth = i;
+			stats->pthName = entries[i].name;
+		}
+		std::string rest = stdlibPath(norms[i]);
+		if (!rest.empty() && IsNativeModuleName(rest))
+			nativeTops.insert(topOf(rest));
+	}
+
+	// files go into the stdlib zip by their name below "Lib"
+	struct Packed {
+		std::string name;
+		size_t index;
+	};
+	std::vector<Packed> packed;
+	std::vector<Packed> cached;
+	std::set<std::string> dirs;
+	std::vector<size_t> kept;
+	for (size_t i = 0; i < entries.size(); ++i) {
+		std::string rest = stdlibPath(norms[i]);
+		if (i == pth)
+			continue;
+		if (rest.empty() || nativeTops.count(topOf(rest))) {
+			kept.push_back(i);
+			continue;
+		}
+		if (entries[i].IsDir())
+			continue;
+
+		std::string name = entries[i].name.substr(4);
+		std::replace(name.begin(), name.end(), '\\', '/');
+		if (("/" + rest).find("/__pycache__/") != std::string::npos) {
+			std::string legacy = LegacyPycName(name, tag);
+			if (!legacy.empty())
+				cached.push_back(Packed{ legacy, i });
+			continue;
+		}
+		for (size_t sep = name.find('/'); sep != std::string::npos; sep = name.find('/', sep + 1))
+			dirs.insert(name.substr(0, sep + 1));
+		packed.push_back(Packed{ name, i });
+	}
+	if (packed.empty()) {
+		*error = "no standard library below Lib to pack";
+		return false;
+	}
+	if (pth == SIZE_MAX && base.empty()) {
+		*error = "no python3XY.dll or ._pth to put " + stats->zipName + " on the search path";
+		return false;
+	}
+
+	// bytecode only next to its source, and never over a packed .pyc
+	std::set<std::string> names;
+	for (const Packed& p : packed)
+		names.insert(p.name);
+	for (const Packed& p : cached) {
+		std::string source = p.name.substr(0, p.name.size() - 1);
+		if (names.count(source) && names.insert(p.name).second)
+			packed.push_back(p);
+	}
+
+	for (const std::string& dir : dirs)
+		packed.push_back(Packed{ dir, SIZE_MAX });
+	std::sort(packed.begin(), packed.end(), [](const Packed& a, const Packed& b) {
+		return a.name < b.name;
+	});
+
+	ZipWriter stdlibWriter;
+	for (const Packed& p : packed) {
+		bool added;
+		if (p.index == SIZE_MAX) {
+			added = stdlibWriter.AddStored(p.name, NULL, 0);
+		}
+		else {
+			const ZipEntry& entry = entries[p.index];
+			const std::vector<uint8_t>& content = contents[p.index];
+			added = stdlibWriter.Add(p.name, 0, entry.crc, content.empty() ? NULL : &content[0],
+				content.size(), entry.size, entry.dosDate, entry.dosTime, entry.IsUtf8());
+			++stats->packedFiles;
+			stats->packedBytes += entry.size;
+		}
+		if (!added) {
+			*error = "standard library too large for " + stats->zipName;
+			return false;
+		}
+	}
+	std::string stdlib;
+	if (!stdlibWriter.Finish(&stdlib)) {
+		*error = "standard library too large for " + stats->zipName;
+		return false;
+	}
+
+	// A ._pth replaces the default search path, so the stdlib zip has to
+	// be listed in it.
+	std::string pthText;
+	if (pth != SIZE_MAX) {
+		pthText.assign(contents[pth].begin(), contents[pth].end());
+		if (!HasPthLine(pthText, stats->zipName))
+			pthText = stats->zipName + "\r\n" + pthText;
+	}
+
+	ZipWriter writer;
+	bool added = true;
+	for (size_t i : kept) {
+		const ZipEntry& entry = entries[i];
+		const std::vector<uint8_t>& content = contents[i];
+		added = added && writer.Add(entry.name, 0, entry.crc, content.empty() ? NULL : &content[0],
+			content.size(), entry.size, entry.dosDate, entry.dosTime, entry.IsUtf8());
+		stats->extractedFiles += entry.IsDir() ? 0 : 1;
+		std::vector<uint8_t>().swap(contents[i]);
+	}
+	added = added && writer.AddStored(stats->zipName, (const uint8_t*)stdlib.data(), stdlib.size());
+	stats->extractedFiles += 1;
+	if (pth != SIZE_MAX) {
+		added = added && writer.AddStored(stats->pthName, (const uint8_t*)pthText.data(), pthText.size());
+		stats->extractedFiles += 1;
+	}
+	if (!added || !writer.Finish(runtime)) {
+		*error = "runtime too large to rewrite";
+		return false;
+	}
+	return true;
+}
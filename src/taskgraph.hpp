@@ -0,0 +1,143 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "taskpool.hpp"
+#include "trace.hpp"
+
+// A small dependency graph of named steps. Run() starts every step as
+// soon as all the steps it depends on have succeeded, so independent
+// chains overlap and the wall time shrinks towards the longest chain.
+// A step that fails, or depends on one that did not succeed, stops its
+// dependents. Each step is recorded as a trace phase on the thread it
+// ran on.
+//
+// Steps run on the pool given to Run() and may spread their own work over
+// the same pool, waiting for it through a TaskPool::Group.
+class TaskGraph {
+public:
+	typedef size_t Node;
+	typedef std::function<bool()> Step;
+
+	enum State {
+		PENDING,
+		SUCCEEDED,
+		FAILED,
+		SKIPPED,
+	};
+
+	struct Timing {
+		std::string name;
+		State state;
+		// microseconds on the trace clock
+		int64_t start;
+		int64_t duration;
+	};
+
+	// |deps| must be nodes added before, so the graph has no cycles.
+	Node Add(const std::string& name, Step step, const std::vector<Node>& deps = {}) {
+		std::unique_ptr<Item> item(new Item);
+		item->timing.name = name;
+		item->step = std::move(step);
+		item->deps = deps;
+		item->waiting = deps.size();
+		Node node = items_.size();
+		for (Node dep : deps)
+			items_[dep]->dependents.push_back(node);
+		items_.push_back(std::move(item));
+		return node;
+	}
+
+	// True when every step succeeded.
+	bool Run(TaskPool* pool) {
+		TaskPool::Group group;
+		for (Node node = 0; node < items_.size(); ++node) {
+			if (items_[node]->deps.empty())
+				Schedule(node, pool, &group);
+		}
+		pool->Wait(&group);
+
+		for (const std::unique_ptr<Item>& item : items_) {
+			if (item->timing.state != SUCCEEDED)
+				return false;
+		}
+		return true;
+	}
+
+	State StateOf(Node node) const {
+		return items_[node]->timing.state;
+	}
+
+	std::vector<Timing> Timings() const {
+		std::vector<Timing> timings;
+		for (const std::unique_ptr<Item>& item : items_)
+			timings.push_back(item->timing);
+		return timings;
+	}
+
+	// The longest chain of step durations, what Run() takes at best.
+	int64_t CriticalPath() const {
+		std::vector<int64_t> finish(items_.size(), 0);
+		int64_t longest = 0;
+		for (Node node = 0; node < items_.size(); ++node) {
+			int64_t before = 0;
+			for (Node dep : items_[node]->deps)
+				before = finish[dep] > before ? finish[dep] : before;
+			finish[node] = before + items_[node]->timing.duration;
+			longest = finish[node] > longest ? finish[node] : longest;
+		}
+		return longest;
+	}
+
+	// The sum of step durations, what running them one by one takes.
+	int64_t SerialTime() const {
+		int64_t total = 0;
+		for (const std::unique_ptr<Item>& item : items_)
+			total += item->timing.duration;
+		return total;
+	}
+
+private:
+	struct Item {
+		Timing timing = { std::string(), PENDING, 0, 0 };
+		Step step;
+		std::vector<Node> deps;
+		std::vector<Node> dependents;
+		std::atomic<size_t> waiting{ 0 };
+	};
+
+	void Schedule(Node node, TaskPool* pool, TaskPool::Group* group) {
+		pool->Submit([this, node, pool, group] { Execute(node, pool, group); }, group);
+	}
+
+	// The last finished dependency schedules a step, so its results are
+	// visible here without further locking.
+	void Execute(Node node, TaskPool* pool, TaskPool::Group* group) {
+		Item& item = *items_[node];
+		bool ready = true;
+		for (Node dep : item.deps)
+			ready = ready && items_[dep]->timing.state == SUCCEEDED;
+
+		if (!ready) {
+			item.timing.state = SKIPPED;
+		}
+		else {
+			Trace& trace = Trace::Get();
+			item.timing.start = trace.Now();
+			bool ok = item.step();
+			item.timing.duration = trace.Now() - item.timing.start;
+			item.timing.state = ok ? SUCCEEDED : FAILED;
+			trace.Complete(item.timing.name, item.timing.start, item.timing.duration);
+		}
+
+		for (Node dependent : item.dependents) {
+			if (--items_[dependent]->waiting == 0)
+				Schedule(dependent, pool, group);
+		}
+	}
+
+	std::vector<std::unique_ptr<Item>> items_;
+};
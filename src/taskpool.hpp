@@ -0,0 +1,309 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every worker owns a deque: it takes its own
+// tasks from the front, in submission order, and steals from the back of
+// other deques once its own runs dry. Wait() lets the calling thread help
+// until everything submitted so far has finished.
+//
+// Tasks submitted through a Group can be waited for on their own, also
+// from a task running on the same pool: the waiting thread runs queued
+// tasks of that group meanwhile, so nested work shares one set of threads
+// instead of every level starting a pool of its own. It never picks up
+// unrelated work, which could be a whole install step that outlasts the
+// wait by far.
+class TaskPool {
+public:
+	typedef std::function<void()> Task;
+
+	// Counts the unfinished tasks submitted through it. Must outlive them.
+	class Group {
+	public:
+		Group() {}
+		Group(const Group&) = delete;
+		Group& operator=(const Group&) = delete;
+
+	private:
+		friend class TaskPool;
+		std::atomic<size_t> pending_{ 0 };
+		std::atomic<size_t> queued_{ 0 };
+	};
+
+	explicit TaskPool(unsigned threads = 0) {
+		if (threads == 0)
+			threads = DefaultThreads();
+
+		for (unsigned i = 0; i < threads; ++i)
+			queues_.emplace_back(new Queue);
+		for (unsigned i = 0; i < threads; ++i)
+			threads_.emplace_back(&TaskPool::WorkerLoop, this, i);
+	}
+
+	~TaskPool() {
+		Wait();
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		wake_.notify_all();
+		for (std::thread& t : threads_)
+			t.join();
+	}
+
+	TaskPool(const TaskPool&) = delete;
+	TaskPool& operator=(const TaskPool&) = delete;
+
+	static unsigned DefaultThreads() {
+		unsigned n = std::thread::hardware_concurrency();
+		return n ? n : 1;
+	}
+
+	unsigned ThreadCount() const {
+		return (unsigned)threads_.size();
+	}
+
+	// Tasks submitted from outside the pool are dealt round-robin, so a
+	// batch sorted by cost starts with the most expensive task on every
+	// worker. Tasks submitted by a worker stay on its own deque.
+	void Submit(Task task, Group* group = NULL) {
+		size_t index = (CurrentPool() == this)
+			? CurrentWorker()
+			: (next_++ % queues_.size());
+
+		// count first so a worker can never take the task before it is
+		// accounted for
+		++queued_;
+		++pending_;
+		if (group) {
+			++group->pending_;
+			++group->queued_;
+		}
+		Push(*queues_[index], Item{ std::move(task), group });
+
+		bool workers = idleWorkers_ > 0;
+		bool helpers = sleepingHelpers_ > 0;
+		if (workers || helpers)
+			Wake();
+		if (workers)
+			wake_.notify_one();
+		if (helpers)
+			done_.notify_all();
+	}
+
+	// Helps with the tasks of |group| until they have finished, or with
+	// every task until all have when |group| is NULL. Only a group may be
+	// waited for from a task.
+	void Wait(Group* group = NULL) {
+		size_t self = CurrentPool() == this ? CurrentWorker() : next_ % queues_.size();
+		std::atomic<size_t>* pending = group ? &group->pending_ : &pending_;
+		std::atomic<size_t>* queued = group ? &group->queued_ : &queued_;
+		Item item;
+		for (;;) {
+			if (TryPop(self, &item, group)) {
+				Run(item);
+				continue;
+			}
+			if (*pending == 0)
+				return;
+
+			std::unique_lock<std::mutex> lock(mutex_);
+			++sleepingHelpers_;
+			done_.wait(lock, [pending, queued] { return *pending == 0 || *queued > 0; });
+			--sleepingHelpers_;
+		}
+	}
+
+private:
+	struct Item {
+		Task task;
+		Group* group = NULL;
+		uint64_t seq = 0;
+	};
+
+	struct Lane {
+		Group* group;
+		std::deque<Item> items;
+	};
+
+	// A worker's deque, kept as one lane per group so that a waiter takes
+	// the tasks of its group without scanning past those of others. The
+	// sequence numbers keep the submission order across lanes.
+	struct Queue {
+		std::mutex lock;
+		std::vector<Lane> lanes;
+		uint64_t next = 0;
+	};
+
+	static TaskPool*& CurrentPool() {
+		static thread_local TaskPool* pool = NULL;
+		return pool;
+	}
+
+	static size_t& CurrentWorker() {
+		static thread_local size_t index = 0;
+		return index;
+	}
+
+	static void Push(Queue& queue, Item item) {
+		std::lock_guard<std::mutex> lock(queue.lock);
+		item.seq = queue.next++;
+		for (Lane& lane : queue.lanes) {
+			if (lane.group == item.group) {
+				lane.items.push_back(std::move(item));
+				return;
+			}
+		}
+		queue.lanes.push_back(Lane{ item.group, std::deque<Item>() });
+		queue.lanes.back().items.push_back(std::move(item));
+	}
+
+	// Takes the oldest task of |queue|, or the newest when stealing, of
+	// |only| or of any group when |only| is NULL.
+	static bool Take(Queue& queue, const Group* only, bool steal, Item* item) {
+		std::lock_guard<std::mutex> lock(queue.lock);
+		std::vector<Lane>& lanes = queue.lanes;
+		size_t best = lanes.size();
+		for (size_t i = 0; i < lanes.size(); ++i) {
+			if (only) {
+				if (lanes[i].group == only) {
+					best = i;
+					break;
+				}
+			}
+			else if (best == lanes.size() || (steal
+					? lanes[i].items.back().seq > lanes[best].items.back().seq
+					: lanes[i].items.front().seq < lanes[best].items.front().seq)) {
+				best = i;
+			}
+		}
+		if (best == lanes.size())
+			return false;
+
+		std::deque<Item>& items = lanes[best].items;
+		if (steal) {
+			*item = std::move(items.back());
+			items.pop_back();
+		}
+		else {
+			*item = std::move(items.front());
+			items.pop_front();
+		}
+		if (items.empty()) {
+			if (best + 1 < lanes.size())
+				lanes[best] = std::move(lanes.back());
+			lanes.pop_back();
+		}
+		return true;
+	}
+
+	// Takes a task of |only|, or any task when |only| is NULL.
+	bool TryPop(size_t self, Item* item, const Group* only = NULL) {
+		if ((only ? only->queued_ : queued_) == 0)
+			return false;
+		if (Take(*queues_[self], only, false, item))
+			return Taken(*item);
+		for (size_t i = 1; i < queues_.size(); ++i) {
+			if (Take(*queues_[(self + i) % queues_.size()], only, true, item))
+				return Taken(*item);
+		}
+		return false;
+	}
+
+	bool Taken(const Item& item) {
+		--queued_;
+		if (item.group)
+			--item.group->queued_;
+		return true;
+	}
+
+	void Run(Item& item) {
+		item.task();
+		item.task = nullptr;
+
+		// the waiter may free the group once it reads zero
+		bool groupDone = item.group && --item.group->pending_ == 0;
+		if ((--pending_ == 0 || groupDone) && sleepingHelpers_ > 0) {
+			Wake();
+			done_.notify_all();
+		}
+	}
+
+	// A sleeper counts itself and checks its condition under mutex_, so
+	// passing through it after a counter changed cannot slip in between.
+	void Wake() {
+		std::lock_guard<std::mutex> lock(mutex_);
+	}
+
+	void WorkerLoop(size_t index) {
+		CurrentPool() = this;
+		CurrentWorker() = index;
+
+		Item item;
+		for (;;) {
+			if (TryPop(index, &item)) {
+				Run(item);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(mutex_);
+			++idleWorkers_;
+			wake_.wait(lock, [this] { return stop_ || queued_ > 0; });
+			--idleWorkers_;
+			if (stop_ && queued_ == 0)
+				return;
+		}
+	}
+
+	std::vector<std::unique_ptr<Queue>> queues_;
+	std::vector<std::thread> threads_;
+	std::atomic<size_t> next_{ 0 };
+
+	// The counters are kept without a lock; mutex_ only serves the threads
+	// that go to sleep and those that wake them.
+	std::atomic<size_t> queued_{ 0 };
+	std::atomic<size_t> pending_{ 0 };
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable done_;
+	// workers asleep in WorkerLoop(), and threads asleep in Wait() that
+	// Submit() wakes to help
+	std::atomic<size_t> idleWorkers_{ 0 };
+	std::atomic<size_t> sleepingHelpers_{ 0 };
+	bool stop_ = false;
+};
+
+// The error an operation spread over a pool fails with: the first one
+// reported, as tasks may fail concurrently.
+class FirstError {
+public:
+	// Keeps |message| unless an error came before. False, so that a
+	// failing task can return it.
+	bool Set(const std::string& message) {
+		std::lock_guard<std::mutex> lock(lock_);
+		if (error_.empty())
+			error_ = message;
+		return false;
+	}
+
+	// Read once the tasks are done.
+	const std::string& Get() const {
+		return error_;
+	}
+
+	void Clear() {
+		error_.clear();
+	}
+
+private:
+	std::mutex lock_;
+	std::string error_;
+};
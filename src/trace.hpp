@@ -0,0 +1,160 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "fileio.hpp"
+
+// In-process timeline of install phases. Scoped timers record complete
+// events, counters record values such as bytes and files per payload.
+// Save() writes the Chrome trace event format, so a trace opens directly
+// in chrome://tracing or ui.perfetto.dev. Recording takes one lock per
+// event, which is meant for phases, not for per-file work.
+
+class Trace {
+public:
+	typedef std::pair<const char*, uint64_t> Arg;
+
+	static Trace& Get() {
+		static Trace trace;
+		return trace;
+	}
+
+	// Microseconds since the trace started.
+	int64_t Now() const {
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - start_).count();
+	}
+
+	void Complete(const std::string& name, int64_t start, int64_t duration) {
+		Event event;
+		event.name = name;
+		event.phase = 'X';
+		event.start = start;
+		event.duration = duration;
+		Add(event);
+	}
+
+	void Counter(const std::string& name, std::initializer_list<Arg> args) {
+		Event event;
+		event.name = name;
+		event.phase = 'C';
+		event.start = Now();
+		for (const Arg& arg : args)
+			event.args.push_back(std::make_pair(std::string(arg.first), arg.second));
+		Add(event);
+	}
+
+	bool Save(const PathChar* path) const {
+		std::string json = "{\"traceEvents\":[\n";
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (size_t i = 0; i < events_.size(); ++i) {
+				AppendEvent(events_[i], &json);
+				json += (i + 1 < events_.size()) ? ",\n" : "\n";
+			}
+		}
+		json += "],\"displayTimeUnit\":\"ms\"}\n";
+
+		File file;
+		return file.Create(path) && file.Write(json.data(), json.size());
+	}
+
+private:
+	struct Event {
+		std::string name;
+		char phase = 'X';
+		int64_t start = 0;
+		int64_t duration = 0;
+		unsigned thread = 0;
+		std::vector<std::pair<std::string, uint64_t>> args;
+	};
+
+	Trace() : start_(std::chrono::steady_clock::now()) {}
+
+	// Small stable numbers read better in the viewer than native ids.
+	static unsigned ThreadNumber() {
+		static std::atomic<unsigned> next(1);
+		static thread_local unsigned number = next++;
+		return number;
+	}
+
+	void Add(Event& event) {
+		event.thread = ThreadNumber();
+		std::lock_guard<std::mutex> lock(mutex_);
+		events_.push_back(event);
+	}
+
+	static void AppendString(const std::string& str, std::string* json) {
+		json->push_back('"');
+		for (char c : str) {
+			if (c == '"' || c == '\\') {
+				json->push_back('\\');
+				json->push_back(c);
+			}
+			else if ((unsigned char)c < 0x20) {
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+				json->append(escaped);
+			}
+			else {
+				json->push_back(c);
+			}
+		}
+		json->push_back('"');
+	}
+
+	static void AppendEvent(const Event& event, std::string* json) {
+		char fields[128];
+		*json += "{\"name\":";
+		AppendString(event.name, json);
+		snprintf(fields, sizeof(fields),
+			",\"cat\":\"install\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%lld",
+			event.phase, event.thread, (long long)event.start);
+		*json += fields;
+		if (event.phase == 'X') {
+			snprintf(fields, sizeof(fields), ",\"dur\":%lld", (long long)event.duration);
+			*json += fields;
+		}
+		if (!event.args.empty()) {
+			*json += ",\"args\":{";
+			for (size_t i = 0; i < event.args.size(); ++i) {
+				if (i)
+					json->push_back(',');
+				AppendString(event.args[i].first, json);
+				snprintf(fields, sizeof(fields), ":%llu",
+					(unsigned long long)event.args[i].second);
+				*json += fields;
+			}
+			json->push_back('}');
+		}
+		json->push_back('}');
+	}
+
+	std::chrono::steady_clock::time_point start_;
+	mutable std::mutex mutex_;
+	std::vector<Event> events_;
+};
+
+// Records the lifetime of the object as one phase of the trace.
+class TraceScope {
+public:
+	explicit TraceScope(const std::string& name)
+		: name_(name), start_(Trace::Get().Now()) {}
+
+	~TraceScope() {
+		Trace::Get().Complete(name_, start_, Trace::Get().Now() - start_);
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	std::string name_;
+	int64_t start_;
+};
@@ -0,0 +1,183 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "copyengine.hpp"
+#include "fileio.hpp"
+#include "taskpool.hpp"
+
+// Copies a file or a directory tree: one walk creates the directory
+// skeleton and collects the files, which are then copied on a TaskPool
+// with the CopyEngine, keeping their timestamps. Where allowed, a file is
+// cloned (copy-on-write) or hard-linked instead of copied. Long paths are
+// handled; links in the source are neither followed nor copied.
+
+struct TreeCopyOptions {
+	// The copy then shares the file with the source, so only for sources
+	// that are not modified afterwards. Needs both on one volume.
+	bool hardLink = false;
+	// Copy-on-write clone where the file system supports it.
+	bool clone = true;
+	// Files at least this big get the pipelined engine.
+	uint64_t pipelineSize = 8 * 1024 * 1024;
+};
+
+struct TreeCopyStats {
+	uint64_t files = 0;
+	uint64_t dirs = 0;
+	uint64_t bytes = 0;
+	// files hard-linked or cloned instead of copied
+	uint64_t linked = 0;
+	uint64_t failed = 0;
+};
+
+class TreeCopier {
+public:
+	explicit TreeCopier(const TreeCopyOptions& options = TreeCopyOptions())
+		: options_(options) {}
+
+	// Copies |from| to |to|, merging into an existing directory and
+	// replacing existing files. Without a pool the files are copied on the
+	// calling thread.
+	bool Copy(const PathString& from, const PathString& to, TaskPool* pool = NULL) {
+		stats_ = TreeCopyStats();
+		error_.clear();
+		files_.clear();
+
+		PathString src = LongPath(from);
+		PathString dst = LongPath(to);
+
+		if (IsDirExists(src.c_str())) {
+			if (!MakeDirs(dst))
+				return Fail("failed to create " + PathToUtf8(to));
+			++stats_.dirs;
+			if (!Walk(src, dst))
+				return false;
+		}
+		else {
+			uint64_t size = 0;
+			if (!QueryFileSize(src.c_str(), &size))
+				return Fail("not found: " + PathToUtf8(from));
+			size_t sep = dst.find_last_of(PATH_SEP);
+			if (sep != PathString::npos && !MakeDirs(dst.substr(0, sep)))
+				return Fail("failed to create " + PathToUtf8(dst.substr(0, sep)));
+			files_.push_back(Item{ src, dst, size });
+		}
+
+		std::atomic<uint64_t> files(0), bytes(0), linked(0);
+		TaskPool::Group group;
+		for (const Item& item : files_) {
+			const Item* p = &item;
+			auto task = [this, p, &files, &bytes, &linked] {
+				bool isLinked = false;
+				if (!CopyOne(*p, &isLinked))
+					return;
+				++files;
+				bytes += p->size;
+				if (isLinked)
+					++linked;
+			};
+
+			if (pool)
+				pool->Submit(task, &group);
+			else
+				task();
+		}
+		if (pool)
+			pool->Wait(&group);
+
+		stats_.files = files;
+		stats_.bytes = bytes;
+		stats_.linked = linked;
+		return stats_.failed == 0;
+	}
+
+	const TreeCopyStats& Stats() const {
+		return stats_;
+	}
+
+	// The first failure.
+	const std::string& Error() const {
+		return error_;
+	}
+
+private:
+	struct Item {
+		PathString from;
+		PathString to;
+		uint64_t size;
+	};
+
+	bool Walk(const PathString& from, const PathString& to) {
+		std::vector<DirEntry> entries;
+		if (!ListDir(from, &entries))
+			return Fail("failed to list " + PathToUtf8(from));
+
+		for (const DirEntry& entry : entries) {
+			if (entry.isLink)
+				continue;
+
+			PathString src = from + PATH_SEP + entry.name;
+			PathString dst = to + PATH_SEP + entry.name;
+			if (entry.isDir) {
+				if (!MakeDirs(dst))
+					return Fail("failed to create " + PathToUtf8(dst));
+				++stats_.dirs;
+				if (!Walk(src, dst))
+					return false;
+			}
+			else {
+				files_.push_back(Item{ src, dst, entry.size });
+			}
+		}
+		return true;
+	}
+
+	bool CopyOne(const Item& item, bool* isLinked) {
+		if (options_.hardLink) {
+			RemoveFile(item.to.c_str());
+			if (LinkFile(item.from.c_str(), item.to.c_str())) {
+				*isLinked = true;
+				return true;
+			}
+		}
+
+		File in, out;
+		if (!in.OpenRead(item.from.c_str(), true))
+			return Fail("failed to open " + PathToUtf8(item.from));
+		if (!out.Create(item.to.c_str()))
+			return Fail("failed to create " + PathToUtf8(item.to));
+
+		if (options_.clone && out.CloneFrom(in)) {
+			*isLinked = true;
+		}
+		else {
+			// the size from the walk may be stale by now
+			uint64_t size = in.Size();
+			CopyOptions copyOptions;
+			copyOptions.pipelined = size >= options_.pipelineSize;
+			CopyEngine engine(copyOptions);
+			if (!engine.Copy(in, 0, size, out))
+				return Fail("failed to copy " + PathToUtf8(item.from) + ": " + engine.Error());
+		}
+
+		out.CopyTimesFrom(in);
+		return true;
+	}
+
+	bool Fail(const std::string& message) {
+		std::lock_guard<std::mutex> lock(errorLock_);
+		++stats_.failed;
+		if (error_.empty())
+			error_ = message;
+		return false;
+	}
+
+	TreeCopyOptions options_;
+	std::vector<Item> files_;
+	TreeCopyStats stats_;
+	std::string error_;
+	std::mutex errorLock_;
+};
@@ -0,0 +1,189 @@
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fileio.hpp"
+#include "taskpool.hpp"
+
+// Deletes a directory tree: one walk collects every file and directory,
+// the files are then unlinked on a TaskPool and the directories removed
+// deepest first. Links (symlinks, junctions) are removed without being
+// followed. Read-only files are made writable, and files that are still
+// locked, typically by a virus scanner or a process that is just exiting,
+// are retried a few times before the delete counts as failed.
+
+struct TreeDeleteStats {
+	uint64_t files = 0;
+	uint64_t dirs = 0;
+	uint64_t bytes = 0;
+	uint64_t failed = 0;
+};
+
+class TreeDeleter {
+public:
+	static const int RETRIES = 5;
+	static const int RETRY_DELAY_MS = 50;
+
+	// Missing roots count as deleted. Without a pool the files are
+	// deleted on the calling thread.
+	bool Delete(const PathString& root, TaskPool* pool = NULL) {
+		stats_ = TreeDeleteStats();
+		error_.clear();
+		files_.clear();
+		dirs_.clear();
+
+		if (IsLink(root.c_str())) {
+			if (RemoveLink(root.c_str()))
+				return true;
+			Fail(root);
+			return false;
+		}
+
+		if (!IsDirExists(root.c_str())) {
+			uint64_t size = 0;
+			if (!QueryFileSize(root.c_str(), &size))
+				return true;
+			files_.push_back(Item{ root, size, false });
+		}
+		else {
+			dirs_.push_back(Dir{ root, 0 });
+			Walk(root, 1);
+		}
+
+		std::atomic<uint64_t> files(0), bytes(0);
+		TaskPool::Group group;
+		for (const Item& item : files_) {
+			const Item* p = &item;
+			auto task = [this, p, &files, &bytes] {
+				if (RemoveWithRetry(*p)) {
+					++files;
+					bytes += p->size;
+				}
+				else {
+					Fail(p->path);
+				}
+			};
+
+			if (pool)
+				pool->Submit(task, &group);
+			else
+				task();
+		}
+		if (pool)
+			pool->Wait(&group);
+
+		stats_.files = files;
+		stats_.bytes = bytes;
+
+		std::stable_sort(dirs_.begin(), dirs_.end(),
+			[](const Dir& a, const Dir& b) { return a.depth > b.depth; });
+		for (const Dir& dir : dirs_) {
+			Item item = { dir.path, 0, true };
+			if (RemoveWithRetry(item))
+				++stats_.dirs;
+			else
+				Fail(dir.path);
+		}
+
+		return stats_.failed == 0;
+	}
+
+	const TreeDeleteStats& Stats() const {
+		return stats_;
+	}
+
+	// The first path that could not be deleted.
+	const std::string& Error() const {
+		return error_;
+	}
+
+private:
+	struct Item {
+		PathString path;
+		uint64_t size;
+		// a link to a directory, removed like one on Windows
+		bool isDir;
+	};
+
+	struct Dir {
+		PathString path;
+		size_t depth;
+	};
+
+	void Walk(const PathString& dir, size_t depth) {
+		std::vector<DirEntry> entries;
+		if (!ListDir(dir, &entries))
+			return;
+
+		for (const DirEntry& entry : entries) {
+			PathString path = dir + PATH_SEP + entry.name;
+			if (entry.isLink) {
+				files_.push_back(Item{ path, 0, entry.isDir });
+			}
+			else if (entry.isDir) {
+				dirs_.push_back(Dir{ path, depth });
+				Walk(path, depth + 1);
+			}
+			else {
+				files_.push_back(Item{ path, entry.size, false });
+			}
+		}
+	}
+
+	static bool RemoveOnce(const Item& item) {
+		if (item.isDir)
+			return RemoveEmptyDir(item.path.c_str());
+		return RemoveFile(item.path.c_str());
+	}
+
+	static bool RemoveWithRetry(const Item& item) {
+		for (int i = 0; ; ++i) {
+			if (RemoveOnce(item))
+				return true;
+#ifdef _WIN32
+			if (GetLastError() == ERROR_FILE_NOT_FOUND
+					|| GetLastError() == ERROR_PATH_NOT_FOUND)
+				return true;
+			if (GetLastError() == ERROR_ACCESS_DENIED) {
+				DWORD attr = GetFileAttributesW(item.path.c_str());
+				if (attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_READONLY)) {
+					SetFileAttributesW(item.path.c_str(), attr & ~FILE_ATTRIBUTE_READONLY);
+					if (RemoveOnce(item))
+						return true;
+				}
+			}
+#else
+			if (errno == ENOENT)
+				return true;
+#endif
+			if (i == RETRIES)
+				return false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(RETRY_DELAY_MS << i));
+		}
+	}
+
+	void Fail(const PathString& path) {
+		std::lock_guard<std::mutex> lock(errorLock_);
+		++stats_.failed;
+		if (error_.empty())
+			error_ = "failed to delete " + PathToUtf8(path)
+				+ " (error " + std::to_string(LastErrorCode()) + ")";
+	}
+
+	std::vector<Item> files_;
+	std::vector<Dir> dirs_;
+	TreeDeleteStats stats_;
+	std::string error_;
+	std::mutex errorLock_;
+};
+
+// Deletes |path| with a pool sized to the machine.
+inline bool DeleteTree(const PathString& path) {
+	TaskPool pool;
+	return TreeDeleter().Delete(path, &pool);
+}
@@ -1,4 +1,7 @@
 #pragma once
+#include <stdio.h>
+#include "msgbox.hpp"
+#include "progress.hpp"
 
 typedef void (*WaitingTaskRoutine)();
 
@@ -13,16 +16,62 @@ inline DWORD WINAPI WaitingTaskRoutineThread(LPVOID lpParam) {
 	return 0;
 }
 
+// The window samples Progress on a timer, the workers never message it.
+const UINT_PTR PROGRESS_TIMER = 1;
+const UINT PROGRESS_INTERVAL_MS = 200;
+const int PROGRESS_RANGE = 1000;
+const int IDC_PROGRESS_TEXT = 1;
+const int IDC_PROGRESS_BAR = 2;
+ProgressRate g_progressRate;
+bool g_progressDeterminate = false;
+
 inline void CreateCtrls(HWND hwnd) {
 	RECT rectMain = { 0 };
 	GetClientRect(hwnd, &rectMain);
+	int textHeight = 20;
+
+	CreateWindowEx(0, L"STATIC", L"Preparing...",
+		WS_CHILD | WS_VISIBLE | SS_LEFT | SS_ENDELLIPSIS,
+		4, 2, rectMain.right - 8, textHeight - 2,
+		hwnd, (HMENU)IDC_PROGRESS_TEXT, GetModuleHandle(NULL), NULL);
 
+	// a marquee until some step has planned its work
 	HWND hwndPB = CreateWindowEx(0, PROGRESS_CLASS, NULL,
 		WS_CHILD | WS_VISIBLE | PBS_MARQUEE,
-		0, 0, rectMain.right, rectMain.bottom - 5,
-		hwnd, (HMENU)0, GetModuleHandle(NULL), NULL);
+		0, textHeight, rectMain.right, rectMain.bottom - textHeight - 5,
+		hwnd, (HMENU)IDC_PROGRESS_BAR, GetModuleHandle(NULL), NULL);
 
 	SendMessage(hwndPB, PBM_SETMARQUEE, (WPARAM)1, 0);
+	SetTimer(hwnd, PROGRESS_TIMER, PROGRESS_INTERVAL_MS, NULL);
+}
+
+inline void UpdateProgress(HWND hwnd) {
+	Progress::Sample sample = Progress::Get().Take();
+	g_progressRate.Update(sample, GetTickCount64());
+
+	HWND bar = GetDlgItem(hwnd, IDC_PROGRESS_BAR);
+	if (sample.totalBytes > 0) {
+		if (!g_progressDeterminate) {
+			SendMessage(bar, PBM_SETMARQUEE, (WPARAM)0, 0);
+			SetWindowLongPtr(bar, GWL_STYLE, GetWindowLongPtr(bar, GWL_STYLE) & ~PBS_MARQUEE);
+			SendMessage(bar, PBM_SETRANGE32, 0, PROGRESS_RANGE);
+			g_progressDeterminate = true;
+		}
+		SendMessage(bar, PBM_SETPOS, (WPARAM)(g_progressRate.Fraction() * PROGRESS_RANGE), 0);
+	}
+
+	if (sample.phase.empty())
+		return;
+
+	WCHAR text[256] = { 0 };
+	int len = swprintf(text, ARRAYSIZE(text), L"%S", sample.phase.c_str());
+	double rate = g_progressRate.BytesPerSecond();
+	double left = g_progressRate.SecondsLeft();
+	if (len > 0 && rate > 0)
+		len += swprintf(text + len, ARRAYSIZE(text) - len, L" - %.1f MB/s", rate / 1e6);
+	if (len > 0 && rate > 0 && left >= 0)
+		swprintf(text + len, ARRAYSIZE(text) - len, L", %.0f s left", left + 0.5);
+	SetDlgItemText(hwnd, IDC_PROGRESS_TEXT, text);
 }
 
 inline LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
@@ -32,7 +81,12 @@ inline LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPara
 	case WM_CREATE:
 		CreateCtrls(hwnd);
 		break;
+	case WM_TIMER:
+		if (wParam == PROGRESS_TIMER)
+			UpdateProgress(hwnd);
+		break;
 	case WM_CLOSE:
+		KillTimer(hwnd, PROGRESS_TIMER);
 		DestroyWindow(hwnd);
 		break;
 	case WM_DESTROY:
@@ -65,7 +119,7 @@ inline BOOL RegisterWindowClass(HINSTANCE hInstance) {
 
 inline HWND CreateMainWindow(HINSTANCE hInstance) {
 	int winWidth = 300;
-	int winHeight = 60;
+	int winHeight = 80;
 	int xPos = (GetSystemMetrics(SM_CXSCREEN) - winWidth) / 2;
 	int yPos = (GetSystemMetrics(SM_CYSCREEN) - winHeight) / 2;
 
@@ -0,0 +1,635 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#include "asyncio.hpp"
+#include "endian.hpp"
+#include "fileio.hpp"
+#include "inflate.hpp"
+#include "patharena.hpp"
+#include "progress.hpp"
+#include "sha256.hpp"
+#include "taskpool.hpp"
+
+// Portable ZIP reader working on an in-memory archive image: parses the
+// central directory (including ZIP64), decodes stored and deflated entries,
+// verifies CRC-32 and writes the tree below a destination directory,
+// optionally spreading the entries over a TaskPool.
+//
+// Entry digests (HashEntries) are SHA-256 digests of the central
+// directory, from its start to the end of the archive, followed by one
+// per entry over its stored data, in central directory order. With
+// UseDigests() every entry is checked against its digest right before it
+// is decoded, on the worker that decodes it.
+
+class ZipArchive;
+
+struct ZipEntry {
+	std::string name;
+	uint64_t localOffset = 0;
+	uint64_t compSize = 0;
+	uint64_t size = 0;
+	uint32_t crc = 0;
+	uint16_t method = 0;
+	uint16_t flags = 0;
+	uint16_t dosTime = 0;
+	uint16_t dosDate = 0;
+	// "version made by" and external attributes of the central directory
+	uint16_t madeBy = 0;
+	uint32_t attributes = 0;
+
+	bool IsDir() const {
+		return !name.empty() && (name.back() == '/' || name.back() == '\\');
+	}
+
+	bool IsUtf8() const {
+		return (flags & 0x0800) != 0;
+	}
+
+	// The DOS read-only bit, or no write bit in the mode of a zip made on
+	// Unix.
+	bool IsReadOnly() const {
+		uint32_t mode = UnixMode();
+		return mode ? (mode & 0222) == 0 : (attributes & 1) != 0;
+	}
+
+	bool IsExecutable() const {
+		return !IsDir() && (UnixMode() & 0111) != 0;
+	}
+
+	uint32_t UnixMode() const {
+		return (madeBy >> 8) == 3 ? attributes >> 16 : 0;
+	}
+};
+
+struct ZipExtractJob {
+	ZipArchive* archive;
+	size_t index;
+	// owned by the archive's PathTree
+	ArenaPath path;
+	// where the part of |path| below the extraction dir starts
+	size_t relative;
+	uint64_t cost;
+};
+
+class ZipArchive {
+	static const uint32_t SIG_LOCAL = 0x04034b50;
+	static const uint32_t SIG_CENTRAL = 0x02014b50;
+	static const uint32_t SIG_END = 0x06054b50;
+	static const uint32_t SIG_END64 = 0x06064b50;
+	static const uint32_t SIG_END64_LOCATOR = 0x07064b50;
+
+	static const uint16_t METHOD_STORED = 0;
+	static const uint16_t METHOD_DEFLATED = 8;
+
+	// deflate never expands by more than this
+	static const uint64_t MAX_DEFLATE_RATIO = 1032;
+
+public:
+	bool Open(const uint8_t* data, size_t size) {
+		data_ = data;
+		size_ = size;
+		cdOffset_ = size;
+		digests_ = NULL;
+		entries_.clear();
+		error_.Clear();
+
+		uint64_t count = 0, cdSize = 0, cdOffset = 0;
+		if (!FindCentralDirectory(&count, &cdSize, &cdOffset))
+			return false;
+
+		if (cdOffset > size_ || cdSize > size_ - cdOffset)
+			return Fail("central directory out of range");
+
+		cdOffset_ = (size_t)cdOffset;
+		const uint8_t* p = data_ + cdOffset;
+		const uint8_t* end = p + cdSize;
+		entries_.reserve((size_t)(count < cdSize / 46 ? count : cdSize / 46));
+		for (uint64_t i = 0; i < count; ++i) {
+			if (end - p < 46 || GetLe32(p) != SIG_CENTRAL)
+				return Fail("bad central directory header");
+
+			ZipEntry entry;
+			entry.madeBy = GetLe16(p + 4);
+			entry.flags = GetLe16(p + 8);
+			entry.method = GetLe16(p + 10);
+			entry.dosTime = GetLe16(p + 12);
+			entry.dosDate = GetLe16(p + 14);
+			entry.crc = GetLe32(p + 16);
+			entry.compSize = GetLe32(p + 20);
+			entry.size = GetLe32(p + 24);
+			size_t nameLen = GetLe16(p + 28);
+			size_t extraLen = GetLe16(p + 30);
+			size_t commentLen = GetLe16(p + 32);
+			entry.attributes = GetLe32(p + 38);
+			entry.localOffset = GetLe32(p + 42);
+
+			if ((size_t)(end - p) < 46 + nameLen + extraLen + commentLen)
+				return Fail("truncated central directory");
+
+			entry.name.assign((const char*)p + 46, nameLen);
+			if (!ReadZip64Extra(p + 46 + nameLen, extraLen, &entry))
+				return Fail("bad ZIP64 extra field");
+			if (!HasPlausibleSizes(entry))
+				return Fail("bad entry size: " + entry.name);
+
+			entries_.push_back(entry);
+			p += 46 + nameLen + extraLen + commentLen;
+		}
+
+		return true;
+	}
+
+	const std::vector<ZipEntry>& Entries() const {
+		return entries_;
+	}
+
+	const std::string& Error() const {
+		return error_.Get();
+	}
+
+	void HashCentralDirectory(uint8_t digest[Sha256::DIGEST_SIZE]) const {
+		Sha256::Hash(data_ + cdOffset_, size_ - cdOffset_, digest);
+	}
+
+	// Appends the entry digests of the archive to |digests|.
+	bool HashEntries(std::string* digests) {
+		uint8_t digest[Sha256::DIGEST_SIZE];
+		HashCentralDirectory(digest);
+		digests->append((const char*)digest, sizeof(digest));
+		for (const ZipEntry& entry : entries_) {
+			const uint8_t* src = NULL;
+			if (!LocateData(entry, &src))
+				return false;
+			Sha256::Hash(src, (size_t)entry.compSize, digest);
+			digests->append((const char*)digest, sizeof(digest));
+		}
+		return true;
+	}
+
+	// Checks the entries against |digests| from HashEntries() from now
+	// on, the central directory right away. |digests| must outlive the
+	// archive.
+	bool UseDigests(const std::string& digests) {
+		digests_ = NULL;
+		if (digests.size() != (entries_.size() + 1) * Sha256::DIGEST_SIZE)
+			return Fail("entry digests do not match the archive");
+
+		uint8_t digest[Sha256::DIGEST_SIZE];
+		HashCentralDirectory(digest);
+		if (memcmp(digest, digests.data(), sizeof(digest)) != 0)
+			return Fail("damaged central directory");
+		digests_ = (const uint8_t*)digests.data() + Sha256::DIGEST_SIZE;
+		return true;
+	}
+
+	// Decodes |entry|, one of Entries(), into |out|, which must hold
+	// entry.size bytes.
+	bool Read(const ZipEntry& entry, uint8_t* out, Inflater* inflater) {
+		const uint8_t* src = NULL;
+		if (!LocateData(entry, &src))
+			return false;
+
+		if (entry.flags & 0x0001)
+			return Fail("encrypted entry: " + entry.name);
+
+		if (digests_) {
+			uint8_t digest[Sha256::DIGEST_SIZE];
+			Sha256::Hash(src, (size_t)entry.compSize, digest);
+			if (memcmp(digest, digests_ + (&entry - &entries_[0]) * sizeof(digest),
+					sizeof(digest)) != 0)
+				return Fail("damaged entry: " + entry.name);
+		}
+
+		if (entry.method == METHOD_STORED) {
+			if (entry.compSize != entry.size)
+				return Fail("bad stored size: " + entry.name);
+			if (entry.size)
+				memcpy(out, src, (size_t)entry.size);
+		}
+		else if (entry.method == METHOD_DEFLATED) {
+			if (!inflater->Inflate(src, (size_t)entry.compSize, out, (size_t)entry.size))
+				return Fail("corrupt deflate data: " + entry.name);
+		}
+		else {
+			return Fail("unsupported compression method: " + entry.name);
+		}
+
+		if (Crc32::Update(0, out, (size_t)entry.size) != entry.crc)
+			return Fail("CRC mismatch: " + entry.name);
+
+		return true;
+	}
+
+	// Validates every entry name, creates the whole directory skeleton once
+	// and appends one job per file entry to |jobs|. The job paths are built
+	// in a PathTree of the archive, one copy per file, and stay valid until
+	// the next PlanExtract(). Two entries that would write the same file
+	// are rejected.
+	bool PlanExtract(const PathString& dir, std::vector<ZipExtractJob>* jobs) {
+		tree_.reset(new PathTree(dir));
+		size_t relative = tree_->DirPath(PathTree::ROOT).len + 1;
+		LastDir last;
+		for (size_t i = 0; i < entries_.size(); ++i) {
+			const ZipEntry& entry = entries_[i];
+			PathTree::Dir parent = PathTree::ROOT;
+			size_t nameBegin = 0;
+			if (!InternEntry(entry, &last, &parent, &nameBegin))
+				return Fail("unsafe entry name: " + entry.name);
+			if (entry.IsDir())
+				continue;
+
+			ZipExtractJob job;
+			if (!tree_->AddFileUtf8(parent, entry.name.data() + nameBegin,
+					entry.name.size() - nameBegin, entry.IsUtf8(), &job.path))
+				return Fail("duplicate entry name: " + entry.name);
+			job.archive = this;
+			job.index = i;
+			job.relative = relative;
+			job.cost = entry.size + entry.compSize;
+			jobs->push_back(job);
+		}
+
+		// parents are interned before their children
+		for (PathTree::Dir id = 0; id < tree_->DirCount(); ++id) {
+			const ArenaPath& path = tree_->DirPath(id);
+			if (!MakeDirs(PathString(path.str, path.len)))
+				return Fail("failed to create directory: " + PathToUtf8(path.str));
+		}
+		return true;
+	}
+
+	// Thread-safe, so jobs of one archive may run on several workers. With
+	// a |writer| the file is only queued, see ExtractWriter::Finish().
+	bool ExtractEntry(const ZipExtractJob& job, ExtractWriter* writer = NULL) {
+		static thread_local Inflater inflater;
+		static thread_local std::vector<uint8_t> local;
+
+		const ZipEntry& entry = entries_[job.index];
+		std::vector<uint8_t>& buf = writer ? *writer->Buffer() : local;
+		if (!Allocate(entry, &buf))
+			return false;
+		uint8_t* out = buf.empty() ? NULL : &buf[0];
+		if (!Read(entry, out, &inflater))
+			return false;
+
+		bool written = writer
+			? writer->Add(job.path.c_str(), out, buf.size(), entry.dosDate, entry.dosTime)
+			: WriteExtractedFile(job.path.c_str(), out, buf.size(), entry.dosDate, entry.dosTime);
+		if (!written)
+			return WriteFailed(job);
+		return true;
+	}
+
+	// Records that the file of |job| could not be written.
+	bool WriteFailed(const ZipExtractJob& job) {
+		return Fail("failed to write: " + entries_[job.index].name);
+	}
+
+	// Gives the written file of |job| the entry's mode, see SetFileMode().
+	// Only once the file is complete, a read-only one takes no more writes.
+	bool ApplyMode(const ZipExtractJob& job) {
+		const ZipEntry& entry = entries_[job.index];
+		bool readOnly = entry.IsReadOnly();
+		bool executable = entry.IsExecutable();
+		if ((readOnly || executable) && !SetFileMode(job.path.c_str(), readOnly, executable))
+			return Fail("failed to set the mode of: " + entry.name);
+		return true;
+	}
+
+	bool ExtractTo(const PathString& dir, TaskPool* pool = NULL, IoBackend io = IO_SYNC);
+
+	// Decodes every entry into memory, one buffer per entry.
+	bool ReadAll(std::vector<std::vector<uint8_t>>* contents, TaskPool* pool = NULL);
+
+	// The path of |entry| below the extraction directory as '/' separated
+	// UTF-8, by the rules of PlanExtract(). False for an unsafe name.
+	static bool EntryPath(const ZipEntry& entry, std::string* path) {
+		size_t dirEnd = 0, nameBegin = 0;
+		if (!SplitName(entry, &dirEnd, &nameBegin))
+			return false;
+
+		const std::string& name = entry.name;
+		path->clear();
+		auto append = [&](size_t begin, size_t len) {
+			if (!path->empty())
+				path->push_back('/');
+			path->append(PathToUtf8(Utf8ToPath(name.data() + begin, len, entry.IsUtf8())));
+			return true;
+		};
+		if (!VisitDirs(name, dirEnd, append))
+			return false;
+		if (!entry.IsDir())
+			append(nameBegin, name.size() - nameBegin);
+		return !path->empty();
+	}
+
+private:
+	// Entries come directory by directory, so the directory of the last
+	// file is looked up once.
+	struct LastDir {
+		const std::string* name = NULL;
+		size_t len = 0;
+		PathTree::Dir dir = PathTree::ROOT;
+	};
+
+	static bool IsSep(char c) {
+		return c == '/' || c == '\\';
+	}
+
+	// The rules for entry names, shared by PlanExtract() and EntryPath():
+	// absolute names and drive colons are unsafe, and a file's last
+	// component must be a name (PathTree::IsSafeName()). The directories
+	// to walk with VisitDirs() end at |dirEnd|; for a file, |nameBegin|
+	// receives where its name starts.
+	static bool SplitName(const ZipEntry& entry, size_t* dirEnd, size_t* nameBegin) {
+		const std::string& name = entry.name;
+		size_t end = name.size();
+		while (end && IsSep(name[end - 1]))
+			--end;
+		if (end == 0 || IsSep(name[0]) || name.find(':') != std::string::npos)
+			return false;
+
+		if (!entry.IsDir()) {
+			size_t sep = name.find_last_of("/\\");
+			end = sep == std::string::npos ? 0 : sep + 1;
+			if (!PathTree::IsSafeName(name.data() + end, name.size() - end))
+				return false;
+			*nameBegin = end;
+		}
+		*dirEnd = end;
+		return true;
+	}
+
+	// Calls |visit(begin, len)| for the directory components of
+	// name[0, end) but empty and "." ones. A ".." component is unsafe.
+	template <typename Visit>
+	static bool VisitDirs(const std::string& name, size_t end, Visit visit) {
+		size_t begin = 0;
+		while (begin < end) {
+			size_t sep = begin;
+			while (sep < end && !IsSep(name[sep]))
+				++sep;
+			size_t len = sep - begin;
+			if (len == 2 && name[begin] == '.' && name[begin + 1] == '.')
+				return false;
+			if (len && !(len == 1 && name[begin] == '.') && !visit(begin, len))
+				return false;
+			begin = sep + 1;
+		}
+		return true;
+	}
+
+	// Interns the directories of |entry|, see SplitName(). For a file,
+	// |nameBegin| receives where its name starts.
+	bool InternEntry(const ZipEntry& entry, LastDir* last,
+			PathTree::Dir* parent, size_t* nameBegin) {
+		const std::string& name = entry.name;
+		size_t dirLen = 0;
+		if (!SplitName(entry, &dirLen, nameBegin))
+			return false;
+		if (!entry.IsDir() && last->name && last->len == dirLen
+				&& last->name->compare(0, dirLen, name, 0, dirLen) == 0) {
+			*parent = last->dir;
+			return true;
+		}
+
+		PathTree::Dir dir = PathTree::ROOT;
+		auto intern = [&](size_t begin, size_t len) {
+			dir = tree_->InternUtf8(dir, name.data() + begin, len, entry.IsUtf8());
+			return dir != PathTree::NOT_FOUND;
+		};
+		if (!VisitDirs(name, dirLen, intern))
+			return false;
+
+		if (entry.IsDir())
+			return dir != PathTree::ROOT;
+		last->name = &name;
+		last->len = dirLen;
+		last->dir = dir;
+		*parent = dir;
+		return true;
+	}
+
+	// The central directory is not covered by any CRC. Sizes a damaged one
+	// makes up must fail here, not as a huge allocation on a worker.
+	bool HasPlausibleSizes(const ZipEntry& entry) const {
+		if (entry.compSize > size_)
+			return false;
+		if (entry.method == METHOD_STORED)
+			return entry.size == entry.compSize;
+		if (entry.method == METHOD_DEFLATED)
+			return entry.size <= entry.compSize * MAX_DEFLATE_RATIO;
+		return true;
+	}
+
+	// Sizes |buf| for |entry|, failing instead of throwing. Sizes are only
+	// bounded for the methods Read() supports.
+	bool Allocate(const ZipEntry& entry, std::vector<uint8_t>* buf) {
+		if (entry.method != METHOD_STORED && entry.method != METHOD_DEFLATED)
+			return Fail("unsupported compression method: " + entry.name);
+		if (entry.size > (uint64_t)SIZE_MAX)
+			return Fail("entry too large: " + entry.name);
+		try {
+			buf->resize((size_t)entry.size);
+		}
+		catch (const std::bad_alloc&) {
+			return Fail("out of memory for " + entry.name);
+		}
+		return true;
+	}
+
+	bool Fail(const std::string& message) {
+		return error_.Set(message);
+	}
+
+	bool FindCentralDirectory(uint64_t* count, uint64_t* cdSize, uint64_t* cdOffset) {
+		if (size_ < 22)
+			return Fail("not a ZIP archive");
+
+		// the end record is followed by a comment of at most 64 KB
+		size_t minPos = size_ > 22 + 0xffff ? size_ - 22 - 0xffff : 0;
+		size_t pos = size_ - 22;
+		while (GetLe32(data_ + pos) != SIG_END) {
+			if (pos == minPos)
+				return Fail("end of central directory not found");
+			--pos;
+		}
+
+		const uint8_t* end = data_ + pos;
+		*count = GetLe16(end + 10);
+		*cdSize = GetLe32(end + 12);
+		*cdOffset = GetLe32(end + 16);
+
+		bool isZip64 = *count == 0xffff
+			|| *cdSize == 0xffffffff || *cdOffset == 0xffffffff;
+		if (!isZip64)
+			return true;
+
+		if (pos < 20 || GetLe32(end - 20) != SIG_END64_LOCATOR)
+			return Fail("ZIP64 locator not found");
+
+		uint64_t end64Pos = GetLe64(end - 20 + 8);
+		if (end64Pos > size_ || size_ - end64Pos < 56
+				|| GetLe32(data_ + end64Pos) != SIG_END64)
+			return Fail("bad ZIP64 end record");
+
+		const uint8_t* end64 = data_ + end64Pos;
+		*count = GetLe64(end64 + 32);
+		*cdSize = GetLe64(end64 + 40);
+		*cdOffset = GetLe64(end64 + 48);
+		return true;
+	}
+
+	static bool ReadZip64Extra(const uint8_t* p, size_t len, ZipEntry* entry) {
+		while (len >= 4) {
+			uint16_t id = GetLe16(p);
+			size_t fieldLen = GetLe16(p + 2);
+			if (fieldLen > len - 4)
+				return false;
+
+			if (id == 0x0001) {
+				const uint8_t* q = p + 4;
+				const uint8_t* qEnd = q + fieldLen;
+				uint64_t* fields[] = {
+					entry->size == 0xffffffff ? &entry->size : NULL,
+					entry->compSize == 0xffffffff ? &entry->compSize : NULL,
+					entry->localOffset == 0xffffffff ? &entry->localOffset : NULL,
+				};
+				for (uint64_t* field : fields) {
+					if (!field)
+						continue;
+					if (qEnd - q < 8)
+						return false;
+					*field = GetLe64(q);
+					q += 8;
+				}
+			}
+
+			p += 4 + fieldLen;
+			len -= 4 + fieldLen;
+		}
+		return true;
+	}
+
+	bool LocateData(const ZipEntry& entry, const uint8_t** src) {
+		uint64_t off = entry.localOffset;
+		if (off > size_ || size_ - off < 30 || GetLe32(data_ + off) != SIG_LOCAL)
+			return Fail("bad local header: " + entry.name);
+
+		uint64_t dataOff = off + 30 + GetLe16(data_ + off + 26) + GetLe16(data_ + off + 28);
+		if (dataOff > size_ || size_ - dataOff < entry.compSize)
+			return Fail("entry data out of range: " + entry.name);
+
+		*src = data_ + dataOff;
+		return true;
+	}
+
+	const uint8_t* data_ = NULL;
+	size_t size_ = 0;
+	size_t cdOffset_ = 0;
+	const uint8_t* digests_ = NULL;
+	std::vector<ZipEntry> entries_;
+	std::unique_ptr<PathTree> tree_;
+	FirstError error_;
+};
+
+// Small files are extracted in batches per pool task, so a tree of
+// thousands of tiny files does not cost a task handoff per file.
+const size_t EXTRACT_BATCH_FILES = 64;
+const uint64_t EXTRACT_BATCH_BYTES = 1024 * 1024;
+
+// Runs extraction jobs, possibly gathered from several archives, biggest
+// first so the long entries (python3x.dll, *.pyd) never end up as the
+// tail of the schedule. Without a pool the jobs run on the caller. With
+// IO_ASYNC each batch keeps its writes in flight on the worker's queue.
+// Entry modes are applied once the files of a batch are written.
+inline bool RunExtractJobs(std::vector<ZipExtractJob>& jobs, TaskPool* pool,
+		IoBackend io = IO_SYNC) {
+	std::stable_sort(jobs.begin(), jobs.end(),
+		[](const ZipExtractJob& a, const ZipExtractJob& b) {
+			return a.cost > b.cost;
+		});
+
+	std::atomic<bool> failed(false);
+	TaskPool::Group group;
+	size_t begin = 0;
+	while (begin < jobs.size()) {
+		size_t end = begin;
+		uint64_t cost = 0, bytes = 0;
+		while (end < jobs.size() && end - begin < EXTRACT_BATCH_FILES
+				&& cost < EXTRACT_BATCH_BYTES) {
+			bytes += jobs[end].archive->Entries()[jobs[end].index].size;
+			cost += jobs[end++].cost;
+		}
+
+		const ZipExtractJob* first = &jobs[begin];
+		const ZipExtractJob* last = first + (end - begin);
+		auto task = [first, last, bytes, io, &failed] {
+			IoQueue* queue = ThreadIoQueue(io);
+			std::unique_ptr<ExtractWriter> writer(queue ? new ExtractWriter(queue) : NULL);
+			const ZipExtractJob* p = first;
+			for (; p != last && !failed; ++p) {
+				if (!p->archive->ExtractEntry(*p, writer.get()))
+					failed = true;
+			}
+			size_t index = 0;
+			if (writer && !writer->Finish(&index) && index < (size_t)(p - first)) {
+				first[index].archive->WriteFailed(first[index]);
+				failed = true;
+			}
+			for (const ZipExtractJob* q = first; q != p && !failed; ++q) {
+				if (!q->archive->ApplyMode(*q))
+					failed = true;
+			}
+			Progress::Get().Done(last - first, bytes);
+		};
+
+		if (pool)
+			pool->Submit(task, &group);
+		else
+			task();
+		begin = end;
+	}
+
+	if (pool)
+		pool->Wait(&group);
+	return !failed;
+}
+
+inline bool ZipArchive::ExtractTo(const PathString& dir, TaskPool* pool, IoBackend io) {
+	std::vector<ZipExtractJob> jobs;
+	return PlanExtract(dir, &jobs) && RunExtractJobs(jobs, pool, io);
+}
+
+inline bool ZipArchive::ReadAll(std::vector<std::vector<uint8_t>>* contents, TaskPool* pool) {
+	contents->clear();
+	contents->resize(entries_.size());
+
+	std::atomic<bool> failed(false);
+	TaskPool::Group group;
+	for (size_t i = 0; i < entries_.size(); ++i) {
+		const ZipEntry* entry = &entries_[i];
+		std::vector<uint8_t>* out = &(*contents)[i];
+		auto task = [this, entry, out, &failed] {
+			static thread_local Inflater inflater;
+			if (!failed && (!Allocate(*entry, out)
+					|| !Read(*entry, out->empty() ? NULL : &(*out)[0], &inflater)))
+				failed = true;
+		};
+
+		if (pool)
+			pool->Submit(task, &group);
+		else
+			task();
+	}
+
+	if (pool)
+		pool->Wait(&group);
+	return !failed;
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "endian.hpp"
+#include "inflate.hpp"
+#include "taskpool.hpp"
+#include "zip.hpp"
+
+// Minimal ZIP writer building an archive in memory. Entries are added
+// already encoded (stored, or deflated by the caller); no ZIP64, so the
+// archive stays below 4 GB and 65535 entries.
+class ZipWriter {
+public:
+	static const uint16_t DOS_TIME = 0x6000;  // 12:00
+	static const uint16_t DOS_DATE = 0x5a21;  // 2025-01-01
+
+	bool Add(const std::string& name, uint16_t method, uint32_t crc,
+			const uint8_t* packed, size_t packedSize, uint64_t size,
+			uint16_t dosDate = DOS_DATE, uint16_t dosTime = DOS_TIME, bool utf8 = true) {
+		if (count_ == 0xffff || size > 0xffffffffu
+				|| out_.size() + 30 + name.size() + packedSize > 0xffffffffu)
+			return false;
+
+		uint32_t offset = (uint32_t)out_.size();
+		PutLe32(&out_, 0x04034b50);
+		PutHeaderFields(&out_, method, crc, packedSize, size, dosDate, dosTime, utf8, name);
+		PutLe16(&out_, 0);  // extra length
+		out_ += name;
+		out_.append((const char*)packed, packedSize);
+
+		PutLe32(&central_, 0x02014b50);
+		PutLe16(&central_, 20);  // made by
+		PutHeaderFields(&central_, method, crc, packedSize, size, dosDate, dosTime, utf8, name);
+		PutLe16(&central_, 0);  // extra length
+		PutLe16(&central_, 0);  // comment length
+		PutLe16(&central_, 0);  // disk
+		PutLe16(&central_, 0);  // internal attributes
+		PutLe32(&central_, 0);  // external attributes
+		PutLe32(&central_, offset);
+		central_ += name;
+		++count_;
+		return true;
+	}
+
+	bool AddStored(const std::string& name, const uint8_t* data, size_t size,
+			uint16_t dosDate = DOS_DATE, uint16_t dosTime = DOS_TIME) {
+		return Add(name, 0, Crc32::Update(0, data, size), data, size, size,
+			dosDate, dosTime);
+	}
+
+	// Appends the central directory; false if the archive got too big.
+	bool Finish(std::string* archive) {
+		if (out_.size() + central_.size() > 0xffffffffu)
+			return false;
+
+		uint32_t cdOffset = (uint32_t)out_.size();
+		out_ += central_;
+		PutLe32(&out_, 0x06054b50);
+		PutLe16(&out_, 0);
+		PutLe16(&out_, 0);
+		PutLe16(&out_, (uint16_t)count_);
+		PutLe16(&out_, (uint16_t)count_);
+		PutLe32(&out_, (uint32_t)central_.size());
+		PutLe32(&out_, cdOffset);
+		PutLe16(&out_, 0);
+		archive->swap(out_);
+		out_.clear();
+		central_.clear();
+		count_ = 0;
+		return true;
+	}
+
+private:
+	static void PutHeaderFields(std::string* out, uint16_t method, uint32_t crc,
+			size_t packedSize, uint64_t size, uint16_t dosDate, uint16_t dosTime,
+			bool utf8, const std::string& name) {
+		PutLe16(out, 20);  // version needed
+		PutLe16(out, utf8 ? 0x0800 : 0);
+		PutLe16(out, method);
+		PutLe16(out, dosTime);
+		PutLe16(out, dosDate);
+		PutLe32(out, crc);
+		PutLe32(out, (uint32_t)packedSize);
+		PutLe32(out, (uint32_t)size);
+		PutLe16(out, (uint16_t)name.size());
+	}
+
+	std::string out_;
+	std::string central_;
+	size_t count_ = 0;
+};
+
+// Rewrites the archive at |data| with every entry stored, decoding the
+// entries on |pool|. Such an archive extracts with plain copies and
+// leaves the compression to an outer codec.
+inline bool StoreZipEntries(const uint8_t* data, size_t size, TaskPool* pool,
+		std::string* archive, std::string* error) {
+	ZipArchive zip;
+	if (!zip.Open(data, size)) {
+		*error = zip.Error();
+		return false;
+	}
+
+	std::vector<std::vector<uint8_t>> contents;
+	if (!zip.ReadAll(&contents, pool)) {
+		*error = zip.Error();
+		return false;
+	}
+
+	const std::vector<ZipEntry>& entries = zip.Entries();
+	ZipWriter writer;
+	for (size_t i = 0; i < entries.size(); ++i) {
+		const ZipEntry& entry = entries[i];
+		const uint8_t* content = contents[i].empty() ? NULL : &contents[i][0];
+		if (!writer.Add(entry.name, 0, entry.crc, content, contents[i].size(),
+				entry.size, entry.dosDate, entry.dosTime, entry.IsUtf8())) {
+			*error = "archive too large to rewrite";
+			return false;
+		}
+		std::vector<uint8_t>().swap(contents[i]);
+	}
+
+	if (!writer.Finish(archive)) {
+		*error = "archive too large to rewrite";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,179 @@
+#include "test.hpp"
+#include "blockcodec.hpp"
+#include "endian.hpp"
+#include "sha256.hpp"
+
+static const uint32_t BLOCK_SIZE = 4096;
+
+// Seeded bytes that no block can compress.
+static std::string Incompressible(size_t size, uint32_t seed) {
+	std::string data(size, '\0');
+	uint32_t x = seed;
+	for (size_t i = 0; i < size; ++i) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		data[i] = (char)(x >> 24);
+	}
+	return data;
+}
+
+// Words of a small vocabulary: long matches for the byte codec.
+static std::string Repetitive(size_t size) {
+	static const char* const words[] = { "import ", "def ", "self", ".py\n", "return ", "None" };
+	std::string data;
+	for (size_t i = 0; data.size() < size; ++i)
+		data += words[(i * 7 + i / 5) % 6];
+	data.resize(size);
+	return data;
+}
+
+// Random letters of a small alphabet: few matches, but literals that the
+// entropy stage shrinks.
+static std::string Skewed(size_t size, uint32_t seed) {
+	std::string data = Incompressible(size, seed);
+	for (char& c : data)
+		c = (char)('a' + (uint8_t)c % 8);
+	return data;
+}
+
+static uint32_t BlockFlags(const std::string& stream, size_t index) {
+	uint32_t field = GetLe32((const uint8_t*)stream.data() + BLOCK_STREAM_HEADER_SIZE + 4 * index);
+	return field & (BLOCK_STREAM_RAW | BLOCK_STREAM_ENTROPY);
+}
+
+static bool RoundTrip(const std::string& data, TaskPool* pool) {
+	std::string stream = BlockStream::Encode((const uint8_t*)data.data(), data.size(),
+		pool, BLOCK_SIZE);
+	BlockStream reader;
+	if (!reader.Open((const uint8_t*)stream.data(), stream.size())
+			|| reader.RawSize() != data.size()
+			|| reader.BlockCount() != (data.size() + BLOCK_SIZE - 1) / BLOCK_SIZE)
+		return false;
+
+	std::vector<uint8_t> out(data.size() + 1, 0xee);
+	return reader.Decode(&out[0], pool)
+		&& memcmp(&out[0], data.data(), data.size()) == 0
+		&& out[data.size()] == 0xee;
+}
+
+static void TestRoundTrips(TaskPool* pool) {
+	CHECK(RoundTrip(std::string(), pool));
+	CHECK(RoundTrip(Incompressible(10 * BLOCK_SIZE + 123, 1), pool));
+	CHECK(RoundTrip(Repetitive(10 * BLOCK_SIZE + 123), pool));
+	CHECK(RoundTrip(std::string(5 * BLOCK_SIZE, 'z'), pool));
+	CHECK(RoundTrip(Skewed(10 * BLOCK_SIZE + 123, 4), pool));
+
+	// block compressed and block kept raw side by side
+	std::string mixed = Repetitive(3 * BLOCK_SIZE) + Incompressible(3 * BLOCK_SIZE, 2);
+	CHECK(RoundTrip(mixed, pool));
+
+	// each input takes the form of block it is meant for
+	std::string data = Repetitive(2 * BLOCK_SIZE);
+	std::string stream = BlockStream::Encode((const uint8_t*)data.data(), data.size(),
+		pool, BLOCK_SIZE);
+	CHECK(stream.size() < data.size() / 2);
+	CHECK(BlockFlags(stream, 0) == 0);
+	data = Skewed(2 * BLOCK_SIZE, 5);
+	stream = BlockStream::Encode((const uint8_t*)data.data(), data.size(), pool, BLOCK_SIZE);
+	CHECK(BlockFlags(stream, 0) == BLOCK_STREAM_ENTROPY);
+	data = Incompressible(2 * BLOCK_SIZE, 6);
+	stream = BlockStream::Encode((const uint8_t*)data.data(), data.size(), pool, BLOCK_SIZE);
+	CHECK(BlockFlags(stream, 0) == BLOCK_STREAM_RAW);
+}
+
+static void TestBlockBoundaries(TaskPool* pool) {
+	const size_t sizes[] = {
+		1, BLOCK_SIZE - 1, BLOCK_SIZE, BLOCK_SIZE + 1,
+		3 * BLOCK_SIZE - 1, 3 * BLOCK_SIZE, 3 * BLOCK_SIZE + 1,
+	};
+	for (size_t size : sizes) {
+		CHECK(RoundTrip(Repetitive(size), pool));
+		CHECK(RoundTrip(Incompressible(size, (uint32_t)size), pool));
+		CHECK(RoundTrip(Skewed(size, (uint32_t)size), pool));
+	}
+}
+
+static void TestSeek() {
+	std::string data = Repetitive(4 * BLOCK_SIZE) + Incompressible(2 * BLOCK_SIZE + 100, 3);
+	std::string stream = BlockStream::Encode((const uint8_t*)data.data(), data.size(),
+		NULL, BLOCK_SIZE);
+	BlockStream reader;
+	CHECK(reader.Open((const uint8_t*)stream.data(), stream.size()));
+
+	// the stored offset of a block is the sum of the stored sizes before it
+	const uint8_t* table = (const uint8_t*)stream.data() + BLOCK_STREAM_HEADER_SIZE;
+	uint64_t expected = BLOCK_STREAM_HEADER_SIZE
+		+ reader.BlockCount() * (4 + Sha256::DIGEST_SIZE);
+	for (size_t block = 0; block < reader.BlockCount(); ++block) {
+		size_t index = 0;
+		uint64_t storedOffset = 0;
+		uint64_t rawOffset = (uint64_t)block * BLOCK_SIZE + 17;
+		CHECK(reader.Seek(rawOffset, &index, &storedOffset));
+		CHECK(index == block);
+		CHECK(storedOffset == expected);
+		expected += GetLe32(table + 4 * block) & ~(BLOCK_STREAM_RAW | BLOCK_STREAM_ENTROPY);
+
+		std::vector<uint8_t> out(BLOCK_SIZE);
+		size_t size = 0;
+		CHECK(reader.DecodeBlock(index, &out[0], &size));
+		CHECK(size == std::min<size_t>(BLOCK_SIZE, data.size() - block * BLOCK_SIZE));
+		CHECK(memcmp(&out[0], data.data() + block * BLOCK_SIZE, size) == 0);
+	}
+	CHECK(expected == stream.size());
+
+	size_t index = 0;
+	uint64_t storedOffset = 0;
+	CHECK(reader.Seek(data.size() - 1, &index, &storedOffset) && index == 6);
+	CHECK(!reader.Seek(data.size(), &index, &storedOffset));
+}
+
+static std::string DecodeError(const std::string& stream, TaskPool* pool) {
+	BlockStream reader;
+	if (!reader.Open((const uint8_t*)stream.data(), stream.size()))
+		return "open: " + reader.Error();
+	std::vector<uint8_t> out((size_t)reader.RawSize() + 1);
+	if (!reader.Decode(&out[0], pool))
+		return reader.Error();
+	return std::string();
+}
+
+static void TestDamage(const std::string& data, TaskPool* pool) {
+	std::string stream = BlockStream::Encode((const uint8_t*)data.data(), data.size(),
+		pool, BLOCK_SIZE);
+	CHECK(DecodeError(stream, pool).empty());
+
+	// cut anywhere into the last block, or into the table
+	CHECK(DecodeError(stream.substr(0, stream.size() - 1), pool) == "open: truncated block stream");
+	CHECK(DecodeError(stream.substr(0, BLOCK_STREAM_HEADER_SIZE + 8), pool)
+		== "open: bad block stream header");
+
+	// a flipped bit in the last block fails its digest
+	std::string flipped = stream;
+	flipped[flipped.size() - 3] ^= 0x10;
+	CHECK(DecodeError(flipped, pool) == "damaged block stream");
+
+	// garbage with a matching digest gets past the check, not the decoder
+	size_t count = (data.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	size_t first = BLOCK_STREAM_HEADER_SIZE + count * (4 + Sha256::DIGEST_SIZE);
+	uint32_t field = GetLe32((const uint8_t*)stream.data() + BLOCK_STREAM_HEADER_SIZE);
+	CHECK(!(field & BLOCK_STREAM_RAW));
+	size_t storedSize = field & ~(BLOCK_STREAM_RAW | BLOCK_STREAM_ENTROPY);
+	std::string garbage = stream;
+	for (size_t i = 0; i < storedSize; ++i)
+		garbage[first + i] = (char)0xff;
+	Sha256::Hash(garbage.data() + first, storedSize,
+		(uint8_t*)&garbage[BLOCK_STREAM_HEADER_SIZE + count * 4]);
+	CHECK(DecodeError(garbage, pool) == "corrupt block stream");
+}
+
+void BlockStreamTests(const PathString& scratch) {
+	(void)scratch;
+	TaskPool pool(2);
+	TestRoundTrips(&pool);
+	TestRoundTrips(NULL);
+	TestBlockBoundaries(&pool);
+	TestSeek();
+	TestDamage(Repetitive(4 * BLOCK_SIZE), &pool);
+	TestDamage(Skewed(4 * BLOCK_SIZE, 7), NULL);
+}
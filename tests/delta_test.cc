@@ -0,0 +1,98 @@
+#include "test.hpp"
+#include "delta.hpp"
+
+static bool Install(DeltaInstaller* installer, const std::string& zip, TaskPool* pool) {
+	return installer->Add("app.zip", (const uint8_t*)zip.data(), zip.size(), "app")
+		&& installer->Run(pool);
+}
+
+static void TestUpgrade(const PathString& scratch, TaskPool* pool) {
+	PathString dir = ScratchDir(scratch, "upgrade");
+	PathString v1 = TestPath(dir, "v1");
+	PathString v2 = TestPath(dir, "v2");
+	MakeDirs(v1);
+	MakeDirs(v2);
+
+	// no manifest in the base yet: everything is written
+	std::string zip1 = MakeZip({
+		{ "same.txt", "same" },
+		{ "lib/changed.py", "old" },
+		{ "touched.txt", "touched" },
+		{ "removed.txt", "removed" },
+	});
+	DeltaInstaller first(v1, TestPath(dir, "none"));
+	CHECK(Install(&first, zip1, pool));
+	CHECK(!first.IsIncremental());
+	CHECK(first.Unchanged() == 0 && first.Written() == 4);
+	CHECK(ReadText(TestPath(v1, "app/lib/changed.py")) == "old");
+
+	// edited in place after the install: same size, new modification time
+	CHECK(WriteText(TestPath(v1, "app/touched.txt"), "TOUCHED"));
+
+	std::string zip2 = MakeZip({
+		{ "same.txt", "same" },
+		{ "lib/changed.py", "new!" },
+		{ "touched.txt", "touched" },
+		{ "added.txt", "added" },
+	});
+	DeltaInstaller second(v2, v1);
+	CHECK(Install(&second, zip2, pool));
+	CHECK(second.IsIncremental());
+	CHECK(second.Unchanged() == 1 && second.Written() == 3);
+	CHECK(second.WrittenBytes() == 4 + 7 + 5);
+
+	CHECK(IsSameFile(TestPath(v2, "app/same.txt"), TestPath(v1, "app/same.txt")));
+	CHECK(ReadText(TestPath(v2, "app/same.txt")) == "same");
+	CHECK(!IsSameFile(TestPath(v2, "app/lib/changed.py"), TestPath(v1, "app/lib/changed.py")));
+	CHECK(ReadText(TestPath(v2, "app/lib/changed.py")) == "new!");
+	CHECK(!IsSameFile(TestPath(v2, "app/touched.txt"), TestPath(v1, "app/touched.txt")));
+	CHECK(ReadText(TestPath(v2, "app/touched.txt")) == "touched");
+	CHECK(ReadText(TestPath(v2, "app/added.txt")) == "added");
+	uint64_t size = 0;
+	CHECK(!QueryFileSize(TestPath(v2, "app/removed.txt").c_str(), &size));
+
+	// the new manifest records the new tree
+	InstallManifest manifest;
+	CHECK(manifest.Load(DeltaInstaller::ManifestPath(v2).c_str()));
+	CHECK(manifest.Files().size() == 4);
+	const InstalledFile* changed = manifest.Find("app/lib/changed.py");
+	CHECK(changed && changed->size == 4 && changed->modified != 0);
+	CHECK(!manifest.Find("app/removed.txt"));
+}
+
+// A manifest without times cannot tell whether a file was edited, so
+// nothing is taken over.
+static void TestManifestWithoutTimes(const PathString& scratch, TaskPool* pool) {
+	PathString dir = ScratchDir(scratch, "v1manifest");
+	PathString base = TestPath(dir, "base");
+	PathString root = TestPath(dir, "root");
+	MakeDirs(TestPath(base, "app"));
+	MakeDirs(root);
+	WriteText(TestPath(base, "app/same.txt"), "same");
+	char line[64];
+	snprintf(line, sizeof(line), "%08x 4 app/same.txt\n", Crc32::Update(0, "same", 4));
+	WriteText(DeltaInstaller::ManifestPath(base),
+		std::string(INSTALL_MANIFEST_HEADER_V1) + "\n" + line);
+
+	DeltaInstaller installer(root, base);
+	CHECK(Install(&installer, MakeZip({ { "same.txt", "same" } }), pool));
+	CHECK(installer.IsIncremental());
+	CHECK(installer.Installed().Find("app/same.txt") != NULL);
+	CHECK(installer.Unchanged() == 0 && installer.Written() == 1);
+	CHECK(!IsSameFile(TestPath(root, "app/same.txt"), TestPath(base, "app/same.txt")));
+}
+
+static void TestBadArchive(const PathString& scratch) {
+	PathString root = ScratchDir(scratch, "bad");
+	DeltaInstaller installer(root, TestPath(scratch, "none"));
+	std::string zip = "not a zip";
+	CHECK(!installer.Add("broken.zip", (const uint8_t*)zip.data(), zip.size(), ""));
+	CHECK(installer.Error().compare(0, 12, "broken.zip: ") == 0);
+}
+
+void DeltaTests(const PathString& scratch) {
+	TaskPool pool(2);
+	TestUpgrade(scratch, &pool);
+	TestManifestWithoutTimes(scratch, &pool);
+	TestBadArchive(scratch);
+}
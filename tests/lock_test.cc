@@ -0,0 +1,127 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "test.hpp"
+#include "instancelock.hpp"
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+static int64_t ElapsedMs(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+// Holds the lock on a thread of its own, since only the owner may release
+// a Windows mutex, and releases it after |holdMs|.
+class Holder {
+public:
+	Holder(const PathString& path, int holdMs) : lock_(path) {
+		thread_ = std::thread([this, holdMs] {
+			acquired_ = lock_.TryAcquire();
+			ready_ = true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(holdMs));
+			lock_.Release();
+		});
+		while (!ready_)
+			std::this_thread::yield();
+	}
+
+	~Holder() {
+		thread_.join();
+	}
+
+	bool Acquired() const {
+		return acquired_;
+	}
+
+private:
+	InstanceLock lock_;
+	std::thread thread_;
+	std::atomic<bool> ready_{ false };
+	std::atomic<bool> acquired_{ false };
+};
+
+static void TestExclusive(const PathString& path) {
+	InstanceLock first(path);
+	InstanceLock second(path);
+	CHECK(first.TryAcquire());
+	CHECK(first.IsHeld());
+	CHECK(!second.TryAcquire());
+	CHECK(second.Error() == "another instance is running");
+	first.Release();
+	CHECK(second.TryAcquire());
+}
+
+static void TestHandoff(const PathString& path) {
+	InstanceLock waiter(path);
+	auto start = std::chrono::steady_clock::now();
+	Holder holder(path, 50);
+	CHECK(holder.Acquired());
+	CHECK(waiter.Acquire(10000));
+	int64_t waited = ElapsedMs(start);
+	CHECK(waited >= 40 && waited < 5000);
+}
+
+static void TestTimeout(const PathString& path) {
+	InstanceLock waiter(path);
+	Holder holder(path, 300);
+	CHECK(holder.Acquired());
+	auto start = std::chrono::steady_clock::now();
+	CHECK(!waiter.Acquire(100));
+	int64_t waited = ElapsedMs(start);
+	CHECK(waited >= 90 && waited < 5000);
+	CHECK(waiter.Error() == "another instance is running");
+	CHECK(!waiter.IsHeld());
+}
+
+// A holder that ends without releasing: a thread that exits owning the
+// mutex abandons it, a process that exits drops its flock().
+static void TestHolderGone(const PathString& path) {
+	InstanceLock waiter(path);
+#ifdef _WIN32
+	InstanceLock held(path);
+	std::atomic<int> acquired(-1);
+	std::thread owner([&held, &acquired] {
+		acquired = held.TryAcquire() ? 1 : 0;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	});
+	while (acquired < 0)
+		std::this_thread::yield();
+	CHECK(acquired == 1);
+	CHECK(waiter.Acquire(10000));
+	owner.join();
+#else
+	int ready[2];
+	CHECK(pipe(ready) == 0);
+	pid_t child = fork();
+	if (child == 0) {
+		InstanceLock held(path);
+		char acquired = held.TryAcquire() ? 1 : 0;
+		if (write(ready[1], &acquired, 1) != 1 || !acquired)
+			_exit(1);
+		usleep(50 * 1000);
+		_exit(0);
+	}
+	char acquired = 0;
+	CHECK(child > 0 && read(ready[0], &acquired, 1) == 1 && acquired);
+	CHECK(waiter.Acquire(10000));
+	int status = 0;
+	waitpid(child, &status, 0);
+	close(ready[0]);
+	close(ready[1]);
+#endif
+}
+
+void LockTests(const PathString& scratch) {
+#ifdef _WIN32
+	PathString path = L"Local\\creeper-tests-" + std::to_wstring(GetCurrentProcessId());
+	(void)scratch;
+#else
+	PathString path = TestPath(scratch, "instance.lock");
+#endif
+	TestExclusive(path);
+	TestHandoff(path);
+	TestTimeout(path);
+	TestHolderGone(path);
+}
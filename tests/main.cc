@@ -0,0 +1,52 @@
+#include <cstdio>
+#include <cstring>
+#include "test.hpp"
+
+int g_failedChecks = 0;
+
+struct TestCommand {
+	const char* name;
+	TestSuite suite;
+};
+
+static const TestCommand g_suites[] = {
+	{ "zip", &ZipTests },
+	{ "staging", &StagingTests },
+	{ "lock", &LockTests },
+	{ "blockstream", &BlockStreamTests },
+	{ "sha256", &Sha256Tests },
+	{ "delta", &DeltaTests },
+	{ "runtimecache", &RuntimeCacheTests },
+	{ "tree", &TreeTests },
+	{ "task", &TaskTests },
+	{ "payload", &PayloadTests },
+	{ "stdlibpack", &StdlibPackTests },
+};
+
+int main(int argc, char** argv) {
+	if (argc == 3) {
+		for (const TestCommand& cmd : g_suites) {
+			if (strcmp(argv[1], cmd.name) != 0)
+				continue;
+			PathString scratch = Utf8ToPath(argv[2], strlen(argv[2]));
+			DeleteTree(scratch);
+			if (!MakeDirs(scratch)) {
+				fprintf(stderr, "%s: cannot create %s\n", cmd.name, argv[2]);
+				return 1;
+			}
+			cmd.suite(scratch);
+			DeleteTree(scratch);
+			if (g_failedChecks) {
+				fprintf(stderr, "%s: %d checks failed\n", cmd.name, g_failedChecks);
+				return 1;
+			}
+			printf("%s: ok\n", cmd.name);
+			return 0;
+		}
+	}
+
+	fprintf(stderr, "usage:\n");
+	for (const TestCommand& cmd : g_suites)
+		fprintf(stderr, "  %s %s <scratch dir>\n", argv[0], cmd.name);
+	return 1;
+}
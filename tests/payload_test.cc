@@ -0,0 +1,208 @@
+#include "test.hpp"
+#include "endian.hpp"
+#include "payload.hpp"
+#include "sha256.hpp"
+
+static const std::string HOST = "MZ host image";
+
+static const uint8_t* Bytes(const std::string& data) {
+	return (const uint8_t*)data.data();
+}
+
+static void SetLe32(std::string* data, size_t pos, uint32_t v) {
+	for (int i = 0; i < 4; ++i)
+		(*data)[pos + i] = (char)(v >> (8 * i));
+}
+
+static size_t FooterPos(const std::string& image) {
+	return image.size() - PAYLOAD_FOOTER_SIZE;
+}
+
+static size_t IndexPos(const std::string& image) {
+	return (size_t)GetLe64(Bytes(image) + FooterPos(image) + 24);
+}
+
+// Makes an edited index pass its CRC again, so only the checks behind it
+// can reject it.
+static void FixIndexCrc(std::string* image) {
+	size_t footer = FooterPos(*image);
+	size_t index = IndexPos(*image);
+	SetLe32(image, footer + 36, Crc32::Update(0, image->data() + index, footer - index));
+}
+
+static std::string OpenError(const std::string& image) {
+	PayloadTable table;
+	CHECK(!table.Open(Bytes(image), image.size()));
+	CHECK(table.Entries().empty());
+	return table.Error();
+}
+
+// The host, then "digested" with two entry digests, "plain" and the
+// block-compressed "packed".
+static std::string WriteNarrow(const PathString& scratch, TaskPool* pool) {
+	PathString path = TestPath(scratch, "narrow.bin");
+	std::string digests(2 * Sha256::DIGEST_SIZE, 'd');
+	std::string packed(10000, 'p');
+	PayloadWriter writer;
+	CHECK(writer.Create(path.c_str()));
+	CHECK(writer.WriteHost(Bytes(HOST), HOST.size()));
+	CHECK(writer.AddPayload("digested", Bytes(std::string("zip data")), 8));
+	writer.AddEntryDigests(digests);
+	CHECK(writer.AddPayload("plain", Bytes(std::string("plain data")), 10));
+	CHECK(writer.AddCompressedPayload("packed", Bytes(packed), packed.size(), pool));
+	CHECK(writer.Finish());
+	return ReadText(path);
+}
+
+static void TestNarrow(const std::string& image) {
+	PayloadTable table;
+	CHECK(table.Open(Bytes(image), image.size()));
+	CHECK(!table.IsLegacy());
+	CHECK(table.HostSize() == HOST.size());
+	CHECK(table.Entries().size() == 3);
+	CHECK(GetLe16(Bytes(image) + FooterPos(image) + 10) == 0);
+
+	const PayloadEntry* digested = table.Find("digested");
+	CHECK(digested && digested->offset == HOST.size());
+	CHECK(digested && digested->flags == PAYLOAD_ENTRY_DIGESTS);
+	CHECK(digested && digested->entryDigests == std::string(2 * Sha256::DIGEST_SIZE, 'd'));
+
+	const PayloadEntry* plain = table.Find("plain");
+	CHECK(plain && plain->size == 10 && plain->storedSize == 10 && plain->flags == 0);
+	CHECK(plain && memcmp(table.Data(*plain), "plain data", 10) == 0);
+	uint8_t hash[Sha256::DIGEST_SIZE];
+	Sha256::Hash("plain data", 10, hash);
+	CHECK(plain && plain->hashType == PAYLOAD_HASH_SHA256
+		&& memcmp(plain->hash, hash, sizeof(hash)) == 0);
+
+	const PayloadEntry* packed = table.Find("packed");
+	CHECK(packed && packed->flags == PAYLOAD_BLOCK_STREAM);
+	CHECK(packed && packed->size == 10000 && packed->storedSize < packed->size);
+	CHECK(!table.Find("missing"));
+}
+
+// A copied block stream that decodes to more than 4 GiB needs 64-bit
+// fields, though the image itself stays small.
+static void TestWide(const PathString& scratch) {
+	PayloadEntry source;
+	source.name = "huge";
+	source.storedSize = 5;
+	source.size = 5ull << 30;
+	source.flags = PAYLOAD_BLOCK_STREAM;
+	source.hashType = PAYLOAD_HASH_SHA256;
+	memset(source.hash, 0xab, sizeof(source.hash));
+
+	PathString path = TestPath(scratch, "wide.bin");
+	PayloadWriter writer;
+	CHECK(writer.Create(path.c_str()));
+	CHECK(writer.WriteHost(Bytes(HOST), HOST.size()));
+	CHECK(writer.AddPayload("small", Bytes(std::string("small")), 5));
+	CHECK(writer.CopyPayload(source, Bytes(std::string("bytes"))));
+	CHECK(writer.Finish());
+	std::string image = ReadText(path);
+	CHECK(GetLe16(Bytes(image) + FooterPos(image) + 10) == PAYLOAD_INDEX_OFFSET64);
+
+	PayloadTable table;
+	CHECK(table.Open(Bytes(image), image.size()));
+	CHECK(table.Entries().size() == 2);
+	const PayloadEntry* huge = table.Find("huge");
+	CHECK(huge && huge->size == 5ull << 30 && huge->storedSize == 5);
+	CHECK(huge && huge->offset == HOST.size() + 5 && huge->flags == PAYLOAD_BLOCK_STREAM);
+	CHECK(huge && huge->hash[0] == 0xab && memcmp(table.Data(*huge), "bytes", 5) == 0);
+	const PayloadEntry* small = table.Find("small");
+	CHECK(small && small->size == 5 && memcmp(table.Data(*small), "small", 5) == 0);
+}
+
+static void TestDamage(const std::string& image) {
+	size_t footer = FooterPos(image);
+	size_t index = IndexPos(image);
+
+	std::string bad = image;
+	bad[index + 30] ^= 1;
+	CHECK(OpenError(bad) == "payload index checksum mismatch");
+
+	bad = image;
+	bad[footer + 8] = 9;
+	CHECK(OpenError(bad) == "unsupported payload index version");
+
+	// the index must end at the footer
+	bad = image;
+	SetLe32(&bad, footer + 32, (uint32_t)(footer - index - 1));
+	CHECK(OpenError(bad) == "payload index out of range");
+
+	// a host that would overlap the index
+	bad = image;
+	SetLe32(&bad, footer + 16, (uint32_t)index + 1);
+	CHECK(OpenError(bad) == "payload index out of range");
+
+	// the first entry, "digested", ending past the index
+	bad = image;
+	SetLe32(&bad, index + 12, (uint32_t)index);
+	FixIndexCrc(&bad);
+	CHECK(OpenError(bad) == "payload out of range: digested");
+
+	// one entry digest more than the index holds
+	bad = image;
+	size_t digestCount = index + 8 + 3 * 4 + 32 + strlen("digested");
+	CHECK(GetLe32(Bytes(bad) + digestCount) == 2);
+	SetLe32(&bad, digestCount, 0x10000000);
+	FixIndexCrc(&bad);
+	CHECK(OpenError(bad) == "truncated payload index");
+
+	// more entries than the index holds
+	bad = image;
+	SetLe32(&bad, footer + 12, 4);
+	CHECK(OpenError(bad) == "truncated payload index");
+}
+
+static void AppendLegacy(std::string* image, const std::string& payload) {
+	uint32_t offset = (uint32_t)image->size();
+	uint32_t length = (uint32_t)payload.size();
+	*image += payload;
+	uint32_t fields[] = { offset, length, offset ^ length };
+	for (uint32_t field : fields) {
+		for (int shift = 24; shift >= 0; shift -= 8)
+			image->push_back((char)(field >> shift));
+	}
+}
+
+static void TestLegacyChain() {
+	std::string image = HOST;
+	AppendLegacy(&image, "first payload");
+	AppendLegacy(&image, "second");
+
+	PayloadTable table;
+	CHECK(table.Open(Bytes(image), image.size()));
+	CHECK(table.IsLegacy());
+	CHECK(table.HostSize() == HOST.size());
+	CHECK(table.Entries().size() == 2);
+	if (table.Entries().size() == 2) {
+		const PayloadEntry& first = table.Entries()[0];
+		const PayloadEntry& second = table.Entries()[1];
+		CHECK(first.offset == HOST.size() && first.size == 13 && first.name.empty());
+		CHECK(memcmp(table.Data(first), "first payload", 13) == 0);
+		CHECK(second.offset == HOST.size() + 13 + 12 && second.storedSize == 6);
+		CHECK(memcmp(table.Data(second), "second", 6) == 0);
+	}
+
+	// a damaged last trailer leaves no chain, the whole image is the host
+	std::string broken = image;
+	broken[broken.size() - 1] ^= 1;
+	CHECK(table.Open(Bytes(broken), broken.size()));
+	CHECK(!table.IsLegacy());
+	CHECK(table.Entries().empty());
+	CHECK(table.HostSize() == broken.size());
+
+	// a plain image has neither index nor chain
+	CHECK(table.Open(Bytes(HOST), HOST.size()));
+	CHECK(!table.IsLegacy() && table.Entries().empty() && table.Error().empty());
+}
+
+void PayloadTests(const PathString& scratch) {
+	TaskPool pool(2);
+	std::string narrow = WriteNarrow(scratch, &pool);
+	TestNarrow(narrow);
+	TestWide(scratch);
+	TestDamage(narrow);
+	TestLegacyChain();
+}
@@ -0,0 +1,105 @@
+#include "test.hpp"
+#include "runtimecache.hpp"
+#include "solid.hpp"
+
+static PathString TempPath(const RuntimeCache& cache, const std::string& key) {
+	return cache.PathFor(key) + Utf8ToPath(".tmp", 4);
+}
+
+// A prepared runtime stays in "<key>.tmp" until Publish().
+static void TestPublish(const PathString& scratch, TaskPool* pool) {
+	RuntimeCache cache(ScratchDir(scratch, "publish"));
+	std::string zip = MakeZip({ { "lib/os.py", "import sys" } });
+	CHECK(cache.Prepare("k1", (const uint8_t*)zip.data(), zip.size(), pool));
+	CHECK(!cache.Has("k1"));
+	CHECK(ReadText(TestPath(TempPath(cache, "k1"), "lib/os.py")) == "import sys");
+
+	CHECK(cache.Publish("k1"));
+	CHECK(cache.Has("k1"));
+	CHECK(!Exists(TempPath(cache, "k1")));
+	CHECK(ReadText(TestPath(cache.PathFor("k1"), "lib/os.py")) == "import sys");
+
+	// a cached runtime is neither extracted nor replaced again
+	std::string other = MakeZip({ { "lib/os.py", "changed" } });
+	CHECK(cache.Prepare("k1", (const uint8_t*)other.data(), other.size(), pool));
+	CHECK(!Exists(TempPath(cache, "k1")));
+	CHECK(cache.Publish("k1"));
+	CHECK(ReadText(TestPath(cache.PathFor("k1"), "lib/os.py")) == "import sys");
+}
+
+static void TestSolid(const PathString& scratch, TaskPool* pool) {
+	RuntimeCache cache(ScratchDir(scratch, "solid"));
+	std::string content = "print('solid')";
+	SolidWriter writer;
+	writer.AddFile("bin/run.py", (const uint8_t*)content.data(), content.size(),
+		ZipWriter::DOS_DATE, ZipWriter::DOS_TIME);
+	std::string archive;
+	CHECK(writer.Finish(pool, &archive));
+	CHECK(cache.Prepare("s1", (const uint8_t*)archive.data(), archive.size(), pool));
+	CHECK(!cache.Has("s1"));
+	CHECK(cache.Publish("s1"));
+	CHECK(ReadText(TestPath(cache.PathFor("s1"), "bin/run.py")) == content);
+}
+
+// A failed extraction leaves neither "<key>" nor "<key>.tmp".
+static void TestFailedPrepare(const PathString& scratch, TaskPool* pool) {
+	RuntimeCache cache(ScratchDir(scratch, "failed"));
+	std::string zip = MakeZip({ { "lib/os.py", "import sys" } });
+	ZipArchive archive;
+	std::string digests;
+	CHECK(archive.Open((const uint8_t*)zip.data(), zip.size()) && archive.HashEntries(&digests));
+
+	std::string damaged = zip;
+	damaged[damaged.find("import")] = 'I';
+	CHECK(!cache.Prepare("k2", (const uint8_t*)damaged.data(), damaged.size(), pool,
+		IO_SYNC, digests));
+	CHECK(cache.Error() == "damaged entry: lib/os.py");
+	CHECK(!cache.Has("k2"));
+	CHECK(!Exists(TempPath(cache, "k2")));
+
+	std::string garbage = "not an archive";
+	CHECK(!cache.Prepare("k3", (const uint8_t*)garbage.data(), garbage.size(), pool));
+	CHECK(!cache.Has("k3"));
+	CHECK(!Exists(TempPath(cache, "k3")));
+
+	// the good copy still goes through
+	CHECK(cache.Prepare("k2", (const uint8_t*)zip.data(), zip.size(), pool, IO_SYNC, digests));
+	CHECK(cache.Publish("k2"));
+	CHECK(cache.Has("k2"));
+}
+
+static void TestLinkAndPrune(const PathString& scratch, TaskPool* pool) {
+	PathString dir = ScratchDir(scratch, "prune");
+	RuntimeCache cache(TestPath(dir, "cache"));
+	MakeDirs(TestPath(dir, "cache"));
+	std::string v1 = MakeZip({ { "version.txt", "1" } });
+	std::string v2 = MakeZip({ { "version.txt", "2" } });
+	std::string v3 = MakeZip({ { "version.txt", "3" } });
+	CHECK(cache.Prepare("v1", (const uint8_t*)v1.data(), v1.size(), pool) && cache.Publish("v1"));
+	CHECK(cache.Prepare("v2", (const uint8_t*)v2.data(), v2.size(), pool) && cache.Publish("v2"));
+	// an install that died before publishing
+	CHECK(cache.Prepare("v3", (const uint8_t*)v3.data(), v3.size(), pool));
+
+	// the link replaces a plain directory from an install without the cache
+	PathString link = TestPath(dir, "python");
+	MakeDirs(link);
+	WriteText(TestPath(link, "version.txt"), "0");
+	CHECK(cache.Link(link, "v1"));
+	CHECK(ReadText(TestPath(link, "version.txt")) == "1");
+	CHECK(cache.Link(link, "v2"));
+	CHECK(ReadText(TestPath(link, "version.txt")) == "2");
+
+	cache.Prune("v2");
+	CHECK(cache.Has("v2"));
+	CHECK(!cache.Has("v1"));
+	CHECK(!Exists(TempPath(cache, "v3")));
+	CHECK(ReadText(TestPath(link, "version.txt")) == "2");
+}
+
+void RuntimeCacheTests(const PathString& scratch) {
+	TaskPool pool(2);
+	TestPublish(scratch, &pool);
+	TestSolid(scratch, &pool);
+	TestFailedPrepare(scratch, &pool);
+	TestLinkAndPrune(scratch, &pool);
+}
@@ -0,0 +1,83 @@
+#include "test.hpp"
+#include "sha256.hpp"
+
+struct KnownAnswer {
+	std::string message;
+	const char* digest;
+};
+
+static std::string HashHex(const std::string& data) {
+	uint8_t digest[Sha256::DIGEST_SIZE];
+	Sha256::Hash(data.data(), data.size(), digest);
+	return Sha256::ToHex(digest);
+}
+
+// Feeds |data| in pieces of |chunk| bytes, so that the buffered tail and
+// the whole-block path of Update both run.
+static std::string HashHexInChunks(const std::string& data, size_t chunk) {
+	Sha256 sha;
+	for (size_t offset = 0; offset < data.size(); offset += chunk)
+		sha.Update(data.data() + offset, std::min(chunk, data.size() - offset));
+	uint8_t digest[Sha256::DIGEST_SIZE];
+	sha.Final(digest);
+	return Sha256::ToHex(digest);
+}
+
+// The FIPS 180-2 examples, plus the empty message.
+static void TestKnownAnswers() {
+	const KnownAnswer answers[] = {
+		{ "",
+			"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+		{ "abc",
+			"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+			"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+		{ "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmno"
+			"ijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+			"cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+		{ std::string(1000000, 'a'),
+			"cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+	};
+	for (const KnownAnswer& answer : answers) {
+		CHECK(HashHex(answer.message) == answer.digest);
+		CHECK(HashHexInChunks(answer.message, 1) == answer.digest);
+		CHECK(HashHexInChunks(answer.message, 63) == answer.digest);
+		CHECK(HashHexInChunks(answer.message, 65) == answer.digest);
+	}
+}
+
+// The SHA-NI kernel and the portable rounds agree on every length around
+// the padding and block edges. Without SHA-NI both sides are portable.
+static void TestHardwareMatchesPortable() {
+	std::string data(3 * 64 + 9, '\0');
+	uint32_t x = 0x2545f491;
+	for (char& c : data) {
+		x = x * 1664525 + 1013904223;
+		c = (char)(x >> 24);
+	}
+
+	bool hardware = Sha256::UseHardware();
+	for (size_t len = 0; len <= data.size(); ++len) {
+		std::string message = data.substr(0, len);
+		Sha256::UseHardware() = true;
+		std::string fast = HashHex(message);
+		std::string fastChunks = HashHexInChunks(message, 7);
+		Sha256::UseHardware() = false;
+		std::string portable = HashHex(message);
+		CHECK(fast == portable);
+		CHECK(fastChunks == portable);
+	}
+	Sha256::UseHardware() = hardware;
+}
+
+void Sha256Tests(const PathString& scratch) {
+	(void)scratch;
+	TestKnownAnswers();
+	bool hardware = Sha256::UseHardware();
+	Sha256::UseHardware() = false;
+	TestKnownAnswers();
+	Sha256::UseHardware() = hardware;
+	TestHardwareMatchesPortable();
+	if (!Sha256::HasHardwareSupport())
+		printf("sha256: no SHA-NI, checked the portable rounds only\n");
+}
@@ -0,0 +1,130 @@
+#include "test.hpp"
+#include "staging.hpp"
+
+static PathString Sibling(const PathString& target, const char* suffix) {
+	return target + Utf8ToPath(suffix, strlen(suffix));
+}
+
+static void TestSwap(const PathString& scratch) {
+	PathString target = TestPath(ScratchDir(scratch, "swap"), "app");
+	MakeDirs(target);
+	WriteText(TestPath(target, "version.txt"), "1");
+	{
+		StagedInstall staged(target);
+		CHECK(staged.Begin());
+		CHECK(WriteText(TestPath(staged.StagePath(), "version.txt"), "2"));
+		CHECK(staged.Commit());
+		CHECK(ReadText(TestPath(target, "version.txt")) == "2");
+		CHECK(ReadText(TestPath(Sibling(target, ".old"), "version.txt")) == "1");
+		CHECK(!IsDirExists(staged.StagePath().c_str()));
+		staged.DeleteOldInBackground();
+	}
+	CHECK(!IsDirExists(Sibling(target, ".old").c_str()));
+}
+
+static void TestFirstInstall(const PathString& scratch) {
+	PathString target = TestPath(ScratchDir(scratch, "first"), "app");
+	StagedInstall staged(target);
+	CHECK(staged.Begin());
+	WriteText(TestPath(staged.StagePath(), "version.txt"), "1");
+	CHECK(staged.Commit());
+	CHECK(ReadText(TestPath(target, "version.txt")) == "1");
+	CHECK(!IsDirExists(Sibling(target, ".old").c_str()));
+}
+
+static void TestAbandoned(const PathString& scratch) {
+	PathString target = TestPath(ScratchDir(scratch, "abandoned"), "app");
+	MakeDirs(target);
+	WriteText(TestPath(target, "version.txt"), "1");
+	// leftovers of an interrupted run
+	MakeDirs(TestPath(Sibling(target, ".new"), "stale"));
+	MakeDirs(TestPath(Sibling(target, ".old"), "stale"));
+	{
+		StagedInstall staged(target);
+		CHECK(staged.Begin());
+		std::vector<DirEntry> entries;
+		CHECK(ListDir(staged.StagePath(), &entries) && entries.empty());
+		CHECK(!IsDirExists(Sibling(target, ".old").c_str()));
+		WriteText(TestPath(staged.StagePath(), "version.txt"), "2");
+	}
+	CHECK(!IsDirExists(Sibling(target, ".new").c_str()));
+	CHECK(ReadText(TestPath(target, "version.txt")) == "1");
+}
+
+// The staging tree vanishes before the swap, so the second rename fails
+// and the first one is undone.
+static void TestRollback(const PathString& scratch) {
+	PathString target = TestPath(ScratchDir(scratch, "rollback"), "app");
+	MakeDirs(target);
+	WriteText(TestPath(target, "version.txt"), "1");
+	StagedInstall staged(target);
+	CHECK(staged.Begin());
+	DeleteTree(staged.StagePath());
+	CHECK(!staged.Commit());
+	CHECK(!staged.Error().empty());
+	CHECK(ReadText(TestPath(target, "version.txt")) == "1");
+	CHECK(!IsDirExists(Sibling(target, ".old").c_str()));
+}
+
+static void TestCarryOver(const PathString& scratch) {
+	PathString target = TestPath(ScratchDir(scratch, "carry"), "app");
+	MakeDirs(TestPath(target, "lib"));
+	MakeDirs(TestPath(target, "user"));
+	WriteText(TestPath(target, "lib/owned.py"), "old");
+	WriteText(TestPath(target, "lib/created.pyc"), "cache");
+	WriteText(TestPath(target, "user/conf.txt"), "conf");
+	WriteText(TestPath(target, "shadowed.txt"), "old");
+	InstallManifest owned;
+	owned.Add("lib/owned.py", InstalledFile());
+
+	StagedInstall staged(target);
+	CHECK(staged.Begin());
+	MakeDirs(TestPath(staged.StagePath(), "lib"));
+	WriteText(TestPath(staged.StagePath(), "lib/owned.py"), "new");
+	WriteText(TestPath(staged.StagePath(), "shadowed.txt"), "new");
+	CHECK(staged.CarryOver(owned));
+	CHECK(staged.Commit());
+
+	CHECK(ReadText(TestPath(target, "lib/owned.py")) == "new");
+	CHECK(ReadText(TestPath(target, "lib/created.pyc")) == "cache");
+	CHECK(ReadText(TestPath(target, "user/conf.txt")) == "conf");
+	CHECK(ReadText(TestPath(target, "shadowed.txt")) == "new");
+	PathString old = Sibling(target, ".old");
+	CHECK(ReadText(TestPath(old, "lib/owned.py")) == "old");
+	CHECK(!IsDirExists(TestPath(old, "user").c_str()));
+}
+
+// Files the installer writes after the swap stay with the old tree, so
+// the new version's copies are not shadowed by stale ones.
+static void TestCarryOverExcluded(const PathString& scratch) {
+	PathString target = TestPath(ScratchDir(scratch, "excluded"), "app");
+	MakeDirs(TestPath(target, "data.old"));
+	WriteText(TestPath(target, "installer.exe"), "old installer");
+	WriteText(TestPath(target, "install-trace.json"), "old trace");
+	WriteText(TestPath(target, "data.old/deleted.conf"), "stale");
+	WriteText(TestPath(target, "user.txt"), "user");
+
+	StagedInstall staged(target);
+	staged.ExcludeFromCarryOver("installer.exe");
+	staged.ExcludeFromCarryOver("data.old");
+	staged.ExcludeFromCarryOver("install-trace.json");
+	CHECK(staged.Begin());
+	CHECK(staged.CarryOver(InstallManifest()));
+	CHECK(staged.Commit());
+
+	uint64_t size = 0;
+	CHECK(!QueryFileSize(TestPath(target, "installer.exe").c_str(), &size));
+	CHECK(!QueryFileSize(TestPath(target, "install-trace.json").c_str(), &size));
+	CHECK(!IsDirExists(TestPath(target, "data.old").c_str()));
+	CHECK(ReadText(TestPath(target, "user.txt")) == "user");
+	CHECK(ReadText(TestPath(Sibling(target, ".old"), "installer.exe")) == "old installer");
+}
+
+void StagingTests(const PathString& scratch) {
+	TestSwap(scratch);
+	TestFirstInstall(scratch);
+	TestAbandoned(scratch);
+	TestRollback(scratch);
+	TestCarryOver(scratch);
+	TestCarryOverExcluded(scratch);
+}
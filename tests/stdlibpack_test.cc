@@ -0,0 +1,154 @@
+#include "test.hpp"
+#include "stdlibpack.hpp"
+
+// The entries of |zip| in archive order, empty if it does not open.
+static ZipFiles ReadZip(const std::string& zip) {
+	ZipArchive archive;
+	std::vector<std::vector<uint8_t>> contents;
+	ZipFiles files;
+	if (!archive.Open((const uint8_t*)zip.data(), zip.size()) || !archive.ReadAll(&contents))
+		return files;
+	for (size_t i = 0; i < contents.size(); ++i)
+		files.push_back({ archive.Entries()[i].name, std::string(contents[i].begin(), contents[i].end()) });
+	return files;
+}
+
+static std::vector<std::string> Names(const ZipFiles& files) {
+	std::vector<std::string> names;
+	for (const auto& file : files)
+		names.push_back(file.first);
+	return names;
+}
+
+static std::string Content(const ZipFiles& files, const std::string& name) {
+	for (const auto& file : files) {
+		if (file.first == name)
+			return file.second;
+	}
+	return "<missing>";
+}
+
+static bool Pack(const ZipFiles& files, TaskPool* pool, ZipFiles* runtime,
+		StdlibPackStats* stats, std::string* error) {
+	std::string zip = MakeZip(files);
+	std::string packed;
+	if (!PackStdlib((const uint8_t*)zip.data(), zip.size(), pool, &packed, stats, error))
+		return false;
+	*runtime = ReadZip(packed);
+	return true;
+}
+
+static void TestLegacyPycName() {
+	const std::string tag = "cpython-312";
+	CHECK(LegacyPycName("json/__pycache__/decoder.cpython-312.pyc", tag) == "json/decoder.pyc");
+	CHECK(LegacyPycName("__pycache__/os.cpython-312.pyc", tag) == "os.pyc");
+	CHECK(LegacyPycName("__pycache__/os.CPython-312.PYC", tag) == "os.pyc");
+	CHECK(LegacyPycName("json/__pycache__/decoder.cpython-311.pyc", tag).empty());
+	CHECK(LegacyPycName("json/__pycache__/decoder.cpython-312.opt-1.pyc", tag).empty());
+	CHECK(LegacyPycName("json/__pycache__/decoder.py", tag).empty());
+	CHECK(LegacyPycName("json/__pycache__/.cpython-312.pyc", tag).empty());
+	CHECK(LegacyPycName("json/my__pycache__/decoder.cpython-312.pyc", tag).empty());
+	CHECK(LegacyPycName("json/decoder.cpython-312.pyc", tag).empty());
+
+	// without a DLL to name the interpreter, any CPython cache will do
+	CHECK(LegacyPycName("json/__pycache__/decoder.cpython-311.pyc", "") == "json/decoder.pyc");
+	CHECK(LegacyPycName("json/__pycache__/decoder.pypy39.pyc", "").empty());
+}
+
+static void TestHasPthLine() {
+	CHECK(HasPthLine("python312.zip\r\n.\r\n", "python312.zip"));
+	CHECK(HasPthLine(".\n  Python312.ZIP \t\nimport site", "python312.zip"));
+	CHECK(HasPthLine(".\r\npython312.zip", "python312.zip"));
+	CHECK(!HasPthLine("# python312.zip\r\n.\r\n", "python312.zip"));
+	CHECK(!HasPthLine("python312.zip.bak\r\n", "python312.zip"));
+	CHECK(!HasPthLine("", "python312.zip"));
+}
+
+static const char* const PYC_312 = "bytecode 3.12";
+
+// An embeddable runtime: a native package, caches of several interpreters
+// and a ._pth without the stdlib zip.
+static ZipFiles Runtime(const std::string& pth) {
+	ZipFiles files = {
+		{ "python.exe", "exe" },
+		{ "python312.dll", "dll" },
+		{ "DLLs/_ssl.pyd", "ssl" },
+		{ "Lib/os.py", "import sys" },
+		{ "Lib/json/", "" },
+		{ "Lib/json/__init__.py", "from .decoder import *" },
+		{ "Lib/json/decoder.py", "class JSONDecoder: pass" },
+		{ "Lib/json/__pycache__/decoder.cpython-312.pyc", PYC_312 },
+		{ "Lib/json/__pycache__/decoder.cpython-311.pyc", "bytecode 3.11" },
+		{ "Lib/json/__pycache__/decoder.cpython-312.opt-1.pyc", "optimized" },
+		{ "Lib/__pycache__/gone.cpython-312.pyc", "no source" },
+		{ "Lib/ctypes/__init__.py", "from _ctypes import *" },
+		{ "Lib/ctypes/_ctypes.pyd", "native" },
+		{ "Lib/site-packages/pip/__init__.py", "pip" },
+	};
+	if (!pth.empty())
+		files.push_back({ "python312._pth", pth });
+	return files;
+}
+
+static void TestPack(TaskPool* pool) {
+	const std::string pth = "python312.zip\r\n.\r\nimport site\r\n";
+	ZipFiles runtime;
+	StdlibPackStats stats;
+	std::string error;
+	CHECK(Pack(Runtime(".\r\nimport site\r\n"), pool, &runtime, &stats, &error));
+	CHECK(stats.zipName == "python312.zip");
+	CHECK(stats.pthName == "python312._pth");
+	CHECK(stats.packedFiles == 4);
+	CHECK(stats.extractedFiles == 8);
+
+	// ctypes ships a .pyd, so all of it stays beside the stdlib zip
+	std::vector<std::string> expected = {
+		"python.exe", "python312.dll", "DLLs/_ssl.pyd", "Lib/ctypes/__init__.py",
+		"Lib/ctypes/_ctypes.pyd", "Lib/site-packages/pip/__init__.py",
+		"python312.zip", "python312._pth",
+	};
+	CHECK(Names(runtime) == expected);
+	CHECK(Content(runtime, "python312._pth") == pth);
+
+	// sorted, with directory entries, and the 3.12 bytecode beside its source
+	ZipFiles stdlib = ReadZip(Content(runtime, "python312.zip"));
+	expected = { "json/", "json/__init__.py", "json/decoder.py", "json/decoder.pyc", "os.py" };
+	CHECK(Names(stdlib) == expected);
+	CHECK(Content(stdlib, "json/decoder.pyc") == PYC_312);
+	CHECK(Content(stdlib, "os.py") == "import sys");
+
+	// a ._pth that lists the zip already is left alone
+	CHECK(Pack(Runtime(pth), pool, &runtime, &stats, &error));
+	CHECK(Content(runtime, "python312._pth") == pth);
+
+	// without a ._pth the DLL name puts the zip on the default path
+	CHECK(Pack(Runtime(""), pool, &runtime, &stats, &error));
+	CHECK(stats.pthName.empty());
+	CHECK(Names(runtime).back() == "python312.zip");
+}
+
+static void TestErrors(TaskPool* pool) {
+	ZipFiles runtime;
+	StdlibPackStats stats;
+	std::string error;
+	ZipFiles files = Runtime("");
+	files.push_back({ "Python312.zip", "packed before" });
+	CHECK(!Pack(files, pool, &runtime, &stats, &error));
+	CHECK(error == "the runtime already has python312.zip");
+
+	CHECK(!Pack({ { "python312.dll", "dll" }, { "DLLs/_ssl.pyd", "ssl" } }, pool,
+		&runtime, &stats, &error));
+	CHECK(error == "no standard library below Lib to pack");
+
+	CHECK(!Pack({ { "Lib/os.py", "import sys" } }, pool, &runtime, &stats, &error));
+	CHECK(error == "no python3XY.dll or ._pth to put stdlib.zip on the search path");
+}
+
+void StdlibPackTests(const PathString& scratch) {
+	(void)scratch;
+	TaskPool pool(2);
+	TestLegacyPycName();
+	TestHasPthLine();
+	TestPack(&pool);
+	TestErrors(&pool);
+}
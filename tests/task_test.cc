@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "test.hpp"
+#include "taskgraph.hpp"
+#include "taskpool.hpp"
+
+static void SpinUntil(const std::atomic<bool>& flag) {
+	while (!flag)
+		std::this_thread::yield();
+}
+
+static void TestWaitAll() {
+	TaskPool pool(4);
+	std::atomic<int> done(0);
+	for (int i = 0; i < 1000; ++i)
+		pool.Submit([&done] { ++done; });
+	pool.Wait();
+	CHECK(done == 1000);
+}
+
+// The only worker is held up, so the waiting thread runs the tasks of its
+// group itself, and none of the other group queued in between.
+static void TestWaitOwnGroup() {
+	TaskPool pool(1);
+	std::atomic<bool> started(false), release(false);
+	TaskPool::Group blocker, mine, other;
+	pool.Submit([&started, &release] {
+		started = true;
+		SpinUntil(release);
+	}, &blocker);
+	SpinUntil(started);
+
+	std::thread::id self = std::this_thread::get_id();
+	std::atomic<int> mineHere(0), otherRun(0);
+	for (int i = 0; i < 20; ++i) {
+		pool.Submit([&otherRun] { ++otherRun; }, &other);
+		pool.Submit([&mineHere, self] {
+			if (std::this_thread::get_id() == self)
+				++mineHere;
+		}, &mine);
+	}
+
+	pool.Wait(&mine);
+	CHECK(mineHere == 20);
+	CHECK(otherRun == 0);
+	release = true;
+	pool.Wait(&other);
+	CHECK(otherRun == 20);
+	pool.Wait(&blocker);
+}
+
+// A task waiting for its subtasks on a pool of one thread runs them
+// itself; an unrelated task queued behind it waits for it to finish.
+static void TestNestedWait() {
+	TaskPool pool(1);
+	TaskPool::Group outer, unrelated;
+	std::atomic<bool> outerDone(false), ranAfterOuter(false);
+	std::atomic<int> inner(0);
+	pool.Submit([&pool, &inner, &outerDone] {
+		TaskPool::Group group;
+		for (int i = 0; i < 50; ++i)
+			pool.Submit([&inner] { ++inner; }, &group);
+		pool.Wait(&group);
+		outerDone = true;
+	}, &outer);
+	pool.Submit([&outerDone, &ranAfterOuter] { ranAfterOuter = outerDone.load(); }, &unrelated);
+
+	pool.Wait(&outer);
+	CHECK(inner == 50);
+	pool.Wait(&unrelated);
+	CHECK(ranAfterOuter);
+}
+
+static void TestGraphOrder() {
+	TaskPool pool(4);
+	TaskGraph graph;
+	std::mutex lock;
+	std::vector<std::string> order;
+	auto step = [&lock, &order](const char* name) {
+		return [&lock, &order, name] {
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			std::lock_guard<std::mutex> guard(lock);
+			order.push_back(name);
+			return true;
+		};
+	};
+	TaskGraph::Node a = graph.Add("a", step("a"));
+	TaskGraph::Node b = graph.Add("b", step("b"), { a });
+	TaskGraph::Node c = graph.Add("c", step("c"));
+	TaskGraph::Node d = graph.Add("d", step("d"), { b, c });
+	CHECK(graph.Run(&pool));
+	CHECK(order.size() == 4);
+
+	auto position = [&order](const char* name) {
+		return std::find(order.begin(), order.end(), name) - order.begin();
+	};
+	CHECK(position("a") < position("b"));
+	CHECK(position("b") < position("d"));
+	CHECK(position("c") < position("d"));
+	for (TaskGraph::Node node : { a, b, c, d })
+		CHECK(graph.StateOf(node) == TaskGraph::SUCCEEDED);
+	CHECK(graph.Timings().size() == 4);
+	CHECK(graph.CriticalPath() <= graph.SerialTime());
+}
+
+static void TestGraphFailure() {
+	TaskPool pool(2);
+	TaskGraph graph;
+	std::atomic<bool> dependentRan(false);
+	TaskGraph::Node failing = graph.Add("failing", [] { return false; });
+	TaskGraph::Node dependent = graph.Add("dependent",
+		[&dependentRan] { dependentRan = true; return true; }, { failing });
+	TaskGraph::Node transitive = graph.Add("transitive", [] { return true; }, { dependent });
+	TaskGraph::Node independent = graph.Add("independent", [] { return true; });
+	CHECK(!graph.Run(&pool));
+	CHECK(!dependentRan);
+	CHECK(graph.StateOf(failing) == TaskGraph::FAILED);
+	CHECK(graph.StateOf(dependent) == TaskGraph::SKIPPED);
+	CHECK(graph.StateOf(transitive) == TaskGraph::SKIPPED);
+	CHECK(graph.StateOf(independent) == TaskGraph::SUCCEEDED);
+}
+
+// Steps spreading their work over the graph's own single-thread pool.
+static void TestGraphNestedWork() {
+	TaskPool pool(1);
+	TaskGraph graph;
+	std::atomic<int> work(0);
+	auto step = [&pool, &work] {
+		TaskPool::Group group;
+		for (int i = 0; i < 10; ++i)
+			pool.Submit([&work] { ++work; }, &group);
+		pool.Wait(&group);
+		return true;
+	};
+	TaskGraph::Node first = graph.Add("first", step);
+	graph.Add("second", step, { first });
+	graph.Add("third", step);
+	CHECK(graph.Run(&pool));
+	CHECK(work == 30);
+}
+
+void TaskTests(const PathString& scratch) {
+	(void)scratch;
+	TestWaitAll();
+	TestWaitOwnGroup();
+	TestNestedWait();
+	TestGraphOrder();
+	TestGraphFailure();
+	TestGraphNestedWork();
+}
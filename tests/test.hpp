@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+#include "fileio.hpp"
+#include "treedelete.hpp"
+#include "zipwriter.hpp"
+
+// Shared helpers for the creeper-tests suites. A suite runs its cases
+// with CHECK(), which reports a failed condition and goes on; the suite
+// fails if any check did. Files go below a scratch dir given by ctest.
+
+typedef void (*TestSuite)(const PathString& scratch);
+
+void ZipTests(const PathString& scratch);
+void StagingTests(const PathString& scratch);
+void LockTests(const PathString& scratch);
+void BlockStreamTests(const PathString& scratch);
+void Sha256Tests(const PathString& scratch);
+void DeltaTests(const PathString& scratch);
+void RuntimeCacheTests(const PathString& scratch);
+void TreeTests(const PathString& scratch);
+void TaskTests(const PathString& scratch);
+void PayloadTests(const PathString& scratch);
+void StdlibPackTests(const PathString& scratch);
+
+extern int g_failedChecks;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			++g_failedChecks; \
+		} \
+	} while (0)
+
+inline PathString TestPath(const PathString& dir, const char* name) {
+	return dir + PATH_SEP + Utf8ToPath(name, strlen(name));
+}
+
+// A fresh, empty |name| below |scratch|.
+inline PathString ScratchDir(const PathString& scratch, const char* name) {
+	PathString dir = TestPath(scratch, name);
+	DeleteTree(dir);
+	MakeDirs(dir);
+	return dir;
+}
+
+inline bool WriteText(const PathString& path, const std::string& text) {
+	File file;
+	return file.Create(path.c_str()) && file.Write(text.data(), text.size());
+}
+
+// Empty if |path| cannot be read.
+inline std::string ReadText(const PathString& path) {
+	std::vector<uint8_t> data;
+	if (!ReadWholeFile(path.c_str(), &data))
+		return std::string();
+	return std::string(data.begin(), data.end());
+}
+
+// A file or a directory.
+inline bool Exists(const PathString& path) {
+	uint64_t size = 0;
+	return IsDirExists(path.c_str()) || QueryFileSize(path.c_str(), &size);
+}
+
+inline std::string FinishZip(ZipWriter* writer) {
+	std::string zip;
+	writer->Finish(&zip);
+	return zip;
+}
+
+// Name and content of each file of a test archive.
+typedef std::vector<std::pair<std::string, std::string>> ZipFiles;
+
+// A zip of |files|, all stored.
+inline std::string MakeZip(const ZipFiles& files) {
+	ZipWriter writer;
+	for (const auto& file : files)
+		writer.AddStored(file.first, (const uint8_t*)file.second.data(), file.second.size());
+	return FinishZip(&writer);
+}
+
+// True if |a| and |b| name one file, as hard links do.
+inline bool IsSameFile(const PathString& a, const PathString& b) {
+#ifdef _WIN32
+	BY_HANDLE_FILE_INFORMATION info[2];
+	const PathString* paths[2] = { &a, &b };
+	for (int i = 0; i < 2; ++i) {
+		HANDLE handle = CreateFileW(paths[i]->c_str(), 0,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+		if (handle == INVALID_HANDLE_VALUE)
+			return false;
+		BOOL ok = GetFileInformationByHandle(handle, &info[i]);
+		CloseHandle(handle);
+		if (!ok)
+			return false;
+	}
+	return info[0].dwVolumeSerialNumber == info[1].dwVolumeSerialNumber
+		&& info[0].nFileIndexHigh == info[1].nFileIndexHigh
+		&& info[0].nFileIndexLow == info[1].nFileIndexLow;
+#else
+	struct stat stA, stB;
+	return stat(a.c_str(), &stA) == 0 && stat(b.c_str(), &stB) == 0
+		&& stA.st_dev == stB.st_dev && stA.st_ino == stB.st_ino;
+#endif
+}
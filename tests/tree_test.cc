@@ -0,0 +1,154 @@
+#include "test.hpp"
+#include "treecopy.hpp"
+#include "treedelete.hpp"
+
+// 2025-01-01 12:00 in File::DosTimeToTicks() units, far from now.
+static uint64_t OldTicks() {
+	uint64_t ticks = 0;
+	File::DosTimeToTicks(0x5a21, 0x6000, &ticks);
+	return ticks;
+}
+
+static bool WriteDated(const PathString& path, const std::string& text, uint64_t ticks) {
+	File file;
+	return file.Create(path.c_str()) && file.Write(text.data(), text.size())
+		&& file.SetModifiedTicks(ticks);
+}
+
+static uint64_t ModifiedTicks(const PathString& path) {
+	uint64_t size = 0, modified = 0;
+	return QueryFileInfo(path.c_str(), &size, &modified) ? modified : 0;
+}
+
+// src/a.txt, src/sub/b.txt, src/sub/deep/c.txt, src/empty/ and a link
+// src/outside -> |outside|, a directory with keep.txt.
+static PathString MakeTree(const PathString& dir, const PathString& outside) {
+	PathString src = TestPath(dir, "src");
+	MakeDirs(TestPath(src, "sub/deep"));
+	MakeDirs(TestPath(src, "empty"));
+	MakeDirs(outside);
+	WriteDated(TestPath(src, "a.txt"), "a", OldTicks());
+	WriteText(TestPath(src, "sub/b.txt"), "bb");
+	WriteText(TestPath(src, "sub/deep/c.txt"), "ccc");
+	WriteText(TestPath(outside, "keep.txt"), "keep");
+	CreateDirLink(TestPath(src, "outside"), outside);
+	return src;
+}
+
+static void TestCopy(const PathString& scratch, TaskPool* pool) {
+	PathString dir = ScratchDir(scratch, pool ? "copy-pool" : "copy");
+	PathString src = MakeTree(dir, TestPath(dir, "outside"));
+	PathString dst = TestPath(dir, "dst");
+	MakeDirs(dst);
+	WriteText(TestPath(dst, "a.txt"), "replaced");
+	WriteText(TestPath(dst, "other.txt"), "other");
+
+	TreeCopier copier;
+	CHECK(copier.Copy(src, dst, pool));
+	CHECK(copier.Stats().files == 3);
+	CHECK(copier.Stats().dirs == 4);
+	CHECK(copier.Stats().bytes == 6);
+	CHECK(copier.Stats().failed == 0);
+	CHECK(ReadText(TestPath(dst, "a.txt")) == "a");
+	CHECK(ReadText(TestPath(dst, "sub/b.txt")) == "bb");
+	CHECK(ReadText(TestPath(dst, "sub/deep/c.txt")) == "ccc");
+	CHECK(IsDirExists(TestPath(dst, "empty").c_str()));
+	CHECK(ReadText(TestPath(dst, "other.txt")) == "other");
+	CHECK(ModifiedTicks(TestPath(dst, "a.txt")) == OldTicks());
+	// links are not copied, nor followed
+	CHECK(!Exists(TestPath(dst, "outside")));
+
+	// a copy, or a clone, does not share the source file
+	CHECK(!IsSameFile(TestPath(dst, "a.txt"), TestPath(src, "a.txt")));
+	WriteText(TestPath(src, "sub/b.txt"), "changed");
+	CHECK(ReadText(TestPath(dst, "sub/b.txt")) == "bb");
+}
+
+static void TestCopyOptions(const PathString& scratch, TaskPool* pool) {
+	PathString dir = ScratchDir(scratch, "options");
+	PathString src = MakeTree(dir, TestPath(dir, "outside"));
+
+	TreeCopyOptions linkOptions;
+	linkOptions.hardLink = true;
+	TreeCopier linker(linkOptions);
+	CHECK(linker.Copy(src, TestPath(dir, "linked"), pool));
+	CHECK(linker.Stats().linked == 3);
+	CHECK(IsSameFile(TestPath(dir, "linked/sub/deep/c.txt"), TestPath(src, "sub/deep/c.txt")));
+
+	// the plain copy path, and the pipelined engine for every file
+	TreeCopyOptions copyOptions;
+	copyOptions.clone = false;
+	copyOptions.pipelineSize = 0;
+	TreeCopier copier(copyOptions);
+	CHECK(copier.Copy(src, TestPath(dir, "copied"), pool));
+	CHECK(copier.Stats().linked == 0 && copier.Stats().files == 3);
+	CHECK(ReadText(TestPath(dir, "copied/sub/deep/c.txt")) == "ccc");
+	CHECK(ModifiedTicks(TestPath(dir, "copied/a.txt")) == OldTicks());
+}
+
+static void TestCopyFile(const PathString& scratch) {
+	PathString dir = ScratchDir(scratch, "copyfile");
+	WriteText(TestPath(dir, "conf.txt"), "conf");
+	TreeCopier copier;
+	CHECK(copier.Copy(TestPath(dir, "conf.txt"), TestPath(dir, "backup/user/conf.txt")));
+	CHECK(ReadText(TestPath(dir, "backup/user/conf.txt")) == "conf");
+
+	CHECK(!copier.Copy(TestPath(dir, "missing.txt"), TestPath(dir, "to.txt")));
+	CHECK(copier.Error() == "not found: " + PathToUtf8(TestPath(dir, "missing.txt")));
+	CHECK(!Exists(TestPath(dir, "to.txt")));
+}
+
+static void TestDelete(const PathString& scratch, TaskPool* pool) {
+	PathString dir = ScratchDir(scratch, pool ? "delete-pool" : "delete");
+	PathString outside = TestPath(dir, "outside");
+	PathString src = MakeTree(dir, outside);
+	WriteText(TestPath(src, "sub/readonly.txt"), "ro");
+	SetFileMode(TestPath(src, "sub/readonly.txt").c_str(), true, false);
+
+	TreeDeleter deleter;
+	CHECK(deleter.Delete(src, pool));
+	CHECK(!Exists(src));
+	// the link goes, what it points to stays
+	CHECK(ReadText(TestPath(outside, "keep.txt")) == "keep");
+	CHECK(deleter.Stats().files == 5);
+	CHECK(deleter.Stats().dirs == 4);
+	CHECK(deleter.Stats().bytes == 8);
+	CHECK(deleter.Stats().failed == 0);
+	CHECK(deleter.Error().empty());
+
+	// missing roots count as deleted
+	CHECK(deleter.Delete(src, pool));
+	CHECK(deleter.Stats().files == 0 && deleter.Stats().dirs == 0);
+}
+
+static void TestDeleteRoots(const PathString& scratch) {
+	PathString dir = ScratchDir(scratch, "roots");
+	PathString target = TestPath(dir, "target");
+	MakeDirs(target);
+	WriteText(TestPath(target, "keep.txt"), "keep");
+
+	// a link as the root is removed, not followed
+	PathString link = TestPath(dir, "link");
+	CHECK(CreateDirLink(link, target));
+	TreeDeleter deleter;
+	CHECK(deleter.Delete(link));
+	CHECK(!IsLink(link.c_str()));
+	CHECK(ReadText(TestPath(target, "keep.txt")) == "keep");
+
+	// so is a single file
+	CHECK(deleter.Delete(TestPath(target, "keep.txt")));
+	CHECK(deleter.Stats().files == 1 && deleter.Stats().bytes == 4);
+	CHECK(!Exists(TestPath(target, "keep.txt")));
+	CHECK(IsDirExists(target.c_str()));
+}
+
+void TreeTests(const PathString& scratch) {
+	TaskPool pool(2);
+	TestCopy(scratch, NULL);
+	TestCopy(scratch, &pool);
+	TestCopyOptions(scratch, &pool);
+	TestCopyFile(scratch);
+	TestDelete(scratch, NULL);
+	TestDelete(scratch, &pool);
+	TestDeleteRoots(scratch);
+}
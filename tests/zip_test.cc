@@ -0,0 +1,323 @@
+#include "test.hpp"
+#include "endian.hpp"
+#include "solid.hpp"
+#include "zip.hpp"
+
+// A stored single-entry zip whose sizes, offsets and counts all live in
+// ZIP64 fields, as in an archive past 4 GB.
+static std::string MakeZip64(const std::string& name, const std::string& content) {
+	uint32_t crc = Crc32::Update(0, content.data(), content.size());
+	std::string zip;
+	PutLe32(&zip, 0x04034b50);
+	PutLe16(&zip, 45);
+	PutLe16(&zip, 0x0800);
+	PutLe16(&zip, 0);
+	PutLe16(&zip, ZipWriter::DOS_TIME);
+	PutLe16(&zip, ZipWriter::DOS_DATE);
+	PutLe32(&zip, crc);
+	PutLe32(&zip, 0xffffffff);
+	PutLe32(&zip, 0xffffffff);
+	PutLe16(&zip, (uint16_t)name.size());
+	PutLe16(&zip, 20);
+	zip += name;
+	PutLe16(&zip, 0x0001);
+	PutLe16(&zip, 16);
+	PutLe64(&zip, content.size());
+	PutLe64(&zip, content.size());
+	zip += content;
+
+	uint64_t cdOffset = zip.size();
+	PutLe32(&zip, 0x02014b50);
+	PutLe16(&zip, 45);
+	PutLe16(&zip, 45);
+	PutLe16(&zip, 0x0800);
+	PutLe16(&zip, 0);
+	PutLe16(&zip, ZipWriter::DOS_TIME);
+	PutLe16(&zip, ZipWriter::DOS_DATE);
+	PutLe32(&zip, crc);
+	PutLe32(&zip, 0xffffffff);
+	PutLe32(&zip, 0xffffffff);
+	PutLe16(&zip, (uint16_t)name.size());
+	PutLe16(&zip, 28);
+	PutLe16(&zip, 0);
+	PutLe16(&zip, 0);
+	PutLe16(&zip, 0);
+	PutLe32(&zip, 0);
+	PutLe32(&zip, 0xffffffff);
+	zip += name;
+	PutLe16(&zip, 0x0001);
+	PutLe16(&zip, 24);
+	PutLe64(&zip, content.size());
+	PutLe64(&zip, content.size());
+	PutLe64(&zip, 0);
+	uint64_t cdSize = zip.size() - cdOffset;
+
+	uint64_t end64 = zip.size();
+	PutLe32(&zip, 0x06064b50);
+	PutLe64(&zip, 44);
+	PutLe16(&zip, 45);
+	PutLe16(&zip, 45);
+	PutLe32(&zip, 0);
+	PutLe32(&zip, 0);
+	PutLe64(&zip, 1);
+	PutLe64(&zip, 1);
+	PutLe64(&zip, cdSize);
+	PutLe64(&zip, cdOffset);
+
+	PutLe32(&zip, 0x07064b50);
+	PutLe32(&zip, 0);
+	PutLe64(&zip, end64);
+	PutLe32(&zip, 1);
+
+	PutLe32(&zip, 0x06054b50);
+	PutLe16(&zip, 0);
+	PutLe16(&zip, 0);
+	PutLe16(&zip, 0xffff);
+	PutLe16(&zip, 0xffff);
+	PutLe32(&zip, 0xffffffff);
+	PutLe32(&zip, 0xffffffff);
+	PutLe16(&zip, 0);
+	return zip;
+}
+
+// Extracts |zip| into |dir|; the archive's error, if any, goes to |error|.
+static bool Extract(const std::string& zip, const PathString& dir, TaskPool* pool,
+		std::string* error = NULL) {
+	ZipArchive archive;
+	bool ok = archive.Open((const uint8_t*)zip.data(), zip.size())
+		&& archive.ExtractTo(dir, pool);
+	if (error)
+		*error = archive.Error();
+	return ok;
+}
+
+static void TestZip64(const PathString& scratch, TaskPool* pool) {
+	std::string zip = MakeZip64("big/data.bin", "zip64 content");
+	ZipArchive archive;
+	CHECK(archive.Open((const uint8_t*)zip.data(), zip.size()));
+	CHECK(archive.Entries().size() == 1);
+	CHECK(!archive.Entries().empty() && archive.Entries()[0].size == 13);
+
+	PathString dir = ScratchDir(scratch, "zip64");
+	CHECK(Extract(zip, dir, pool));
+	CHECK(ReadText(TestPath(dir, "big/data.bin")) == "zip64 content");
+
+	// a locator pointing past the archive
+	std::string bad = zip;
+	size_t locator = bad.size() - 22 - 20;
+	bad[locator + 8] = (char)0xff;
+	bad[locator + 9] = (char)0xff;
+	CHECK(!archive.Open((const uint8_t*)bad.data(), bad.size()));
+}
+
+static void TestCrcMismatch(const PathString& scratch, TaskPool* pool) {
+	ZipWriter writer;
+	std::string content = "checked content";
+	uint32_t crc = Crc32::Update(0, content.data(), content.size());
+	writer.Add("good.txt", 0, crc, (const uint8_t*)content.data(), content.size(), content.size());
+	writer.Add("bad.txt", 0, crc ^ 1, (const uint8_t*)content.data(), content.size(), content.size());
+
+	PathString dir = ScratchDir(scratch, "crc");
+	std::string error;
+	CHECK(!Extract(FinishZip(&writer), dir, pool, &error));
+	CHECK(error == "CRC mismatch: bad.txt");
+}
+
+static void TestEntryDigests(const PathString& scratch, TaskPool* pool) {
+	std::string zip = MakeZip({ { "one.txt", "first" }, { "two.txt", "second" } });
+
+	ZipArchive archive;
+	std::string digests;
+	CHECK(archive.Open((const uint8_t*)zip.data(), zip.size()) && archive.HashEntries(&digests));
+	CHECK(digests.size() == 3 * Sha256::DIGEST_SIZE);
+	CHECK(archive.UseDigests(digests));
+	CHECK(archive.ExtractTo(ScratchDir(scratch, "digests"), pool));
+
+	// the digest is checked before the data is decoded
+	std::string damaged = zip;
+	damaged[damaged.find("second")] = 'S';
+	CHECK(archive.Open((const uint8_t*)damaged.data(), damaged.size()) && archive.UseDigests(digests));
+	CHECK(!archive.ExtractTo(ScratchDir(scratch, "damaged"), pool));
+	CHECK(archive.Error() == "damaged entry: two.txt");
+
+	// a renamed entry passes every CRC, not the directory digest
+	damaged = zip;
+	damaged[damaged.rfind("two.txt")] = 'T';
+	CHECK(archive.Open((const uint8_t*)damaged.data(), damaged.size()));
+	CHECK(!archive.UseDigests(digests));
+	CHECK(archive.Error() == "damaged central directory");
+	CHECK(!archive.UseDigests(digests.substr(Sha256::DIGEST_SIZE)));
+}
+
+static void TestUnsafeNames(const PathString& scratch, TaskPool* pool) {
+	static const char* const names[] = {
+		"../evil.txt", "a/../../evil.txt", "/evil.txt", "\\evil.txt", "c:/evil.txt",
+		"a/./../evil.txt", "..\\evil.txt",
+	};
+	PathString dir = ScratchDir(scratch, "unsafe");
+	PathString inner = TestPath(dir, "inner");
+	for (const char* name : names) {
+		std::string error;
+		CHECK(!Extract(MakeZip({ { name, "x" } }), inner, pool, &error));
+		CHECK(error == std::string("unsafe entry name: ") + name);
+	}
+	std::vector<DirEntry> entries;
+	CHECK(ListDir(dir, &entries) && entries.size() <= 1);
+	uint64_t size = 0;
+	CHECK(!QueryFileSize(TestPath(dir, "evil.txt").c_str(), &size));
+}
+
+static void TestDuplicateNames(const PathString& scratch, TaskPool* pool) {
+	std::string zip = MakeZip({ { "dir/same.txt", "first" }, { "dir\\same.txt", "second" } });
+	std::string error;
+	CHECK(!Extract(zip, ScratchDir(scratch, "duplicate"), pool, &error));
+	CHECK(error == "duplicate entry name: dir\\same.txt");
+}
+
+static void TestSizeBounds() {
+	// three bytes of deflate cannot expand to a gigabyte
+	ZipWriter writer;
+	uint8_t packed[3] = { 0x03, 0x00, 0x00 };
+	writer.Add("bomb.bin", 8, 0, packed, sizeof(packed), 1u << 30);
+	std::string zip = FinishZip(&writer);
+	ZipArchive archive;
+	CHECK(!archive.Open((const uint8_t*)zip.data(), zip.size()));
+	CHECK(archive.Error() == "bad entry size: bomb.bin");
+
+	// a stored entry with sizes that disagree
+	ZipWriter stored;
+	stored.Add("stored.bin", 0, 0, packed, sizeof(packed), 4);
+	zip = FinishZip(&stored);
+	CHECK(!archive.Open((const uint8_t*)zip.data(), zip.size()));
+}
+
+static void TestExtract(const PathString& scratch, TaskPool* pool) {
+	std::string zip = MakeZip({ { "empty/", "" }, { "a/b/c.txt", "nested" }, { "zero.txt", "" } });
+	PathString dir = ScratchDir(scratch, "extract");
+	CHECK(Extract(zip, dir, pool));
+	CHECK(IsDirExists(TestPath(dir, "empty").c_str()));
+	CHECK(ReadText(TestPath(dir, "a/b/c.txt")) == "nested");
+	uint64_t size = 1;
+	CHECK(QueryFileSize(TestPath(dir, "zero.txt").c_str(), &size) && size == 0);
+}
+
+// Sets "version made by" and the external attributes of the central
+// directory record of |name|, which ZipWriter leaves at DOS and zero.
+static void SetAttributes(std::string* zip, const std::string& name, uint16_t madeBy,
+		uint32_t attributes) {
+	for (size_t pos = zip->find("PK\x01\x02"); pos != std::string::npos;
+			pos = zip->find("PK\x01\x02", pos + 4)) {
+		uint8_t* header = (uint8_t*)&(*zip)[pos];
+		if (zip->compare(pos + 46, GetLe16(header + 28), name) != 0)
+			continue;
+		header[4] = (uint8_t)madeBy;
+		header[5] = (uint8_t)(madeBy >> 8);
+		for (int i = 0; i < 4; ++i)
+			header[38 + i] = (uint8_t)(attributes >> (8 * i));
+	}
+}
+
+static bool IsReadOnlyFile(const PathString& path) {
+#ifdef _WIN32
+	DWORD attr = GetFileAttributesW(path.c_str());
+	return attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_READONLY);
+#else
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && (st.st_mode & 0222) == 0;
+#endif
+}
+
+static bool IsExecutableFile(const PathString& path) {
+#ifdef _WIN32
+	(void)path;
+	return true;
+#else
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && (st.st_mode & 0100) != 0;
+#endif
+}
+
+// Modes from a zip made on Unix, and the DOS read-only bit, reach the
+// extracted files through either archive format.
+static void TestModes(const PathString& scratch, TaskPool* pool) {
+	std::string zip = MakeZip({
+		{ "bin/run.sh", "#!/bin/sh" },
+		{ "ro.txt", "ro" },
+		{ "dos-ro.txt", "dos" },
+		{ "plain.txt", "plain" },
+	});
+	SetAttributes(&zip, "bin/run.sh", 3 << 8 | 20, 0100755u << 16);
+	SetAttributes(&zip, "ro.txt", 3 << 8 | 20, 0100444u << 16);
+	SetAttributes(&zip, "dos-ro.txt", 20, 1);
+	SetAttributes(&zip, "plain.txt", 3 << 8 | 20, 0100644u << 16);
+
+	std::string solid, error;
+	CHECK(ZipToSolid((const uint8_t*)zip.data(), zip.size(), pool, &solid, &error));
+	const IoBackend backends[] = { IO_SYNC, IO_ASYNC };
+	for (IoBackend io : backends) {
+		PathString fromZip = ScratchDir(scratch, io == IO_SYNC ? "modes-zip" : "modes-zip-async");
+		ZipArchive archive;
+		CHECK(archive.Open((const uint8_t*)zip.data(), zip.size())
+			&& archive.ExtractTo(fromZip, pool, io));
+		PathString fromSolid = ScratchDir(scratch, io == IO_SYNC ? "modes-solid" : "modes-solid-async");
+		SolidArchive solidArchive;
+		CHECK(solidArchive.Open((const uint8_t*)solid.data(), solid.size())
+			&& solidArchive.ExtractTo(fromSolid, pool, io));
+
+		for (const PathString& dir : { fromZip, fromSolid }) {
+			CHECK(ReadText(TestPath(dir, "ro.txt")) == "ro");
+			CHECK(IsReadOnlyFile(TestPath(dir, "ro.txt")));
+			CHECK(IsReadOnlyFile(TestPath(dir, "dos-ro.txt")));
+			CHECK(!IsReadOnlyFile(TestPath(dir, "plain.txt")));
+			CHECK(!IsReadOnlyFile(TestPath(dir, "bin/run.sh")));
+			CHECK(IsExecutableFile(TestPath(dir, "bin/run.sh")));
+#ifndef _WIN32
+			CHECK(!IsExecutableFile(TestPath(dir, "plain.txt")));
+#endif
+		}
+	}
+}
+
+// Two files for one path are refused when the solid archive is written,
+// not left for extraction to overwrite one with the other.
+static void TestSolidDuplicates(TaskPool* pool) {
+	const uint8_t* data = (const uint8_t*)"x";
+	std::string archive;
+	SolidWriter same;
+	same.AddFile("dir/same.txt", data, 1, ZipWriter::DOS_DATE, ZipWriter::DOS_TIME);
+	same.AddFile("other.txt", data, 1, ZipWriter::DOS_DATE, ZipWriter::DOS_TIME);
+	same.AddFile("dir/same.txt", data, 1, ZipWriter::DOS_DATE, ZipWriter::DOS_TIME);
+	CHECK(!same.Finish(pool, &archive));
+	CHECK(same.Error() == "duplicate file name: dir/same.txt");
+
+	SolidWriter fileOverDir;
+	fileOverDir.AddFile("lib/os.py", data, 1, ZipWriter::DOS_DATE, ZipWriter::DOS_TIME);
+	fileOverDir.AddFile("lib", data, 1, ZipWriter::DOS_DATE, ZipWriter::DOS_TIME);
+	CHECK(!fileOverDir.Finish(pool, &archive));
+	CHECK(fileOverDir.Error() == "duplicate file name: lib");
+
+	SolidWriter unsafe;
+	unsafe.AddFile("a/../b.txt", data, 1, ZipWriter::DOS_DATE, ZipWriter::DOS_TIME);
+	CHECK(!unsafe.Finish(pool, &archive));
+	CHECK(unsafe.Error() == "unsafe directory name: a/..");
+
+	// entry names that only differ in the separator meet in ZipToSolid
+	std::string zip = MakeZip({ { "dir/same.txt", "x" }, { "dir\\same.txt", "x" } });
+	std::string error;
+	CHECK(!ZipToSolid((const uint8_t*)zip.data(), zip.size(), pool, &archive, &error));
+	CHECK(error == "duplicate file name: dir/same.txt");
+}
+
+void ZipTests(const PathString& scratch) {
+	TaskPool pool(2);
+	TestZip64(scratch, &pool);
+	TestCrcMismatch(scratch, &pool);
+	TestEntryDigests(scratch, &pool);
+	TestUnsafeNames(scratch, &pool);
+	TestDuplicateNames(scratch, &pool);
+	TestSizeBounds();
+	TestExtract(scratch, &pool);
+	TestExtract(scratch, NULL);
+	TestModes(scratch, &pool);
+	TestSolidDuplicates(&pool);
+}